@@ -0,0 +1,288 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Deferred query accounting routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "accounting.h"
+#include "shmem.h"
+#include "log.h"
+// getOverTimeID()
+#include "overTime.h"
+// data getter functions
+#include "datastructure.h"
+// global variable killed, thread_names[], thread_sleepms()
+#include "signals.h"
+// atomic_*()
+#include <stdatomic.h>
+
+// Statistics updates triggered by dnsmasq's main thread are put into a
+// lock-free single-producer single-consumer ring buffer. The accounting
+// thread applies them in batches so the DNS hot path only has to do the
+// work needed for the blocking decision. All updates are plain additions,
+// hence the order in which they are applied does not matter
+#define ACCOUNTING_QUEUE_SIZE 16384 // Needs to be a power of two
+// Maximum number of events applied while holding the shared memory lock
+#define ACCOUNTING_BATCH 256
+// Time the accounting thread sleeps when the queue is empty [ms]. Events
+// are applied directly when the queue fills up in the meantime
+#define ACCOUNTING_INTERVAL 50
+
+enum accounting_type {
+	ACCOUNT_NEW_QUERY,
+	ACCOUNT_STATUS,
+	ACCOUNT_REPLY,
+	ACCOUNT_UPSTREAM,
+	ACCOUNT_BLOCKED
+} __attribute__ ((packed));
+
+typedef struct {
+	enum accounting_type type;
+	time_t timestamp;
+	int id;
+	int from;
+	int to;
+} accounting_event;
+
+static accounting_event *queue = NULL;
+static atomic_size_t queue_head = 0;
+static atomic_size_t queue_tail = 0;
+static atomic_bool queue_active = false;
+static atomic_uint queue_peak = 0;
+static atomic_ullong queue_processed = 0;
+static atomic_ullong queue_overflows = 0;
+static pthread_t producer;
+// Protects the consumer side of the queue
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Apply a single event to the shared memory counters. Needs to be called
+// with the shared memory lock held
+static void apply_event(const accounting_event *event)
+{
+	switch(event->type)
+	{
+		case ACCOUNT_NEW_QUERY:
+		{
+			const int timeidx = getOverTimeID(event->timestamp);
+			overTime[timeidx].total++;
+			counters->status[QUERY_UNKNOWN]++;
+			counters->reply[REPLY_UNKNOWN]++;
+			if(event->from >= TYPE_A && event->from < TYPE_MAX)
+				counters->querytype[event->from-1]++;
+
+			clientsData *client = getClient(event->id, true);
+			if(client == NULL)
+				break;
+
+			// Set lastQuery timer and add one query for network table
+			if(event->timestamp > client->lastQuery)
+				client->lastQuery = event->timestamp;
+			client->numQueriesARP++;
+			break;
+		}
+
+		case ACCOUNT_STATUS:
+		{
+			const enum query_status old_status = event->from;
+			const enum query_status new_status = event->to;
+			counters->status[old_status]--;
+			counters->status[new_status]++;
+
+			const int timeidx = getOverTimeID(event->timestamp);
+			if(is_blocked(old_status))
+				overTime[timeidx].blocked--;
+			if(is_blocked(new_status))
+				overTime[timeidx].blocked++;
+
+			if(old_status == QUERY_CACHE)
+				overTime[timeidx].cached--;
+			if(new_status == QUERY_CACHE)
+				overTime[timeidx].cached++;
+
+			if(old_status == QUERY_FORWARDED)
+				overTime[timeidx].forwarded--;
+			if(new_status == QUERY_FORWARDED)
+				overTime[timeidx].forwarded++;
+			break;
+		}
+
+		case ACCOUNT_REPLY:
+			counters->reply[event->from]--;
+			counters->reply[event->to]++;
+			break;
+
+		case ACCOUNT_UPSTREAM:
+		{
+			upstreamsData *upstream = getUpstream(event->id, true);
+			if(upstream == NULL)
+				break;
+
+			const int timeidx = getOverTimeID(event->timestamp);
+			upstream->overTime[timeidx] += event->to;
+			if(event->to > 0)
+				upstream->lastQuery = time(NULL);
+			break;
+		}
+
+		case ACCOUNT_BLOCKED:
+		{
+			clientsData *client = getClient(event->id, true);
+			if(client != NULL)
+				change_clientcount(client, 0, event->to);
+			break;
+		}
+	}
+}
+
+// Queue an event or apply it immediately when we are not called from
+// dnsmasq's main thread (e.g., in TCP forks or during history import) or when
+// the queue is full
+static void account(const accounting_event *event)
+{
+	if(!atomic_load_explicit(&queue_active, memory_order_relaxed) ||
+	   !pthread_equal(pthread_self(), producer))
+	{
+		apply_event(event);
+		return;
+	}
+
+	const size_t head = atomic_load_explicit(&queue_head, memory_order_relaxed);
+	const size_t tail = atomic_load_explicit(&queue_tail, memory_order_acquire);
+	const size_t depth = head - tail;
+	if(depth >= ACCOUNTING_QUEUE_SIZE)
+	{
+		// We are holding the shared memory lock, so we can safely
+		// apply this event ourselves
+		atomic_fetch_add_explicit(&queue_overflows, 1, memory_order_relaxed);
+		apply_event(event);
+		return;
+	}
+
+	queue[head & (ACCOUNTING_QUEUE_SIZE - 1)] = *event;
+	atomic_store_explicit(&queue_head, head + 1, memory_order_release);
+
+	// Only the producer writes the peak value
+	if(depth + 1 > atomic_load_explicit(&queue_peak, memory_order_relaxed))
+		atomic_store_explicit(&queue_peak, depth + 1, memory_order_relaxed);
+}
+
+void account_new_query(const time_t timestamp, const int clientID, const enum query_types type)
+{
+	const accounting_event event = { .type = ACCOUNT_NEW_QUERY, .timestamp = timestamp, .id = clientID, .from = type };
+	account(&event);
+}
+
+void account_status(const time_t timestamp, const enum query_status old_status, const enum query_status new_status)
+{
+	const accounting_event event = { .type = ACCOUNT_STATUS, .timestamp = timestamp, .from = old_status, .to = new_status };
+	account(&event);
+}
+
+void account_reply(const enum reply_type old_reply, const enum reply_type new_reply)
+{
+	const accounting_event event = { .type = ACCOUNT_REPLY, .from = old_reply, .to = new_reply };
+	account(&event);
+}
+
+void account_upstream(const time_t timestamp, const int upstreamID, const int mod)
+{
+	const accounting_event event = { .type = ACCOUNT_UPSTREAM, .timestamp = timestamp, .id = upstreamID, .to = mod };
+	account(&event);
+}
+
+void account_blocked(const int clientID, const int mod)
+{
+	const accounting_event event = { .type = ACCOUNT_BLOCKED, .id = clientID, .to = mod };
+	account(&event);
+}
+
+// Apply all queued events. Returns the number of events applied
+static unsigned int drain_queue(void)
+{
+	unsigned int applied = 0;
+	pthread_mutex_lock(&queue_lock);
+	size_t tail = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+	while(true)
+	{
+		const size_t head = atomic_load_explicit(&queue_head, memory_order_acquire);
+		if(head == tail)
+			break;
+
+		// Do not hold the lock for too long so dnsmasq is not blocked
+		// by us when there are many events to be processed
+		size_t end = head;
+		if(end - tail > ACCOUNTING_BATCH)
+			end = tail + ACCOUNTING_BATCH;
+
+		const unsigned int batch = end - tail;
+		lock_shm();
+		for(; tail != end; tail++)
+			apply_event(&queue[tail & (ACCOUNTING_QUEUE_SIZE - 1)]);
+		unlock_shm();
+
+		// Release slots for the producer
+		atomic_store_explicit(&queue_tail, tail, memory_order_release);
+		atomic_fetch_add_explicit(&queue_processed, batch, memory_order_relaxed);
+		applied += batch;
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	return applied;
+}
+
+// Make sure all events queued so far have been applied, e.g., before
+// answering API requests
+void flush_accounting(void)
+{
+	if(atomic_load(&queue_active))
+		drain_queue();
+}
+
+static void accounting_atfork_child(void)
+{
+	// Threads do not survive fork(), forks account synchronously. Events
+	// still in the (copied) queue are applied by the main process
+	atomic_store(&queue_active, false);
+}
+
+// Set up the queue. Needs to be called from dnsmasq's main thread before the
+// accounting thread is started
+void init_accounting(void)
+{
+	if(queue == NULL && (queue = calloc(ACCOUNTING_QUEUE_SIZE, sizeof(accounting_event))) == NULL)
+		return;
+
+	pthread_atfork(NULL, NULL, accounting_atfork_child);
+	producer = pthread_self();
+	atomic_store(&queue_active, true);
+}
+
+void *accounting_thread(void *val)
+{
+	// Set thread name
+	thread_names[ACCOUNTING] = "accounting";
+	prctl(PR_SET_NAME, thread_names[ACCOUNTING], 0, 0, 0);
+
+	while(!killed && atomic_load(&queue_active))
+	{
+		// Sleep only if there was nothing to do
+		if(drain_queue() == 0)
+			thread_sleepms(ACCOUNTING, ACCOUNTING_INTERVAL);
+	}
+
+	return NULL;
+}
+
+void get_accounting_info(struct accounting_info *info)
+{
+	const size_t tail = atomic_load(&queue_tail);
+	info->depth = atomic_load(&queue_head) - tail;
+	info->peak = atomic_load(&queue_peak);
+	info->processed = atomic_load(&queue_processed);
+	info->overflows = atomic_load(&queue_overflows);
+}
@@ -0,0 +1,37 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Deferred query accounting prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+// enum query_types, enum query_status, enum reply_type
+#include "enums.h"
+
+// All account_*() functions have to be called with the shared memory lock
+// held. Updates originating from dnsmasq's main thread are queued and
+// applied by the accounting thread, all others are applied immediately
+void account_new_query(const time_t timestamp, const int clientID, const enum query_types type);
+void account_status(const time_t timestamp, const enum query_status old_status, const enum query_status new_status);
+void account_reply(const enum reply_type old_reply, const enum reply_type new_reply);
+void account_upstream(const time_t timestamp, const int upstreamID, const int mod);
+void account_blocked(const int clientID, const int mod);
+
+void init_accounting(void);
+void *accounting_thread(void *val);
+void flush_accounting(void);
+
+struct accounting_info {
+	unsigned int depth;
+	unsigned int peak;
+	unsigned long long processed;
+	unsigned long long overflows;
+};
+void get_accounting_info(struct accounting_info *info);
+
+#endif //ACCOUNTING_H
@@ -28,6 +28,8 @@
 #include "../database/common.h"
 // get_number_of_queries_in_DB()
 #include "../database/query-table.h"
+// prepare_rollup_query()
+#include "../database/rollup-table.h"
 // in_auditlist()
 #include "../database/gravity-db.h"
 // struct overTime
@@ -1205,8 +1207,16 @@ void getDBstats(const int sock, const bool istelnet)
 	format_memory_size(prefix, filesize, &formatted);
 
 	if(istelnet)
+	{
 		ssend(sock, "queries in database: %i\ndatabase filesize: %.2f %sB\nSQLite version: %s\n",
 		             get_number_of_queries_in_DB(NULL), formatted, prefix, get_sqlite3_version());
+
+		// Report progress of deleting old queries (if running)
+		int deleted = 0;
+		const double progress = get_delete_old_queries_progress(&deleted);
+		if(progress >= 0.0)
+			ssend(sock, "deleting old queries: %.1f%% (%i rows deleted)\n", progress, deleted);
+	}
 	else {
 		pack_int32(sock, get_number_of_queries_in_DB(NULL));
 		pack_int64(sock, filesize);
@@ -1216,6 +1226,89 @@ void getDBstats(const int sock, const bool istelnet)
 	}
 }
 
+void getRollup(const char *client_message, const int sock, const bool istelnet)
+{
+	// Which rollup table?
+	// example: >rollup-clients
+	enum rollup_table table = ROLLUP_SUMMARY;
+	if(command(client_message, ">rollup-types"))
+		table = ROLLUP_TYPES;
+	else if(command(client_message, ">rollup-clients"))
+		table = ROLLUP_CLIENTS;
+	else if(command(client_message, ">rollup-domains"))
+		table = ROLLUP_DOMAINS;
+
+	// Exit before processing any data if requested via config setting
+	get_privacy_level(NULL);
+	if((table == ROLLUP_CLIENTS && config.privacylevel >= PRIVACY_HIDE_DOMAINS_CLIENTS) ||
+	   (table == ROLLUP_DOMAINS && config.privacylevel >= PRIVACY_HIDE_DOMAINS))
+		return;
+
+	// Daily instead of hourly data?
+	// example: >rollup daily
+	const int interval = command(client_message, " daily") ? ROLLUP_DAY : ROLLUP_HOUR;
+
+	// Limit time range?
+	// example: >rollup daily 1609459200 1612137600
+	long long from = 0, until = time(NULL);
+	sscanf(client_message, "%*[^0-9(]%lli %lli", &from, &until);
+
+	// Number of domains to be returned
+	// example: >rollup-domains 1609459200 1612137600 (25)
+	int count = 10, num;
+	if(sscanf(client_message, "%*[^(](%i)", &num) > 0)
+		count = num;
+
+	sqlite3 *db = dbopen(false);
+	if(db == NULL)
+		return;
+
+	sqlite3_stmt *stmt = prepare_rollup_query(db, table, interval, from, until, count);
+	if(stmt == NULL)
+	{
+		dbclose(&db);
+		return;
+	}
+
+	// Send one row per line, integer columns are sent as int64, text
+	// columns (client and domain) as str32
+	int rc;
+	const int columns = sqlite3_column_count(stmt);
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		for(int i = 0; i < columns; i++)
+		{
+			const bool last = i == columns - 1;
+			if(sqlite3_column_type(stmt, i) == SQLITE_TEXT)
+			{
+				const char *text = (const char *)sqlite3_column_text(stmt, i);
+				if(istelnet)
+					ssend(sock, "%s%s", text, last ? "\n" : " ");
+				else if(!pack_str32(sock, text))
+				{
+					sqlite3_finalize(stmt);
+					dbclose(&db);
+					return;
+				}
+			}
+			else
+			{
+				const long long value = sqlite3_column_int64(stmt, i);
+				if(istelnet)
+					ssend(sock, "%lli%s", value, last ? "\n" : " ");
+				else
+					pack_int64(sock, value);
+			}
+		}
+	}
+
+	if(rc != SQLITE_DONE)
+		logg("getRollup() - SQL error step: %s", sqlite3_errstr(rc));
+
+	sqlite3_finalize(stmt);
+	dbclose(&db);
+}
+
 void getClientsOverTime(const int sock, const bool istelnet)
 {
 	// Exit before processing any data if requested via config setting
@@ -1251,6 +1344,71 @@ void getClientsOverTime(const int sock, const bool istelnet)
 		}
 	}
 
+	// Assign an output column to every client to be shown. Clients managed
+	// by an alias-client are counted for their alias-client
+	int *column = calloc(counters->clients > 0 ? counters->clients : 1, sizeof(int));
+	if(column == NULL)
+	{
+		if(excludeclients != NULL)
+			clearSetupVarsArray();
+		return;
+	}
+
+	int columns = 0;
+	for(int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		column[clientID] = -1;
+		if(skipclient[clientID])
+			continue;
+
+		// Get client pointer
+		const clientsData* client = getClient(clientID, true);
+		// Skip invalid clients and also those managed by alias clients
+		if(client == NULL || client->aliasclient_id >= 0)
+			continue;
+		// Also skip clients with no active counts at all (may be old IPv6 addresses)
+		if(client->count == 0)
+			continue;
+
+		column[clientID] = columns++;
+	}
+	for(int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		const clientsData* client = getClient(clientID, true);
+		if(client != NULL && client->aliasclient_id >= 0 && client->aliasclient_id < counters->clients)
+			column[clientID] = column[client->aliasclient_id];
+	}
+
+	// Count the queries of each client in each slot. The per-client overTime
+	// data is not kept in memory as most clients are idle in most slots
+	int *counts = calloc((size_t)OVERTIME_SLOTS*(columns > 0 ? columns : 1), sizeof(int));
+	if(counts == NULL)
+	{
+		free(column);
+		if(excludeclients != NULL)
+			clearSetupVarsArray();
+		return;
+	}
+
+	const time_t firstSlot = overTime[0].timestamp - OVERTIME_INTERVAL/2;
+	for(int queryID = 0; queryID < counters->queries; queryID++)
+	{
+		const queriesData* query = getQuery(queryID, true);
+		if(query == NULL || query->clientID < 0 || query->clientID >= counters->clients)
+			continue;
+
+		const int col = column[query->clientID];
+		if(col < 0)
+			continue;
+
+		// Same bounds as getOverTimeID() but without its debug output
+		long slot = query->timestamp >= firstSlot ? (long)((query->timestamp - firstSlot)/OVERTIME_INTERVAL) : 0;
+		if(slot >= OVERTIME_SLOTS)
+			slot = OVERTIME_SLOTS - 1;
+
+		counts[slot*columns + col]++;
+	}
+
 	// Main return loop
 	for(int slot = 0; slot < OVERTIME_SLOTS; slot++)
 	{
@@ -1259,21 +1417,10 @@ void getClientsOverTime(const int sock, const bool istelnet)
 		else
 			pack_int32(sock, (int32_t)overTime[slot].timestamp);
 
-		// Loop over forward destinations to generate output to be sent to the client
-		for(int clientID = 0; clientID < counters->clients; clientID++)
+		// Loop over clients to generate output to be sent to the client
+		for(int col = 0; col < columns; col++)
 		{
-			if(skipclient[clientID])
-				continue;
-
-			// Get client pointer
-			const clientsData* client = getClient(clientID, true);
-			// Skip invalid clients and also those managed by alias clients
-			if(client == NULL || client->aliasclient_id >= 0)
-				continue;
-			// Also skip clients with no active counts at all (may be old IPv6 addresses)
-			if(client->count == 0)
-				continue;
-			const int thisclient = client->overTime[slot];
+			const int thisclient = counts[slot*columns + col];
 
 			if(istelnet)
 				ssend(sock, " %i", thisclient);
@@ -1287,6 +1434,9 @@ void getClientsOverTime(const int sock, const bool istelnet)
 			pack_int32(sock, -1);
 	}
 
+	free(counts);
+	free(column);
+
 	if(excludeclients != NULL)
 		clearSetupVarsArray();
 }
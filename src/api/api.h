@@ -26,6 +26,7 @@ void getClientNames(const int sock, const bool istelnet);
 void getClientID(const int sock, const bool istelnet);
 void getVersion(const int sock, const bool istelnet);
 void getDBstats(const int sock, const bool istelnet);
+void getRollup(const char *client_message, const int sock, const bool istelnet);
 void getUnknownQueries(const int sock, const bool istelnet);
 void getMAXLOGAGE(const int sock);
 void getGateway(const int sock);
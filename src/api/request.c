@@ -21,6 +21,8 @@
 // Eventqueue routines
 #include "../events.h"
 #include "../config.h"
+// flush_accounting()
+#include "../accounting.h"
 
 bool __attribute__((pure)) command(const char *client_message, const char* cmd) {
 	return strstr(client_message, cmd) != NULL;
@@ -33,6 +35,9 @@ bool process_request(const char *client_message, const int sock, const bool iste
 	EOT[1] = 0x00;
 	bool processed = false;
 
+	// Apply pending statistics updates so we report up-to-date numbers
+	flush_accounting();
+
 	if(command(client_message, ">stats"))
 	{
 		processed = true;
@@ -116,6 +121,12 @@ bool process_request(const char *client_message, const int sock, const bool iste
 		// is guaranteed to be atomic
 		getDBstats(sock, istelnet);
 	}
+	else if(command(client_message, ">rollup"))
+	{
+		processed = true;
+		// No lock required, data is read from the database
+		getRollup(client_message, sock, istelnet);
+	}
 	else if(command(client_message, ">ClientsoverTime"))
 	{
 		processed = true;
@@ -154,6 +165,8 @@ bool process_request(const char *client_message, const int sock, const bool iste
 	{
 		processed = true;
 		logg("Received API request to recompile regex");
+		// Compile regex filters before locking the shared memory
+		prepare_regex_from_database();
 		lock_shm();
 		// Reread regex.list
 		// Read and compile possible regex filters
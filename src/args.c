@@ -34,10 +34,14 @@
 #include "lua/ftl_lua.h"
 // gravity_parseList()
 #include "tools/gravity-parseList.h"
+// gravity_bench()
+#include "tools/gravity-bench.h"
 // run_dhcp_discover()
 #include "tools/dhcp-discover.h"
 // run_arp_scan()
 #include "tools/arp-scan.h"
+// run_dns_bench()
+#include "tools/dns-bench.h"
 // defined in dnsmasq.c
 extern void print_dnsmasq_version(const char *yellow, const char *green, const char *bold, const char *normal);
 
@@ -186,6 +190,13 @@ void parse_args(int argc, char* argv[])
 			exit(gravity_parseList(argv[3], argv[4], argv[5]));
 		}
 
+		// pihole-FTL gravity bench [<number of lines> | <list file>]
+		if((argc == 3 || argc == 4) && strcmp(argv[2], "bench") == 0)
+		{
+			// Measure the speed of the list import
+			exit(gravity_bench(argc == 4 ? argv[3] : NULL));
+		}
+
 		printf("Incorrect usage of pihole-FTL gravity subcommand\n");
 		exit(EXIT_FAILURE);
 	}
@@ -198,6 +209,15 @@ void parse_args(int argc, char* argv[])
 		exit(run_dhcp_discover());
 	}
 
+	// DNS throughput benchmark
+	// pihole-FTL dns-bench [<server>] [<port>] [<queries>]
+	if(argc > 1 && argc < 6 && strcmp(argv[1], "dns-bench") == 0)
+	{
+		exit(run_dns_bench(argc > 2 ? argv[2] : NULL,
+		                   argc > 3 ? argv[3] : NULL,
+		                   argc > 4 ? argv[4] : NULL));
+	}
+
 	// ARP scanning mode
 	if(argc > 1 && strcmp(argv[1], "arp-scan") == 0)
 	{
@@ -571,6 +591,9 @@ void parse_args(int argc, char* argv[])
 			printf("\t                    interfaces\n");
 			printf("\t                    Append %s-x%s to force scan on all\n", cyan, normal);
 			printf("\t                    interfaces and scan 10x more often\n");
+			printf("\t%sdns-bench %s[<server>] [<port>] [<queries>]%s\n", green, cyan, normal);
+			printf("\t                    Measure how many UDP queries per\n");
+			printf("\t                    second a DNS server answers\n");
 			printf("\t%s-h%s, %shelp%s            Display this help and exit\n\n", green, normal, green, normal);
 			exit(EXIT_SUCCESS);
 		}
@@ -34,6 +34,7 @@ FTLFileNamesStruct FTLfiles = {
 	NULL,
 	NULL,
 	NULL,
+	NULL,
 	NULL
 };
 
@@ -230,6 +231,30 @@ void read_FTLconf(void)
 		logg("   DBFILE: Using %s (not storing queries)", FTLfiles.FTL_db);
 	}
 
+	// DBPARTITION
+	// Store queries in one table per day or per week instead of one single
+	// table. Removing old queries becomes dropping whole tables and reading
+	// a time range only touches the relevant tables. Queries are kept until
+	// their entire partition is older than MAXDBDAYS
+	// defaults to: NONE
+	buffer = parse_FTLconf(fp, "DBPARTITION");
+
+	if(buffer != NULL && strcasecmp(buffer, "DAY") == 0)
+	{
+		config.db_partitioning = PARTITION_DAY;
+		logg("   DBPARTITION: Storing queries in one table per day");
+	}
+	else if(buffer != NULL && strcasecmp(buffer, "WEEK") == 0)
+	{
+		config.db_partitioning = PARTITION_WEEK;
+		logg("   DBPARTITION: Storing queries in one table per week");
+	}
+	else
+	{
+		config.db_partitioning = PARTITION_NONE;
+		logg("   DBPARTITION: Storing queries in one table");
+	}
+
 	// FTLPORT
 	// On which port should FTL be listening?
 	// defaults to: 4711
@@ -496,6 +521,49 @@ void read_FTLconf(void)
 	else
 		logg("   RATE_LIMIT: Disabled");
 
+	// RATE_LIMIT_SUBNET
+	// Rate-limit whole networks in addition to individual clients so that
+	// clients rotating their addresses within a network are caught, too.
+	// The size of the networks is set by RATE_LIMIT_IPV4_PREFIX and
+	// RATE_LIMIT_IPV6_PREFIX
+	// defaults to: disabled
+	config.rate_limit.subnet.count = 0;
+	config.rate_limit.subnet.interval = 60;
+	buffer = parse_FTLconf(fp, "RATE_LIMIT_SUBNET");
+
+	count = 0, interval = 0;
+	if(buffer != NULL && sscanf(buffer, "%u/%u", &count, &interval) == 2)
+	{
+		config.rate_limit.subnet.count = count;
+		config.rate_limit.subnet.interval = interval;
+	}
+
+	// RATE_LIMIT_IPV4_PREFIX
+	// defaults to: 24
+	config.rate_limit.subnet.prefix4 = 24;
+	buffer = parse_FTLconf(fp, "RATE_LIMIT_IPV4_PREFIX");
+
+	unsigned int prefix4 = 0;
+	if(buffer != NULL && sscanf(buffer, "%u", &prefix4) == 1 && prefix4 <= 32)
+		config.rate_limit.subnet.prefix4 = prefix4;
+
+	// RATE_LIMIT_IPV6_PREFIX
+	// defaults to: 64
+	config.rate_limit.subnet.prefix6 = 64;
+	buffer = parse_FTLconf(fp, "RATE_LIMIT_IPV6_PREFIX");
+
+	unsigned int prefix6 = 0;
+	if(buffer != NULL && sscanf(buffer, "%u", &prefix6) == 1 && prefix6 <= 128)
+		config.rate_limit.subnet.prefix6 = prefix6;
+
+	if(config.rate_limit.subnet.count > 0)
+		logg("   RATE_LIMIT_SUBNET: Rate-limiting /%u (IPv4) and /%u (IPv6) networks making more than %u queries in %u second%s",
+		     config.rate_limit.subnet.prefix4, config.rate_limit.subnet.prefix6,
+		     config.rate_limit.subnet.count, config.rate_limit.subnet.interval,
+		     config.rate_limit.subnet.interval == 1 ? "" : "s");
+	else
+		logg("   RATE_LIMIT_SUBNET: Disabled");
+
 	// LOCAL_IPV4
 	// Use a specific IP address instead of automatically detecting the
 	// IPv4 interface address a query arrived on for A hostname queries
@@ -770,6 +838,55 @@ void read_FTLconf(void)
 
 	logg("   CHECK_DISK: Warning if certain disk usage exceeds %d%%", config.check.disk);
 
+	// SHMEM_SNAPSHOT
+	// Should FTL store a binary snapshot of its shared memory objects on
+	// clean shutdown and restore it on the next start instead of importing
+	// the history from the long-term database?
+	// defaults to: true
+	buffer = parse_FTLconf(fp, "SHMEM_SNAPSHOT");
+	config.snapshot = read_bool(buffer, true);
+
+	if(config.snapshot)
+		logg("   SHMEM_SNAPSHOT: Enabled");
+	else
+		logg("   SHMEM_SNAPSHOT: Disabled");
+
+	// SNAPSHOTFILE
+	getpath(fp, "SNAPSHOTFILE", "/etc/pihole/pihole-FTL.snapshot", &FTLfiles.snapshot);
+
+	// SHARED_GRAVITY
+	// Should FTL keep read-only lookup tables of gravity and the exact
+	// black- and whitelists in memory shared with its TCP workers? Without
+	// them, each TCP connection has to open the gravity database
+	// defaults to: true
+	buffer = parse_FTLconf(fp, "SHARED_GRAVITY");
+	config.shared_gravity = read_bool(buffer, true);
+
+	if(config.shared_gravity)
+		logg("   SHARED_GRAVITY: Enabled");
+	else
+		logg("   SHARED_GRAVITY: Disabled");
+
+	// DNS_UDP_BATCH
+	// How many UDP queries should be read from a listening socket at once?
+	// The replies to them are sent together as well. A value of 1 disables
+	// batching so each query is read and answered on its own
+	// defaults to: 32 queries
+	config.udp_batch = 32;
+	buffer = parse_FTLconf(fp, "DNS_UDP_BATCH");
+
+	if(buffer != NULL && sscanf(buffer, "%u", &uval) && uval > 0)
+		config.udp_batch = uval;
+
+	// Cap at the number of buffers dnsmasq allocates
+	if(config.udp_batch > 64)
+		config.udp_batch = 64;
+
+	if(config.udp_batch == 1)
+		logg("   DNS_UDP_BATCH: Disabled");
+	else
+		logg("   DNS_UDP_BATCH: Reading up to %u UDP queries at once", config.udp_batch);
+
 	// Read DEBUG_... setting from pihole-FTL.conf
 	read_debuging_settings(fp);
 
@@ -51,6 +51,8 @@ typedef struct {
 	bool edns0_ecs :1;
 	bool show_dnssec :1;
 	bool addr2line :1;
+	bool snapshot :1;
+	bool shared_gravity :1;
 	struct {
 		bool mozilla_canary :1;
 		bool icloud_private_relay :1;
@@ -65,6 +67,7 @@ typedef struct {
 	enum refresh_hostnames refresh_hostnames;
 	enum busy_reply reply_when_busy;
 	enum ptr_type pihole_ptr;
+	enum db_partitioning db_partitioning;
 	int maxDBdays;
 	int port;
 	int maxlogage;
@@ -72,9 +75,16 @@ typedef struct {
 	unsigned int delay_startup;
 	unsigned int network_expire;
 	unsigned int block_ttl;
+	unsigned int udp_batch;
 	struct {
 		unsigned int count;
 		unsigned int interval;
+		struct {
+			unsigned int count;
+			unsigned int interval;
+			unsigned int prefix4;
+			unsigned int prefix6;
+		} subnet;
 	} rate_limit;
 	enum debug_flags debug;
 	time_t DBinterval;
@@ -106,6 +116,7 @@ typedef struct {
 	char* macvendor_db;
 	char* setupVars;
 	char* auditlist;
+	char* snapshot;
 } FTLFileNamesStruct;
 
 extern ConfigStruct config;
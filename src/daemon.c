@@ -287,6 +287,9 @@ void cleanup(const int ret)
 	// This should be the last action when cleaning up
 	destroy_shmem();
 
+	// Write pending log lines, the final message is written synchronously
+	stop_async_log();
+
 	char buffer[42] = { 0 };
 	format_time(buffer, 0, timer_elapsed_msec(EXIT_TIMER));
 	logg("########## FTL terminated after%s (code %i)! ##########", buffer, ret);
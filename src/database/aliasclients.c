@@ -55,7 +55,6 @@ static void recompute_aliasclient(const int aliasclientID)
 	// Reset this alias-client
 	aliasclient->count = 0;
 	aliasclient->blockedcount = 0;
-	memset(aliasclient->overTime, 0, sizeof(aliasclient->overTime));
 
 	// Loop over all existing clients to find which clients are associated to this one
 	for(int clientID = 0; clientID < counters->clients; clientID++)
@@ -87,8 +86,6 @@ static void recompute_aliasclient(const int aliasclientID)
 		// Add counts of this client to the alias-client
 		aliasclient->count += client->count;
 		aliasclient->blockedcount += client->blockedcount;
-		for(int idx = 0; idx < OVERTIME_SLOTS; idx++)
-			aliasclient->overTime[idx] += client->overTime[idx];
 	}
 }
 
@@ -341,7 +338,6 @@ void reimport_aliasclients(sqlite3 *db)
 		// Reset this alias-client
 		client->count = 0;
 		client->blockedcount = 0;
-		memset(client->overTime, 0, sizeof(client->overTime));
 	}
 
 	// Import aliasclients from database table
@@ -25,8 +25,11 @@
 #include "aliasclients.h"
 // add_additional_info_column()
 #include "query-table.h"
+// create_rollup_tables()
+#include "rollup-table.h"
 
-bool DBdeleteoldqueries = false;
+// Old queries are deleted once on startup and after every GC run
+bool DBdeleteoldqueries = true;
 static bool DBerror = false;
 long int lastdbindex = 0;
 
@@ -465,6 +468,21 @@ void db_init(void)
 		dbversion = db_get_int(db, DB_VERSION);
 	}
 
+	// Update to version 13 if lower
+	if(dbversion < 13)
+	{
+		// Update to version 13: Add hourly and daily rollup tables
+		logg("Updating long-term database to version 13");
+		if(!create_rollup_tables(db))
+		{
+			logg("Rollup tables not generated, database not available");
+			dbclose(&db);
+			return;
+		}
+		// Get updated version
+		dbversion = db_get_int(db, DB_VERSION);
+	}
+
 	lock_shm();
 	import_aliasclients(db);
 	unlock_shm();
@@ -593,7 +611,9 @@ long int get_max_query_ID(sqlite3 *db)
 	if(FTLDBerror())
 		return DB_FAILED;
 
-	const char *sql = "SELECT MAX(ID) FROM queries";
+	// Use the AUTOINCREMENT counters of all tables storing queries as
+	// MAX(id) would have to scan all partitions of the queries view
+	const char *sql = "SELECT IFNULL(MAX(seq),0) FROM sqlite_sequence WHERE name = 'query_storage' OR name GLOB 'query_storage_[0-9]*'";
 	if(config.debug & DEBUG_DATABASE)
 		logg("dbquery: \"%s\"", sql);
 
@@ -62,15 +62,6 @@ void *DB_thread(void *val)
 				lock_shm();
 				DB_save_queries(db);
 				unlock_shm();
-
-				// Check if GC should be done on the database
-				if(DBdeleteoldqueries && config.maxDBdays != -1)
-				{
-					// No thread locks needed
-					delete_old_queries_in_DB(db);
-					DBdeleteoldqueries = false;
-				}
-
 				DBCLOSE_OR_BREAK();
 			}
 
@@ -79,6 +70,18 @@ void *DB_thread(void *val)
 				set_event(PARSE_NEIGHBOR_CACHE);
 		}
 
+		// Check if GC should be done on the database. Old queries are
+		// deleted in small chunks, one per iteration of this loop, to
+		// never block storing new queries for long
+		if(DBdeleteoldqueries && config.DBexport && config.maxDBdays != -1)
+		{
+			DBOPEN_OR_AGAIN();
+			// No thread locks needed
+			if(delete_old_queries_in_DB(db))
+				DBdeleteoldqueries = false;
+			DBCLOSE_OR_BREAK();
+		}
+
 		// Update MAC vendor strings once a month (the MAC vendor
 		// database is not updated very often)
 		if(now % 2592000L == 0)
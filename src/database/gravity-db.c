@@ -31,6 +31,10 @@
 
 // Definition of struct regexData
 #include "../regex_r.h"
+// gravity_filter_check()
+#include "gravity-filter.h"
+// gravity_shared_lookup()
+#include "gravity-shared.h"
 
 // Prefix of interface names in the client table
 #define INTERFACE_SEP ":"
@@ -48,6 +52,8 @@ static sqlite3_stmt* table_stmt = NULL;
 static sqlite3_stmt* auditlist_stmt = NULL;
 bool gravityDB_opened = false;
 static bool gravity_abp_format = false;
+// Are we a TCP fork using the lookup tables shared by the main process?
+static bool gravity_forked = false;
 
 // Table names corresponding to the enum defined in gravity-db.h
 static const char* tablename[] = { "vw_gravity", "vw_blacklist", "vw_whitelist", "vw_regex_blacklist", "vw_regex_whitelist" , "" };
@@ -92,10 +98,32 @@ void gravityDB_forked(void)
 	blacklist_stmt = NULL;
 	gravity_stmt = NULL;
 
+	// Use the lookup tables shared by the main process if available. The
+	// database is opened only when they cannot answer a request
+	gravity_forked = true;
+	if(gravity_shared_available())
+		return;
+
 	// Open the database
 	gravityDB_open();
 }
 
+// TCP forks answer list lookups from the shared tables whenever possible and
+// open the database on demand otherwise
+static bool use_shared_tables(const clientsData *client)
+{
+	if(!gravity_forked)
+		return false;
+
+	if(gravity_shared_usable(client))
+		return true;
+
+	if(!gravityDB_opened)
+		gravityDB_open();
+
+	return false;
+}
+
 static void gravity_check_ABP_format(void)
 {
 	// Check if we have a valid ABP format
@@ -1277,12 +1305,17 @@ enum db_result in_whitelist(const char *domain, DNSCacheData *dns_cache, clients
 {
 	// If list statement is not ready and cannot be initialized (e.g. no
 	// access to the database), we return false to prevent an FTL crash
-	if(whitelist_stmt == NULL)
+	if(whitelist_stmt == NULL && !gravity_forked)
 		return LIST_NOT_AVAILABLE;
 
 	// Check if this client needs a rechecking of group membership
 	gravityDB_client_check_again(client);
 
+	if(use_shared_tables(client))
+		return gravity_shared_lookup(EXACT_WHITELIST_TABLE, domain, client, &dns_cache->domainlist_id);
+	if(whitelist_stmt == NULL)
+		return LIST_NOT_AVAILABLE;
+
 	// Get whitelist statement from vector of prepared statements if available
 	sqlite3_stmt *stmt = whitelist_stmt->get(whitelist_stmt, client->id);
 
@@ -1304,33 +1337,59 @@ enum db_result in_whitelist(const char *domain, DNSCacheData *dns_cache, clients
 	return domain_in_list(domain, stmt, "whitelist", &dns_cache->domainlist_id);
 }
 
+// Check one domain against gravity, either using the client's prepared
+// statement or the shared lookup tables (stmt == NULL)
+static enum db_result gravity_match(const char *domain, sqlite3_stmt *stmt, const clientsData *client)
+{
+	if(stmt == NULL)
+		return gravity_shared_lookup(GRAVITY_TABLE, domain, client, NULL);
+
+	return domain_in_list(domain, stmt, "gravity", NULL);
+}
+
 enum db_result in_gravity(const char *domain, clientsData *client)
 {
 	// If list statement is not ready and cannot be initialized (e.g. no
 	// access to the database), we return false to prevent an FTL crash
-	if(gravity_stmt == NULL)
+	if(gravity_stmt == NULL && !gravity_forked)
 		return LIST_NOT_AVAILABLE;
 
 	// Check if this client needs a rechecking of group membership
 	gravityDB_client_check_again(client);
 
-	// Get whitelist statement from vector of prepared statements
-	sqlite3_stmt *stmt = gravity_stmt->get(gravity_stmt, client->id);
+	// Skip the database if the domain is definitely not in gravity. ABP
+	// style entries are in the filter as well, so they are checked below
+	const bool exact_maybe = gravity_filter_check(domain);
+	if(!exact_maybe && !gravity_abp_format)
+		return NOT_FOUND;
 
-	// If client statement is not ready and cannot be initialized (e.g. no access to
-	// the database), we return false (not in gravity list) to prevent an FTL crash
-	if(stmt == NULL && !gravityDB_prepare_client_statements(client))
+	// TCP forks may use the shared lookup tables instead of a statement
+	sqlite3_stmt *stmt = NULL;
+	if(!use_shared_tables(client))
 	{
-		logg("ERROR: Gravity database not available");
-		return LIST_NOT_AVAILABLE;
-	}
+		if(gravity_stmt == NULL)
+			return LIST_NOT_AVAILABLE;
 
-	// Update statement if has just been initialized
-	if(stmt == NULL)
+		// Get gravity statement from vector of prepared statements
 		stmt = gravity_stmt->get(gravity_stmt, client->id);
 
+		// If client statement is not ready and cannot be initialized (e.g. no access to
+		// the database), we return false (not in gravity list) to prevent an FTL crash
+		if(stmt == NULL && !gravityDB_prepare_client_statements(client))
+		{
+			logg("ERROR: Gravity database not available");
+			return LIST_NOT_AVAILABLE;
+		}
+
+		// Update statement if has just been initialized
+		if(stmt == NULL)
+			stmt = gravity_stmt->get(gravity_stmt, client->id);
+	}
+
 	// Check if domain is exactly in gravity list
-	const enum db_result exact_match = domain_in_list(domain, stmt, "gravity", NULL);
+	const enum db_result exact_match = exact_maybe ? gravity_match(domain, stmt, client) : NOT_FOUND;
+	if(exact_maybe && exact_match == NOT_FOUND)
+		gravity_filter_false_positive();
 	if(config.debug & DEBUG_QUERIES)
 		logg("Checking if \"%s\" is in gravity: %s",
 		     domain, exact_match == FOUND ? "yes" : "no");
@@ -1393,7 +1452,10 @@ enum db_result in_gravity(const char *domain, clientsData *client)
 			memcpy(abpDomain+2, ptr, component_size);
 		}
 		// Check if the constructed ABP-style domain is in the gravity list
-		const enum db_result abp_match = domain_in_list(abpDomain, stmt, "gravity", NULL);
+		const bool abp_maybe = gravity_filter_check(abpDomain);
+		const enum db_result abp_match = abp_maybe ? gravity_match(abpDomain, stmt, client) : NOT_FOUND;
+		if(abp_maybe && abp_match == NOT_FOUND)
+			gravity_filter_false_positive();
 		if(config.debug & DEBUG_QUERIES)
 			logg("Checking if \"%s\" is in gravity: %s",
 			     abpDomain, abp_match == FOUND ? "yes" : "no");
@@ -1431,12 +1493,29 @@ enum db_result in_blacklist(const char *domain, DNSCacheData *dns_cache, clients
 {
 	// If list statement is not ready and cannot be initialized (e.g. no
 	// access to the database), we return false to prevent an FTL crash
-	if(blacklist_stmt == NULL)
+	if(blacklist_stmt == NULL && !gravity_forked)
 		return LIST_NOT_AVAILABLE;
 
 	// Check if this client needs a rechecking of group membership
 	gravityDB_client_check_again(client);
 
+	// Skip the database if the domain is definitely not on the blacklist
+	if(!gravity_filter_check(domain))
+	{
+		dns_cache->domainlist_id = -1;
+		return NOT_FOUND;
+	}
+
+	if(use_shared_tables(client))
+	{
+		const enum db_result result = gravity_shared_lookup(EXACT_BLACKLIST_TABLE, domain, client, &dns_cache->domainlist_id);
+		if(result == NOT_FOUND)
+			gravity_filter_false_positive();
+		return result;
+	}
+	if(blacklist_stmt == NULL)
+		return LIST_NOT_AVAILABLE;
+
 	// Get whitelist statement from vector of prepared statements
 	sqlite3_stmt *stmt = blacklist_stmt->get(blacklist_stmt, client->id);
 
@@ -1452,7 +1531,11 @@ enum db_result in_blacklist(const char *domain, DNSCacheData *dns_cache, clients
 	if(stmt == NULL)
 		stmt = blacklist_stmt->get(blacklist_stmt, client->id);
 
-	return domain_in_list(domain, stmt, "blacklist", &dns_cache->domainlist_id);
+	const enum db_result result = domain_in_list(domain, stmt, "blacklist", &dns_cache->domainlist_id);
+	if(result == NOT_FOUND)
+		gravity_filter_false_positive();
+
+	return result;
 }
 
 bool in_auditlist(const char *domain)
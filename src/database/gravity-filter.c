@@ -0,0 +1,293 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Gravity negative-lookup filter routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "../FTL.h"
+#include "sqlite3.h"
+#include "gravity-filter.h"
+// struct config
+#include "../config.h"
+// logg()
+#include "../log.h"
+// lock_shm()
+#include "../shmem.h"
+// struct FTLfiles
+#include "../files.h"
+// mmap()
+#include <sys/mman.h>
+// pow()
+#include <math.h>
+
+// Most domains are neither on the blacklist nor in gravity. The Bloom filter
+// built here contains all exact blacklist and gravity domains (regardless of
+// their groups) so we can skip the database lookups for domains which are
+// definitely not on any of the lists. The filter lives in an anonymous shared
+// mapping which TCP forks inherit without having to copy it. It is never
+// modified after being built, a reload replaces it as a whole
+#define FILTER_BITS_PER_ENTRY 10
+#define FILTER_HASHES 7
+#define FILTER_MIN_BITS 1024
+
+typedef struct {
+	uint64_t mask;
+	unsigned int entries;
+	double fp_rate;
+	uint64_t bits[];
+} gravity_filter;
+
+// Lookup statistics. Shared with the forks, updated with the shared memory
+// lock held
+struct filter_stats {
+	unsigned long long skipped;
+	unsigned long long passed;
+	unsigned long long false_positives;
+};
+
+static gravity_filter *filter = NULL;
+static size_t filter_size = 0;
+static struct filter_stats *stats = NULL;
+
+// FNV-1a
+static uint64_t __attribute__((pure)) filter_hash(const char *domain)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(const unsigned char *p = (const unsigned char*)domain; *p != '\0'; p++)
+	{
+		hash ^= *p;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// splitmix64 finalizer
+static uint64_t __attribute__((const)) filter_mix(uint64_t hash)
+{
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+// Well-mixed 64 bit hash of a domain, also used as fingerprint by the shared
+// gravity lookup tables
+uint64_t gravity_domain_hash(const char *domain)
+{
+	return filter_mix(filter_hash(domain));
+}
+
+// Double hashing, the step has to be odd so we visit distinct bits
+static void filter_add(gravity_filter *f, const char *domain)
+{
+	const uint64_t h1 = filter_hash(domain);
+	const uint64_t h2 = filter_mix(h1) | 1u;
+	for(unsigned int i = 0; i < FILTER_HASHES; i++)
+	{
+		const uint64_t bit = (h1 + i*h2) & f->mask;
+		f->bits[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+static bool __attribute__((pure)) filter_contains(const gravity_filter *f, const char *domain)
+{
+	const uint64_t h1 = filter_hash(domain);
+	const uint64_t h2 = filter_mix(h1) | 1u;
+	for(unsigned int i = 0; i < FILTER_HASHES; i++)
+	{
+		const uint64_t bit = (h1 + i*h2) & f->mask;
+		if(!(f->bits[bit / 64] & (1ULL << (bit % 64))))
+			return false;
+	}
+	return true;
+}
+
+// Install a new filter (may be NULL) and release the previous one. Forks keep
+// their own mapping of the filter they were started with
+static void filter_replace(gravity_filter *f, const size_t size)
+{
+	lock_shm();
+	gravity_filter *old = filter;
+	const size_t old_size = filter_size;
+	filter = f;
+	filter_size = size;
+	unlock_shm();
+
+	if(old != NULL)
+		munmap(old, old_size);
+}
+
+// Get the number of domains we have to expect
+static int filter_count(sqlite3 *db)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT COALESCE((SELECT value FROM info WHERE property = 'gravity_count'),"
+	                                                "(SELECT COUNT(*) FROM gravity)) + "
+	                                       "(SELECT COUNT(*) FROM domainlist WHERE type = 1);",
+	                            -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_filter_load() - SQL error prepare count: %s", sqlite3_errstr(rc));
+		return -1;
+	}
+
+	int count = -1;
+	if((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		count = sqlite3_column_int(stmt, 0);
+	else
+		logg("gravity_filter_load() - SQL error step count: %s", sqlite3_errstr(rc));
+
+	sqlite3_finalize(stmt);
+	return count;
+}
+
+// (Re-)build the filter from the gravity database. This is done without
+// holding the shared memory lock, only the final swap needs it
+void gravity_filter_load(void)
+{
+	// Lookup statistics survive reloads, they are allocated only once
+	if(stats == NULL)
+	{
+		void *ptr = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+		                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(ptr != MAP_FAILED)
+			stats = ptr;
+	}
+
+	sqlite3 *db = NULL;
+	int rc = sqlite3_open_v2(FTLfiles.gravity_db, &db, SQLITE_OPEN_READONLY, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_filter_load() - SQL error open: %s", sqlite3_errstr(rc));
+		sqlite3_close(db);
+		filter_replace(NULL, 0);
+		return;
+	}
+
+	const int count = filter_count(db);
+	if(count < 0)
+	{
+		sqlite3_close(db);
+		filter_replace(NULL, 0);
+		return;
+	}
+
+	// Use a power of two as number of bits so we can mask the hashes
+	uint64_t nbits = FILTER_MIN_BITS;
+	while(nbits < (uint64_t)count * FILTER_BITS_PER_ENTRY)
+		nbits <<= 1;
+	const size_t size = sizeof(gravity_filter) + nbits / 8;
+
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(ptr == MAP_FAILED)
+	{
+		logg("WARN: Cannot allocate %zu bytes for the gravity filter: %s", size, strerror(errno));
+		sqlite3_close(db);
+		filter_replace(NULL, 0);
+		return;
+	}
+	gravity_filter *f = ptr;
+	f->mask = nbits - 1;
+	f->entries = 0;
+
+	sqlite3_stmt *stmt = NULL;
+	rc = sqlite3_prepare_v2(db, "SELECT domain FROM gravity UNION ALL "
+	                            "SELECT domain FROM domainlist WHERE type = 1;",
+	                        -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_filter_load() - SQL error prepare: %s", sqlite3_errstr(rc));
+		munmap(f, size);
+		sqlite3_close(db);
+		filter_replace(NULL, 0);
+		return;
+	}
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		if(domain == NULL)
+			continue;
+		filter_add(f, domain);
+		f->entries++;
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+
+	// An incomplete filter would skip domains which are on the lists
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_filter_load() - SQL error step: %s", sqlite3_errstr(rc));
+		munmap(f, size);
+		filter_replace(NULL, 0);
+		return;
+	}
+
+	// Expected false-positive rate, estimated from the fraction of set
+	// bits as the lists may contain the same domain more than once
+	uint64_t set = 0;
+	for(uint64_t i = 0; i < nbits / 64; i++)
+		set += __builtin_popcountll(f->bits[i]);
+	f->fp_rate = pow((double)set / nbits, FILTER_HASHES);
+
+	// The filter is read-only from now on
+	mprotect(f, size, PROT_READ);
+	filter_replace(f, size);
+
+	if(config.debug & DEBUG_DATABASE)
+		logg("Gravity filter: %u domains, %zu bytes, expected false-positive rate %.4f%%",
+		     f->entries, size, 100.0*f->fp_rate);
+}
+
+// Returns false if the domain is definitely neither on the blacklist nor in
+// gravity. Needs to be called with the shared memory lock held
+bool gravity_filter_check(const char *domain)
+{
+	// Without filter, all domains have to be checked
+	if(filter == NULL)
+		return true;
+
+	const bool maybe = filter_contains(filter, domain);
+	if(stats != NULL)
+	{
+		if(maybe)
+			stats->passed++;
+		else
+			stats->skipped++;
+	}
+
+	return maybe;
+}
+
+// The database did not contain a domain which passed the filter. This
+// includes domains that are on lists not assigned to the current client
+void gravity_filter_false_positive(void)
+{
+	if(filter != NULL && stats != NULL)
+		stats->false_positives++;
+}
+
+// Needs to be called with the shared memory lock held
+void get_gravity_filter_info(struct gravity_filter_info *info)
+{
+	memset(info, 0, sizeof(*info));
+	if(stats != NULL)
+	{
+		info->skipped = stats->skipped;
+		info->passed = stats->passed;
+		info->false_positives = stats->false_positives;
+	}
+
+	if(filter == NULL)
+		return;
+
+	info->entries = filter->entries;
+	info->size = filter_size;
+	info->expected_fp_rate = filter->fp_rate;
+}
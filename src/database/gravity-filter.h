@@ -0,0 +1,28 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Gravity negative-lookup filter prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef GRAVITY_FILTER_H
+#define GRAVITY_FILTER_H
+
+void gravity_filter_load(void);
+bool gravity_filter_check(const char *domain);
+void gravity_filter_false_positive(void);
+uint64_t gravity_domain_hash(const char *domain) __attribute__((pure));
+
+struct gravity_filter_info {
+	unsigned int entries;
+	size_t size;
+	double expected_fp_rate;
+	unsigned long long skipped;
+	unsigned long long passed;
+	unsigned long long false_positives;
+};
+void get_gravity_filter_info(struct gravity_filter_info *info);
+
+#endif //GRAVITY_FILTER_H
@@ -0,0 +1,546 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Shared gravity lookup table routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "../FTL.h"
+#include "sqlite3.h"
+#include "gravity-shared.h"
+// gravity_domain_hash()
+#include "gravity-filter.h"
+// struct config
+#include "../config.h"
+// logg()
+#include "../log.h"
+// lock_shm(), getstr()
+#include "../shmem.h"
+// mmap()
+#include <sys/mman.h>
+
+// TCP forks cannot use the database connection of the main process and
+// opening their own connection and preparing all per-client statements is
+// expensive. The main process therefore builds read-only lookup tables of
+// gravity, the exact blacklist and the exact whitelist in an anonymous shared
+// mapping which is inherited by all forks. Domains are stored as 64 bit
+// fingerprints together with the set of groups they are enabled for, the
+// chance of a fingerprint collision is negligible even for millions of
+// domains. Group sets are stored as bitmasks, hence this is only available
+// when all group IDs are smaller than SHARED_MAX_GROUPS
+#define SHARED_MAX_GROUPS 64
+#define SHARED_LISTS (EXACT_WHITELIST_TABLE + 1)
+#define SHARED_MIN_CAPACITY 1024u
+
+typedef struct {
+	uint32_t capacity; // Power of two
+	uint32_t used;
+	uint64_t *fp;
+	// Index of the group set + 1, 0 means the slot is empty
+	uint32_t *set;
+	// Domainlist IDs (only for black- and whitelist)
+	int *id;
+} domain_table;
+
+typedef struct {
+	size_t size;
+	unsigned int nsets;
+	uint64_t *sets;
+	domain_table lists[SHARED_LISTS];
+} shared_tables;
+
+// Group sets assigned to an adlist
+typedef struct {
+	int id;
+	uint64_t mask;
+} adlist_groups;
+
+// Temporary state while reading the database
+typedef struct {
+	uint64_t *sets;
+	unsigned int nsets;
+	unsigned int sets_alloc;
+	// Hash index into sets (index + 1, 0 = empty)
+	uint32_t *set_index;
+	uint32_t set_capacity;
+	adlist_groups *adlists;
+	unsigned int nadlists;
+	domain_table lists[SHARED_LISTS];
+} shared_builder;
+
+static shared_tables *shared = NULL;
+
+static uint32_t __attribute__((const)) mask_hash(const uint64_t mask)
+{
+	return (mask * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+// Get (or create) the index + 1 of a group set, returns 0 on error
+static uint32_t get_set(shared_builder *b, const uint64_t mask)
+{
+	// Keep the hash index at most half full
+	if(2*(b->nsets + 1) > b->set_capacity)
+	{
+		const uint32_t capacity = b->set_capacity > 0 ? 2*b->set_capacity : 64u;
+		uint32_t *index = calloc(capacity, sizeof(uint32_t));
+		if(index == NULL)
+			return 0;
+		for(unsigned int i = 0; i < b->nsets; i++)
+		{
+			uint32_t slot = mask_hash(b->sets[i]) & (capacity - 1);
+			while(index[slot] != 0)
+				slot = (slot + 1) & (capacity - 1);
+			index[slot] = i + 1;
+		}
+		if(b->set_index != NULL)
+			free(b->set_index);
+		b->set_index = index;
+		b->set_capacity = capacity;
+	}
+
+	uint32_t slot = mask_hash(mask) & (b->set_capacity - 1);
+	while(b->set_index[slot] != 0)
+	{
+		if(b->sets[b->set_index[slot] - 1] == mask)
+			return b->set_index[slot];
+		slot = (slot + 1) & (b->set_capacity - 1);
+	}
+
+	if(b->nsets == b->sets_alloc)
+	{
+		const unsigned int alloc = b->sets_alloc > 0 ? 2*b->sets_alloc : 64u;
+		uint64_t *sets = realloc(b->sets, alloc*sizeof(uint64_t));
+		if(sets == NULL)
+			return 0;
+		b->sets = sets;
+		b->sets_alloc = alloc;
+	}
+
+	b->sets[b->nsets++] = mask;
+	b->set_index[slot] = b->nsets;
+	return b->nsets;
+}
+
+static uint32_t __attribute__((pure)) table_find(const domain_table *t, const uint64_t fp)
+{
+	uint32_t slot = fp & (t->capacity - 1);
+	while(t->set[slot] != 0 && t->fp[slot] != fp)
+		slot = (slot + 1) & (t->capacity - 1);
+	return slot;
+}
+
+static void free_table(domain_table *t)
+{
+	if(t->fp != NULL)
+		free(t->fp);
+	if(t->set != NULL)
+		free(t->set);
+	if(t->id != NULL)
+		free(t->id);
+	memset(t, 0, sizeof(*t));
+}
+
+// Double the capacity of a table, keeping it at most 3/4 full
+static bool table_grow(domain_table *t, const bool with_id)
+{
+	domain_table grown = { 0 };
+	grown.capacity = t->capacity > 0 ? 2*t->capacity : SHARED_MIN_CAPACITY;
+	grown.used = t->used;
+	grown.fp = calloc(grown.capacity, sizeof(uint64_t));
+	grown.set = calloc(grown.capacity, sizeof(uint32_t));
+	if(with_id)
+		grown.id = calloc(grown.capacity, sizeof(int));
+	if(grown.fp == NULL || grown.set == NULL || (with_id && grown.id == NULL))
+	{
+		free_table(&grown);
+		return false;
+	}
+
+	for(uint32_t i = 0; i < t->capacity; i++)
+	{
+		if(t->set[i] == 0)
+			continue;
+		const uint32_t slot = table_find(&grown, t->fp[i]);
+		grown.fp[slot] = t->fp[i];
+		grown.set[slot] = t->set[i];
+		if(with_id)
+			grown.id[slot] = t->id[i];
+	}
+
+	free_table(t);
+	*t = grown;
+	return true;
+}
+
+// Add a domain to a table. Domains which are already known get the groups
+// added to their group set
+static bool table_add(shared_builder *b, domain_table *t, const char *domain,
+                      const uint64_t mask, const int id, const bool with_id)
+{
+	if(4*(t->used + 1) > 3*t->capacity && !table_grow(t, with_id))
+		return false;
+
+	const uint64_t fp = gravity_domain_hash(domain);
+	const uint32_t slot = table_find(t, fp);
+	uint64_t groups = mask;
+	if(t->set[slot] != 0)
+		groups |= b->sets[t->set[slot] - 1];
+	else
+		t->used++;
+
+	const uint32_t set = get_set(b, groups);
+	if(set == 0)
+		return false;
+
+	t->fp[slot] = fp;
+	t->set[slot] = set;
+	if(with_id)
+		t->id[slot] = id;
+	return true;
+}
+
+static int adlist_cmp(const void *a, const void *b)
+{
+	const int ida = ((const adlist_groups*)a)->id;
+	const int idb = ((const adlist_groups*)b)->id;
+	return (ida > idb) - (ida < idb);
+}
+
+// Get the enabled groups of all enabled adlists
+static bool read_adlist_groups(sqlite3 *db, shared_builder *b)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT adlist.id, adlist_by_group.group_id FROM adlist "
+	                                  "JOIN adlist_by_group ON adlist_by_group.adlist_id = adlist.id "
+	                                  "JOIN \"group\" ON \"group\".id = adlist_by_group.group_id "
+	                                  "WHERE adlist.enabled = 1 AND \"group\".enabled = 1 "
+	                                  "ORDER BY adlist.id;",
+	                            -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_shared_load() - SQL error prepare adlists: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	unsigned int alloc = 0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		const int group = sqlite3_column_int(stmt, 1);
+		if(group < 0 || group >= SHARED_MAX_GROUPS)
+		{
+			logg("INFO: Group ID %d too large, TCP workers use the gravity database", group);
+			sqlite3_finalize(stmt);
+			return false;
+		}
+
+		// Rows are sorted by adlist ID
+		if(b->nadlists == 0 || b->adlists[b->nadlists - 1].id != id)
+		{
+			if(b->nadlists == alloc)
+			{
+				alloc = alloc > 0 ? 2*alloc : 64u;
+				adlist_groups *adlists = realloc(b->adlists, alloc*sizeof(adlist_groups));
+				if(adlists == NULL)
+				{
+					sqlite3_finalize(stmt);
+					return false;
+				}
+				b->adlists = adlists;
+			}
+			b->adlists[b->nadlists].id = id;
+			b->adlists[b->nadlists].mask = 0;
+			b->nadlists++;
+		}
+		b->adlists[b->nadlists - 1].mask |= 1ULL << group;
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_shared_load() - SQL error step adlists: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+static bool read_gravity(sqlite3 *db, shared_builder *b)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT domain, adlist_id FROM gravity;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_shared_load() - SQL error prepare gravity: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		const adlist_groups key = { .id = sqlite3_column_int(stmt, 1) };
+		const adlist_groups *adlist = bsearch(&key, b->adlists, b->nadlists,
+		                                      sizeof(adlist_groups), adlist_cmp);
+
+		// Skip domains of disabled adlists or adlists without groups
+		if(domain == NULL || adlist == NULL)
+			continue;
+
+		if(!table_add(b, &b->lists[GRAVITY_TABLE], domain, adlist->mask, 0, false))
+		{
+			logg("WARN: Cannot allocate memory for the shared gravity table");
+			sqlite3_finalize(stmt);
+			return false;
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_shared_load() - SQL error step gravity: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+static bool read_domainlist(sqlite3 *db, shared_builder *b, const enum gravity_tables list)
+{
+	const char *querystr = list == EXACT_BLACKLIST_TABLE ?
+		"SELECT domain, id, group_id FROM vw_blacklist WHERE group_id IS NOT NULL;" :
+		"SELECT domain, id, group_id FROM vw_whitelist WHERE group_id IS NOT NULL;";
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_shared_load() - SQL error prepare domainlist: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		const int id = sqlite3_column_int(stmt, 1);
+		const int group = sqlite3_column_int(stmt, 2);
+		if(domain == NULL)
+			continue;
+
+		if(group < 0 || group >= SHARED_MAX_GROUPS)
+		{
+			logg("INFO: Group ID %d too large, TCP workers use the gravity database", group);
+			sqlite3_finalize(stmt);
+			return false;
+		}
+
+		if(!table_add(b, &b->lists[list], domain, 1ULL << group, id, true))
+		{
+			logg("WARN: Cannot allocate memory for the shared domainlist table");
+			sqlite3_finalize(stmt);
+			return false;
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_shared_load() - SQL error step domainlist: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+static void free_builder(shared_builder *b)
+{
+	for(unsigned int i = 0; i < SHARED_LISTS; i++)
+		free_table(&b->lists[i]);
+	if(b->sets != NULL)
+		free(b->sets);
+	if(b->set_index != NULL)
+		free(b->set_index);
+	if(b->adlists != NULL)
+		free(b->adlists);
+}
+
+// Copy the tables into a read-only shared mapping
+static shared_tables *finalize_tables(const shared_builder *b)
+{
+	size_t size = sizeof(shared_tables) + b->nsets*sizeof(uint64_t);
+	for(unsigned int i = 0; i < SHARED_LISTS; i++)
+	{
+		const domain_table *t = &b->lists[i];
+		size += t->capacity*(sizeof(uint64_t) + sizeof(uint32_t));
+		if(t->id != NULL)
+			size += t->capacity*sizeof(int);
+	}
+
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(ptr == MAP_FAILED)
+	{
+		logg("WARN: Cannot allocate %zu bytes for the shared gravity tables: %s", size, strerror(errno));
+		return NULL;
+	}
+
+	// 64 bit arrays first so all arrays are properly aligned
+	shared_tables *tables = ptr;
+	tables->size = size;
+	tables->nsets = b->nsets;
+	unsigned char *next = (unsigned char*)ptr + sizeof(shared_tables);
+	tables->sets = (void*)next;
+	memcpy(tables->sets, b->sets, b->nsets*sizeof(uint64_t));
+	next += b->nsets*sizeof(uint64_t);
+
+	for(unsigned int i = 0; i < SHARED_LISTS; i++)
+	{
+		const domain_table *t = &b->lists[i];
+		domain_table *dst = &tables->lists[i];
+		dst->capacity = t->capacity;
+		dst->used = t->used;
+		dst->fp = (void*)next;
+		memcpy(dst->fp, t->fp, t->capacity*sizeof(uint64_t));
+		next += t->capacity*sizeof(uint64_t);
+	}
+	for(unsigned int i = 0; i < SHARED_LISTS; i++)
+	{
+		const domain_table *t = &b->lists[i];
+		domain_table *dst = &tables->lists[i];
+		dst->set = (void*)next;
+		memcpy(dst->set, t->set, t->capacity*sizeof(uint32_t));
+		next += t->capacity*sizeof(uint32_t);
+		if(t->id != NULL)
+		{
+			dst->id = (void*)next;
+			memcpy(dst->id, t->id, t->capacity*sizeof(int));
+			next += t->capacity*sizeof(int);
+		}
+	}
+
+	// The tables are read-only from now on
+	mprotect(ptr, size, PROT_READ);
+	return tables;
+}
+
+// Install new tables (may be NULL) and release the previous ones. Forks keep
+// their own mapping of the tables they were started with
+static void shared_replace(shared_tables *tables)
+{
+	lock_shm();
+	shared_tables *old = shared;
+	shared = tables;
+	unlock_shm();
+
+	if(old != NULL)
+		munmap(old, old->size);
+}
+
+// (Re-)build the shared lookup tables from the gravity database. This is done
+// without holding the shared memory lock, only the final swap needs it
+void gravity_shared_load(void)
+{
+	if(!config.shared_gravity)
+	{
+		shared_replace(NULL);
+		return;
+	}
+
+	sqlite3 *db = NULL;
+	int rc = sqlite3_open_v2(FTLfiles.gravity_db, &db, SQLITE_OPEN_READONLY, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_shared_load() - SQL error open: %s", sqlite3_errstr(rc));
+		sqlite3_close(db);
+		shared_replace(NULL);
+		return;
+	}
+
+	shared_builder b = { 0 };
+	bool okay = true;
+	for(unsigned int i = 0; i < SHARED_LISTS && okay; i++)
+		okay = table_grow(&b.lists[i], i != GRAVITY_TABLE);
+	okay = okay &&
+	       read_adlist_groups(db, &b) &&
+	       read_gravity(db, &b) &&
+	       read_domainlist(db, &b, EXACT_BLACKLIST_TABLE) &&
+	       read_domainlist(db, &b, EXACT_WHITELIST_TABLE);
+	sqlite3_close(db);
+
+	shared_tables *tables = okay ? finalize_tables(&b) : NULL;
+	free_builder(&b);
+	shared_replace(tables);
+
+	if(tables != NULL && config.debug & DEBUG_DATABASE)
+		logg("Shared gravity tables: %u gravity, %u blacklist, %u whitelist domains, %zu bytes",
+		     tables->lists[GRAVITY_TABLE].used, tables->lists[EXACT_BLACKLIST_TABLE].used,
+		     tables->lists[EXACT_WHITELIST_TABLE].used, tables->size);
+}
+
+bool gravity_shared_available(void)
+{
+	return shared != NULL;
+}
+
+// Convert the comma-separated group IDs of a client into a bitmask
+static bool group_mask(const char *groups, uint64_t *mask)
+{
+	*mask = 0;
+	while(*groups != '\0')
+	{
+		char *end = NULL;
+		const unsigned long group = strtoul(groups, &end, 10);
+		if(end == groups || group >= SHARED_MAX_GROUPS)
+			return false;
+		*mask |= 1ULL << group;
+		groups = *end == ',' ? end + 1 : end;
+	}
+
+	return true;
+}
+
+// Check if the lookup tables can answer requests for this client. Needs to be
+// called with the shared memory lock held
+bool gravity_shared_usable(const clientsData *client)
+{
+	uint64_t mask;
+	return shared != NULL && client->flags.found_group &&
+	       group_mask(getstr(client->groupspos), &mask);
+}
+
+// Check if a domain is on the given list for any of the client's groups.
+// Needs to be called with the shared memory lock held
+enum db_result gravity_shared_lookup(const enum gravity_tables list, const char *domain,
+                                     const clientsData *client, int *domain_id)
+{
+	uint64_t mask;
+	if(shared == NULL || list >= SHARED_LISTS || !client->flags.found_group ||
+	   !group_mask(getstr(client->groupspos), &mask))
+		return LIST_NOT_AVAILABLE;
+
+	if(domain_id != NULL)
+		*domain_id = -1;
+
+	const domain_table *t = &shared->lists[list];
+	const uint32_t slot = table_find(t, gravity_domain_hash(domain));
+	if(t->set[slot] == 0 || (shared->sets[t->set[slot] - 1] & mask) == 0)
+		return NOT_FOUND;
+
+	if(domain_id != NULL && t->id != NULL)
+		*domain_id = t->id[slot];
+
+	return FOUND;
+}
+
+// Needs to be called with the shared memory lock held
+void get_gravity_shared_info(struct gravity_shared_info *info)
+{
+	memset(info, 0, sizeof(*info));
+	if(shared == NULL)
+		return;
+
+	for(unsigned int i = 0; i < SHARED_LISTS; i++)
+		info->domains += shared->lists[i].used;
+	info->size = shared->size;
+}
@@ -0,0 +1,30 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Shared gravity lookup table prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef GRAVITY_SHARED_H
+#define GRAVITY_SHARED_H
+
+// clientsData
+#include "../datastructure.h"
+// enum gravity_tables
+#include "gravity-db.h"
+
+void gravity_shared_load(void);
+bool gravity_shared_available(void) __attribute__((pure));
+bool gravity_shared_usable(const clientsData *client);
+enum db_result gravity_shared_lookup(const enum gravity_tables list, const char *domain,
+                                     const clientsData *client, int *domain_id);
+
+struct gravity_shared_info {
+	unsigned int domains;
+	size_t size;
+};
+void get_gravity_shared_info(struct gravity_shared_info *info);
+
+#endif //GRAVITY_SHARED_H
@@ -23,8 +23,6 @@
 #include "../signals.h"
 // struct config
 #include "../config.h"
-// get_rate_limit_turnaround()
-#include "../gc.h"
 
 static const char *message_types[MAX_MESSAGE] =
 	{ "REGEX", "SUBNET", "HOSTNAME", "DNSMASQ_CONFIG", "RATE_LIMIT", "DNSMASQ_WARN", "LOAD", "SHMEM", "DISK", "ADLIST" };
@@ -59,7 +57,7 @@ static unsigned char message_blob_types[MAX_MESSAGE][5] =
 			SQLITE_NULL, // Not used
 			SQLITE_NULL  // Not used
 		},
-		{	// RATE_LIMIT_MESSAGE: The message column contains the IP address of the client in question
+		{	// RATE_LIMIT_MESSAGE: The message column contains the IP address of the client (or network) in question
 			SQLITE_INTEGER, // Configured maximum number of queries
 			SQLITE_INTEGER, // Configured rate-limiting interval [seconds]
 			SQLITE_NULL, // Not used
@@ -356,16 +354,14 @@ void logg_fatal_dnsmasq_message(const char *message)
 	cleanup(EXIT_FAILURE);
 }
 
-void logg_rate_limit_message(const char *clientIP, const unsigned int rate_limit_count)
+void logg_rate_limit_message(const char *clientIP, const time_t turnaround, const unsigned int count, const unsigned int interval)
 {
-	const time_t turnaround = get_rate_limit_turnaround(rate_limit_count);
-
 	// Log to FTL.log
 	logg("Rate-limiting %s for at least %ld second%s",
 	     clientIP, turnaround, turnaround == 1 ? "" : "s");
 
 	// Log to database
-	add_message(RATE_LIMIT_MESSAGE, clientIP, 2, config.rate_limit.count, config.rate_limit.interval);
+	add_message(RATE_LIMIT_MESSAGE, clientIP, 2, count, interval);
 }
 
 void logg_warn_dnsmasq_message(char *message)
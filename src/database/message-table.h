@@ -20,7 +20,7 @@ void logg_subnet_warning(const char *ip, const int matching_count, const char *m
                          const int chosen_match_id);
 void logg_hostname_warning(const char *ip, const char *name, const unsigned int pos);
 void logg_fatal_dnsmasq_message(const char *message);
-void logg_rate_limit_message(const char *clientIP, const unsigned int rate_limit_count);
+void logg_rate_limit_message(const char *clientIP, const time_t turnaround, const unsigned int count, const unsigned int interval);
 void logg_warn_dnsmasq_message(char *message);
 void log_resource_shortage(const double load, const int nprocs, const int shmem, const int disk, const char *path, const char *msg);
 void logg_inaccessible_adlist(const int dbindex, const char *address);
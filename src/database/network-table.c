@@ -21,11 +21,17 @@
 #include "../resolve.h"
 // killed
 #include "../signals.h"
+// get_neighbor_cache()
+#include "../netlink.h"
 
 // Private prototypes
 static char *getMACVendor(const char *hwaddr) __attribute__ ((malloc));
 enum arp_status { CLIENT_NOT_HANDLED, CLIENT_ARP_COMPLETE, CLIENT_ARP_INCOMPLETE };
 
+// How often do we write all devices to the database even when they did not
+// change (this updates their lastSeen timestamps)? [seconds]
+#define NETDB_REFRESH_INTERVAL 3600
+
 bool create_network_table(sqlite3 *db)
 {
 	// Return early if database is known to be broken
@@ -311,6 +317,177 @@ static int find_recent_device_by_mock_hwaddr(sqlite3 *db, const char *ipaddr)
 	return network_id;
 }
 
+// Prepared statements used while updating the network table. They are
+// prepared once per run of parse_neighbor_cache() and reused for all devices
+enum netDB_stmt {
+	NETDB_UPDATE_NAME,
+	NETDB_UPDATE_LASTQUERY,
+	NETDB_UPDATE_NUMQUERIES,
+	NETDB_ADD_ADDRESS,
+	NETDB_INSERT_DEVICE,
+	NETDB_UNMOCK_DEVICE,
+	NETDB_UPDATE_INTERFACE,
+	NETDB_STMT_MAX
+};
+static sqlite3_stmt *netDB_stmts[NETDB_STMT_MAX] = { NULL };
+
+static sqlite3_stmt *get_netDB_stmt(sqlite3 *db, const enum netDB_stmt idx, const char *querystr, int *rc)
+{
+	*rc = SQLITE_OK;
+	if(netDB_stmts[idx] == NULL)
+		*rc = sqlite3_prepare_v2(db, querystr, -1, &netDB_stmts[idx], NULL);
+	return netDB_stmts[idx];
+}
+
+static void finalize_netDB_stmts(void)
+{
+	for(unsigned int i = 0; i < NETDB_STMT_MAX; i++)
+	{
+		if(netDB_stmts[i] == NULL)
+			continue;
+		sqlite3_finalize(netDB_stmts[i]);
+		netDB_stmts[i] = NULL;
+	}
+}
+
+// Remember what we last stored for every address so that subsequent runs
+// only need to touch devices which actually changed. Entries are identified
+// by their source and IP address
+enum netDB_source { NETDB_FROM_ARP, NETDB_FROM_FTL, NETDB_FROM_IFACE };
+typedef struct {
+	enum netDB_source source;
+	char ip[INET6_ADDRSTRLEN];
+	char hwaddr[HWADDR_STRLEN];
+	char iface[IF_NAMESIZE];
+	size_t namepos;
+	time_t lastQuery;
+	time_t seen;
+} netDB_state;
+
+static struct {
+	netDB_state *states;
+	unsigned int count;
+	// Entries [0, sorted) are sorted and can be searched
+	unsigned int sorted;
+	// Row counts after the last successful run, used to detect
+	// changes made by other processes
+	int devices;
+	int addresses;
+	time_t last_full_run;
+	bool full_run;
+} netDB_cache = { NULL, 0u, 0u, -1, -1, 0, true };
+
+static int netDB_state_cmp(const void *a, const void *b)
+{
+	const netDB_state *sa = a, *sb = b;
+	if(sa->source != sb->source)
+		return sa->source < sb->source ? -1 : 1;
+	return strcmp(sa->ip, sb->ip);
+}
+
+static netDB_state *find_netDB_state(const enum netDB_source source, const char *ip)
+{
+	netDB_state key = { .source = source };
+	strncpy(key.ip, ip, sizeof(key.ip) - 1);
+	return bsearch(&key, netDB_cache.states, netDB_cache.sorted, sizeof(netDB_state), netDB_state_cmp);
+}
+
+// Check if the device data is the same as what we stored in a previous run. In
+// this case, there is nothing to be written to the database
+static bool netDB_unchanged(const enum netDB_source source, const char *ip, const char *hwaddr,
+                            const char *iface, const size_t namepos, const time_t lastQuery,
+                            const unsigned int numQueriesARP, const time_t now)
+{
+	if(netDB_cache.full_run || numQueriesARP > 0)
+		return false;
+
+	netDB_state *state = find_netDB_state(source, ip);
+	if(state == NULL ||
+	   strncmp(state->hwaddr, hwaddr, sizeof(state->hwaddr) - 1) != 0 ||
+	   strncmp(state->iface, iface, sizeof(state->iface) - 1) != 0 ||
+	   state->namepos != namepos || state->lastQuery != lastQuery)
+		return false;
+
+	state->seen = now;
+	return true;
+}
+
+// Memorize device data after it has been written to the database
+static void remember_netDB_state(const enum netDB_source source, const char *ip, const char *hwaddr,
+                                 const char *iface, const size_t namepos, const time_t lastQuery,
+                                 const time_t now)
+{
+	netDB_state *state = find_netDB_state(source, ip);
+	if(state == NULL)
+	{
+		// Append new entry, it becomes searchable after sorting at the
+		// end of this run
+		netDB_state *states = realloc(netDB_cache.states, (netDB_cache.count + 1)*sizeof(netDB_state));
+		if(states == NULL)
+			return;
+		netDB_cache.states = states;
+		state = &netDB_cache.states[netDB_cache.count++];
+		memset(state, 0, sizeof(*state));
+		state->source = source;
+		strncpy(state->ip, ip, sizeof(state->ip) - 1);
+	}
+
+	strncpy(state->hwaddr, hwaddr, sizeof(state->hwaddr) - 1);
+	strncpy(state->iface, iface, sizeof(state->iface) - 1);
+	state->namepos = namepos;
+	state->lastQuery = lastQuery;
+	state->seen = now;
+}
+
+// Forget everything we know, the next run will write all devices
+static void reset_netDB_cache(void)
+{
+	if(netDB_cache.states != NULL)
+		free(netDB_cache.states);
+	netDB_cache.states = NULL;
+	netDB_cache.count = 0u;
+	netDB_cache.sorted = 0u;
+	netDB_cache.devices = -1;
+	netDB_cache.addresses = -1;
+	netDB_cache.full_run = true;
+}
+
+// Decide whether this run has to write all devices. This is the case
+// periodically (to refresh the lastSeen timestamps) and when other processes
+// have added or removed devices since our last run
+static void start_netDB_run(sqlite3 *db, const time_t now)
+{
+	const int devices = db_query_int(db, "SELECT COUNT(*) FROM network;");
+	const int addresses = db_query_int(db, "SELECT COUNT(*) FROM network_addresses;");
+	netDB_cache.full_run = now - netDB_cache.last_full_run >= NETDB_REFRESH_INTERVAL ||
+	                       devices != netDB_cache.devices ||
+	                       addresses != netDB_cache.addresses;
+
+	if(config.debug & DEBUG_ARP)
+		logg("Network table: Starting %s update", netDB_cache.full_run ? "full" : "incremental");
+}
+
+// Make entries added in this run searchable and memorize the table sizes
+static void finish_netDB_run(sqlite3 *db, const time_t now)
+{
+	// Drop entries not seen during a full run, they are gone
+	if(netDB_cache.full_run)
+	{
+		unsigned int j = 0u;
+		for(unsigned int i = 0u; i < netDB_cache.count; i++)
+			if(netDB_cache.states[i].seen >= now)
+				netDB_cache.states[j++] = netDB_cache.states[i];
+		netDB_cache.count = j;
+		netDB_cache.last_full_run = now;
+	}
+
+	qsort(netDB_cache.states, netDB_cache.count, sizeof(netDB_state), netDB_state_cmp);
+	netDB_cache.sorted = netDB_cache.count;
+
+	netDB_cache.devices = db_query_int(db, "SELECT COUNT(*) FROM network;");
+	netDB_cache.addresses = db_query_int(db, "SELECT COUNT(*) FROM network_addresses;");
+}
+
 // Store hostname of device identified by dbID
 static int update_netDB_name(sqlite3 *db, const char *ip, const char *name)
 {
@@ -322,12 +499,12 @@ static int update_netDB_name(sqlite3 *db, const char *ip, const char *name)
 	if(name == NULL || strlen(name) < 1)
 		return SQLITE_OK;
 
-	sqlite3_stmt *query_stmt = NULL;
 	const char querystr[] = "UPDATE network_addresses SET name = ?1, "
 	                               "nameUpdated = (cast(strftime('%s', 'now') as int)) "
 	                               "WHERE ip = ?2";
 
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
+	int rc = SQLITE_OK;
+	sqlite3_stmt *query_stmt = get_netDB_stmt(db, NETDB_UPDATE_NAME, querystr, &rc);
 	if(rc != SQLITE_OK)
 	{
 		logg("update_netDB_name(%s, \"%s\") - SQL error prepare (%i): %s",
@@ -373,16 +550,57 @@ static int update_netDB_name(sqlite3 *db, const char *ip, const char *name)
 		return rc;
 	}
 
-	// Finalize statement
-	if ((rc = sqlite3_finalize(query_stmt)) != SQLITE_OK)
+	// Reset statement, it is reused for the next device
+	sqlite3_reset(query_stmt);
+	sqlite3_clear_bindings(query_stmt);
+
+	return SQLITE_OK;
+}
+
+// Bind two integers to the cached statement <idx> and step it
+static int step_netDB_int_stmt(sqlite3 *db, const enum netDB_stmt idx, const char *querystr,
+                               const sqlite3_int64 arg1, const int arg2)
+{
+	int rc = SQLITE_OK;
+	sqlite3_stmt *query_stmt = get_netDB_stmt(db, idx, querystr, &rc);
+	if(rc != SQLITE_OK)
 	{
-		logg("update_netDB_name(%s, \"%s\"): Failed to finalize (error %d): %s",
-		     ip, name, rc, sqlite3_errstr(rc));
+		logg("step_netDB_int_stmt(\"%s\") - SQL error prepare (%i): %s",
+		     querystr, rc, sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		return rc;
+	}
+
+	if(config.debug & DEBUG_DATABASE)
+	{
+		logg("dbquery: \"%s\" with arguments ?1 = %lli and ?2 = %i",
+		     querystr, (long long)arg1, arg2);
+	}
+
+	if((rc = sqlite3_bind_int64(query_stmt, 1, arg1)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_int(query_stmt, 2, arg2)) != SQLITE_OK)
+	{
+		logg("step_netDB_int_stmt(\"%s\"): Failed to bind (error %d): %s",
+		     querystr, rc, sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		sqlite3_reset(query_stmt);
+		return rc;
+	}
+
+	// Perform step
+	if((rc = sqlite3_step(query_stmt)) != SQLITE_DONE)
+	{
+		logg("step_netDB_int_stmt(\"%s\"): Failed to step (error %d): %s",
+		     querystr, rc, sqlite3_errstr(rc));
 		checkFTLDBrc(rc);
 		sqlite3_reset(query_stmt);
 		return rc;
 	}
 
+	// Reset statement, it is reused for the next device
+	sqlite3_reset(query_stmt);
+	sqlite3_clear_bindings(query_stmt);
+
 	return SQLITE_OK;
 }
 
@@ -399,12 +617,9 @@ static int update_netDB_lastQuery(sqlite3 *db, const int network_id, const time_
 	if(lastQuery < 1)
 		return SQLITE_OK;
 
-	const int ret = dbquery(db, "UPDATE network "\
-	                            "SET lastQuery = MAX(lastQuery, %ld) "\
-	                            "WHERE id = %i;",
-	                            lastQuery, network_id);
-
-	return ret;
+	return step_netDB_int_stmt(db, NETDB_UPDATE_LASTQUERY,
+	                           "UPDATE network SET lastQuery = MAX(lastQuery, ?1) WHERE id = ?2;",
+	                           lastQuery, network_id);
 }
 
 
@@ -420,12 +635,9 @@ static int update_netDB_numQueries(sqlite3 *db, const int dbID, const int numQue
 	if(numQueries < 1)
 		return SQLITE_OK;
 
-	const int ret = dbquery(db, "UPDATE network "
-	                            "SET numQueries = numQueries + %u "
-	                            "WHERE id = %i;",
-	                            numQueries, dbID);
-
-	return ret;
+	return step_netDB_int_stmt(db, NETDB_UPDATE_NUMQUERIES,
+	                           "UPDATE network SET numQueries = numQueries + ?1 WHERE id = ?2;",
+	                           numQueries, dbID);
 }
 
 // Add IP address record if it does not exist (INSERT). If it already exists,
@@ -441,7 +653,6 @@ static int add_netDB_network_address(sqlite3 *db, const int network_id, const ch
 	if(ip == NULL || strlen(ip) == 0)
 		return SQLITE_OK;
 
-	sqlite3_stmt *query_stmt = NULL;
 	const char querystr[] = "INSERT OR REPLACE INTO network_addresses "
 	                        "(network_id,ip,lastSeen,name,nameUpdated) VALUES "
 	                        "(?1,?2,(cast(strftime('%s', 'now') as int)),"
@@ -450,7 +661,8 @@ static int add_netDB_network_address(sqlite3 *db, const int network_id, const ch
 	                        "(SELECT nameUpdated FROM network_addresses "
 	                                "WHERE ip = ?2));";
 
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
+	int rc = SQLITE_OK;
+	sqlite3_stmt *query_stmt = get_netDB_stmt(db, NETDB_ADD_ADDRESS, querystr, &rc);
 	if(rc != SQLITE_OK)
 	{
 		logg("add_netDB_network_address(%i, \"%s\") - SQL error prepare (%i): %s",
@@ -494,15 +706,9 @@ static int add_netDB_network_address(sqlite3 *db, const int network_id, const ch
 		return rc;
 	}
 
-	// Finalize statement
-	if ((rc = sqlite3_finalize(query_stmt)) != SQLITE_OK)
-	{
-		logg("add_netDB_network_address(%i, \"%s\"): Failed to finalize (error %d): %s",
-		     network_id, ip, rc, sqlite3_errstr(rc));
-		checkFTLDBrc(rc);
-		sqlite3_reset(query_stmt);
-		return rc;
-	}
+	// Reset statement, it is reused for the next device
+	sqlite3_reset(query_stmt);
+	sqlite3_clear_bindings(query_stmt);
 
 	return SQLITE_OK;
 }
@@ -515,12 +721,12 @@ static int insert_netDB_device(sqlite3 *db, const char *hwaddr, time_t now, time
 	if(FTLDBerror())
 		return SQLITE_ERROR;
 
-	sqlite3_stmt *query_stmt = NULL;
 	const char querystr[] = "INSERT INTO network "\
 	                        "(hwaddr,interface,firstSeen,lastQuery,numQueries,macVendor) "\
 	                        "VALUES (?1,\'N/A\',?2,?3,?4,?5);";
 
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
+	int rc = SQLITE_OK;
+	sqlite3_stmt *query_stmt = get_netDB_stmt(db, NETDB_INSERT_DEVICE, querystr, &rc);
 	if(rc != SQLITE_OK)
 	{
 		logg("insert_netDB_device(\"%s\",%lu, %lu, %u, \"%s\") - SQL error prepare (%i): %s",
@@ -595,15 +801,9 @@ static int insert_netDB_device(sqlite3 *db, const char *hwaddr, time_t now, time
 		return rc;
 	}
 
-	// Finalize statement
-	if ((rc = sqlite3_finalize(query_stmt)) != SQLITE_OK)
-	{
-		logg("insert_netDB_device(\"%s\",%lu, %lu, %u, \"%s\"): Failed to finalize (error %d): %s",
-		     hwaddr, now, lastQuery, numQueriesARP, macVendor, rc, sqlite3_errstr(rc));
-		sqlite3_reset(query_stmt);
-		checkFTLDBrc(rc);
-		return rc;
-	}
+	// Reset statement, it is reused for the next device
+	sqlite3_reset(query_stmt);
+	sqlite3_clear_bindings(query_stmt);
 
 	return SQLITE_OK;
 }
@@ -615,11 +815,11 @@ static int unmock_netDB_device(sqlite3 *db, const char *hwaddr, const char *macV
 	if(FTLDBerror())
 		return SQLITE_ERROR;
 
-	sqlite3_stmt *query_stmt = NULL;
 	const char querystr[] = "UPDATE network SET "\
 	                        "hwaddr = ?1, macVendor=?2 WHERE id = ?3;";
 
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
+	int rc = SQLITE_OK;
+	sqlite3_stmt *query_stmt = get_netDB_stmt(db, NETDB_UNMOCK_DEVICE, querystr, &rc);
 	if(rc != SQLITE_OK)
 	{
 		logg("unmock_netDB_device(\"%s\", \"%s\", %i) - SQL error prepare (%i): %s",
@@ -674,15 +874,9 @@ static int unmock_netDB_device(sqlite3 *db, const char *hwaddr, const char *macV
 		return rc;
 	}
 
-	// Finalize statement
-	if ((rc = sqlite3_finalize(query_stmt)) != SQLITE_OK)
-	{
-		logg("unmock_netDB_device(\"%s\", \"%s\", %i): Failed to finalize (error %d): %s",
-		     hwaddr, macVendor, dbID, rc, sqlite3_errstr(rc));
-		sqlite3_reset(query_stmt);
-		checkFTLDBrc(rc);
-		return rc;
-	}
+	// Reset statement, it is reused for the next device
+	sqlite3_reset(query_stmt);
+	sqlite3_clear_bindings(query_stmt);
 
 	return SQLITE_OK;
 }
@@ -698,10 +892,10 @@ static int update_netDB_interface(sqlite3 *db, const int network_id, const char
 	if(iface == NULL || strlen(iface) == 0)
 		return SQLITE_OK;
 
-	sqlite3_stmt *query_stmt = NULL;
 	const char querystr[] = "UPDATE network SET interface = ?1 WHERE id = ?2";
 
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
+	int rc = SQLITE_OK;
+	sqlite3_stmt *query_stmt = get_netDB_stmt(db, NETDB_UPDATE_INTERFACE, querystr, &rc);
 	if(rc != SQLITE_OK)
 	{
 		logg("update_netDB_interface(%i, \"%s\") - SQL error prepare (%i): %s",
@@ -745,22 +939,17 @@ static int update_netDB_interface(sqlite3 *db, const int network_id, const char
 		return rc;
 	}
 
-	// Finalize statement
-	if ((rc = sqlite3_finalize(query_stmt)) != SQLITE_OK)
-	{
-		logg("update_netDB_interface(%i, \"%s\"): Failed to finalize (error %d): %s",
-		     network_id, iface, rc, sqlite3_errstr(rc));
-		sqlite3_reset(query_stmt);
-		checkFTLDBrc(rc);
-		return rc;
-	}
+	// Reset statement, it is reused for the next device
+	sqlite3_reset(query_stmt);
+	sqlite3_clear_bindings(query_stmt);
 
 	return SQLITE_OK;
 }
 
 // Loop over all clients known to FTL and ensure we add them all to the database
 static bool add_FTL_clients_to_network_table(sqlite3 *db, enum arp_status *client_status, time_t now,
-                                             unsigned int *additional_entries, int num_clients)
+                                             unsigned int *additional_entries, unsigned int *unchanged,
+                                             int num_clients)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
@@ -816,18 +1005,39 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, enum arp_status *clien
 			logg("Network table: %s NOT known through ARP/neigh cache", ipaddr);
 		}
 
-		//
-		// Variant 1: Try to find a device with an EDNS(0)-provided hardware address
-		//
-		int dbID = DB_NODATA;
-		if(client->hwlen == 6)
+		// The hardware address is only known for clients sending EDNS(0) data
+		const bool edns_hwaddr = client->hwlen == 6;
+		if(edns_hwaddr)
 		{
 			snprintf(hwaddr, sizeof(hwaddr), "%02X:%02X:%02X:%02X:%02X:%02X",
 			         client->hwaddr[0], client->hwaddr[1],
 			         client->hwaddr[2], client->hwaddr[3],
 			         client->hwaddr[4], client->hwaddr[5]);
 			hwaddr[6*2+5] = '\0';
+		}
+		else
+			hwaddr[0] = '\0';
+
+		// Skip this client if nothing changed since we last stored it
+		const size_t namepos = client->namepos;
+		const time_t lastSeenQuery = client->lastQuery;
+		if(netDB_unchanged(NETDB_FROM_FTL, ipaddr, hwaddr, interface, namepos,
+		                   lastSeenQuery, client->numQueriesARP, now))
+		{
+			if(ipaddr) free(ipaddr);
+			if(hostname) free(hostname);
+			if(interface) free(interface);
+			unlock_shm();
+			(*unchanged)++;
+			continue;
+		}
 
+		//
+		// Variant 1: Try to find a device with an EDNS(0)-provided hardware address
+		//
+		int dbID = DB_NODATA;
+		if(edns_hwaddr)
+		{
 			unlock_shm();
 			dbID = find_device_by_hwaddr(db, hwaddr);
 			lock_shm();
@@ -1001,6 +1211,10 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, enum arp_status *clien
 			break;
 		}
 
+		// Memorize what we stored for this client
+		remember_netDB_state(NETDB_FROM_FTL, ipaddr, edns_hwaddr ? hwaddr : "", interface,
+		                     namepos, lastSeenQuery, now);
+
 		// Add to number of processed ARP cache entries
 		(*additional_entries)++;
 
@@ -1027,92 +1241,36 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, enum arp_status *clien
 	return true;
 }
 
-static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsigned int *additional_entries)
+static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsigned int *additional_entries,
+                                                  unsigned int *unchanged)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
 		return SQLITE_ERROR;
 
-	// Try to access the kernel's Internet protocol address management
-	FILE *ip_pipe = NULL;
-	const char cmd[] = "ip address show";
-	errno = ENOMEM;
-	if((ip_pipe = popen(cmd, "r")) == NULL)
+	// Obtain addresses of all local interfaces from the kernel
+	interface_address *addresses = NULL;
+	const int num_addresses = get_interface_addresses(&addresses);
+	if(num_addresses < 0)
 	{
-		logg("WARN: Command \"%s\" failed: %s", cmd, strerror(errno));
+		logg("WARN: Reading local interface addresses failed");
 		return false;
 	}
 
-	// Buffers
-	char *linebuffer = NULL;
-	size_t linebuffersize = 0u;
-	int iface_no, rc;
-	bool has_iface = false, has_hwaddr = false;
-	char ipaddr[128], hwaddr[128], iface[128];
-
-	// Read response line by line
-	while(getline(&linebuffer, &linebuffersize, ip_pipe) != -1)
+	int rc;
+	for(int i = 0; i < num_addresses; i++)
 	{
-		// Skip if line buffer is invalid
-		if(linebuffer == NULL)
-			continue;
-
-		if(sscanf(linebuffer, "%i: %99[^:]", &iface_no, iface) == 2)
-		{
-			// Obtained an interface, continue to the next line
-			has_iface = true;
-			has_hwaddr = false;
-			iface[sizeof(iface)-1] = '\0';
-			continue;
-		}
-
-		// Do not try to read IP addresses when the information above is incomplete
-		if(!has_iface)
-			continue;
+		const char *ipaddr = addresses[i].ip;
+		const char *hwaddr = addresses[i].hwaddr;
+		const char *iface = addresses[i].iface;
 
-		// Try to read hardware address
-		// We skip lines with "link/none" (virtual, e.g., wireguard interfaces)
-		if(sscanf(linebuffer, "    link/ether %99s", hwaddr) == 1)
-		{
-			// Obtained an Ethernet hardware address, continue to the next line
-			has_hwaddr = true;
-			hwaddr[sizeof(hwaddr)-1] = '\0';
-			continue;
-		}
-		else if(sscanf(linebuffer, "    link/loopback %99s", hwaddr) == 1)
+		// Skip this address if nothing changed since we last stored it
+		if(netDB_unchanged(NETDB_FROM_IFACE, ipaddr, hwaddr, iface, 0, 0, 0, now))
 		{
-			// Obtained a loopback hardware address, continue to the next line
-			has_hwaddr = true;
-			hwaddr[sizeof(hwaddr)-1] = '\0';
+			(*unchanged)++;
 			continue;
 		}
 
-		// Do not try to read IP addresses when the information above is incomplete
-		if(!has_hwaddr)
-			continue;
-
-		// Try to read IPv4 address
-		// We need a special rule here to avoid "inet6 ..." being accepted as IPv4 address
-		if(sscanf(linebuffer, "    inet%*[ ]%[0-9.] brd", ipaddr) == 1)
-		{
-			// Obtained an IPv4 address
-			ipaddr[sizeof(ipaddr)-1] = '\0';
-		}
-		else
-		{
-			// Try to read IPv6 address
-			if(sscanf(linebuffer, "    inet6%*[ ]%[0-9a-fA-F:] scope", ipaddr) == 1)
-			{
-				// Obtained an IPv6 address
-				ipaddr[sizeof(ipaddr)-1] = '\0';
-			}
-			else
-			{
-				// No address data, continue to next line
-				continue;
-			}
-		}
-
 		if(config.debug & DEBUG_ARP)
 		{
 			logg("Network table: read interface details for interface %s (%s) with address %s",
@@ -1156,6 +1314,7 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 				if(asprintf(&querystr, "SELECT lastQuery from network where id = %i", mockID) < 10)
 				{
 					free(macVendor);
+					free(addresses);
 					return false;
 				}
 				lastQuery = db_query_int(db, querystr);
@@ -1164,6 +1323,7 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 				if(asprintf(&querystr, "SELECT firstSeen from network where id = %i", mockID) < 10)
 				{
 					free(macVendor);
+					free(addresses);
 					return false;
 				}
 				firstSeen = db_query_int(db, querystr);
@@ -1172,6 +1332,7 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 				if(asprintf(&querystr, "SELECT numQueries from network where id = %i", mockID) < 10)
 				{
 					free(macVendor);
+					free(addresses);
 					return false;
 				}
 				numQueries = db_query_int(db, querystr);
@@ -1210,41 +1371,38 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 		if(rc != SQLITE_OK)
 			break;
 
+		// Memorize what we stored for this address
+		remember_netDB_state(NETDB_FROM_IFACE, ipaddr, hwaddr, iface, 0, 0, now);
+
 		// Add to number of processed ARP cache entries
 		(*additional_entries)++;
 	}
 
-	// Close pipe handle and free allocated memory
-	pclose(ip_pipe);
-	if(linebuffer != NULL)
-		free(linebuffer);
+	// Free allocated memory
+	if(addresses != NULL)
+		free(addresses);
 
 	return true;
 }
 
-// Parse kernel's neighbor cache
-void parse_neighbor_cache(sqlite3* db)
+// Update network table from the kernel's neighbor cache, the clients known to
+// FTL and the local interfaces. Returns true if all changes were committed
+static bool update_network_table(sqlite3* db, const time_t now)
 {
-	// Try to access the kernel's neighbor cache
-	FILE *arpfp = NULL;
-	const char cmd[] = "ip neigh show";
-	errno = ENOMEM;
-	if((arpfp = popen(cmd, "r")) == NULL)
-	{
-		logg("WARN: Command \"%s\" failed: %s", cmd, strerror(errno));
-		return;
-	}
-
 	// Start ARP timer
 	if(config.debug & DEBUG_ARP)
 		timer_start(ARP_TIMER);
 
-	// Prepare buffers
-	char *linebuffer = NULL;
-	size_t linebuffersize = 0u;
-	char ip[128], hwaddr[128], iface[128];
-	unsigned int entries = 0u, additional_entries = 0u;
-	time_t now = time(NULL);
+	// Try to access the kernel's neighbor cache
+	neighbor_entry *neighbors = NULL;
+	const int num_neighbors = get_neighbor_cache(&neighbors);
+	if(num_neighbors < 0)
+	{
+		logg("WARN: Reading the neighbor cache failed");
+		return false;
+	}
+
+	unsigned int entries = 0u, additional_entries = 0u, unchanged = 0u;
 
 	const char sql[] = "BEGIN TRANSACTION IMMEDIATE";
 	int rc = dbquery(db, sql);
@@ -1258,10 +1416,14 @@ void parse_neighbor_cache(sqlite3* db)
 
 		// dbquery() above already logs the reason for why the query failed
 		logg("%s: Storing devices in network table (\"%s\") failed", text, sql);
-		pclose(arpfp);
-		return;
+		if(neighbors != NULL)
+			free(neighbors);
+		return false;
 	}
 
+	// Decide whether we can skip devices which did not change
+	start_netDB_run(db, now);
+
 	// Remove all but the most recent IP addresses not seen for more than a certain time
 	if(config.network_expire > 0u)
 	{
@@ -1270,17 +1432,25 @@ void parse_neighbor_cache(sqlite3* db)
 		                        "WHERE lastSeen < %lu;", (unsigned long)limit);
 		if(rc != SQLITE_OK)
 		{
-			pclose(arpfp);
-			return;
+			if(neighbors != NULL)
+				free(neighbors);
+			return false;
 		}
+		int expired = sqlite3_changes(db);
 
 		rc = dbquery(db, "UPDATE network_addresses SET name = NULL "
-		                        "WHERE nameUpdated < %lu;", (unsigned long)limit);
+		                        "WHERE nameUpdated < %lu AND name IS NOT NULL;", (unsigned long)limit);
 		if(rc != SQLITE_OK)
 		{
-			pclose(arpfp);
-			return;
+			if(neighbors != NULL)
+				free(neighbors);
+			return false;
 		}
+		expired += sqlite3_changes(db);
+
+		// Expired records have to be restored for devices still around
+		if(expired > 0)
+			netDB_cache.full_run = true;
 	}
 
 	// Initialize array of status for individual clients used to
@@ -1294,65 +1464,33 @@ void parse_neighbor_cache(sqlite3* db)
 		client_status[i] = CLIENT_NOT_HANDLED;
 	}
 
-	// Read ARP cache line by line
-	while(getline(&linebuffer, &linebuffersize, arpfp) != -1)
+	// Process neighbor cache entry by entry
+	for(int i = 0; i < num_neighbors; i++)
 	{
-		// Skip if line buffer is invalid
-		if(linebuffer == NULL)
-			continue;
-
 		// Check thread cancellation
 		if(killed)
 			break;
 
-		int num = sscanf(linebuffer, "%99s dev %99s lladdr %99s",
-		                 ip, iface, hwaddr);
-
-		// Ensure strings are null-terminated in case we hit the max.
-		// length limitation
-		ip[sizeof(ip)-1] = '\0';
-		iface[sizeof(iface)-1] = '\0';
-		hwaddr[sizeof(hwaddr)-1] = '\0';
+		const char *ip = neighbors[i].ip;
+		const char *hwaddr = neighbors[i].hwaddr;
+		const char *iface = neighbors[i].iface;
 
-		// Check if we want to process the line we just read
-		if(num != 3)
+		// Check if we want to process the entry we just read
+		if(!neighbors[i].has_hwaddr)
 		{
-			if(num == 2)
-			{
-				// This line is incomplete, remember this to skip
-				// mock-device creation after ARP processing
-				lock_shm();
-				int clientID = findClientID(ip, false, false);
-				unlock_shm();
-				if(clientID >= 0)
-					client_status[clientID] = CLIENT_ARP_INCOMPLETE;
-			}
+			// This entry is incomplete, remember this to skip
+			// mock-device creation after ARP processing
+			lock_shm();
+			int clientID = findClientID(ip, false, false);
+			unlock_shm();
+			if(clientID >= 0)
+				client_status[clientID] = CLIENT_ARP_INCOMPLETE;
 
-			// Skip to the next row in the neigh cache rather when
+			// Skip to the next entry in the neigh cache rather when
 			// marking as incomplete client
 			continue;
 		}
 
-		// Get ID of this device in our network database. If it cannot be
-		// found, then this is a new device. We only use the hardware address
-		// to uniquely identify clients and only use the first returned ID.
-		//
-		// Same MAC, two IPs: Non-deterministic (sequential) DHCP server, we
-		// update the IP address to the last seen one.
-		//
-		// We can run this SELECT inside the currently active transaction as
-		// only the changed to the database are collected for latter
-		// commitment. Read-only access such as this SELECT command will be
-		// executed immediately on the database.
-		int dbID = find_device_by_hwaddr(db, hwaddr);
-
-		if(dbID == DB_FAILED)
-		{
-			// Get SQLite error code and return early from loop
-			rc = sqlite3_errcode(db);
-			break;
-		}
-
 		// If we reach this point, we can check if this client
 		// is known to pihole-FTL
 		// false = do not create a new record if the client is
@@ -1365,6 +1503,7 @@ void parse_neighbor_cache(sqlite3* db)
 		bool client_valid = false;
 		time_t lastQuery = 0;
 		unsigned int numQueries = 0;
+		size_t namepos = 0;
 
 		// This client is known (by its IP address) to pihole-FTL if
 		// findClientID() returned a non-negative index
@@ -1372,10 +1511,14 @@ void parse_neighbor_cache(sqlite3* db)
 		{
 			clientsData *client = getClient(clientID, true);
 			if(!client)
+			{
+				unlock_shm();
 				continue;
+			}
 
 			client_valid = true;
 			hostname = strdup(getstr(client->namepos));
+			namepos = client->namepos;
 			lastQuery = client->lastQuery;
 			numQueries = client->numQueriesARP;
 			client_status[clientID] = CLIENT_ARP_COMPLETE;
@@ -1386,6 +1529,37 @@ void parse_neighbor_cache(sqlite3* db)
 		}
 		unlock_shm();
 
+		// Skip this device if nothing changed since we last stored it
+		if(netDB_unchanged(NETDB_FROM_ARP, ip, hwaddr, iface, namepos, lastQuery, numQueries, now))
+		{
+			free(hostname);
+			unchanged++;
+			continue;
+		}
+
+		bool remember = true;
+
+		// Get ID of this device in our network database. If it cannot be
+		// found, then this is a new device. We only use the hardware address
+		// to uniquely identify clients and only use the first returned ID.
+		//
+		// Same MAC, two IPs: Non-deterministic (sequential) DHCP server, we
+		// update the IP address to the last seen one.
+		//
+		// We can run this SELECT inside the currently active transaction as
+		// only the changed to the database are collected for latter
+		// commitment. Read-only access such as this SELECT command will be
+		// executed immediately on the database.
+		int dbID = find_device_by_hwaddr(db, hwaddr);
+
+		if(dbID == DB_FAILED)
+		{
+			// Get SQLite error code and return early from loop
+			rc = sqlite3_errcode(db);
+			free(hostname);
+			break;
+		}
+
 		// Device not in database, add new entry
 		if(dbID == DB_NODATA)
 		{
@@ -1447,6 +1621,9 @@ void parse_neighbor_cache(sqlite3* db)
 				// Update/replace important device properties
 				unmock_netDB_device(db, hwaddr, macVendor, dbID);
 
+				// Make sure the next run stores the remaining details
+				remember = false;
+
 				// Host name, count and last query timestamp will be set in the next
 				// loop iteration for the sake of simplicity
 			}
@@ -1515,43 +1692,46 @@ void parse_neighbor_cache(sqlite3* db)
 		if(rc != SQLITE_OK)
 			break;
 
+		// Memorize what we stored for this device
+		if(remember)
+			remember_netDB_state(NETDB_FROM_ARP, ip, hwaddr, iface, namepos, lastQuery, now);
+
 		// Count number of processed ARP cache entries
 		entries++;
 	}
 
-	// Close pipe handle and free allocated memory
-	pclose(arpfp);
-	if(linebuffer != NULL)
-		free(linebuffer);
+	// Free allocated memory
+	if(neighbors != NULL)
+		free(neighbors);
 
 	if(rc != SQLITE_OK)
 	{
 		logg("Database error in ARP cache processing loop");
-		return;
+		return false;
 	}
 
 	// Check thread cancellation
 	if(killed)
-		return;
+		return false;
 
 	// Loop over all clients known to FTL and ensure we add them all to the
 	// database
-	if(!add_FTL_clients_to_network_table(db, client_status, now, &additional_entries, clients))
-		return;
+	if(!add_FTL_clients_to_network_table(db, client_status, now, &additional_entries, &unchanged, clients))
+		return false;
 
 	// Check thread cancellation
 	if(killed)
-		return;
+		return false;
 
 	// Finally, loop over the available interfaces to ensure we list the
 	// IP addresses correctly (local addresses are NOT contained in the
 	// ARP/neighbor cache).
-	if(!add_local_interfaces_to_network_table(db, now, &additional_entries))
-		return;
+	if(!add_local_interfaces_to_network_table(db, now, &additional_entries, &unchanged))
+		return false;
 
 	// Check thread cancellation
 	if(killed)
-		return;
+		return false;
 
 	// Ensure mock-devices which are not assigned to any addresses any more
 	// (they have been converted to "real" devices), are removed at this point
@@ -1562,7 +1742,7 @@ void parse_neighbor_cache(sqlite3* db)
 	{
 		logg("Database error in mock-device cleaning statement");
 		checkFTLDBrc(rc);
-		return;
+		return false;
 	}
 
 	// Actually update the database
@@ -1575,15 +1755,33 @@ void parse_neighbor_cache(sqlite3* db)
 
 		logg("%s: Storing devices in network table failed: %s", text, sqlite3_errstr(rc));
 		checkFTLDBrc(rc);
-		return;
+		return false;
 	}
 
 	// Debug logging
 	if(config.debug & DEBUG_ARP)
 	{
-		logg("ARP table processing (%i entries from ARP, %i from FTL's cache) took %.1f ms",
-		     entries, additional_entries, timer_elapsed_msec(ARP_TIMER));
+		logg("ARP table processing (%i entries from ARP, %i from FTL's cache, %i unchanged) took %.1f ms",
+		     entries, additional_entries, unchanged, timer_elapsed_msec(ARP_TIMER));
 	}
+
+	return true;
+}
+
+// Parse kernel's neighbor cache
+void parse_neighbor_cache(sqlite3* db)
+{
+	const time_t now = time(NULL);
+
+	// Only write what changed since the last successful run. If anything
+	// went wrong, the transaction was not committed and the next run has
+	// to store all devices again
+	if(update_network_table(db, now))
+		finish_netDB_run(db, now);
+	else
+		reset_netDB_cache();
+
+	finalize_netDB_stmts();
 }
 
 // Loop over all entries in network table and unify entries by their hwaddr
@@ -1664,83 +1862,205 @@ bool unify_hwaddr(sqlite3 *db)
 	return true;
 }
 
-static char * __attribute__ ((malloc)) getMACVendor(const char *hwaddr)
+// In-memory copy of the MAC vendor database. Vendors are identified by the
+// first three octets of the hardware address (OUI), the array is sorted by
+// this prefix so lookups are a binary search
+typedef struct {
+	uint32_t oui;
+	uint32_t vendor;
+} macvendor_entry;
+
+static struct {
+	macvendor_entry *entries;
+	unsigned int count;
+	// All vendor strings, zero-terminated one after another
+	char *strings;
+	size_t strings_len;
+	// Identity of the file we loaded, used to detect updates
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	bool loaded;
+} macvendors = { NULL, 0u, NULL, 0u, 0, 0, 0, 0, false };
+
+// Parse "XX:YY:ZZ..." into the 24 bit OUI, returns false for anything else
+static bool parse_oui(const char *hwaddr, uint32_t *oui)
 {
-	// Special handling for the loopback interface
-	if(strcmp(hwaddr, "00:00:00:00:00:00") == 0)
-			return strdup("virtual interface");
+	unsigned int o[3];
+	if(sscanf(hwaddr, "%2x:%2x:%2x", &o[0], &o[1], &o[2]) != 3)
+		return false;
+	*oui = (o[0] << 16) | (o[1] << 8) | o[2];
+	return true;
+}
 
-	struct stat st;
-	if(stat(FTLfiles.macvendor_db, &st) != 0)
-	{
-		// File does not exist
-		if(config.debug & DEBUG_ARP)
-			logg("getMACVenor(\"%s\"): %s does not exist", hwaddr, FTLfiles.macvendor_db);
-		return strdup("");
-	}
-	else if(strlen(hwaddr) != 17 || strstr(hwaddr, "ip-") != NULL)
-	{
-		// MAC address is incomplete or mock address (for distant clients)
-		if(config.debug & DEBUG_ARP)
-			logg("getMACVenor(\"%s\"): MAC invalid (length %zu)", hwaddr, strlen(hwaddr));
-		return strdup("");
-	}
+static int macvendor_cmp(const void *a, const void *b)
+{
+	const macvendor_entry *ea = a, *eb = b;
+	if(ea->oui == eb->oui)
+		return 0;
+	return ea->oui < eb->oui ? -1 : 1;
+}
+
+static void free_macvendors(void)
+{
+	if(macvendors.entries != NULL)
+		free(macvendors.entries);
+	if(macvendors.strings != NULL)
+		free(macvendors.strings);
+	macvendors.entries = NULL;
+	macvendors.strings = NULL;
+	macvendors.count = 0u;
+	macvendors.strings_len = 0u;
+	macvendors.loaded = false;
+}
+
+// Read the entire MAC vendor database into memory
+static bool load_macvendors(const struct stat *st)
+{
+	free_macvendors();
+
+	// Remember the file identity even if loading fails below, this
+	// prevents retrying (and logging) over and over again
+	macvendors.dev = st->st_dev;
+	macvendors.ino = st->st_ino;
+	macvendors.mtime = st->st_mtime;
+	macvendors.size = st->st_size;
+	macvendors.loaded = true;
+
+	if(config.debug & DEBUG_ARP)
+		timer_start(MACVENDOR_TIMER);
 
 	sqlite3 *macvendor_db = NULL;
 	int rc = sqlite3_open_v2(FTLfiles.macvendor_db, &macvendor_db, SQLITE_OPEN_READONLY, NULL);
 	if(rc != SQLITE_OK)
 	{
-		logg("getMACVendor(\"%s\") - SQL error: %s", hwaddr, sqlite3_errstr(rc));
+		logg("load_macvendors() - SQL error: %s", sqlite3_errstr(rc));
 		sqlite3_close(macvendor_db);
-		return strdup("");
+		return false;
 	}
 
-	// Only keep "XX:YY:ZZ" (8 characters)
-	char hwaddrshort[9];
-	strncpy(hwaddrshort, hwaddr, 8);
-	hwaddrshort[8] = '\0';
-	const char querystr[] = "SELECT vendor FROM macvendor WHERE mac LIKE ?;";
-
+	const char querystr[] = "SELECT mac,vendor FROM macvendor;";
 	sqlite3_stmt *stmt = NULL;
 	rc = sqlite3_prepare_v2(macvendor_db, querystr, -1, &stmt, NULL);
 	if(rc != SQLITE_OK)
 	{
-		logg("getMACVendor(\"%s\") - SQL error prepare \"%s\": %s", hwaddr, querystr, sqlite3_errstr(rc));
+		logg("load_macvendors() - SQL error prepare \"%s\": %s", querystr, sqlite3_errstr(rc));
 		sqlite3_close(macvendor_db);
-		return strdup("");
+		return false;
 	}
 
-	// Bind hwaddrshort to prepared statement
-	if((rc = sqlite3_bind_text(stmt, 1, hwaddrshort, -1, SQLITE_STATIC)) != SQLITE_OK)
+	unsigned int capacity = 0u;
+	size_t strings_capacity = 0u;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
 	{
-		logg("getMACVendor(\"%s\" -> \"%s\"): Failed to bind hwaddrshort: %s",
-		     hwaddr, hwaddrshort, sqlite3_errstr(rc));
-		sqlite3_reset(stmt);
-		sqlite3_finalize(stmt);
-		sqlite3_close(macvendor_db);
-		return strdup("");
+		const char *mac = (const char*)sqlite3_column_text(stmt, 0);
+		const char *vendor = (const char*)sqlite3_column_text(stmt, 1);
+		uint32_t oui = 0;
+		if(mac == NULL || vendor == NULL || !parse_oui(mac, &oui))
+			continue;
+
+		// Grow arrays exponentially
+		if(macvendors.count >= capacity)
+		{
+			capacity = capacity > 0 ? 2*capacity : 4096u;
+			macvendor_entry *entries = realloc(macvendors.entries, capacity*sizeof(macvendor_entry));
+			if(entries == NULL)
+				break;
+			macvendors.entries = entries;
+		}
+		const size_t len = strlen(vendor) + 1u;
+		if(macvendors.strings_len + len > strings_capacity)
+		{
+			strings_capacity = MAX(2*strings_capacity, macvendors.strings_len + len + 65536u);
+			char *strings = realloc(macvendors.strings, strings_capacity);
+			if(strings == NULL)
+				break;
+			macvendors.strings = strings;
+		}
+
+		macvendors.entries[macvendors.count].oui = oui;
+		macvendors.entries[macvendors.count].vendor = macvendors.strings_len;
+		memcpy(macvendors.strings + macvendors.strings_len, vendor, len);
+		macvendors.strings_len += len;
+		macvendors.count++;
 	}
 
-	char *vendor = NULL;
-	rc = sqlite3_step(stmt);
-	if(rc == SQLITE_ROW)
+	if(rc != SQLITE_DONE)
+		logg("load_macvendors() - SQL error step: %s", sqlite3_errstr(rc));
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(macvendor_db);
+
+	if(rc != SQLITE_DONE)
 	{
-		vendor = strdup((char*)sqlite3_column_text(stmt, 0));
+		free_macvendors();
+		macvendors.loaded = true;
+		return false;
 	}
-	else
+
+	qsort(macvendors.entries, macvendors.count, sizeof(macvendor_entry), macvendor_cmp);
+
+	if(config.debug & DEBUG_ARP)
+		logg("Loaded %u MAC vendors (%zu bytes) in %.1f ms", macvendors.count,
+		     macvendors.count*sizeof(macvendor_entry) + macvendors.strings_len,
+		     timer_elapsed_msec(MACVENDOR_TIMER));
+
+	return true;
+}
+
+// Make sure the in-memory vendor table reflects the current file. Returns
+// false if there is no MAC vendor database
+static bool check_macvendors(void)
+{
+	struct stat st;
+	if(stat(FTLfiles.macvendor_db, &st) != 0)
 	{
-		// Not found
-		vendor = strdup("");
+		// File does not exist (anymore)
+		if(macvendors.loaded)
+			free_macvendors();
+		return false;
 	}
 
-	if(rc != SQLITE_DONE && rc != SQLITE_ROW)
+	// (Re-)load if the file has been replaced or modified
+	if(!macvendors.loaded || st.st_dev != macvendors.dev || st.st_ino != macvendors.ino ||
+	   st.st_mtime != macvendors.mtime || st.st_size != macvendors.size)
+		load_macvendors(&st);
+
+	return true;
+}
+
+// Get vendor of a hardware address. This function is only called from the
+// database thread so the vendor table is not protected by a lock
+static char * __attribute__ ((malloc)) getMACVendor(const char *hwaddr)
+{
+	// Special handling for the loopback interface
+	if(strcmp(hwaddr, "00:00:00:00:00:00") == 0)
+			return strdup("virtual interface");
+
+	uint32_t oui = 0;
+	if(!check_macvendors())
 	{
-		// Error
-		logg("getMACVendor(\"%s\") - SQL error step: %s", hwaddr, sqlite3_errstr(rc));
+		// File does not exist
+		if(config.debug & DEBUG_ARP)
+			logg("getMACVenor(\"%s\"): %s does not exist", hwaddr, FTLfiles.macvendor_db);
+		return strdup("");
+	}
+	else if(strlen(hwaddr) != 17 || strstr(hwaddr, "ip-") != NULL || !parse_oui(hwaddr, &oui))
+	{
+		// MAC address is incomplete or mock address (for distant clients)
+		if(config.debug & DEBUG_ARP)
+			logg("getMACVenor(\"%s\"): MAC invalid (length %zu)", hwaddr, strlen(hwaddr));
+		return strdup("");
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(macvendor_db);
+	const macvendor_entry key = { oui, 0 };
+	const macvendor_entry *entry = NULL;
+	if(macvendors.count > 0)
+		entry = bsearch(&key, macvendors.entries, macvendors.count, sizeof(macvendor_entry), macvendor_cmp);
+
+	// Not found -> empty string
+	char *vendor = strdup(entry != NULL ? macvendors.strings + entry->vendor : "");
 
 	if(config.debug & DEBUG_DATABASE)
 		logg("DEBUG: MAC Vendor lookup for %s returned \"%s\"", hwaddr, vendor);
@@ -1754,8 +2074,7 @@ void updateMACVendorRecords(sqlite3 *db)
 	if(FTLDBerror())
 		return;
 
-	struct stat st;
-	if(stat(FTLfiles.macvendor_db, &st) != 0)
+	if(!check_macvendors())
 	{
 		// File does not exist
 		if(config.debug & DEBUG_ARP)
@@ -1763,8 +2082,8 @@ void updateMACVendorRecords(sqlite3 *db)
 		return;
 	}
 
-	sqlite3_stmt *stmt = NULL;
-	const char *selectstr = "SELECT id,hwaddr FROM network;";
+	sqlite3_stmt *stmt = NULL, *update_stmt = NULL;
+	const char *selectstr = "SELECT id,hwaddr,macVendor FROM network;";
 	int rc = sqlite3_prepare_v2(db, selectstr, -1, &stmt, NULL);
 	if(rc != SQLITE_OK)
 	{
@@ -1773,51 +2092,77 @@ void updateMACVendorRecords(sqlite3 *db)
 		return;
 	}
 
+	const char *updatestr = "UPDATE network SET macVendor = ?1 WHERE id = ?2;";
+	rc = sqlite3_prepare_v2(db, updatestr, -1, &update_stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("updateMACVendorRecords() - SQL error prepare \"%s\": %s", updatestr, sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		sqlite3_finalize(stmt);
+		return;
+	}
+
+	// Collect all updates in one transaction
+	if(dbquery(db, "BEGIN TRANSACTION") != SQLITE_OK)
+	{
+		sqlite3_finalize(stmt);
+		sqlite3_finalize(update_stmt);
+		return;
+	}
+
+	unsigned int updated = 0u;
 	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
 	{
 		const int id = sqlite3_column_int(stmt, 0);
-		char *hwaddr = strdup((char*)sqlite3_column_text(stmt, 1));
+		const char *hwaddr = (const char*)sqlite3_column_text(stmt, 1);
+		const char *oldvendor = (const char*)sqlite3_column_text(stmt, 2);
+		if(hwaddr == NULL)
+			continue;
 
 		// Get vendor for MAC
 		char *vendor = getMACVendor(hwaddr);
-		free(hwaddr);
-		hwaddr = NULL;
 
-		// Prepare UPDATE statement
-		char *updatestr = NULL;
-		if(asprintf(&updatestr, "UPDATE network SET macVendor = \'%s\' WHERE id = %i", vendor, id) < 1)
+		// Skip devices whose vendor did not change
+		if(oldvendor != NULL && strcmp(vendor, oldvendor) == 0)
 		{
-			logg("updateMACVendorRecords() - Allocation error");
 			free(vendor);
-			break;
+			continue;
 		}
 
-		// Execute prepared statement
-		char *zErrMsg = NULL;
-		rc = sqlite3_exec(db, updatestr, NULL, NULL, &zErrMsg);
-		if(rc != SQLITE_OK)
+		if((rc = sqlite3_bind_text(update_stmt, 1, vendor, -1, SQLITE_STATIC)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_int(update_stmt, 2, id)) != SQLITE_OK ||
+		   (rc = sqlite3_step(update_stmt)) != SQLITE_DONE)
 		{
-			logg("updateMACVendorRecords() - SQL exec error: \"%s\": %s", updatestr, zErrMsg);
+			logg("updateMACVendorRecords() - SQL error \"%s\": %s", updatestr, sqlite3_errstr(rc));
 			checkFTLDBrc(rc);
-			sqlite3_free(zErrMsg);
-			free(updatestr);
 			free(vendor);
 			break;
 		}
+		sqlite3_reset(update_stmt);
+		sqlite3_clear_bindings(update_stmt);
+		updated++;
 
 		// Free allocated memory
-		free(updatestr);
 		free(vendor);
 	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(update_stmt);
+
 	if(rc != SQLITE_DONE)
 	{
 		// Error
 		logg("updateMACVendorRecords() - SQL error step: %s", sqlite3_errstr(rc));
 		checkFTLDBrc(rc);
+		dbquery(db, "ROLLBACK TRANSACTION");
 		return;
 	}
 
-	sqlite3_finalize(stmt);
+	if(dbquery(db, "END TRANSACTION") != SQLITE_OK)
+		return;
+
+	if(config.debug & DEBUG_ARP)
+		logg("updateMACVendorRecords(): Updated vendor of %u devices", updated);
 }
 
 // Get hardware address of device identified by IP address
@@ -25,9 +25,260 @@
 #include "../config.h"
 // getstr()
 #include "../shmem.h"
+// runGC()
+#include "../gc.h"
+// update_rollup_tables()
+#include "rollup-table.h"
+// get_nprocs()
+#include <sys/sysinfo.h>
 
 static bool saving_failed_before = false;
 
+// Name of the table storing queries when partitioning is disabled
+#define QUERY_STORAGE "query_storage"
+// Maximum number of tables combined in the queries view (SQLite limits the
+// number of terms in a compound SELECT to 500)
+#define MAX_QUERY_TABLES 500
+// Buffer size for query table names (query_storage_YYYYMMDD)
+#define QUERY_TABLE_NAMELEN 24
+
+// Get name of the table storing queries with the given timestamp. Partitions
+// start at midnight (UTC), weekly partitions always start on a Monday
+static void get_query_table_name(const time_t timestamp, char name[QUERY_TABLE_NAMELEN])
+{
+	if(config.db_partitioning == PARTITION_NONE)
+	{
+		strcpy(name, QUERY_STORAGE);
+		return;
+	}
+
+	time_t start = timestamp - timestamp % 86400;
+	// 1 Jan 1970 was a Thursday
+	if(config.db_partitioning == PARTITION_WEEK)
+		start -= ((start / 86400 + 3) % 7) * 86400;
+
+	struct tm tm;
+	gmtime_r(&start, &tm);
+	strftime(name, QUERY_TABLE_NAMELEN, QUERY_STORAGE"_%Y%m%d", &tm);
+}
+
+// Get names of all tables storing queries. The unpartitioned table comes
+// first, followed by the partitions (oldest first). If there are too many
+// partitions, only the most recent ones are returned. Returns the number of
+// tables or -1 on error
+static int get_query_tables(sqlite3 *db, char tables[MAX_QUERY_TABLES][QUERY_TABLE_NAMELEN])
+{
+	strcpy(tables[0], QUERY_STORAGE);
+	int num = 1;
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT name FROM sqlite_master "
+	                                "WHERE type = 'table' AND name GLOB '"QUERY_STORAGE"_[0-9]*' "
+	                                "ORDER BY name DESC;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("get_query_tables() - SQL error prepare: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		return -1;
+	}
+
+	// Partitions are read newest first so the oldest ones are skipped
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW && num < MAX_QUERY_TABLES)
+	{
+		const char *name = (const char *)sqlite3_column_text(stmt, 0);
+		if(name != NULL && strlen(name) < QUERY_TABLE_NAMELEN)
+			strcpy(tables[num++], name);
+	}
+
+	if(rc == SQLITE_ROW)
+		logg("WARNING: More than %i query partitions in the database, ignoring the oldest ones", MAX_QUERY_TABLES - 1);
+	else if(rc != SQLITE_DONE)
+	{
+		logg("get_query_tables() - SQL error step: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		num = -1;
+	}
+
+	sqlite3_finalize(stmt);
+
+	// Reverse the partitions so that the oldest one comes first
+	for(int i = 1, j = num - 1; i < j; i++, j--)
+	{
+		char tmp[QUERY_TABLE_NAMELEN];
+		strcpy(tmp, tables[i]);
+		strcpy(tables[i], tables[j]);
+		strcpy(tables[j], tmp);
+	}
+
+	return num;
+}
+
+// Get name of the oldest partition, returns false if there is none
+static bool get_oldest_query_partition(sqlite3 *db, char name[QUERY_TABLE_NAMELEN])
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT name FROM sqlite_master "
+	                                "WHERE type = 'table' AND name GLOB '"QUERY_STORAGE"_[0-9]*' "
+	                                "ORDER BY name LIMIT 1;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("get_oldest_query_partition() - SQL error prepare: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		return false;
+	}
+
+	bool found = false;
+	if((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *table = (const char *)sqlite3_column_text(stmt, 0);
+		if(table != NULL && strlen(table) < QUERY_TABLE_NAMELEN)
+		{
+			strcpy(name, table);
+			found = true;
+		}
+	}
+	else if(rc != SQLITE_DONE)
+	{
+		logg("get_oldest_query_partition() - SQL error step: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+	}
+
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+// (Re-)create the queries view combining all tables storing queries
+static bool update_queries_view(sqlite3 *db)
+{
+	char tables[MAX_QUERY_TABLES][QUERY_TABLE_NAMELEN];
+	const int num = get_query_tables(db, tables);
+	if(num < 1)
+		return false;
+
+	// Every table becomes one term of a compound SELECT so that SQLite can
+	// push conditions on the timestamp down into each of them
+	char *view = NULL;
+	for(int i = 0; i < num; i++)
+	{
+		view = sqlite3_mprintf("%z%s"
+		                       "SELECT id, timestamp, type, status, "
+		                         "CASE typeof(domain) WHEN 'integer' THEN (SELECT domain FROM domain_by_id d WHERE d.id = q.domain) ELSE domain END domain,"
+		                         "CASE typeof(client) WHEN 'integer' THEN (SELECT ip FROM client_by_id c WHERE c.id = q.client) ELSE client END client,"
+		                         "CASE typeof(forward) WHEN 'integer' THEN (SELECT forward FROM forward_by_id f WHERE f.id = q.forward) ELSE forward END forward,"
+		                         "CASE typeof(additional_info) WHEN 'integer' THEN (SELECT content FROM addinfo_by_id a WHERE a.id = q.additional_info) ELSE additional_info END additional_info, "
+		                         "reply_type, reply_time, dnssec "
+		                         "FROM %s q",
+		                       view, i > 0 ? " UNION ALL " : "", tables[i]);
+		if(view == NULL)
+		{
+			logg("update_queries_view(): Memory allocation failed");
+			return false;
+		}
+	}
+
+	const bool okay = dbquery(db, "DROP VIEW IF EXISTS queries") == SQLITE_OK &&
+	                  dbquery(db, "CREATE VIEW queries AS %s", view) == SQLITE_OK;
+	sqlite3_free(view);
+
+	return okay;
+}
+
+// Make sure the table for storing queries exists. New partitions are created
+// and added to the queries view
+static bool ensure_query_table(sqlite3 *db, const char *name)
+{
+	if(strcmp(name, QUERY_STORAGE) == 0)
+		return true;
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = ?;",
+	                            -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("ensure_query_table(%s) - SQL error prepare: %s", name, sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		return false;
+	}
+
+	sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+	const bool exists = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+	sqlite3_finalize(stmt);
+
+	if(exists)
+		return true;
+
+	SQL_bool(db, "CREATE TABLE %s (id INTEGER PRIMARY KEY AUTOINCREMENT, timestamp INTEGER NOT NULL, type INTEGER NOT NULL, status INTEGER NOT NULL, domain INTEGER NOT NULL, client INTEGER NOT NULL, forward INTEGER, additional_info INTEGER, reply_type INTEGER, reply_time REAL, dnssec INTEGER);", name);
+	SQL_bool(db, "CREATE INDEX %s_timestamp ON %s (timestamp);", name, name);
+
+	if(config.debug & DEBUG_DATABASE)
+		logg("Created new query partition %s", name);
+
+	return update_queries_view(db);
+}
+
+// Drop the oldest partition if it holds only queries older than <timestamp>.
+// The partition new queries are stored in is never dropped. Returns true if a
+// partition has been dropped
+static bool drop_old_partition(sqlite3 *db, const int timestamp)
+{
+	// The oldest partition may not be part of the queries view if there
+	// are too many partitions, so it is looked up separately
+	char oldest[QUERY_TABLE_NAMELEN];
+	if(!get_oldest_query_partition(db, oldest))
+		return false;
+
+	char current[QUERY_TABLE_NAMELEN];
+	get_query_table_name(time(NULL), current);
+	if(strcmp(oldest, current) == 0)
+		return false;
+
+	char *querystr = sqlite3_mprintf("SELECT IFNULL(MAX(timestamp),0) FROM %s;", oldest);
+	if(querystr == NULL)
+		return false;
+	const int newest = db_query_int(db, querystr);
+	sqlite3_free(querystr);
+
+	if(newest < 0 || newest > timestamp)
+		return false;
+
+	if(dbquery(db, "BEGIN TRANSACTION IMMEDIATE") != SQLITE_OK)
+		return false;
+
+	if(dbquery(db, "DROP TABLE %s;", oldest) != SQLITE_OK || !update_queries_view(db))
+	{
+		logg("drop_old_partition(): Dropping partition %s failed!", oldest);
+		dbquery(db, "ROLLBACK");
+		return false;
+	}
+
+	if(dbquery(db, "COMMIT") != SQLITE_OK)
+		return false;
+
+	logg("Notice: Database size is %.2f MB, dropped partition %s", 1e-6*get_FTL_db_filesize(), oldest);
+	return true;
+}
+
+// Prepare statement for storing queries in the given table
+static int prepare_query_stmt(sqlite3 *db, const char *table, sqlite3_stmt **stmt)
+{
+	char *querystr = sqlite3_mprintf("INSERT INTO %s "
+	                                 "(id,timestamp,type,status,domain,client,forward,additional_info,reply_type,reply_time,dnssec) "
+	                                 "VALUES "
+	                                 "(?13,?1,?2,?3,"
+	                                 "(SELECT id FROM domain_by_id WHERE domain = ?4),"
+	                                 "(SELECT id FROM client_by_id WHERE ip = ?5 AND name = ?6),"
+	                                 "(SELECT id FROM forward_by_id WHERE forward = ?7),"
+	                                 "(SELECT id FROM addinfo_by_id WHERE type = ?8 AND content = ?9),"
+	                                 "?10,?11,?12)", table);
+	if(querystr == NULL)
+		return SQLITE_NOMEM;
+
+	const int rc = sqlite3_prepare_v3(db, querystr, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+	sqlite3_free(querystr);
+
+	return rc;
+}
+
 int get_number_of_queries_in_DB(sqlite3 *db)
 {
 	// Return early if database is known to be broken
@@ -49,7 +300,21 @@ int get_number_of_queries_in_DB(sqlite3 *db)
 	}
 
 	// Count number of rows using the index timestamp is faster than select(*)
-	int result = db_query_int(db, "SELECT COUNT(timestamp) FROM query_storage");
+	char tables[MAX_QUERY_TABLES][QUERY_TABLE_NAMELEN];
+	const int num = get_query_tables(db, tables);
+	int result = num > 0 ? 0 : DB_FAILED;
+	for(int i = 0; i < num; i++)
+	{
+		char *querystr = sqlite3_mprintf("SELECT COUNT(timestamp) FROM %s", tables[i]);
+		const int count = querystr != NULL ? db_query_int(db, querystr) : DB_FAILED;
+		sqlite3_free(querystr);
+		if(count < 0)
+		{
+			result = DB_FAILED;
+			break;
+		}
+		result += count;
+	}
 
 	if(db_opened) dbclose(&db);
 
@@ -105,16 +370,10 @@ int DB_save_queries(sqlite3 *db)
 	}
 
 	// Prepare statements
-	rc  = sqlite3_prepare_v3(db, "INSERT INTO query_storage "
-	                                 "(timestamp,type,status,domain,client,forward,additional_info,reply_type,reply_time,dnssec) "
-	                                 "VALUES "
-	                                 "(?1,?2,?3,"
-	                                 "(SELECT id FROM domain_by_id WHERE domain = ?4),"
-	                                 "(SELECT id FROM client_by_id WHERE ip = ?5 AND name = ?6),"
-	                                 "(SELECT id FROM forward_by_id WHERE forward = ?7),"
-	                                 "(SELECT id FROM addinfo_by_id WHERE type = ?8 AND content = ?9),"
-	                                 "?10,?11,?12)",
-	                         -1, SQLITE_PREPARE_PERSISTENT, &query_stmt, NULL);
+	// Queries are stored in the table (partition) covering their timestamp
+	char table[QUERY_TABLE_NAMELEN];
+	get_query_table_name(time(NULL), table);
+	rc = ensure_query_table(db, table) ? prepare_query_stmt(db, table, &query_stmt) : SQLITE_ERROR;
 	if( rc != SQLITE_OK )
 	{
 		const char *text, *spaces;
@@ -243,8 +502,28 @@ int DB_save_queries(sqlite3 *db)
 		return DB_FAILED;
 	}
 
-	// Get last ID stored in the database
+	// Get last ID stored in the database. IDs have to be assigned
+	// explicitly to stay unique across partitions, so we cannot store
+	// anything without knowing it
 	long int lastID = get_max_query_ID(db);
+	if(lastID < 0)
+	{
+		logg("WARNING: Storing queries in long-term database failed: Unable to get last ID");
+		logg("         Keeping queries in memory for later new attempt");
+		saving_failed_before = true;
+
+		sqlite3_finalize(query_stmt);
+		sqlite3_finalize(domain_stmt);
+		sqlite3_finalize(client_stmt);
+		sqlite3_finalize(forward_stmt);
+		sqlite3_finalize(addinfo_stmt);
+		dbquery(db, "ROLLBACK");
+
+		if(db_opened) dbclose(&db);
+
+		return DB_FAILED;
+	}
+	const long int firstID = lastID;
 
 	int total = 0, blocked = 0;
 	time_t currenttimestamp = time(NULL);
@@ -279,6 +558,27 @@ int DB_save_queries(sqlite3 *db)
 			continue;
 		}
 
+		// Switch to another partition if needed
+		char name[QUERY_TABLE_NAMELEN];
+		get_query_table_name(query->timestamp, name);
+		if(strcmp(name, table) != 0)
+		{
+			sqlite3_finalize(query_stmt);
+			query_stmt = NULL;
+			strcpy(table, name);
+			if(!ensure_query_table(db, table) ||
+			   prepare_query_stmt(db, table, &query_stmt) != SQLITE_OK)
+			{
+				logg("Encountered error while trying to store queries in table %s", table);
+				error = true;
+				break;
+			}
+		}
+
+		// ID
+		// IDs are assigned explicitly to keep them unique across partitions
+		sqlite3_bind_int64(query_stmt, 13, lastID + 1);
+
 		// TIMESTAMP
 		sqlite3_bind_int(query_stmt, 1, query->timestamp);
 
@@ -487,6 +787,9 @@ int DB_save_queries(sqlite3 *db)
 		lastdbindex = queryID;
 		db_set_FTL_property(db, DB_LASTTIMESTAMP, newlasttimestamp);
 		db_update_counters(db, total, blocked);
+
+		// Add the new queries to the hourly and daily statistics
+		update_rollup_tables(db, firstID, lastID);
 	}
 
 	// Finish prepared statement
@@ -522,26 +825,163 @@ int DB_save_queries(sqlite3 *db)
 	return saved;
 }
 
-void delete_old_queries_in_DB(sqlite3 *db)
+// Number of rowids covered by one DELETE statement when removing old queries
+#define DELETE_CHUNK_SIZE 10000
+
+// State of the currently running deletion of old queries. Rows are deleted
+// in chunks of consecutive rowids so that every single transaction stays small.
+// Only the database thread accesses this
+static struct {
+	bool running;
+	int timestamp;
+	sqlite3_int64 first;
+	sqlite3_int64 next;
+	sqlite3_int64 last;
+	int deleted;
+} old_queries = { false, 0, 0, 0, 0, 0 };
+
+// Copy of the progress for other threads (e.g., the API), updated by the
+// database thread after every chunk
+static struct {
+	double percent;
+	int deleted;
+} old_queries_progress = { -1.0, 0 };
+static pthread_mutex_t old_queries_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Get the range of rowids that may contain queries older than <timestamp>
+// Returns false if there is nothing to delete or on error
+static bool get_old_queries_range(sqlite3 *db, const int timestamp)
+{
+	// The rowid of the most recent old query is found using the timestamp
+	// index, the oldest one is the smallest rowid in the table
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT (SELECT MIN(id) FROM query_storage),"
+	                                       "(SELECT id FROM query_storage WHERE timestamp <= ? ORDER BY timestamp DESC LIMIT 1);",
+	                            -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("get_old_queries_range() - SQL error prepare: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		return false;
+	}
+
+	bool found = false;
+	if((rc = sqlite3_bind_int(stmt, 1, timestamp)) != SQLITE_OK)
+	{
+		logg("get_old_queries_range() - Failed to bind timestamp: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+	}
+	else if((rc = sqlite3_step(stmt)) != SQLITE_ROW)
+	{
+		logg("get_old_queries_range() - SQL error step: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+	}
+	else if(sqlite3_column_type(stmt, 1) != SQLITE_NULL)
+	{
+		old_queries.first = sqlite3_column_int64(stmt, 0);
+		old_queries.last = sqlite3_column_int64(stmt, 1);
+		found = old_queries.first <= old_queries.last;
+	}
+
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+// Delete one chunk of old queries, see delete_old_queries_in_DB()
+static bool delete_old_queries_chunk(sqlite3 *db)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
-		return;
+		return true;
+
+	// Start a new pass if there is none in progress
+	if(!old_queries.running)
+	{
+		old_queries.timestamp = time(NULL) - config.maxDBdays * 86400;
+
+		// Drop entire partitions first (one per call)
+		if(drop_old_partition(db, old_queries.timestamp))
+			return false;
+
+		// Delete remaining old queries from the unpartitioned table
+		old_queries.deleted = 0;
+		if(!get_old_queries_range(db, old_queries.timestamp))
+		{
+			if(config.debug & DEBUG_DATABASE)
+				logg("delete_old_queries_in_DB(): No queries older than %i in database",
+				     old_queries.timestamp);
+			delete_old_rollups(db, old_queries.timestamp);
+			return true;
+		}
+		old_queries.next = old_queries.first;
+		old_queries.running = true;
 
-	int timestamp = time(NULL) - config.maxDBdays * 86400;
+		if(config.debug & DEBUG_DATABASE)
+			logg("delete_old_queries_in_DB(): Deleting queries older than %i in rowid range [%lli,%lli]",
+			     old_queries.timestamp, (long long)old_queries.first, (long long)old_queries.last);
+	}
 
-	if(dbquery(db, "DELETE FROM query_storage WHERE timestamp <= %i", timestamp) != SQLITE_OK)
+	if(dbquery(db, "DELETE FROM "QUERY_STORAGE" WHERE id >= %lli AND id < %lli AND timestamp <= %i",
+	           (long long)old_queries.next, (long long)(old_queries.next + DELETE_CHUNK_SIZE),
+	           old_queries.timestamp) != SQLITE_OK)
 	{
 		logg("delete_old_queries_in_DB(): Deleting queries due to age of entries failed!");
-		return;
+		old_queries.running = false;
+		return true;
 	}
 
 	// Get how many rows have been affected (deleted)
-	const int affected = sqlite3_changes(db);
+	old_queries.deleted += sqlite3_changes(db);
+	old_queries.next += DELETE_CHUNK_SIZE;
+
+	if(old_queries.next <= old_queries.last)
+		return false;
+
+	old_queries.running = false;
+
+	// Statistics are kept for as long as the queries they are based on
+	delete_old_rollups(db, old_queries.timestamp);
 
 	// Print final message only if there is a difference
-	if((config.debug & DEBUG_DATABASE) || affected)
-		logg("Notice: Database size is %.2f MB, deleted %i rows", 1e-6*get_FTL_db_filesize(), affected);
+	if((config.debug & DEBUG_DATABASE) || old_queries.deleted)
+		logg("Notice: Database size is %.2f MB, deleted %i rows", 1e-6*get_FTL_db_filesize(), old_queries.deleted);
+
+	return true;
+}
+
+// Delete queries older than maxDBdays from the long-term database. Only one
+// chunk of at most DELETE_CHUNK_SIZE rowids is deleted per call so the
+// database thread can store new queries in between. Returns true when all
+// old queries have been deleted (or on error)
+bool delete_old_queries_in_DB(sqlite3 *db)
+{
+	const bool done = delete_old_queries_chunk(db);
+
+	pthread_mutex_lock(&old_queries_progress_lock);
+	if(old_queries.running)
+	{
+		const sqlite3_int64 total = old_queries.last - old_queries.first + 1;
+		old_queries_progress.percent = 100.0*(old_queries.next - old_queries.first)/total;
+		old_queries_progress.deleted = old_queries.deleted;
+	}
+	else
+		old_queries_progress.percent = -1.0;
+	pthread_mutex_unlock(&old_queries_progress_lock);
+
+	return done;
+}
+
+// Get progress of the deletion of old queries in percent
+// Returns -1 if no deletion is currently in progress
+double get_delete_old_queries_progress(int *deleted)
+{
+	pthread_mutex_lock(&old_queries_progress_lock);
+	const double percent = old_queries_progress.percent;
+	if(deleted != NULL)
+		*deleted = old_queries_progress.deleted;
+	pthread_mutex_unlock(&old_queries_progress_lock);
+
+	return percent;
 }
 
 bool add_additional_info_column(sqlite3 *db)
@@ -684,7 +1124,517 @@ bool create_addinfo_table(sqlite3 *db)
 	return true;
 }
 
+// Number of rows handed to an import worker at once
+#define IMPORT_BATCH_SIZE 4096
+// Maximum number of threads resolving strings during the history import
+#define IMPORT_MAX_WORKERS 8
+// Marker for unset string references in import rows
+#define IMPORT_NONE UINT32_MAX
+
+// A string seen during the history import together with the number of
+// queries referencing it and the ID it has been assigned in shared memory
+typedef struct {
+	char *str;
+	uint32_t hash;
+	unsigned int count;
+	int id;
+} import_entry;
+
+// Hash map of strings seen during the history import (open addressing with
+// linear probing). Slots store the entry index + 1, zero marks a free slot
+typedef struct {
+	import_entry *entries;
+	unsigned int num;
+	unsigned int size;
+	unsigned int *slots;
+	unsigned int nslots;
+} import_map;
+
+// A validated row of the query table. The string references are offsets into
+// the batch's string arena until a worker replaced them by the indices of the
+// corresponding entries in its private maps
+typedef struct {
+	time_t timestamp;
+	double reply_time;
+	int type;
+	int addinfo;
+	uint32_t domain;
+	uint32_t client;
+	uint32_t upstream;
+	uint32_t cname;
+	unsigned char status;
+	unsigned char reply;
+	unsigned char dnssec;
+	bool reply_time_avail;
+	bool has_addinfo;
+} import_row;
+
+typedef struct import_batch {
+	struct import_batch *next;
+	import_row rows[IMPORT_BATCH_SIZE];
+	unsigned int num;
+	unsigned int worker;
+	char *arena;
+	size_t arena_len;
+	size_t arena_size;
+} import_batch;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	import_batch *head;
+	import_batch *tail;
+	bool done;
+} import_queue;
+
+typedef struct {
+	pthread_t thread;
+	import_queue *queue;
+	unsigned int id;
+	bool failed;
+	import_map domains;
+	import_map clients;
+	import_map upstreams;
+} import_worker;
+
+// Add a string to an import map (or add to the count of an existing entry)
+// Returns the index of the entry or IMPORT_NONE on memory errors
+static uint32_t import_map_add(import_map *map, const char *str, const unsigned int count)
+{
+	// Keep the load factor below 50%
+	if(2*(map->num + 1) > map->nslots)
+	{
+		const unsigned int nslots = map->nslots > 0 ? 2*map->nslots : 1024;
+		unsigned int *slots = calloc(nslots, sizeof(*slots));
+		if(slots == NULL)
+			return IMPORT_NONE;
+
+		// Rehash existing entries
+		for(unsigned int i = 0; i < map->num; i++)
+		{
+			unsigned int j = map->entries[i].hash & (nslots - 1);
+			while(slots[j] != 0)
+				j = (j + 1) & (nslots - 1);
+			slots[j] = i + 1;
+		}
+
+		if(map->slots != NULL)
+			free(map->slots);
+		map->slots = slots;
+		map->nslots = nslots;
+	}
+
+	const uint32_t hash = hashStr(str);
+	unsigned int i = hash & (map->nslots - 1);
+	while(map->slots[i] != 0)
+	{
+		import_entry *entry = &map->entries[map->slots[i] - 1];
+		if(entry->hash == hash && strcmp(entry->str, str) == 0)
+		{
+			entry->count += count;
+			return map->slots[i] - 1;
+		}
+		i = (i + 1) & (map->nslots - 1);
+	}
+
+	// This is a new string
+	if(map->num == map->size)
+	{
+		const unsigned int size = map->size > 0 ? 2*map->size : 1024;
+		import_entry *entries = realloc(map->entries, size*sizeof(*entries));
+		if(entries == NULL)
+			return IMPORT_NONE;
+		map->entries = entries;
+		map->size = size;
+	}
+
+	import_entry *entry = &map->entries[map->num];
+	if((entry->str = strdup(str)) == NULL)
+		return IMPORT_NONE;
+	entry->hash = hash;
+	entry->count = count;
+	entry->id = -1;
+	map->slots[i] = ++map->num;
+
+	return map->num - 1;
+}
+
+static void import_map_free(import_map *map)
+{
+	for(unsigned int i = 0; i < map->num; i++)
+		free(map->entries[i].str);
+	if(map->entries != NULL)
+		free(map->entries);
+	if(map->slots != NULL)
+		free(map->slots);
+	memset(map, 0, sizeof(*map));
+}
+
+// Merge the private maps of all workers into one map. The index of the merged
+// entry is stored in the id field of the worker's entries
+static bool import_merge_maps(import_map *global, import_map *const maps[], const unsigned int nmaps)
+{
+	for(unsigned int m = 0; m < nmaps; m++)
+	{
+		for(unsigned int i = 0; i < maps[m]->num; i++)
+		{
+			import_entry *entry = &maps[m]->entries[i];
+			const uint32_t idx = import_map_add(global, entry->str, entry->count);
+			if(idx == IMPORT_NONE)
+				return false;
+			entry->id = idx;
+		}
+	}
+	return true;
+}
+
+// Copy a string into the batch's string arena and return its offset
+static uint32_t import_batch_addstr(import_batch *batch, const char *str)
+{
+	const size_t len = strlen(str) + 1;
+	if(batch->arena_len + len > batch->arena_size)
+	{
+		const size_t size = MAX(2*batch->arena_size, batch->arena_len + len + 65536u);
+		char *arena = realloc(batch->arena, size);
+		if(arena == NULL)
+			return IMPORT_NONE;
+		batch->arena = arena;
+		batch->arena_size = size;
+	}
+
+	memcpy(batch->arena + batch->arena_len, str, len);
+	batch->arena_len += len;
+
+	return batch->arena_len - len;
+}
+
+// Resolve the strings of all rows in this batch into the worker's private maps
+static bool import_resolve_batch(import_batch *batch, import_worker *worker)
+{
+	for(unsigned int i = 0; i < batch->num; i++)
+	{
+		import_row *row = &batch->rows[i];
+		row->domain = import_map_add(&worker->domains, batch->arena + row->domain, 1);
+		row->client = import_map_add(&worker->clients, batch->arena + row->client, 1);
+		if(row->domain == IMPORT_NONE || row->client == IMPORT_NONE)
+			return false;
+
+		if(row->upstream != IMPORT_NONE &&
+		   (row->upstream = import_map_add(&worker->upstreams, batch->arena + row->upstream, 1)) == IMPORT_NONE)
+			return false;
+
+		// Domains only seen during CNAME inspection are not counted
+		if(row->cname != IMPORT_NONE &&
+		   (row->cname = import_map_add(&worker->domains, batch->arena + row->cname, 0)) == IMPORT_NONE)
+			return false;
+	}
+
+	// Strings are not needed any longer
+	batch->worker = worker->id;
+	free(batch->arena);
+	batch->arena = NULL;
+
+	return true;
+}
+
+static void import_queue_push(import_queue *queue, import_batch *batch)
+{
+	pthread_mutex_lock(&queue->lock);
+	if(queue->tail != NULL)
+		queue->tail->next = batch;
+	else
+		queue->head = batch;
+	queue->tail = batch;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// Get the next batch from the queue. Blocks until either a batch is
+// available or the reader is done (returns NULL in this case)
+static import_batch *import_queue_pop(import_queue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	while(queue->head == NULL && !queue->done)
+		pthread_cond_wait(&queue->cond, &queue->lock);
+
+	import_batch *batch = queue->head;
+	if(batch != NULL)
+	{
+		queue->head = batch->next;
+		if(queue->head == NULL)
+			queue->tail = NULL;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return batch;
+}
+
+static void *import_worker_thread(void *val)
+{
+	import_worker *worker = val;
+	prctl(PR_SET_NAME, "db-import", 0, 0, 0);
+
+	import_batch *batch;
+	while((batch = import_queue_pop(worker->queue)) != NULL)
+		if(!worker->failed && !import_resolve_batch(batch, worker))
+			worker->failed = true;
+
+	return NULL;
+}
+
+// Assign shared memory IDs to all strings resolved by the workers and add the
+// query counts of domains and clients in bulk. Needs to be called with the
+// SHM lock held
+static bool import_assign_IDs(import_worker workers[], const unsigned int nworkers)
+{
+	import_map *maps[IMPORT_MAX_WORKERS];
+	import_map global = { 0 };
+
+	// Domains: Seed the merged map with the domains already known to FTL
+	for(int domainID = 0; domainID < counters->domains; domainID++)
+	{
+		const domainsData *domain = getDomain(domainID, true);
+		if(domain == NULL)
+			continue;
+		const uint32_t idx = import_map_add(&global, getstr(domain->domainpos), 0);
+		if(idx == IMPORT_NONE)
+			goto import_assign_IDs_failed;
+		global.entries[idx].id = domainID;
+	}
+	for(unsigned int w = 0; w < nworkers; w++)
+		maps[w] = &workers[w].domains;
+	if(!import_merge_maps(&global, maps, nworkers))
+		goto import_assign_IDs_failed;
+	for(unsigned int i = 0; i < global.num; i++)
+	{
+		import_entry *entry = &global.entries[i];
+		if(entry->id < 0)
+		{
+			shm_ensure_size();
+			entry->id = addDomainID(entry->str, false);
+		}
+		domainsData *domain = getDomain(entry->id, true);
+		if(domain != NULL)
+			domain->count += entry->count;
+	}
+	for(unsigned int w = 0; w < nworkers; w++)
+		for(unsigned int i = 0; i < workers[w].domains.num; i++)
+			workers[w].domains.entries[i].id = global.entries[workers[w].domains.entries[i].id].id;
+	import_map_free(&global);
+
+	// Clients: Seed the merged map with the clients already known to FTL
+	for(int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		const clientsData *client = getClient(clientID, true);
+		if(client == NULL)
+			continue;
+		const uint32_t idx = import_map_add(&global, getstr(client->ippos), 0);
+		if(idx == IMPORT_NONE)
+			goto import_assign_IDs_failed;
+		global.entries[idx].id = clientID;
+	}
+	for(unsigned int w = 0; w < nworkers; w++)
+		maps[w] = &workers[w].clients;
+	if(!import_merge_maps(&global, maps, nworkers))
+		goto import_assign_IDs_failed;
+	for(unsigned int i = 0; i < global.num; i++)
+	{
+		import_entry *entry = &global.entries[i];
+		unsigned int count = entry->count;
+		if(entry->id < 0)
+		{
+			// New clients are created with a count of one
+			shm_ensure_size();
+			entry->id = addClientID(entry->str, true, false);
+			count--;
+		}
+		clientsData *client = getClient(entry->id, true);
+		if(client != NULL && count > 0)
+			change_clientcount(client, count, 0);
+	}
+	for(unsigned int w = 0; w < nworkers; w++)
+		for(unsigned int i = 0; i < workers[w].clients.num; i++)
+			workers[w].clients.entries[i].id = global.entries[workers[w].clients.entries[i].id].id;
+	import_map_free(&global);
+
+	// Upstreams: There are only a few of them, look them up directly
+	for(unsigned int w = 0; w < nworkers; w++)
+	{
+		for(unsigned int i = 0; i < workers[w].upstreams.num; i++)
+		{
+			import_entry *entry = &workers[w].upstreams.entries[i];
+
+			// Get IP address and port of upstream destination
+			char serv_addr[INET6_ADDRSTRLEN] = { 0 };
+			unsigned int serv_port = 53;
+			// We limit the number of bytes written into the serv_addr buffer
+			// to prevent buffer overflows. If there is no port available in
+			// the database, we skip extracting them and use the default port
+			sscanf(entry->str, "%"xstr(INET6_ADDRSTRLEN)"[^#]#%u", serv_addr, &serv_port);
+			serv_addr[INET6_ADDRSTRLEN-1] = '\0';
+			shm_ensure_size();
+			entry->id = findUpstreamID(serv_addr, (in_port_t)serv_port);
+		}
+	}
+
+	return true;
+
+import_assign_IDs_failed:
+	import_map_free(&global);
+	return false;
+}
+
+// Store a resolved row in shared memory. Needs to be called with the SHM lock held
+static void import_store_query(const import_row *row, const import_worker *worker)
+{
+	// Ensure we have enough shared memory available for new data
+	shm_ensure_size();
+
+	const int timeidx = getOverTimeID(row->timestamp);
+	const int domainID = worker->domains.entries[row->domain].id;
+	const int clientID = worker->clients.entries[row->client].id;
+	const int upstreamID = row->upstream != IMPORT_NONE ? worker->upstreams.entries[row->upstream].id : -1;
+	const enum query_status status = row->status;
+
+	// Set index for this query
+	const int queryIndex = counters->queries;
+
+	// Store this query in memory
+	queriesData* query = getQuery(queryIndex, false);
+	query->magic = MAGICBYTE;
+	query->timestamp = row->timestamp;
+	if(row->type < 100)
+	{
+		// Mapped query type
+		query->type = row->type;
+	}
+	else
+	{
+		// Offset query type
+		query->type = TYPE_OTHER;
+		query->qtype = row->type - 100;
+	}
+
+	// Status is set below
+	query->domainID = domainID;
+	query->clientID = clientID;
+	query->upstreamID = upstreamID;
+	query->id = 0;
+	query->response = 0;
+	query->flags.response_calculated = row->reply_time_avail;
+	query->dnssec = row->dnssec;
+	query->reply = row->reply;
+	counters->reply[query->reply]++;
+	query->response = row->reply_time * 1e4; // convert to tenth-millisecond unit
+	query->CNAME_domainID = -1;
+	// Initialize flags
+	query->flags.complete = true; // Mark as all information is available
+	query->flags.blocked = false;
+	query->flags.whitelisted = false;
+	query->flags.database = true;
+	query->ede = -1; // EDE_UNSET == -1
+
+	// Set lastQuery timer for network table
+	clientsData* client = getClient(clientID, true);
+	client->lastQuery = row->timestamp;
+
+	// Handle type counters
+	counters->querytype[query->type-1]++;
+
+	// Update overTime data
+	overTime[timeidx].total++;
+
+	// Increase DNS queries counter
+	counters->queries++;
+
+	// Get additional information from the additional_info column if applicable
+	if(row->cname != IMPORT_NONE)
+	{
+		// QUERY_*_CNAME: Set domain causing the blocking
+		query->CNAME_domainID = worker->domains.entries[row->cname].id;
+	}
+	else if(row->has_addinfo)
+	{
+		// Set ID of the domainlist entry that was the reason for permitting/blocking this query
+		const int cacheID = findCacheID(query->domainID, query->clientID, query->type, true);
+		DNSCacheData *cache = getDNSCache(cacheID, true);
+		// Only load if
+		//  a) we have a cache entry
+		if(cache != NULL)
+			cache->domainlist_id = row->addinfo;
+	}
+
+	// Increment status counters, we first have to add one to the count of
+	// unknown queries because query_set_status() will subtract from there
+	// when setting a different status
+	counters->status[QUERY_UNKNOWN]++;
+	query_set_status(query, status);
+
+	// Do further processing based on the query status we read from the database
+	switch(status)
+	{
+		case QUERY_UNKNOWN: // Unknown
+			break;
+
+		case QUERY_GRAVITY: // Blocked by gravity
+		case QUERY_REGEX: // Blocked by regex blacklist
+		case QUERY_BLACKLIST: // Blocked by exact blacklist
+		case QUERY_EXTERNAL_BLOCKED_IP: // Blocked by external provider
+		case QUERY_EXTERNAL_BLOCKED_NULL: // Blocked by external provider
+		case QUERY_EXTERNAL_BLOCKED_NXRA: // Blocked by external provider
+		case QUERY_GRAVITY_CNAME: // Blocked by gravity (inside CNAME path)
+		case QUERY_REGEX_CNAME: // Blocked by regex blacklist (inside CNAME path)
+		case QUERY_BLACKLIST_CNAME: // Blocked by exact blacklist (inside CNAME path)
+		case QUERY_DBBUSY: // Blocked because gravity database was busy
+		case QUERY_SPECIAL_DOMAIN: // Blocked by special domain handling
+			query->flags.blocked = true;
+			// Get domain pointer
+			domainsData* domain = getDomain(domainID, true);
+			domain->blockedcount++;
+			change_clientcount(client, 0, 1);
+			break;
+
+		case QUERY_FORWARDED: // Forwarded
+		case QUERY_RETRIED: // (fall through)
+		case QUERY_RETRIED_DNSSEC: // (fall through)
+			// Only update upstream if there is one (there
+			// won't be one for retried DNSSEC queries)
+			if(upstreamID > -1)
+			{
+				upstreamsData *upstream = getUpstream(upstreamID, true);
+				if(upstream != NULL)
+				{
+					upstream->overTime[timeidx]++;
+					upstream->lastQuery = row->timestamp;
+				}
+			}
+			break;
+
+		case QUERY_CACHE: // Cached or local config
+		case QUERY_CACHE_STALE:
+			// Nothing to be done here
+			break;
+
+		case QUERY_IN_PROGRESS:
+			// Nothing to be done here
+			break;
+
+		case QUERY_STATUS_MAX:
+		default:
+			logg("Warning: Found unknown status %i in long term database!", status);
+			break;
+	}
+}
+
 // Get most recent 24 hours data from long-term database
+//
+// The import is done in three stages:
+//   1. The calling thread streams rows from the database, validates them and
+//      hands them over in batches to a pool of worker threads
+//   2. The workers resolve domain, client and upstream strings into private
+//      hash maps (no locking needed)
+//   3. The private maps are merged and the queries are stored in shared
+//      memory in bulk while holding the SHM lock only once
 void DB_read_queries(void)
 {
 	// Return early if database is known to be broken
@@ -703,7 +1653,10 @@ void DB_read_queries(void)
 	// Get time stamp 24 hours in the past
 	const time_t now = time(NULL);
 	const time_t mintime = now - config.maxlogage;
-	const char *querystr = "SELECT id,timestamp,type,status,domain,client,forward,additional_info,reply_type,reply_time,dnssec FROM queries WHERE timestamp >= ?";
+	// The queries view is a compound SELECT over all partitions which does
+	// not guarantee any order, so the queries are sorted explicitly. Sorting
+	// by timestamp lets SQLite use the timestamp index of each table
+	const char *querystr = "SELECT id,timestamp,type,status,domain,client,forward,additional_info,reply_type,reply_time,dnssec FROM queries WHERE timestamp >= ? ORDER BY timestamp";
 	// Log FTL_db query string in debug mode
 	if(config.debug & DEBUG_DATABASE)
 		logg("DB_read_queries(): \"%s\" with ? = %lli", querystr, (long long)mintime);
@@ -725,8 +1678,35 @@ void DB_read_queries(void)
 		goto end_of_DB_read_queries;
 	}
 
-	// Lock shared memory
-	lock_shm();
+	// Start worker threads
+	import_queue queue = { .head = NULL, .tail = NULL, .done = false };
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	import_worker workers[IMPORT_MAX_WORKERS] = {{ 0 }};
+	int max_workers = MAX(get_nprocs(), 1);
+	if(max_workers > IMPORT_MAX_WORKERS)
+		max_workers = IMPORT_MAX_WORKERS;
+	unsigned int nworkers = 0;
+	for(int w = 0; w < max_workers; w++)
+	{
+		workers[nworkers].queue = &queue;
+		workers[nworkers].id = nworkers;
+		const int ret = pthread_create(&workers[nworkers].thread, NULL, import_worker_thread, &workers[nworkers]);
+		if(ret != 0)
+		{
+			// pthread_create() returns the error code instead of setting errno
+			logg("WARNING: Unable to start database import thread: %s", strerror(ret));
+			break;
+		}
+		nworkers++;
+	}
+
+	// Batches are processed by the workers in any order but have to be
+	// stored in the order they were read from the database
+	import_batch **batches = NULL;
+	unsigned int nbatches = 0, batches_size = 0;
+	import_batch *batch = NULL;
+	bool failed = false;
 
 	// Loop through returned database rows
 	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
@@ -788,26 +1768,6 @@ void DB_read_queries(void)
 			continue;
 		}
 
-		// Ensure we have enough shared memory available for new data
-		shm_ensure_size();
-
-		const char *buffer = NULL;
-		int upstreamID = -1; // Default if not forwarded
-		// Try to extract the upstream from the "forward" column if non-empty
-		if(sqlite3_column_bytes(stmt, 6) > 0 &&
-		   (buffer = (const char *)sqlite3_column_text(stmt, 6)) != NULL)
-		{
-			// Get IP address and port of upstream destination
-			char serv_addr[INET6_ADDRSTRLEN] = { 0 };
-			unsigned int serv_port = 53;
-			// We limit the number of bytes written into the serv_addr buffer
-			// to prevent buffer overflows. If there is no port available in
-			// the database, we skip extracting them and use the default port
-			sscanf(buffer, "%"xstr(INET6_ADDRSTRLEN)"[^#]#%u", serv_addr, &serv_port);
-			serv_addr[INET6_ADDRSTRLEN-1] = '\0';
-			upstreamID = findUpstreamID(serv_addr, (in_port_t)serv_port);
-		}
-
 		int reply_type = REPLY_UNKNOWN;
 		if(sqlite3_column_type(stmt, 8) == SQLITE_INTEGER)
 		{
@@ -846,70 +1806,52 @@ void DB_read_queries(void)
 			}
 		}
 
-		// Obtain IDs only after filtering which queries we want to keep
-		const int timeidx = getOverTimeID(queryTimeStamp);
-		const int domainID = findDomainID(domainname, true);
-		const int clientID = findClientID(clientIP, true, false);
-
-		// Set index for this query
-		const int queryIndex = counters->queries;
-
-		// Store this query in memory
-		queriesData* query = getQuery(queryIndex, false);
-		query->magic = MAGICBYTE;
-		query->timestamp = queryTimeStamp;
-		if(type < 100)
+		// Get a new batch if needed
+		if(batch == NULL)
 		{
-			// Mapped query type
-			if(type >= TYPE_A && type < TYPE_MAX)
-				query->type = type;
-			else
+			if(nbatches == batches_size)
 			{
-				// Invalid query type
-				logg("DB warn: Query type %d is invalid.", type);
-				continue;
+				batches_size = batches_size > 0 ? 2*batches_size : 64;
+				import_batch **new_batches = realloc(batches, batches_size*sizeof(*batches));
+				if(new_batches == NULL)
+				{
+					failed = true;
+					break;
+				}
+				batches = new_batches;
+			}
+			if((batch = calloc(1, sizeof(import_batch))) == NULL)
+			{
+				failed = true;
+				break;
 			}
+			batches[nbatches++] = batch;
 		}
-		else
-		{
-			// Offset query type
-			query->type = TYPE_OTHER;
-			query->qtype = type - 100;
-		}
-
-		// Status is set below
-		query->domainID = domainID;
-		query->clientID = clientID;
-		query->upstreamID = upstreamID;
-		query->id = 0;
-		query->response = 0;
-		query->flags.response_calculated = reply_time_avail;
-		query->dnssec = dnssec;
-		query->reply = reply_type;
-		counters->reply[query->reply]++;
-		query->response = reply_time * 1e4; // convert to tenth-millisecond unit
-		query->CNAME_domainID = -1;
-		// Initialize flags
-		query->flags.complete = true; // Mark as all information is available
-		query->flags.blocked = false;
-		query->flags.whitelisted = false;
-		query->flags.database = true;
-		query->ede = -1; // EDE_UNSET == -1
-
-		// Set lastQuery timer for network table
-		clientsData* client = getClient(clientID, true);
-		client->lastQuery = queryTimeStamp;
-
-		// Handle type counters
-		counters->querytype[query->type-1]++;
 
-		// Update overTime data
-		overTime[timeidx].total++;
-		// Update overTime data structure with the new client
-		change_clientcount(client, 0, 0, timeidx, 1);
+		// Store this row in the current batch
+		import_row *row = &batch->rows[batch->num];
+		row->timestamp = queryTimeStamp;
+		row->type = type;
+		row->status = status;
+		row->reply = reply_type;
+		row->reply_time = reply_time;
+		row->reply_time_avail = reply_time_avail;
+		row->dnssec = dnssec;
+		row->domain = import_batch_addstr(batch, domainname);
+		row->client = import_batch_addstr(batch, clientIP);
+		row->upstream = IMPORT_NONE;
+		row->cname = IMPORT_NONE;
+		row->has_addinfo = false;
 
-		// Increase DNS queries counter
-		counters->queries++;
+		// Try to extract the upstream from the "forward" column if non-empty
+		const char *buffer = NULL;
+		if(sqlite3_column_bytes(stmt, 6) > 0 &&
+		   (buffer = (const char *)sqlite3_column_text(stmt, 6)) != NULL)
+		{
+			row->upstream = import_batch_addstr(batch, buffer);
+			if(row->upstream == IMPORT_NONE)
+				failed = true;
+		}
 
 		// Get additional information from the additional_info column if applicable
 		if(status == QUERY_GRAVITY_CNAME ||
@@ -920,96 +1862,105 @@ void DB_read_queries(void)
 			const char *CNAMEdomain = (const char *)sqlite3_column_text(stmt, 7);
 			if(CNAMEdomain != NULL && strlen(CNAMEdomain) > 0)
 			{
-				// Add domain to FTL's memory but do not count it. Seeing a
-				// domain in the middle of a CNAME trajectory does not mean
-				// it was queried intentionally.
-				const int CNAMEdomainID = findDomainID(CNAMEdomain, false);
-				query->CNAME_domainID = CNAMEdomainID;
+				// The domain is added to FTL's memory but not counted.
+				// Seeing a domain in the middle of a CNAME trajectory
+				// does not mean it was queried intentionally.
+				row->cname = import_batch_addstr(batch, CNAMEdomain);
+				if(row->cname == IMPORT_NONE)
+					failed = true;
 			}
 		}
 		else if(sqlite3_column_bytes(stmt, 7) != 0)
 		{
-			// Set ID of the domainlist entry that was the reason for permitting/blocking this query
+			// ID of the domainlist entry that was the reason for permitting/blocking this query
 			// We assume the value in this field is said ID when it is not a CNAME-related domain
 			// (checked above) and the value of additional_info is not NULL (0 bytes storage size)
-			const int cacheID = findCacheID(query->domainID, query->clientID, query->type, true);
-			DNSCacheData *cache = getDNSCache(cacheID, true);
-			// Only load if
-			//  a) we have a cache entry
-			if(cache != NULL)
-				cache->domainlist_id = sqlite3_column_int(stmt, 7);
+			row->has_addinfo = true;
+			row->addinfo = sqlite3_column_int(stmt, 7);
 		}
 
-		// Increment status counters, we first have to add one to the count of
-		// unknown queries because query_set_status() will subtract from there
-		// when setting a different status
-		counters->status[QUERY_UNKNOWN]++;
-		query_set_status(query, status);
-
-		// Do further processing based on the query status we read from the database
-		switch(status)
+		if(failed || row->domain == IMPORT_NONE || row->client == IMPORT_NONE)
 		{
-			case QUERY_UNKNOWN: // Unknown
-				break;
+			failed = true;
+			break;
+		}
 
-			case QUERY_GRAVITY: // Blocked by gravity
-			case QUERY_REGEX: // Blocked by regex blacklist
-			case QUERY_BLACKLIST: // Blocked by exact blacklist
-			case QUERY_EXTERNAL_BLOCKED_IP: // Blocked by external provider
-			case QUERY_EXTERNAL_BLOCKED_NULL: // Blocked by external provider
-			case QUERY_EXTERNAL_BLOCKED_NXRA: // Blocked by external provider
-			case QUERY_GRAVITY_CNAME: // Blocked by gravity (inside CNAME path)
-			case QUERY_REGEX_CNAME: // Blocked by regex blacklist (inside CNAME path)
-			case QUERY_BLACKLIST_CNAME: // Blocked by exact blacklist (inside CNAME path)
-			case QUERY_DBBUSY: // Blocked because gravity database was busy
-			case QUERY_SPECIAL_DOMAIN: // Blocked by special domain handling
-				query->flags.blocked = true;
-				// Get domain pointer
-				domainsData* domain = getDomain(domainID, true);
-				domain->blockedcount++;
-				change_clientcount(client, 0, 1, -1, 0);
-				break;
+		// Hand full batches over to the workers (or resolve them here if
+		// no worker could be started)
+		if(++batch->num == IMPORT_BATCH_SIZE)
+		{
+			if(nworkers > 0)
+				import_queue_push(&queue, batch);
+			else if(!import_resolve_batch(batch, &workers[0]))
+				failed = true;
+			batch = NULL;
+		}
+	}
 
-			case QUERY_FORWARDED: // Forwarded
-			case QUERY_RETRIED: // (fall through)
-			case QUERY_RETRIED_DNSSEC: // (fall through)
-				// Only update upstream if there is one (there
-				// won't be one for retried DNSSEC queries)
-				if(upstreamID > -1)
-				{
-					upstreamsData *upstream = getUpstream(upstreamID, true);
-					if(upstream != NULL)
-					{
-						upstream->overTime[timeidx]++;
-						upstream->lastQuery = queryTimeStamp;
-					}
-				}
-				break;
+	// Hand over the last (incomplete) batch
+	if(batch != NULL)
+	{
+		if(nworkers > 0)
+			import_queue_push(&queue, batch);
+		else if(!import_resolve_batch(batch, &workers[0]))
+			failed = true;
+	}
 
-			case QUERY_CACHE: // Cached or local config
-			case QUERY_CACHE_STALE:
-				// Nothing to be done here
-				break;
+	// Signal the workers that there are no more batches and wait for them
+	pthread_mutex_lock(&queue.lock);
+	queue.done = true;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.lock);
+	for(unsigned int w = 0; w < nworkers; w++)
+	{
+		pthread_join(workers[w].thread, NULL);
+		failed |= workers[w].failed;
+	}
+	pthread_mutex_destroy(&queue.lock);
+	pthread_cond_destroy(&queue.cond);
 
-			case QUERY_IN_PROGRESS:
-				// Nothing to be done here
-				break;
+	// Lock shared memory
+	lock_shm();
 
-			case QUERY_STATUS_MAX:
-			default:
-				logg("Warning: Found unknown status %i in long term database!", status);
-				break;
-		}
+	if(failed || !import_assign_IDs(workers, MAX(nworkers, 1u)))
+	{
+		logg("DB_read_queries() - Memory allocation failed, not importing queries");
+	}
+	else
+	{
+		// Store queries in the order they were read from the database
+		for(unsigned int b = 0; b < nbatches; b++)
+			for(unsigned int i = 0; i < batches[b]->num; i++)
+				import_store_query(&batches[b]->rows[i], &workers[batches[b]->worker]);
 	}
 
 	unlock_shm();
 	logg("Imported %i queries from the long-term database", counters->queries);
 
+	if(config.debug & DEBUG_DATABASE)
+		logg("DB_read_queries(): Used %u worker thread%s", nworkers, nworkers == 1 ? "" : "s");
+
+	// Free import memory
+	for(unsigned int b = 0; b < nbatches; b++)
+	{
+		if(batches[b]->arena != NULL)
+			free(batches[b]->arena);
+		free(batches[b]);
+	}
+	if(batches != NULL)
+		free(batches);
+	for(unsigned int w = 0; w < IMPORT_MAX_WORKERS; w++)
+	{
+		import_map_free(&workers[w].domains);
+		import_map_free(&workers[w].clients);
+		import_map_free(&workers[w].upstreams);
+	}
+
 	// Update lastdbindex so that the next call to DB_save_queries()
 	// skips the queries that we just imported from the database
 	lastdbindex = counters->queries;
 
-	if( rc != SQLITE_DONE ){
+	if( rc != SQLITE_DONE && !failed ){
 		logg("DB_read_queries() - SQL error step: %s", sqlite3_errstr(rc));
 		checkFTLDBrc(rc);
 		goto end_of_DB_read_queries;
@@ -1021,3 +1972,67 @@ void DB_read_queries(void)
 end_of_DB_read_queries:	// Close database here, we have to reopen it later (after forking)
 	dbclose(&db);
 }
+
+// Get the last timestamp stored in the long-term database. It is used to
+// ensure the database has not been modified since the snapshot was written
+static time_t get_snapshot_dbstamp(void)
+{
+	// Return early if database is known to be broken
+	if(FTLDBerror())
+		return DB_FAILED;
+
+	sqlite3 *db;
+	if((db = dbopen(false)) == NULL)
+		return DB_FAILED;
+
+	const time_t dbstamp = db_get_int(db, DB_LASTTIMESTAMP);
+	dbclose(&db);
+
+	return dbstamp;
+}
+
+// Store a snapshot of FTL's shared memory on clean shutdown. It is restored on
+// the next start instead of importing the history from the database
+void DB_save_snapshot(void)
+{
+	timer_start(SNAPSHOT_TIMER);
+	const time_t dbstamp = get_snapshot_dbstamp();
+
+	lock_shm();
+	const bool saved = save_shmem_snapshot(FTLfiles.snapshot, dbstamp);
+	const int queries = counters->queries;
+	unlock_shm();
+
+	if(saved)
+		logg("Stored snapshot of %i queries (took %.1f ms)",
+		     queries, timer_elapsed_msec(SNAPSHOT_TIMER));
+}
+
+// Restore FTL's shared memory from the snapshot written on the last clean
+// shutdown. Returns false if there is no usable snapshot, the caller should
+// import the history from the long-term database in this case
+bool DB_read_snapshot(void)
+{
+	timer_start(SNAPSHOT_TIMER);
+	if(!load_shmem_snapshot(FTLfiles.snapshot, get_snapshot_dbstamp()))
+		return false;
+
+	// Update lastdbindex so that the next call to DB_save_queries() starts
+	// at the first restored query that has not been stored in the database
+	// before the snapshot was written
+	for(lastdbindex = 0; lastdbindex < counters->queries; lastdbindex++)
+	{
+		const queriesData *query = getQuery(lastdbindex, true);
+		if(query != NULL && !query->flags.database)
+			break;
+	}
+
+	// Remove queries that became too old while FTL was not running and
+	// move the overTime slots to the current time
+	runGC(time(NULL), NULL);
+
+	logg("Restored %i queries from snapshot (took %.1f ms)",
+	     counters->queries, timer_elapsed_msec(SNAPSHOT_TIMER));
+
+	return true;
+}
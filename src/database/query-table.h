@@ -13,12 +13,15 @@
 #include "sqlite3.h"
 
 int get_number_of_queries_in_DB(sqlite3 *db);
-void delete_old_queries_in_DB(sqlite3 *db);
+bool delete_old_queries_in_DB(sqlite3 *db);
+double get_delete_old_queries_progress(int *deleted);
 bool add_additional_info_column(sqlite3 *db);
 bool optimize_queries_table(sqlite3 *db);
 bool create_addinfo_table(sqlite3 *db);
 int DB_save_queries(sqlite3 *db);
 void DB_read_queries(void);
+bool DB_read_snapshot(void);
+void DB_save_snapshot(void);
 bool add_query_storage_columns(sqlite3 *db);
 
 #endif //DATABASE_QUERY_TABLE_H
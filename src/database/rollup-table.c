@@ -0,0 +1,185 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  pihole-FTL.db -> rollup tables routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "../FTL.h"
+#include "rollup-table.h"
+#include "common.h"
+// logg()
+#include "../log.h"
+// struct config
+#include "../config.h"
+// enum query_status
+#include "../enums.h"
+
+// SQL conditions for blocked, cached and forwarded queries
+#define BLOCKED_STATUS "status IN (%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d)"
+#define BLOCKED_STATUS_ARGS QUERY_GRAVITY, QUERY_REGEX, QUERY_BLACKLIST, \
+                            QUERY_EXTERNAL_BLOCKED_IP, QUERY_EXTERNAL_BLOCKED_NULL, \
+                            QUERY_EXTERNAL_BLOCKED_NXRA, QUERY_GRAVITY_CNAME, \
+                            QUERY_REGEX_CNAME, QUERY_BLACKLIST_CNAME, \
+                            QUERY_DBBUSY, QUERY_SPECIAL_DOMAIN
+#define CACHED_STATUS "status IN (%d,%d)"
+#define CACHED_STATUS_ARGS QUERY_CACHE, QUERY_CACHE_STALE
+#define FORWARDED_STATUS "status IN (%d,%d,%d)"
+#define FORWARDED_STATUS_ARGS QUERY_FORWARDED, QUERY_RETRIED, QUERY_RETRIED_DNSSEC
+
+bool create_rollup_tables(sqlite3 *db)
+{
+	// Start transaction of database update
+	SQL_bool(db, "BEGIN TRANSACTION");
+
+	// Totals per hour/day
+	SQL_bool(db, "CREATE TABLE rollup (interval INTEGER NOT NULL, timestamp INTEGER NOT NULL, " \
+	                                  "total INTEGER NOT NULL, blocked INTEGER NOT NULL, " \
+	                                  "cached INTEGER NOT NULL, forwarded INTEGER NOT NULL, " \
+	                                  "PRIMARY KEY (interval, timestamp)) WITHOUT ROWID;");
+
+	// Query types per hour/day
+	SQL_bool(db, "CREATE TABLE rollup_types (interval INTEGER NOT NULL, timestamp INTEGER NOT NULL, " \
+	                                        "type INTEGER NOT NULL, count INTEGER NOT NULL, " \
+	                                        "PRIMARY KEY (interval, timestamp, type)) WITHOUT ROWID;");
+
+	// Clients per hour/day
+	SQL_bool(db, "CREATE TABLE rollup_clients (interval INTEGER NOT NULL, timestamp INTEGER NOT NULL, " \
+	                                          "client TEXT NOT NULL, total INTEGER NOT NULL, blocked INTEGER NOT NULL, " \
+	                                          "PRIMARY KEY (interval, timestamp, client)) WITHOUT ROWID;");
+
+	// Domains per day (hourly data would grow too large)
+	SQL_bool(db, "CREATE TABLE rollup_domains (timestamp INTEGER NOT NULL, domain TEXT NOT NULL, " \
+	                                          "total INTEGER NOT NULL, blocked INTEGER NOT NULL, " \
+	                                          "PRIMARY KEY (timestamp, domain)) WITHOUT ROWID;");
+
+	// Fill rollup tables with the queries already in the database
+	if(!update_rollup_tables(db, 0, INT64_MAX))
+	{
+		logg("create_rollup_tables(): Failed to fill rollup tables!");
+		return false;
+	}
+
+	// Update database version to 13
+	if(!db_set_FTL_property(db, DB_VERSION, 13))
+	{
+		logg("create_rollup_tables(): Failed to update database version!");
+		return false;
+	}
+
+	// Finish transaction
+	SQL_bool(db, "COMMIT");
+
+	return true;
+}
+
+// Add the queries with IDs in the range (firstID, lastID] to the rollup tables
+bool update_rollup_tables(sqlite3 *db, const sqlite3_int64 firstID, const sqlite3_int64 lastID)
+{
+	const long long first = firstID, last = lastID;
+	const int intervals[] = { ROLLUP_HOUR, ROLLUP_DAY };
+	for(unsigned int i = 0; i < sizeof(intervals)/sizeof(intervals[0]); i++)
+	{
+		const int interval = intervals[i];
+		SQL_bool(db, "INSERT INTO rollup (interval,timestamp,total,blocked,cached,forwarded) " \
+		             "SELECT %d,timestamp/%d*%d,COUNT(*),SUM("BLOCKED_STATUS"),SUM("CACHED_STATUS"),SUM("FORWARDED_STATUS") " \
+		             "FROM queries WHERE id > %lld AND id <= %lld GROUP BY 2 " \
+		             "ON CONFLICT(interval,timestamp) DO UPDATE SET total = total + excluded.total, " \
+		             "blocked = blocked + excluded.blocked, cached = cached + excluded.cached, " \
+		             "forwarded = forwarded + excluded.forwarded;",
+		             interval, interval, interval, BLOCKED_STATUS_ARGS, CACHED_STATUS_ARGS,
+		             FORWARDED_STATUS_ARGS, first, last);
+
+		SQL_bool(db, "INSERT INTO rollup_types (interval,timestamp,type,count) " \
+		             "SELECT %d,timestamp/%d*%d,type,COUNT(*) " \
+		             "FROM queries WHERE id > %lld AND id <= %lld GROUP BY 2,3 " \
+		             "ON CONFLICT(interval,timestamp,type) DO UPDATE SET count = count + excluded.count;",
+		             interval, interval, interval, first, last);
+
+		SQL_bool(db, "INSERT INTO rollup_clients (interval,timestamp,client,total,blocked) " \
+		             "SELECT %d,timestamp/%d*%d,client,COUNT(*),SUM("BLOCKED_STATUS") " \
+		             "FROM queries WHERE id > %lld AND id <= %lld GROUP BY 2,3 " \
+		             "ON CONFLICT(interval,timestamp,client) DO UPDATE SET total = total + excluded.total, " \
+		             "blocked = blocked + excluded.blocked;",
+		             interval, interval, interval, BLOCKED_STATUS_ARGS, first, last);
+	}
+
+	SQL_bool(db, "INSERT INTO rollup_domains (timestamp,domain,total,blocked) " \
+	             "SELECT timestamp/%d*%d,domain,COUNT(*),SUM("BLOCKED_STATUS") " \
+	             "FROM queries WHERE id > %lld AND id <= %lld GROUP BY 1,2 " \
+	             "ON CONFLICT(timestamp,domain) DO UPDATE SET total = total + excluded.total, " \
+	             "blocked = blocked + excluded.blocked;",
+	             ROLLUP_DAY, ROLLUP_DAY, BLOCKED_STATUS_ARGS, first, last);
+
+	return true;
+}
+
+// Delete rollup data older than <timestamp>. Buckets straddling <timestamp>
+// still contain queries that are kept and are therefore kept as well
+bool delete_old_rollups(sqlite3 *db, const int timestamp)
+{
+	SQL_bool(db, "DELETE FROM rollup WHERE timestamp + interval <= %d;", timestamp);
+	SQL_bool(db, "DELETE FROM rollup_types WHERE timestamp + interval <= %d;", timestamp);
+	SQL_bool(db, "DELETE FROM rollup_clients WHERE timestamp + interval <= %d;", timestamp);
+	// Domains are only rolled up per day
+	SQL_bool(db, "DELETE FROM rollup_domains WHERE timestamp + %d <= %d;", ROLLUP_DAY, timestamp);
+
+	return true;
+}
+
+// Prepare statement reading from one of the rollup tables. The domains table
+// is aggregated over the entire time range and limited to the top <count>
+// domains, all other tables return one row per interval
+sqlite3_stmt *prepare_rollup_query(sqlite3 *db, const enum rollup_table table, const int interval,
+                                   const time_t from, const time_t until, const int count)
+{
+	const char *querystr = NULL;
+	switch(table)
+	{
+		case ROLLUP_SUMMARY:
+			querystr = "SELECT timestamp,total,blocked,cached,forwarded FROM rollup "
+			           "WHERE interval = :interval AND timestamp >= :from AND timestamp <= :until "
+			           "ORDER BY timestamp;";
+			break;
+		case ROLLUP_TYPES:
+			querystr = "SELECT timestamp,type,count FROM rollup_types "
+			           "WHERE interval = :interval AND timestamp >= :from AND timestamp <= :until "
+			           "ORDER BY timestamp,type;";
+			break;
+		case ROLLUP_CLIENTS:
+			querystr = "SELECT timestamp,client,total,blocked FROM rollup_clients "
+			           "WHERE interval = :interval AND timestamp >= :from AND timestamp <= :until "
+			           "ORDER BY timestamp,total DESC;";
+			break;
+		case ROLLUP_DOMAINS:
+			querystr = "SELECT domain,SUM(total),SUM(blocked) FROM rollup_domains "
+			           "WHERE timestamp >= :from AND timestamp <= :until "
+			           "GROUP BY domain ORDER BY 2 DESC LIMIT :count;";
+			break;
+	}
+
+	if(config.debug & DEBUG_DATABASE)
+		logg("prepare_rollup_query(): \"%s\" with interval = %i, from = %lli, until = %lli, count = %i",
+		     querystr, interval, (long long)from, (long long)until, count);
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("prepare_rollup_query() - SQL error prepare: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		return NULL;
+	}
+
+	// Not all parameters are used by all queries, binding to index
+	// zero (parameter not found) is a harmless no-op
+	sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":interval"), interval);
+	sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":from"), from);
+	sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":until"), until);
+	sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":count"), count);
+
+	return stmt;
+}
@@ -0,0 +1,32 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  pihole-FTL.db -> rollup tables prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef ROLLUPTABLE_H
+#define ROLLUPTABLE_H
+
+#include "sqlite3.h"
+
+// Intervals covered by one row of the rollup tables [seconds]
+#define ROLLUP_HOUR 3600
+#define ROLLUP_DAY 86400
+
+enum rollup_table {
+	ROLLUP_SUMMARY,
+	ROLLUP_TYPES,
+	ROLLUP_CLIENTS,
+	ROLLUP_DOMAINS
+} __attribute__ ((packed));
+
+bool create_rollup_tables(sqlite3 *db);
+bool update_rollup_tables(sqlite3 *db, const sqlite3_int64 firstID, const sqlite3_int64 lastID);
+bool delete_old_rollups(sqlite3 *db, const int timestamp);
+sqlite3_stmt *prepare_rollup_query(sqlite3 *db, const enum rollup_table table, const int interval,
+                                   const time_t from, const time_t until, const int count);
+
+#endif //ROLLUPTABLE_H
@@ -28,6 +28,12 @@
 #include "overTime.h"
 // short_path()
 #include "files.h"
+// account_status()
+#include "accounting.h"
+// gravity_filter_load()
+#include "database/gravity-filter.h"
+// gravity_shared_load()
+#include "database/gravity-shared.h"
 
 const char *querytypes[TYPE_MAX] = {"UNKNOWN", "A", "AAAA", "ANY", "SRV", "SOA", "PTR", "TXT",
                                     "NAPTR", "MX", "DS", "RRSIG", "DNSKEY", "NS", "OTHER", "SVCB",
@@ -163,6 +169,13 @@ int findDomainID(const char *domainString, const bool count)
 	}
 
 	// If we did not return until here, then this domain is not known
+	return addDomainID(domainString, count);
+}
+
+// Add a new domain to FTL's memory. The caller has to ensure this domain
+// is not already known (use findDomainID() otherwise)
+int addDomainID(const char *domainString, const bool count)
+{
 	// Store ID
 	const int domainID = counters->domains;
 
@@ -170,7 +183,7 @@ int findDomainID(const char *domainString, const bool count)
 	domainsData* domain = getDomain(domainID, false);
 	if(domain == NULL)
 	{
-		logg("ERROR: Encountered serious memory error in findDomainID()");
+		logg("ERROR: Encountered serious memory error in addDomainID()");
 		return -1;
 	}
 
@@ -211,7 +224,7 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 		if(strcmp(getstr(client->ippos), clientIP) == 0)
 		{
 			// Add one if count == true (do not add one, e.g., during ARP table processing)
-			if(count && !aliasclient) change_clientcount(client, 1, 0, -1, 0);
+			if(count && !aliasclient) change_clientcount(client, 1, 0);
 			return clientID;
 		}
 	}
@@ -222,6 +235,13 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 		return -1;
 
 	// If we did not return until here, then this client is definitely new
+	return addClientID(clientIP, count, aliasclient);
+}
+
+// Add a new client to FTL's memory. The caller has to ensure this client
+// is not already known (use findClientID() otherwise)
+int addClientID(const char *clientIP, const bool count, const bool aliasclient)
+{
 	// Store ID
 	const int clientID = counters->clients;
 
@@ -229,7 +249,7 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 	clientsData* client = getClient(clientID, false);
 	if(client == NULL)
 	{
-		logg("ERROR: Encountered serious memory error in findClientID()");
+		logg("ERROR: Encountered serious memory error in addClientID()");
 		return -1;
 	}
 
@@ -268,9 +288,6 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 	client->flags.aliasclient = aliasclient;
 	client->aliasclient_id = -1;
 
-	// Initialize client-specific overTime data
-	memset(client->overTime, 0, sizeof(client->overTime));
-
 	// Store client ID
 	client->id = clientID;
 
@@ -295,12 +312,10 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 	return clientID;
 }
 
-void change_clientcount(clientsData *client, int total, int blocked, int overTimeIdx, int overTimeMod)
+void change_clientcount(clientsData *client, int total, int blocked)
 {
 		client->count += total;
 		client->blockedcount += blocked;
-		if(overTimeIdx > -1 && overTimeIdx < OVERTIME_SLOTS)
-			client->overTime[overTimeIdx] += overTimeMod;
 
 		// Also add counts to the connected alias-client (if any)
 		if(client->flags.aliasclient)
@@ -314,8 +329,6 @@ void change_clientcount(clientsData *client, int total, int blocked, int overTim
 			clientsData *aliasclient = getClient(client->aliasclient_id, true);
 			aliasclient->count += total;
 			aliasclient->blockedcount += blocked;
-			if(overTimeIdx > -1 && overTimeIdx < OVERTIME_SLOTS)
-				aliasclient->overTime[overTimeIdx] += overTimeMod;
 		}
 }
 
@@ -498,6 +511,16 @@ void FTL_reset_per_client_domain_data(void)
 // May only be called from the database thread
 void FTL_reload_all_domainlists(void)
 {
+	// Rebuild the negative-lookup filter and the lookup tables used by TCP
+	// workers before locking the shared memory, this may take a while for
+	// large lists
+	gravity_filter_load();
+	gravity_shared_load();
+
+	// Compile the regex filters, the previous ones are used for DNS queries
+	// until they are swapped in below
+	prepare_regex_from_database();
+
 	lock_shm();
 
 	// (Re-)open gravity database connection
@@ -506,8 +529,8 @@ void FTL_reload_all_domainlists(void)
 	// Reset number of blocked domains
 	counters->gravity = gravityDB_count(GRAVITY_TABLE);
 
-	// Read and compile possible regex filters
-	// only after having called gravityDB_open()
+	// Swap in the regex filters compiled above and load the per-client
+	// regex settings only after having called gravityDB_open()
 	read_regex_from_database();
 
 	// Check for inaccessible adlist URLs
@@ -621,26 +644,7 @@ void _query_set_status(queriesData *query, const enum query_status new_status, c
 
 	// Update counters
 	if(query->status != new_status)
-	{
-		counters->status[query->status]--;
-		counters->status[new_status]++;
-
-		const int timeidx = getOverTimeID(query->timestamp);
-		if(is_blocked(query->status))
-			overTime[timeidx].blocked--;
-		if(is_blocked(new_status))
-			overTime[timeidx].blocked++;
-
-		if(query->status == QUERY_CACHE)
-			overTime[timeidx].cached--;
-		if(new_status == QUERY_CACHE)
-			overTime[timeidx].cached++;
-
-		if(query->status == QUERY_FORWARDED)
-			overTime[timeidx].forwarded--;
-		if(new_status == QUERY_FORWARDED)
-			overTime[timeidx].forwarded++;
-	}
+		account_status(query->timestamp, query->status, new_status);
 
 	// Update status
 	query->status = new_status;
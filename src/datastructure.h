@@ -72,15 +72,12 @@ typedef struct {
 		bool new:1;
 		bool found_group:1;
 		bool aliasclient:1;
-		bool rate_limited:1;
 	} flags;
 	int count;
 	int blockedcount;
 	int aliasclient_id;
 	unsigned int id;
-	unsigned int rate_limit;
 	unsigned int numQueriesARP;
-	int overTime[OVERTIME_SLOTS];
 	size_t groupspos;
 	size_t ippos;
 	size_t namepos;
@@ -112,7 +109,9 @@ uint32_t hashStr(const char *s) __attribute__((pure));
 int findQueryID(const int id);
 int findUpstreamID(const char * upstream, const in_port_t port);
 int findDomainID(const char *domain, const bool count);
+int addDomainID(const char *domain, const bool count);
 int findClientID(const char *client, const bool count, const bool aliasclient);
+int addClientID(const char *client, const bool count, const bool aliasclient);
 #define findCacheID(domainID, clientID, query_type, create_new) _findCacheID(domainID, clientID, query_type, create_new, __FUNCTION__, __LINE__, __FILE__)
 int _findCacheID(const int domainID, const int clientID, const enum query_types query_type, const bool create_new, const char *func, const int line, const char *file);
 bool isValidIPv4(const char *addr);
@@ -130,7 +129,7 @@ const char *getCNAMEDomainString(const queriesData* query);
 const char *getClientIPString(const queriesData* query);
 const char *getClientNameString(const queriesData* query);
 
-void change_clientcount(clientsData *client, int total, int blocked, int overTimeIdx, int overTimeMod);
+void change_clientcount(clientsData *client, int total, int blocked);
 
 const char *get_query_reply_str(const enum reply_type query) __attribute__ ((const));
 
@@ -18,6 +18,9 @@
 #include "dnsmasq_interface.h"
 
 static struct crec *cache_head = NULL, *cache_tail = NULL, **hash_table = NULL;
+/************ Pi-hole modification ************/
+static struct crec **rev_table = NULL;
+/**********************************************/
 #ifdef HAVE_DHCP
 static struct crec *dhcp_spare = NULL;
 #endif
@@ -135,6 +138,10 @@ static void cache_unlink(struct crec *crecp);
 static void cache_link(struct crec *crecp);
 void rehash(int size);
 static void cache_hash(struct crec *crecp);
+/************ Pi-hole modification ************/
+static void cache_rev_link(struct crec *crecp);
+static void cache_unchain(struct crec **up, struct crec *crecp);
+/**********************************************/
 
 unsigned short rrtype(char *in)
 {
@@ -194,6 +201,9 @@ void cache_init(void)
 	  cache_link(crecp);
 	  crecp->flags = 0;
 	  crecp->uid = UID_NONE;
+	  /************ Pi-hole modification ************/
+	  crecp->rev_up = NULL;
+	  /**********************************************/
 	}
     }
   
@@ -209,23 +219,43 @@ void rehash(int size)
 {
   struct crec **new, **old, *p, *tmp;
   int i, new_size, old_size;
+  /************ Pi-hole modification ************/
+  struct crec **new_rev;
+  /**********************************************/
 
   /* hash_size is a power of two. */
   for (new_size = 64; new_size < size/10; new_size = new_size << 1);
   
   /* must succeed in getting first instance, failure later is non-fatal */
   if (!hash_table)
-    new = safe_malloc(new_size * sizeof(struct crec *));
+    {
+      new = safe_malloc(new_size * sizeof(struct crec *));
+      /************ Pi-hole modification ************/
+      new_rev = safe_malloc(new_size * sizeof(struct crec *));
+      /**********************************************/
+    }
   else if (new_size <= hash_size || !(new = whine_malloc(new_size * sizeof(struct crec *))))
     return;
+  /************ Pi-hole modification ************/
+  else if (!(new_rev = whine_malloc(new_size * sizeof(struct crec *))))
+    {
+      free(new);
+      return;
+    }
+  /**********************************************/
 
   for (i = 0; i < new_size; i++)
-    new[i] = NULL;
+    new[i] = new_rev[i] = NULL;
 
   old = hash_table;
   old_size = hash_size;
   hash_table = new;
   hash_size = new_size;
+  /************ Pi-hole modification ************/
+  /* All entries are linked into the new reverse index by cache_hash() below */
+  free(rev_table);
+  rev_table = new_rev;
+  /**********************************************/
   
   if (old)
     {
@@ -286,7 +316,82 @@ static void cache_hash(struct crec *crecp)
   
   crecp->hash_next = *up;
   *up = crecp;
+
+  /************ Pi-hole modification ************/
+  cache_rev_link(crecp);
+  /**********************************************/
+}
+
+/************ Pi-hole modification ************/
+/* Reverse entries are additionally indexed by address in rev_table (which
+   has the same size as hash_table), so cache_find_by_addr() and inserting
+   reverse entries only have to look at the entries for one address instead
+   of the reverse entries at the start of every hash chain. An entry is in
+   the index exactly when it is in a hash chain with F_REVERSE set, so
+   entries must be removed from their hash chain with cache_unchain(). */
+static struct crec **rev_bucket(const union all_addr *addr, unsigned int prot)
+{
+  const unsigned char *p = (const unsigned char *)addr;
+  int i, len = (prot & F_IPV6) ? IN6ADDRSZ : INADDRSZ;
+  unsigned int val = 2166136261u; /* FNV-1a */
+
+  for (i = 0; i < len; i++)
+    val = (val ^ p[i]) * 16777619u;
+
+  /* hash_size is a power of two */
+  return rev_table + ((val ^ (val >> 16)) & (hash_size - 1));
+}
+
+static void cache_rev_link(struct crec *crecp)
+{
+  struct crec **up;
+
+  crecp->rev_next = NULL;
+  crecp->rev_up = NULL;
+
+  if (!(crecp->flags & F_REVERSE) || !(crecp->flags & (F_IPV4 | F_IPV6)))
+    return;
+
+  up = rev_bucket(&crecp->addr, crecp->flags);
+  crecp->rev_next = *up;
+  crecp->rev_up = up;
+  if (*up)
+    (*up)->rev_up = &crecp->rev_next;
+  *up = crecp;
+}
+
+static void cache_rev_unlink(struct crec *crecp)
+{
+  if (crecp->rev_up)
+    {
+      *crecp->rev_up = crecp->rev_next;
+      if (crecp->rev_next)
+	crecp->rev_next->rev_up = crecp->rev_up;
+      crecp->rev_next = NULL;
+      crecp->rev_up = NULL;
+    }
+}
+
+/* Remove crecp from the hash chain, up points to the pointer to it */
+static void cache_unchain(struct crec **up, struct crec *crecp)
+{
+  *up = crecp->hash_next;
+  cache_rev_unlink(crecp);
+}
+
+/* Remove crecp from its hash chain when we don't know its predecessor */
+static void cache_unhash(struct crec *crecp)
+{
+  struct crec **up;
+
+  for (up = hash_bucket(cache_get_name(crecp)); *up; up = &(*up)->hash_next)
+    if (*up == crecp)
+      {
+	cache_unchain(up, crecp);
+	return;
+      }
 }
+/**********************************************/
 
 static void cache_blockdata_free(struct crec *crecp)
 {
@@ -449,7 +554,7 @@ unsigned int cache_remove_uid(const unsigned int uid)
 	tmp = crecp->hash_next;
 	if ((crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)) && crecp->uid == uid)
 	  {
-	    *up = tmp;
+	    cache_unchain(up, crecp); /* Pi-hole modified */
 	    free(crecp);
 	    removed++;
 	  }
@@ -506,7 +611,7 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 		{
 		  if (crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG))
 		    return crecp;
-		  *up = crecp->hash_next;
+		  cache_unchain(up, crecp); /* Pi-hole modified */
 		  /* If this record is for the name we're inserting and is the target
 		     of a CNAME record. Make the new record for the same name, in the same
 		     crec, with the same uid to avoid breaking the existing CNAME. */
@@ -528,7 +633,7 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 		{
 		  if (crecp->flags & F_CONFIG)
 		    return crecp;
-		  *up = crecp->hash_next;
+		  cache_unchain(up, crecp); /* Pi-hole modified */
 		  cache_unlink(crecp);
 		  cache_free(crecp);
 		  continue;
@@ -538,7 +643,7 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 
 	  if (is_expired(now, crecp) || is_outdated_cname_pointer(crecp))
 	    { 
-	      *up = crecp->hash_next;
+	      cache_unchain(up, crecp); /* Pi-hole modified */
 	      if (!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)))
 		{
 		  cache_unlink(crecp);
@@ -550,6 +655,38 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 	  up = &crecp->hash_next;
 	}
     }
+  /************ Pi-hole modification ************/
+  else if ((flags & F_REVERSE) && addr)
+    {
+      /* Only the entries for this address need to be looked at. Expired
+	 entries elsewhere are removed by the scan below (flags == 0) when
+	 really_insert() runs out of free entries. */
+      struct crec *tmp;
+      int addrlen = (flags & F_IPV6) ? IN6ADDRSZ : INADDRSZ;
+
+      for (crecp = *rev_bucket(addr, flags); crecp; crecp = tmp)
+	{
+	  tmp = crecp->rev_next;
+	  if (is_expired(now, crecp))
+	    {
+	      cache_unhash(crecp);
+	      if (!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)))
+		{ 
+		  cache_unlink(crecp);
+		  cache_free(crecp);
+		}
+	    }
+	  else if (!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)) &&
+		   (flags & crecp->flags & (F_IPV4 | F_IPV6)) &&
+		   memcmp(&crecp->addr, addr, addrlen) == 0)
+	    {
+	      cache_unhash(crecp);
+	      cache_unlink(crecp);
+	      cache_free(crecp);
+	    }
+	}
+    }
+  /**********************************************/
   else
     {
       int i;
@@ -561,7 +698,7 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 	     crecp = crecp->hash_next)
 	  if (is_expired(now, crecp))
 	    {
-	      *up = crecp->hash_next;
+	      cache_unchain(up, crecp); /* Pi-hole modified */
 	      if (!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)))
 		{ 
 		  cache_unlink(crecp);
@@ -573,7 +710,7 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 		   (flags & crecp->flags & (F_IPV4 | F_IPV6)) &&
 		   addr && memcmp(&crecp->addr, addr, addrlen) == 0)
 	    {
-	      *up = crecp->hash_next;
+	      cache_unchain(up, crecp); /* Pi-hole modified */
 	      cache_unlink(crecp);
 	      cache_free(crecp);
 	    }
@@ -641,7 +778,10 @@ static struct crec *really_insert(char *name, union all_addr *addr, unsigned sho
 {
   struct crec *new, *target_crec = NULL;
   union bigname *big_name = NULL;
-  int freed_all = (flags & F_REVERSE);
+  /************ Pi-hole modification ************/
+  /* Inserting reverse entries no longer scans all hash chains */
+  int freed_all = 0;
+  /**********************************************/
   struct crec *free_avail = NULL;
   unsigned int target_uid;
   
@@ -1044,7 +1184,7 @@ struct crec *cache_find_by_name(struct crec *crecp, char *name, time_t now, unsi
 	  else
 	    {
 	      /* expired entry, free it */
-	      *up = crecp->hash_next;
+	      cache_unchain(up, crecp); /* Pi-hole modified */
 	      if (!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)))
 		{ 
 		  cache_unlink(crecp);
@@ -1076,16 +1216,15 @@ struct crec *cache_find_by_addr(struct crec *crecp, union all_addr *addr,
   else
     {  
       /* first search, look for relevant entries and push to top of list
-	 also free anything which has expired. All the reverse entries are at the
-	 start of the hash chain, so we can give up when we find the first 
-	 non-REVERSE one.  */
-       int i;
-       struct crec **up, **chainp = &ans;
+	 also free anything which has expired. */
+      /************ Pi-hole modification ************/
+      /* Only the entries in the reverse index bucket of this address need
+	 to be looked at */
+       struct crec *tmp, **chainp = &ans;
        
-       for (i=0; i<hash_size; i++)
-	 for (crecp = hash_table[i], up = &hash_table[i]; 
-	      crecp && (crecp->flags & F_REVERSE);
-	      crecp = crecp->hash_next)
+       for (crecp = *rev_bucket(addr, prot); crecp; crecp = tmp)
+	 {
+	   tmp = crecp->rev_next;
 	   if (!is_expired(now, crecp))
 	     {      
 	       if ((crecp->flags & prot) &&
@@ -1102,17 +1241,18 @@ struct crec *cache_find_by_addr(struct crec *crecp, union all_addr *addr,
 		       cache_link(crecp);
 		     }
 		 }
-	       up = &crecp->hash_next;
 	     }
 	   else
 	     {
-	       *up = crecp->hash_next;
+	       cache_unhash(crecp);
 	       if (!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)))
 		 {
 		   cache_unlink(crecp);
 		   cache_free(crecp);
 		 }
 	     }
+	 }
+      /**********************************************/
        
        *chainp = cache_head;
     }
@@ -1370,12 +1510,12 @@ void cache_reload(void)
 	tmp = cache->hash_next;
 	if (cache->flags & (F_HOSTS | F_CONFIG))
 	  {
-	    *up = cache->hash_next;
+	    cache_unchain(up, cache); /* Pi-hole modified */
 	    free(cache);
 	  }
 	else if (!(cache->flags & F_DHCP))
 	  {
-	    *up = cache->hash_next;
+	    cache_unchain(up, cache); /* Pi-hole modified */
 	    if (cache->flags & F_BIGNAME)
 	      {
 		cache->name.bname->next = big_free;
@@ -1531,7 +1671,7 @@ void cache_unhash_dhcp(void)
     for (cache = hash_table[i], up = &hash_table[i]; cache; cache = cache->hash_next)
       if (cache->flags & F_DHCP)
 	{
-	  *up = cache->hash_next;
+	  cache_unchain(up, cache); /* Pi-hole modified */
 	  cache->next = dhcp_spare;
 	  dhcp_spare = cache;
 	}
@@ -1655,7 +1795,7 @@ static void make_non_terminals(struct crec *source)
 	  !(crecp->flags & (F_IPV4 | F_IPV6 | F_CNAME | F_DNSKEY | F_DS | F_RR)) && 
 	  hostname_isequal(name, cache_get_name(crecp)))
 	{
-	  *up = crecp->hash_next;
+	  cache_unchain(up, crecp); /* Pi-hole modified */
 #ifdef HAVE_DHCP
 	  if (type & F_DHCP)
 	    {
@@ -1641,6 +1641,14 @@ static void async_event(int pipe, time_t now)
 	  }
 #endif
 	
+	/************ Pi-hole modification ************/
+#ifdef HAVE_DHCP
+	/* Leave a complete lease file behind for others to read */
+	if (daemon->lease_stream)
+	  lease_compact_file(now);
+#endif
+	/**********************************************/
+
 	if (daemon->lease_stream)
 	  fclose(daemon->lease_stream);
 
@@ -1884,7 +1892,23 @@ static void check_dns_listeners(time_t now)
     {
 
       if (listener->fd != -1 && poll_check(listener->fd, POLLIN))
-	receive_query(listener, now); 
+	{
+	  /************ Pi-hole modification ************/
+#ifdef HAVE_LINUX_NETWORK
+	  /* Process all queries read by one recvmmsg() and send the replies
+	     together afterwards */
+	  if (udp_batch_begin(listener->fd))
+	    {
+	      do
+		receive_query(listener, now);
+	      while (udp_batch_pending(listener->fd));
+	      udp_batch_end();
+	    }
+	  else
+#endif
+	  /**********************************************/
+	    receive_query(listener, now);
+	}
       
       /* check to see if we have a free tcp process slot.
 	 Note that we can't assume that because we had
@@ -487,6 +487,10 @@ struct crec {
   /* used as class if DNSKEY/DS, index to source for F_HOSTS */
   unsigned int uid; 
   unsigned int flags;
+  /************ Pi-hole modification ************/
+  /* chain of reverse index bucket, rev_up is NULL if not in one */
+  struct crec *rev_next, **rev_up;
+  /**********************************************/
   union {
     char sname[SMALLDNAME];
     union bigname *bname;
@@ -808,6 +812,9 @@ struct frec {
   struct frec *next_dependent; /* list of above. */
   struct frec *blocking_query; /* Query which is blocking us. */
 #endif
+  /************ Pi-hole modification ************/
+  struct frec *id_next, **id_prev; /* chain of frec_ids bucket, id_prev is NULL if not in one */
+  /**********************************************/
   struct frec *next;
 };
 
@@ -839,6 +846,9 @@ struct frec {
 #define LEASE_TA            64  /* IPv6 temporary lease */
 #define LEASE_HAVE_HWADDR  128  /* Have set hwaddress */
 #define LEASE_EXP_CHANGED  256  /* Lease expiry time changed */
+/************ Pi-hole modification ************/
+#define LEASE_JOURNAL      512  /* changed since last written to the lease file */
+/**********************************************/
 
 #define LIMIT_SIG_FAIL    0
 #define LIMIT_CRYPTO      1
@@ -875,6 +885,11 @@ struct dhcp_lease {
   } *slaac_address;
   int vendorclass_count;
 #endif
+  /************ Pi-hole modification ************/
+  /* lookup indexes in lease.c: by address, client-ID and hardware address */
+  struct dhcp_lease *hash_next[3];
+  unsigned int hash_bucket[3], hashed, seq;
+  /**********************************************/
   struct dhcp_lease *next;
 };
 
@@ -1556,6 +1571,14 @@ void resend_query(void);
 int allocate_rfd(struct randfd_list **fdlp, struct server *serv);
 void free_rfds(struct randfd_list **fdlp);
 int fast_retry(time_t now);
+/************ Pi-hole modification ************/
+#ifdef HAVE_LINUX_NETWORK
+#define UDP_BATCH_MAX 64
+unsigned int udp_batch_begin(int fd);
+int udp_batch_pending(int fd);
+void udp_batch_end(void);
+#endif
+/**********************************************/
 
 /* network.c */
 int indextoname(int fd, int index, char *name);
@@ -1607,6 +1630,9 @@ char *host_from_dns(struct in_addr addr);
 /* lease.c */
 #ifdef HAVE_DHCP
 void lease_update_file(time_t now);
+/************ Pi-hole modification ************/
+void lease_compact_file(time_t now);
+/**********************************************/
 void lease_update_dns(int force);
 void lease_init(time_t now);
 struct dhcp_lease *lease4_allocate(struct in_addr addr);
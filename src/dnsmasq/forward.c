@@ -26,9 +26,18 @@ static struct frec *lookup_frec_dnssec(char *target, int class, int flags, struc
 
 static unsigned short get_id(void);
 static void free_frec(struct frec *f);
+/************ Pi-hole modification ************/
+static void frec_set_id(struct frec *f, void *hash);
+static void frec_unlink_id(struct frec *f);
+/**********************************************/
 static void query_full(time_t now, char *domain);
 
 static void return_reply(time_t now, struct frec *forward, struct dns_header *header, ssize_t n, int status);
+/************ Pi-hole modification ************/
+#ifdef HAVE_LINUX_NETWORK
+static int udp_batch_queue(int fd, struct msghdr *msg);
+#endif
+/**********************************************/
 
 /* Send a UDP packet with its source address set as "source" 
    unless nowild is true, when we just send it with the kernel default */
@@ -98,6 +107,14 @@ int send_from(int fd, int nowild, char *packet, size_t len,
 	}
     }
   
+  /************ Pi-hole modification ************/
+#ifdef HAVE_LINUX_NETWORK
+  /* Replies to a batch of queries are sent together once the batch is done */
+  if (udp_batch_queue(fd, &msg))
+    return 1;
+#endif
+  /**********************************************/
+
   while (retry_send(sendmsg(fd, &msg, 0)));
 
   if (errno != 0)
@@ -112,6 +129,208 @@ int send_from(int fd, int nowild, char *packet, size_t len,
   
   return 1;
 }
+
+/************ Pi-hole modification ************/
+#ifdef HAVE_LINUX_NETWORK
+/* Batched UDP I/O on the listening sockets. When a listener becomes readable,
+   up to daemon->udp_batch datagrams are drained with a single recvmmsg().
+   receive_query() then takes them one at a time (copying each into
+   daemon->packet, so everything downstream is unchanged) and the replies
+   it sends via send_from() are queued and flushed with sendmmsg() once the
+   batch has been processed (or the queue is full). Replies to forwarded
+   queries arrive outside of a batch and are sent immediately, as before. */
+union udp_control {
+  struct cmsghdr align; /* this ensures alignment */
+  char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+  char control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+};
+
+struct udp_slots {
+  struct mmsghdr msg[UDP_BATCH_MAX];
+  struct iovec iov[UDP_BATCH_MAX];
+  union mysockaddr addr[UDP_BATCH_MAX];
+  union udp_control control[UDP_BATCH_MAX];
+  unsigned int count;
+};
+
+static struct {
+  int fd;                   /* listener being drained, -1 if none */
+  unsigned int size;        /* datagrams per batch */
+  unsigned int next;        /* next received datagram to be processed */
+  size_t slotsz;            /* size of each packet buffer */
+  char *buff;               /* packet buffers, receive slots first */
+  struct udp_slots rx, tx;
+} udp_batch = { .fd = -1 };
+
+/* Start draining listener fd. Returns the batch size, or zero if batching
+   is disabled and receive_query() should fall back to recvmsg() */
+unsigned int udp_batch_begin(int fd)
+{
+  unsigned int size = FTL_udp_batch();
+
+  if (size > UDP_BATCH_MAX)
+    size = UDP_BATCH_MAX;
+  
+  if (size < 2)
+    return 0;
+
+  /* The EDNS packet size is fixed at startup, allocate once */
+  if (!udp_batch.buff)
+    {
+      udp_batch.slotsz = daemon->edns_pktsz;
+      if (!(udp_batch.buff = whine_malloc(2 * UDP_BATCH_MAX * udp_batch.slotsz)))
+	return 0;
+    }
+
+  udp_batch.fd = fd;
+  udp_batch.size = size;
+  udp_batch.next = udp_batch.rx.count = udp_batch.tx.count = 0;
+
+  return size;
+}
+
+/* More datagrams of the current batch are waiting in receive_query() */
+int udp_batch_pending(int fd)
+{
+  return udp_batch.fd == fd && udp_batch.next < udp_batch.rx.count;
+}
+
+static void udp_batch_flush(void)
+{
+  unsigned int sent = 0;
+
+  while (sent < udp_batch.tx.count)
+    {
+      int rc = sendmmsg(udp_batch.fd, &udp_batch.tx.msg[sent], udp_batch.tx.count - sent, 0);
+
+      if (retry_send(rc))
+	continue;
+
+      if (rc == -1)
+	{
+	  /* If interface is still in DAD, EINVAL results - ignore that.
+	     Drop the failing reply, as send_from() would, and carry on
+	     with the rest. */
+	  if (errno != EINVAL)
+	    my_syslog(LOG_ERR, _("failed to send packet: %s"), strerror(errno));
+	  sent++;
+	}
+      else
+	sent += rc;
+    }
+  
+  udp_batch.tx.count = 0;
+}
+
+/* Send the queued replies and stop batching */
+void udp_batch_end(void)
+{
+  if (udp_batch.fd != -1)
+    udp_batch_flush();
+  
+  udp_batch.fd = -1;
+  udp_batch.next = udp_batch.rx.count = 0;
+}
+
+/* Queue a reply to be sent on the listener being drained. Returns zero if
+   the reply has to be sent directly instead. */
+static int udp_batch_queue(int fd, struct msghdr *msg)
+{
+  struct udp_slots *tx = &udp_batch.tx;
+  unsigned int i;
+
+  if (fd != udp_batch.fd)
+    return 0;
+
+  if (tx->count == udp_batch.size)
+    udp_batch_flush();
+
+  if (msg->msg_iov[0].iov_len > udp_batch.slotsz ||
+      msg->msg_controllen > sizeof(union udp_control) ||
+      msg->msg_namelen > sizeof(union mysockaddr))
+    {
+      /* Keep the replies in order */
+      udp_batch_flush();
+      return 0;
+    }
+
+  i = tx->count++;
+  tx->iov[i].iov_base = udp_batch.buff + (UDP_BATCH_MAX + i) * udp_batch.slotsz;
+  tx->iov[i].iov_len = msg->msg_iov[0].iov_len;
+  memcpy(tx->iov[i].iov_base, msg->msg_iov[0].iov_base, msg->msg_iov[0].iov_len);
+  memcpy(&tx->addr[i], msg->msg_name, msg->msg_namelen);
+  memcpy(&tx->control[i], msg->msg_control, msg->msg_controllen);
+
+  tx->msg[i].msg_hdr.msg_name = &tx->addr[i];
+  tx->msg[i].msg_hdr.msg_namelen = msg->msg_namelen;
+  tx->msg[i].msg_hdr.msg_iov = &tx->iov[i];
+  tx->msg[i].msg_hdr.msg_iovlen = 1;
+  tx->msg[i].msg_hdr.msg_control = msg->msg_controllen ? &tx->control[i] : NULL;
+  tx->msg[i].msg_hdr.msg_controllen = msg->msg_controllen;
+  tx->msg[i].msg_hdr.msg_flags = 0;
+
+  return 1;
+}
+
+/* recvmsg() replacement for receive_query(): hand out the next datagram of
+   the current batch, reading a new batch if necessary. */
+static ssize_t udp_batch_recv(int fd, struct msghdr *msg)
+{
+  struct udp_slots *rx = &udp_batch.rx;
+  struct msghdr *hdr;
+  unsigned int i;
+  int rc;
+
+  if (fd != udp_batch.fd)
+    return recvmsg(fd, msg, 0);
+
+  if (udp_batch.next >= rx->count)
+    {
+      for (i = 0; i < udp_batch.size; i++)
+	{
+	  rx->iov[i].iov_base = udp_batch.buff + i * udp_batch.slotsz;
+	  rx->iov[i].iov_len = udp_batch.slotsz;
+	  rx->msg[i].msg_hdr.msg_name = &rx->addr[i];
+	  rx->msg[i].msg_hdr.msg_namelen = sizeof(rx->addr[i]);
+	  rx->msg[i].msg_hdr.msg_iov = &rx->iov[i];
+	  rx->msg[i].msg_hdr.msg_iovlen = 1;
+	  rx->msg[i].msg_hdr.msg_control = &rx->control[i];
+	  rx->msg[i].msg_hdr.msg_controllen = sizeof(rx->control[i]);
+	  rx->msg[i].msg_hdr.msg_flags = 0;
+	}
+      
+      udp_batch.next = rx->count = 0;
+      if ((rc = recvmmsg(fd, rx->msg, udp_batch.size, MSG_DONTWAIT, NULL)) <= 0)
+	return -1;
+      rx->count = rc;
+    }
+
+  i = udp_batch.next++;
+  hdr = &rx->msg[i].msg_hdr;
+
+  /* Copy into the caller's buffers, truncating like recvmsg() would */
+  if (hdr->msg_namelen < msg->msg_namelen)
+    msg->msg_namelen = hdr->msg_namelen;
+  memcpy(msg->msg_name, hdr->msg_name, msg->msg_namelen);
+  
+  msg->msg_flags = hdr->msg_flags;
+  if (hdr->msg_controllen > msg->msg_controllen)
+    msg->msg_flags |= MSG_CTRUNC;
+  else
+    msg->msg_controllen = hdr->msg_controllen;
+  memcpy(msg->msg_control, hdr->msg_control, msg->msg_controllen);
+
+  if (rx->msg[i].msg_len > msg->msg_iov[0].iov_len)
+    {
+      msg->msg_flags |= MSG_TRUNC;
+      rx->msg[i].msg_len = msg->msg_iov[0].iov_len;
+    }
+  memcpy(msg->msg_iov[0].iov_base, rx->iov[i].iov_base, rx->msg[i].msg_len);
+  
+  return rx->msg[i].msg_len;
+}
+#endif
+/**********************************************/
           
 #ifdef HAVE_CONNTRACK
 static void set_outgoing_mark(struct frec *forward, int fd)
@@ -333,8 +552,9 @@ static int forward_query(int udpfd, union mysockaddr *udpaddr,
       forward->frec_src.iface = dst_iface;
       forward->frec_src.next = NULL;
       forward->frec_src.fd = udpfd;
-      forward->new_id = get_id();
-      memcpy(forward->hash, hash, HASH_SIZE);
+      /************ Pi-hole modification ************/
+      frec_set_id(forward, hash);
+      /**********************************************/
       forward->forwardall = 0;
       forward->flags = fwd_flags;
       if (domain_no_rebind(daemon->namebuff))
@@ -1056,6 +1276,11 @@ static void dnssec_validate(struct frec *forward, struct dns_header *header,
 		  
 		  *new = *forward; /* copy everything, then overwrite */
 		  new->next = next;
+		  /************ Pi-hole modification ************/
+		  /* not in forward's ID bucket */
+		  new->id_next = NULL;
+		  new->id_prev = NULL;
+		  /**********************************************/
 		  new->blocking_query = NULL;
 		  
 		  new->frec_src.log_id = daemon->log_display_id = ++daemon->log_id;
@@ -1077,8 +1302,9 @@ static void dnssec_validate(struct frec *forward, struct dns_header *header,
 		  forward->stash_len = plen;
 		  forward->stash = stash;
 		  
-		  memcpy(new->hash, hash, HASH_SIZE);
-		  new->new_id = get_id();
+		  /************ Pi-hole modification ************/
+		  frec_set_id(new, hash);
+		  /**********************************************/
 		  header->id = htons(new->new_id);
 		  /* Save query for retransmission and de-dup */
 		  new->stash = blockdata_alloc((char *)header, nn);
@@ -1602,8 +1828,15 @@ void receive_query(struct listener *listen, time_t now)
   msg.msg_iov = iov;
   msg.msg_iovlen = 1;
   
+  /************ Pi-hole modification ************/
+#ifdef HAVE_LINUX_NETWORK
+  if ((n = udp_batch_recv(listen->fd, &msg)) == -1)
+    return;
+#else
   if ((n = recvmsg(listen->fd, &msg, 0)) == -1)
     return;
+#endif
+  /**********************************************/
   
   if (n < (int)sizeof(struct dns_header) || 
       (msg.msg_flags & MSG_TRUNC) ||
@@ -2976,6 +3209,9 @@ static void free_frec(struct frec *f)
   free_rfds(&f->rfds);
   f->sentto = NULL;
   f->flags = 0;
+  /************ Pi-hole modification ************/
+  frec_unlink_id(f);
+  /**********************************************/
 
   if (f->stash)
     {
@@ -3076,11 +3312,90 @@ static struct frec *get_new_frec(time_t now, struct server *master, int force)
     {
       target->time = now;
       target->forward_delay = daemon->fast_retry_time;
+      /************ Pi-hole modification ************/
+      /* A free record may still be indexed under the ID it last had */
+      frec_unlink_id(target);
+      /**********************************************/
     }
   
   return target;
 }
 
+/************ Pi-hole modification ************/
+/* Records in use are indexed by their new_id, which get_id() keeps unique
+   among them, so matching a reply from upstream (and finding a free ID)
+   only has to look at the records in one bucket instead of walking
+   daemon->frec_list. The question hash is still compared on lookup. If the
+   table cannot be allocated, we fall back to walking the list. */
+static struct frec **frec_ids = NULL;
+static unsigned int frec_ids_mask = 0;
+
+static int frec_ids_init(void)
+{
+  static int tried = 0;
+  unsigned int size = 1024;
+
+  if (!tried)
+    {
+      tried = 1;
+
+      /* Room for twice the configured maximum of concurrent queries, more
+	 records may be in use with several server groups and DNSSEC */
+      while (size < 65536 && size < 2 * (unsigned int)daemon->ftabsize)
+	size <<= 1;
+
+      if ((frec_ids = whine_malloc(size * sizeof(struct frec *))))
+	frec_ids_mask = size - 1;
+    }
+
+  return frec_ids != NULL;
+}
+
+/* First record to look at when searching for ID id, continue with
+   frec_id_next() */
+static struct frec *frec_id_first(unsigned short id)
+{
+  return frec_ids ? frec_ids[id & frec_ids_mask] : daemon->frec_list;
+}
+
+static struct frec *frec_id_next(struct frec *f)
+{
+  return frec_ids ? f->id_next : f->next;
+}
+
+static void frec_unlink_id(struct frec *f)
+{
+  if (f->id_prev)
+    {
+      *f->id_prev = f->id_next;
+      if (f->id_next)
+	f->id_next->id_prev = f->id_prev;
+      f->id_next = NULL;
+      f->id_prev = NULL;
+    }
+}
+
+/* Give record a new unique ID for the question with the given hash */
+static void frec_set_id(struct frec *f, void *hash)
+{
+  frec_unlink_id(f);
+
+  memcpy(f->hash, hash, HASH_SIZE);
+  f->new_id = get_id();
+
+  if (frec_ids_init())
+    {
+      struct frec **bucket = &frec_ids[f->new_id & frec_ids_mask];
+
+      f->id_prev = bucket;
+      f->id_next = *bucket;
+      if (*bucket)
+	(*bucket)->id_prev = &f->id_next;
+      *bucket = f;
+    }
+}
+/**********************************************/
+
 static void query_full(time_t now, char *domain)
 {
   static time_t last_log = 0;
@@ -3103,8 +3418,10 @@ static struct frec *lookup_frec(unsigned short id, int fd, void *hash, int *firs
   int first, last;
   struct randfd_list *fdl;
 
+  /************ Pi-hole modification ************/
   if (hash)
-    for (f = daemon->frec_list; f; f = f->next)
+    for (f = frec_id_first(id); f; f = frec_id_next(f))
+  /**********************************************/
       if (f->sentto && f->new_id == id && 
 	  (memcmp(hash, f->hash, HASH_SIZE) == 0))
 	{
@@ -3213,7 +3530,10 @@ static unsigned short get_id(void)
       ret = rand16();
 
       /* ensure id is unique. */
-      for (f = daemon->frec_list; f; f = f->next)
+      /************ Pi-hole modification ************/
+      frec_ids_init();
+      for (f = frec_id_first(ret); f; f = frec_id_next(f))
+      /**********************************************/
 	if (f->sentto && f->new_id == ret)
 	  break;
 
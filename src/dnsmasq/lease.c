@@ -20,6 +20,218 @@
 static struct dhcp_lease *leases = NULL, *old_leases = NULL;
 static int dns_dirty, file_dirty, leases_left;
 
+/************ Pi-hole modification ************/
+/* Leases are indexed by address, client-ID and hardware address so that
+   the lease_find_*() functions don't have to walk the whole list of leases.
+   Keys can be shared by more than one lease, the list functions returned the
+   first match in list order, i.e. the most recently allocated lease. We keep
+   that by returning the match with the highest sequence number. If the
+   tables cannot be allocated, the lists are walked as before. */
+enum { LEASE_HASH_ADDR, LEASE_HASH_CLID, LEASE_HASH_HWADDR, LEASE_HASHES };
+
+static struct dhcp_lease **lease_hash[LEASE_HASHES];
+static unsigned int lease_hash_mask, lease_seq;
+
+static void lease_hash_init(void)
+{
+  unsigned int i, size = 64;
+
+  /* room for dhcp-lease-max leases */
+  while (size < 65536 && size < (unsigned int)daemon->dhcp_max)
+    size <<= 1;
+
+  for (i = 0; i < LEASE_HASHES; i++)
+    if (!(lease_hash[i] = whine_malloc(size * sizeof(struct dhcp_lease *))))
+      {
+	while (i-- > 0)
+	  {
+	    free(lease_hash[i]);
+	    lease_hash[i] = NULL;
+	  }
+	return;
+      }
+
+  lease_hash_mask = size - 1;
+}
+
+static unsigned int lease_hash_key(const void *key, int len)
+{
+  const unsigned char *p = key;
+  unsigned int val = 2166136261u; /* FNV-1a */
+
+  while (len-- > 0)
+    val = (val ^ *p++) * 16777619u;
+
+  return (val ^ (val >> 16)) & lease_hash_mask;
+}
+
+static unsigned int lease_addr_key(struct dhcp_lease *lease)
+{
+#ifdef HAVE_DHCP6
+  if (lease->flags & (LEASE_TA | LEASE_NA))
+    return lease_hash_key(&lease->addr6, IN6ADDRSZ);
+#endif
+  return lease_hash_key(&lease->addr, INADDRSZ);
+}
+
+static void lease_hash_add(struct dhcp_lease *lease, int idx, unsigned int bucket)
+{
+  if (!lease_hash[idx])
+    return;
+
+  lease->hash_bucket[idx] = bucket;
+  lease->hash_next[idx] = lease_hash[idx][bucket];
+  lease_hash[idx][bucket] = lease;
+  lease->hashed |= 1u << idx;
+}
+
+static void lease_hash_del(struct dhcp_lease *lease, int idx)
+{
+  struct dhcp_lease **up;
+
+  if (!(lease->hashed & (1u << idx)))
+    return;
+
+  for (up = &lease_hash[idx][lease->hash_bucket[idx]]; *up; up = &(*up)->hash_next[idx])
+    if (*up == lease)
+      {
+	*up = lease->hash_next[idx];
+	break;
+      }
+
+  lease->hashed &= ~(1u << idx);
+}
+
+static void lease_hash_clid(struct dhcp_lease *lease)
+{
+  if (lease->clid && lease->clid_len > 0)
+    lease_hash_add(lease, LEASE_HASH_CLID, lease_hash_key(lease->clid, lease->clid_len));
+}
+
+static void lease_hash_hwaddr(struct dhcp_lease *lease)
+{
+  if (lease->hwaddr_len > 0 && lease->hwaddr_len <= DHCP_CHADDR_MAX)
+    lease_hash_add(lease, LEASE_HASH_HWADDR, lease_hash_key(lease->hwaddr, lease->hwaddr_len));
+}
+
+/* Of two matching leases, the one allocated later comes first in the list */
+static struct dhcp_lease *lease_first(struct dhcp_lease *found, struct dhcp_lease *lease)
+{
+  return (!found || lease->seq > found->seq) ? lease : found;
+}
+
+/* Rather than rewriting the whole lease file on every change, changed leases
+   are appended to <leasefile>.journal in the lease file format and deleted
+   leases as "- <address>". The journal is folded back into the lease file
+   once it holds more records than there are leases, after LEASE_JOURNAL_AGE
+   seconds and on exit, so the cost of writing is proportional to the changes.
+   At startup, the journal is replayed on top of the lease file. */
+#define LEASE_JOURNAL_MIN 64
+#define LEASE_JOURNAL_AGE 60
+
+static FILE *journal_stream = NULL, *lease_out = NULL;
+static unsigned int journal_records, journal_compact, journal_replay;
+static time_t journal_since;
+static struct journal_del {
+  union all_addr addr;
+  int v6;
+} *journal_dels = NULL;
+static unsigned int journal_dels_count, journal_dels_size;
+
+static void lease_journal_open(void)
+{
+  char *name = whine_malloc(strlen(daemon->lease_file) + sizeof(".journal"));
+
+  if (!name)
+    return;
+
+  strcpy(name, daemon->lease_file);
+  strcat(name, ".journal");
+
+  /* Without a journal, the whole lease file is rewritten on every change */
+  if (!(journal_stream = fopen(name, "a+")))
+    my_syslog(MS_DHCP | LOG_WARNING, _("cannot open or create lease journal %s: %s"), name, strerror(errno));
+  else
+    rewind(journal_stream);
+
+  free(name);
+}
+
+/* Remember a deleted lease for the next journal write */
+static void lease_journal_del(struct dhcp_lease *lease)
+{
+  if (!journal_stream || journal_compact)
+    return;
+
+  if (journal_dels_count == journal_dels_size)
+    {
+      unsigned int size = journal_dels_size ? 2 * journal_dels_size : LEASE_JOURNAL_MIN;
+      struct journal_del *new = whine_realloc(journal_dels, size * sizeof(struct journal_del));
+
+      if (!new)
+	{
+	  /* Can't record the deletion, rewrite the whole file instead */
+	  journal_compact = 1;
+	  return;
+	}
+
+      journal_dels = new;
+      journal_dels_size = size;
+    }
+
+  journal_dels[journal_dels_count].v6 = 0;
+#ifdef HAVE_DHCP6
+  if (lease->flags & (LEASE_TA | LEASE_NA))
+    {
+      journal_dels[journal_dels_count].v6 = 1;
+      journal_dels[journal_dels_count].addr.addr6 = lease->addr6;
+    }
+  else
+#endif
+    journal_dels[journal_dels_count].addr.addr4 = lease->addr;
+
+  journal_dels_count++;
+}
+
+/* Drop a lease superseded or deleted by the journal while replaying it */
+static void lease_journal_forget(struct dhcp_lease *lease)
+{
+  struct dhcp_lease **up;
+
+  for (up = &leases; *up; up = &(*up)->next)
+    if (*up == lease)
+      {
+	*up = lease->next;
+	break;
+      }
+
+  lease_hash_del(lease, LEASE_HASH_ADDR);
+  lease_hash_del(lease, LEASE_HASH_CLID);
+  lease_hash_del(lease, LEASE_HASH_HWADDR);
+
+  free(lease->clid);
+  free(lease->hostname);
+  free(lease->fqdn);
+  free(lease->old_hostname);
+  free(lease->extradata);
+  free(lease);
+
+  leases_left++;
+}
+
+static struct dhcp_lease *lease_journal_find(union all_addr *addr, int v6)
+{
+#ifdef HAVE_DHCP6
+  if (v6)
+    return lease6_find_by_addr(&addr->addr6, 128, 0);
+#else
+  (void)v6;
+#endif
+
+  return lease_find_by_addr(addr->addr4);
+}
+/**********************************************/
+
 static int read_leases(time_t now, FILE *leasestream)
 {
   unsigned long ei;
@@ -44,6 +256,31 @@ static int read_leases(time_t now, FILE *leasestream)
 	*daemon->namebuff = *daemon->dhcp_buff = *daemon->packet = '\0';
 	hw_len = hw_type = clid_len = 0;
 	
+	/************ Pi-hole modification ************/
+	if (journal_replay)
+	  {
+	    journal_records++;
+
+	    if (strcmp(daemon->dhcp_buff3, "-") == 0)
+	      {
+		if (inet_pton(AF_INET, daemon->dhcp_buff2, &addr.addr4))
+		  lease = lease_journal_find(&addr, 0);
+#ifdef HAVE_DHCP6
+		else if (inet_pton(AF_INET6, daemon->dhcp_buff2, &addr.addr6))
+		  lease = lease_journal_find(&addr, 1);
+#endif
+		else
+		  lease = NULL;
+
+		if (lease)
+		  lease_journal_forget(lease);
+
+		*daemon->dhcp_buff3 = *daemon->dhcp_buff2 = '\0';
+		continue;
+	      }
+	  }
+	/**********************************************/
+
 #ifdef HAVE_DHCP6
 	if (strcmp(daemon->dhcp_buff3, "duid") == 0)
 	  {
@@ -67,6 +304,12 @@ static int read_leases(time_t now, FILE *leasestream)
 		
 	if (inet_pton(AF_INET, daemon->namebuff, &addr.addr4))
 	  {
+	    /************ Pi-hole modification ************/
+	    /* A journal record replaces the lease with the same address */
+	    if (journal_replay && (lease = lease_journal_find(&addr, 0)))
+	      lease_journal_forget(lease);
+	    /**********************************************/
+
 	    lease = lease4_allocate(addr.addr4);
 	    
 	    
@@ -87,6 +330,11 @@ static int read_leases(time_t now, FILE *leasestream)
 		s++;
 	      }
 	    
+	    /************ Pi-hole modification ************/
+	    if (journal_replay && (lease = lease_journal_find(&addr, 1)))
+	      lease_journal_forget(lease);
+	    /**********************************************/
+
 	    if ((lease = lease6_allocate(&addr.addr6, lease_type)))
 	      lease_set_iaid(lease, strtoul(s, NULL, 10));
 	  }
@@ -127,7 +375,7 @@ static int read_leases(time_t now, FILE *leasestream)
 	
 	/* set these correctly: the "old" events are generated later from
 	   the startup synthesised SIGHUP. */
-	lease->flags &= ~(LEASE_NEW | LEASE_CHANGED);
+	lease->flags &= ~(LEASE_NEW | LEASE_CHANGED | LEASE_JOURNAL); /* Pi-hole modified */
 	
 	*daemon->dhcp_buff3 = *daemon->dhcp_buff2 = '\0';
       }
@@ -140,6 +388,9 @@ void lease_init(time_t now)
   FILE *leasestream;
 
   leases_left = daemon->dhcp_max;
+  /************ Pi-hole modification ************/
+  lease_hash_init();
+  /**********************************************/
 
   if (option_bool(OPT_LEASE_RO))
     {
@@ -172,6 +423,10 @@ void lease_init(time_t now)
 
       /* a+ mode leaves pointer at end. */
       rewind(leasestream);
+
+      /************ Pi-hole modification ************/
+      lease_journal_open();
+      /**********************************************/
     }
 
   if (leasestream)
@@ -182,6 +437,17 @@ void lease_init(time_t now)
       if (ferror(leasestream))
 	die(_("failed to read lease file %s: %s"), daemon->lease_file, EC_FILE);
     }
+
+  /************ Pi-hole modification ************/
+  journal_since = now;
+  if (journal_stream)
+    {
+      journal_replay = 1;
+      if (!read_leases(now, journal_stream) || ferror(journal_stream))
+	my_syslog(MS_DHCP | LOG_ERR, _("failed to parse lease journal cleanly"));
+      journal_replay = 0;
+    }
+  /**********************************************/
   
 #ifdef HAVE_SCRIPT
   if (!daemon->lease_stream)
@@ -211,6 +477,12 @@ void lease_init(time_t now)
   file_dirty = 0;
   lease_prune(NULL, now);
   dns_dirty = 1;
+
+  /************ Pi-hole modification ************/
+  /* Fold a replayed journal into the lease file right away */
+  if (journal_records != 0)
+    journal_compact = file_dirty = 1;
+  /**********************************************/
 }
 
 void lease_update_from_configs(void)
@@ -238,107 +510,222 @@ static void ourprintf(int *errp, char *format, ...)
   va_list ap;
   
   va_start(ap, format);
-  if (!(*errp) && vfprintf(daemon->lease_stream, format, ap) < 0)
+  if (!(*errp) && vfprintf(lease_out, format, ap) < 0) /* Pi-hole modified */
     *errp = errno;
   va_end(ap);
 }
 
-void lease_update_file(time_t now)
+/************ Pi-hole modification ************/
+/* Write one lease in the lease file format, returns 0 if it was skipped */
+static int lease_print(int *errp, struct dhcp_lease *lease)
 {
-  struct dhcp_lease *lease;
-  time_t next_event;
-  int i, err = 0;
+  int i;
 
-  if (file_dirty != 0 && daemon->lease_stream)
+#ifdef HAVE_DHCP6
+  if (lease->flags & (LEASE_TA | LEASE_NA))
     {
-      errno = 0;
-      rewind(daemon->lease_stream);
-      if (errno != 0 || ftruncate(fileno(daemon->lease_stream), 0) != 0)
-	err = errno;
-      
-      for (lease = leases; lease; lease = lease->next)
-	{
+      /* IPv6 leases are only stored along with our DUID */
+      if (!daemon->duid)
+	return 0;
 
-#ifdef HAVE_DHCP6
-	  if (lease->flags & (LEASE_TA | LEASE_NA))
-	    continue;
+#ifdef HAVE_BROKEN_RTC
+      ourprintf(errp, "%u ", lease->length);
+#else
+      ourprintf(errp, "%lu ", (unsigned long)lease->expires);
 #endif
-
+    
+      inet_ntop(AF_INET6, &lease->addr6, daemon->addrbuff, ADDRSTRLEN);
+	 
+      ourprintf(errp, "%s%u %s ", (lease->flags & LEASE_TA) ? "T" : "",
+		lease->iaid, daemon->addrbuff);
+    }
+  else
+#endif
+    {
 #ifdef HAVE_BROKEN_RTC
-	  ourprintf(&err, "%u ", lease->length);
+      ourprintf(errp, "%u ", lease->length);
 #else
-	  ourprintf(&err, "%lu ", (unsigned long)lease->expires);
+      ourprintf(errp, "%lu ", (unsigned long)lease->expires);
 #endif
 
-	  if (lease->hwaddr_type != ARPHRD_ETHER || lease->hwaddr_len == 0) 
-	    ourprintf(&err, "%.2x-", lease->hwaddr_type);
-	  for (i = 0; i < lease->hwaddr_len; i++)
-	    {
-	      ourprintf(&err, "%.2x", lease->hwaddr[i]);
-	      if (i != lease->hwaddr_len - 1)
-		ourprintf(&err, ":");
-	    }
+      if (lease->hwaddr_type != ARPHRD_ETHER || lease->hwaddr_len == 0) 
+	ourprintf(errp, "%.2x-", lease->hwaddr_type);
+      for (i = 0; i < lease->hwaddr_len; i++)
+	{
+	  ourprintf(errp, "%.2x", lease->hwaddr[i]);
+	  if (i != lease->hwaddr_len - 1)
+	    ourprintf(errp, ":");
+	}
 	  
-	  inet_ntop(AF_INET, &lease->addr, daemon->addrbuff, ADDRSTRLEN); 
+      inet_ntop(AF_INET, &lease->addr, daemon->addrbuff, ADDRSTRLEN); 
+
+      ourprintf(errp, " %s ", daemon->addrbuff);
+    }
 
-	  ourprintf(&err, " %s ", daemon->addrbuff);
-	  ourprintf(&err, "%s ", lease->hostname ? lease->hostname : "*");
+  ourprintf(errp, "%s ", lease->hostname ? lease->hostname : "*");
 	  	  
-	  if (lease->clid && lease->clid_len != 0)
-	    {
-	      for (i = 0; i < lease->clid_len - 1; i++)
-		ourprintf(&err, "%.2x:", lease->clid[i]);
-	      ourprintf(&err, "%.2x\n", lease->clid[i]);
-	    }
-	  else
-	    ourprintf(&err, "*\n");	  
-	}
+  if (lease->clid && lease->clid_len != 0)
+    {
+      for (i = 0; i < lease->clid_len - 1; i++)
+	ourprintf(errp, "%.2x:", lease->clid[i]);
+      ourprintf(errp, "%.2x\n", lease->clid[i]);
+    }
+  else
+    ourprintf(errp, "*\n");	  
+
+  return 1;
+}
+
+/* Append the leases changed since the last write to the journal */
+static int lease_write_journal(time_t now)
+{
+  struct dhcp_lease *lease;
+  unsigned int i;
+  int err = 0;
+
+  lease_out = journal_stream;
+
+  /* The journal ages from its first record */
+  if (journal_records == 0)
+    journal_since = now;
+
+  for (i = 0; i < journal_dels_count; i++)
+    {
+#ifdef HAVE_DHCP6
+      if (journal_dels[i].v6)
+	inet_ntop(AF_INET6, &journal_dels[i].addr.addr6, daemon->addrbuff, ADDRSTRLEN);
+      else
+#endif
+	inet_ntop(AF_INET, &journal_dels[i].addr.addr4, daemon->addrbuff, ADDRSTRLEN);
+      ourprintf(&err, "- %s\n", daemon->addrbuff);
+      journal_records++;
+    }
+
+  for (lease = leases; lease; lease = lease->next)
+    if ((lease->flags & LEASE_JOURNAL) && lease_print(&err, lease))
+      journal_records++;
+
+  if (fflush(journal_stream) != 0 ||
+      fsync(fileno(journal_stream)) < 0)
+    err = errno;
+
+  /* A partly written record would stop the replay, start over */
+  if (err)
+    journal_compact = 1;
+
+  return err;
+}
+
+/* Rewrite the whole lease file and empty the journal */
+static int lease_write_all(time_t now)
+{
+  struct dhcp_lease *lease;
+  int err = 0;
+#ifdef HAVE_DHCP6
+  int i;
+#endif
+
+  lease_out = daemon->lease_stream;
+
+  errno = 0;
+  rewind(daemon->lease_stream);
+  if (errno != 0 || ftruncate(fileno(daemon->lease_stream), 0) != 0)
+    err = errno;
+      
+  for (lease = leases; lease; lease = lease->next)
+    {
+#ifdef HAVE_DHCP6
+      if (lease->flags & (LEASE_TA | LEASE_NA))
+	continue;
+#endif
+      lease_print(&err, lease);
+    }
       
 #ifdef HAVE_DHCP6  
-      if (daemon->duid)
-	{
-	  ourprintf(&err, "duid ");
-	  for (i = 0; i < daemon->duid_len - 1; i++)
-	    ourprintf(&err, "%.2x:", daemon->duid[i]);
-	  ourprintf(&err, "%.2x\n", daemon->duid[i]);
+  if (daemon->duid)
+    {
+      ourprintf(&err, "duid ");
+      for (i = 0; i < daemon->duid_len - 1; i++)
+	ourprintf(&err, "%.2x:", daemon->duid[i]);
+      ourprintf(&err, "%.2x\n", daemon->duid[i]);
 	  
-	  for (lease = leases; lease; lease = lease->next)
-	    {
-	      
-	      if (!(lease->flags & (LEASE_TA | LEASE_NA)))
-		continue;
-
-#ifdef HAVE_BROKEN_RTC
-	      ourprintf(&err, "%u ", lease->length);
-#else
-	      ourprintf(&err, "%lu ", (unsigned long)lease->expires);
-#endif
-    
-	      inet_ntop(AF_INET6, &lease->addr6, daemon->addrbuff, ADDRSTRLEN);
-	 
-	      ourprintf(&err, "%s%u %s ", (lease->flags & LEASE_TA) ? "T" : "",
-			lease->iaid, daemon->addrbuff);
-	      ourprintf(&err, "%s ", lease->hostname ? lease->hostname : "*");
-	      
-	      if (lease->clid && lease->clid_len != 0)
-		{
-		  for (i = 0; i < lease->clid_len - 1; i++)
-		    ourprintf(&err, "%.2x:", lease->clid[i]);
-		  ourprintf(&err, "%.2x\n", lease->clid[i]);
-		}
-	      else
-		ourprintf(&err, "*\n");	  
-	    }
-	}
+      for (lease = leases; lease; lease = lease->next)
+	if (lease->flags & (LEASE_TA | LEASE_NA))
+	  lease_print(&err, lease);
+    }
 #endif      
 	  
-      if (fflush(daemon->lease_stream) != 0 ||
-	  fsync(fileno(daemon->lease_stream)) < 0)
+  if (fflush(daemon->lease_stream) != 0 ||
+      fsync(fileno(daemon->lease_stream)) < 0)
+    err = errno;
+
+  /* Only drop the journal once the lease file is safely on disk. Should we
+     die in between, replaying the journal once more does no harm. */
+  if (!err && journal_stream)
+    {
+      errno = 0;
+      rewind(journal_stream);
+      if (errno != 0 || ftruncate(fileno(journal_stream), 0) != 0)
 	err = errno;
-      
-      if (!err)
-	file_dirty = 0;
+      else
+	{
+	  journal_records = journal_compact = 0;
+	  journal_since = now;
+	}
     }
+
+  return err;
+}
+
+static int lease_write_file(time_t now)
+{
+  struct dhcp_lease *lease;
+  unsigned int count = daemon->dhcp_max - leases_left;
+  int err;
+
+  if (count < LEASE_JOURNAL_MIN)
+    count = LEASE_JOURNAL_MIN;
+
+  if (journal_stream && !journal_compact && journal_records < count &&
+      difftime(now, journal_since) < LEASE_JOURNAL_AGE)
+    err = lease_write_journal(now);
+  else
+    err = lease_write_all(now);
+
+  if (!err)
+    {
+      for (lease = leases; lease; lease = lease->next)
+	lease->flags &= ~LEASE_JOURNAL;
+      journal_dels_count = 0;
+      file_dirty = 0;
+    }
+
+  return err;
+}
+
+void lease_compact_file(time_t now)
+{
+  if (daemon->lease_stream && journal_stream && (file_dirty != 0 || journal_records != 0))
+    {
+      journal_compact = 1;
+      lease_write_file(now);
+    }
+}
+/**********************************************/
+
+void lease_update_file(time_t now)
+{
+  struct dhcp_lease *lease;
+  time_t next_event;
+  int err = 0;
+
+  /************ Pi-hole modification ************/
+  /* Also fold an old journal into the lease file when nothing changed */
+  if (daemon->lease_stream &&
+      (file_dirty != 0 ||
+       (journal_records != 0 && difftime(now, journal_since) >= LEASE_JOURNAL_AGE)))
+    err = lease_write_file(now);
+  /**********************************************/
   
   /* Set alarm for when the first lease expires. */
   next_event = 0;
@@ -367,6 +754,16 @@ void lease_update_file(time_t now)
     if (lease->expires != 0 &&
 	(next_event == 0 || difftime(next_event, lease->expires) > 0.0))
       next_event = lease->expires;
+
+  /************ Pi-hole modification ************/
+  if (journal_records != 0)
+    {
+      time_t event = journal_since + LEASE_JOURNAL_AGE;
+
+      if (next_event == 0 || difftime(next_event, event) > 0.0)
+	next_event = event;
+    }
+  /**********************************************/
    
   if (err)
     {
@@ -481,6 +878,7 @@ void lease_make_duid(time_t now)
   if (!daemon->duid && daemon->doing_dhcp6)
     {
       file_dirty = 1;
+      journal_compact = 1; /* Pi-hole modified */
       make_duid(now);
     }
 }
@@ -560,8 +958,16 @@ void lease_prune(struct dhcp_lease *target, time_t now)
 	    dns_dirty = 1;
 
 	  daemon->metrics[lease->addr.s_addr ? METRIC_LEASES_PRUNED_4 : METRIC_LEASES_PRUNED_6]++;
+	  /************ Pi-hole modification ************/
+	  lease_journal_del(lease);
+	  /**********************************************/
 
  	  *up = lease->next; /* unlink */
+	  /************ Pi-hole modification ************/
+	  lease_hash_del(lease, LEASE_HASH_ADDR);
+	  lease_hash_del(lease, LEASE_HASH_CLID);
+	  lease_hash_del(lease, LEASE_HASH_HWADDR);
+	  /**********************************************/
 	  
 	  /* Put on old_leases list 'till we
 	     can run the script */
@@ -581,6 +987,46 @@ struct dhcp_lease *lease_find_by_client(unsigned char *hwaddr, int hw_len, int h
 {
   struct dhcp_lease *lease;
 
+  /************ Pi-hole modification ************/
+  if (lease_hash[LEASE_HASH_CLID])
+    {
+      struct dhcp_lease *found = NULL;
+
+      if (clid && clid_len > 0)
+	{
+	  for (lease = lease_hash[LEASE_HASH_CLID][lease_hash_key(clid, clid_len)]; lease; lease = lease->hash_next[LEASE_HASH_CLID])
+	    {
+#ifdef HAVE_DHCP6
+	      if (lease->flags & (LEASE_TA | LEASE_NA))
+		continue;
+#endif
+	      if (lease->clid && clid_len == lease->clid_len &&
+		  memcmp(clid, lease->clid, clid_len) == 0)
+		found = lease_first(found, lease);
+	    }
+
+	  if (found)
+	    return found;
+	}
+
+      if (hw_len > 0 && hw_len <= DHCP_CHADDR_MAX)
+	for (lease = lease_hash[LEASE_HASH_HWADDR][lease_hash_key(hwaddr, hw_len)]; lease; lease = lease->hash_next[LEASE_HASH_HWADDR])
+	  {
+#ifdef HAVE_DHCP6
+	    if (lease->flags & (LEASE_TA | LEASE_NA))
+	      continue;
+#endif
+	    if ((!lease->clid || !clid) && 
+		lease->hwaddr_len == hw_len &&
+		lease->hwaddr_type == hw_type &&
+		memcmp(hwaddr, lease->hwaddr, hw_len) == 0)
+	      found = lease_first(found, lease);
+	  }
+
+      return found;
+    }
+  /**********************************************/
+
   if (clid)
     for (lease = leases; lease; lease = lease->next)
       {
@@ -614,6 +1060,25 @@ struct dhcp_lease *lease_find_by_addr(struct in_addr addr)
 {
   struct dhcp_lease *lease;
 
+  /************ Pi-hole modification ************/
+  if (lease_hash[LEASE_HASH_ADDR])
+    {
+      struct dhcp_lease *found = NULL;
+
+      for (lease = lease_hash[LEASE_HASH_ADDR][lease_hash_key(&addr, INADDRSZ)]; lease; lease = lease->hash_next[LEASE_HASH_ADDR])
+	{
+#ifdef HAVE_DHCP6
+	  if (lease->flags & (LEASE_TA | LEASE_NA))
+	    continue;
+#endif  
+	  if (lease->addr.s_addr == addr.s_addr)
+	    found = lease_first(found, lease);
+	}
+
+      return found;
+    }
+  /**********************************************/
+
   for (lease = leases; lease; lease = lease->next)
     {
 #ifdef HAVE_DHCP6
@@ -635,6 +1100,22 @@ struct dhcp_lease *lease6_find(unsigned char *clid, int clid_len,
 {
   struct dhcp_lease *lease;
   
+  /************ Pi-hole modification ************/
+  if (lease_hash[LEASE_HASH_ADDR])
+    {
+      struct dhcp_lease *found = NULL;
+
+      for (lease = lease_hash[LEASE_HASH_ADDR][lease_hash_key(addr, IN6ADDRSZ)]; lease; lease = lease->hash_next[LEASE_HASH_ADDR])
+	if ((lease->flags & lease_type) && lease->iaid == iaid &&
+	    IN6_ARE_ADDR_EQUAL(&lease->addr6, addr) &&
+	    clid_len == lease->clid_len &&
+	    memcmp(clid, lease->clid, clid_len) == 0)
+	  found = lease_first(found, lease);
+
+      return found;
+    }
+  /**********************************************/
+
   for (lease = leases; lease; lease = lease->next)
     {
       if (!(lease->flags & lease_type) || lease->iaid != iaid)
@@ -696,6 +1177,30 @@ struct dhcp_lease *lease6_find_by_addr(struct in6_addr *net, int prefix, u64 add
 {
   struct dhcp_lease *lease;
     
+  /************ Pi-hole modification ************/
+  /* With a prefix of at least 64 bits, only one address can match */
+  if (lease_hash[LEASE_HASH_ADDR] && prefix >= 64)
+    {
+      struct dhcp_lease *found = NULL;
+      struct in6_addr key = *net;
+
+      if (prefix != 128)
+	setaddr6part(&key, addr);
+
+      for (lease = lease_hash[LEASE_HASH_ADDR][lease_hash_key(&key, IN6ADDRSZ)]; lease; lease = lease->hash_next[LEASE_HASH_ADDR])
+	{
+	  if (!(lease->flags & (LEASE_TA | LEASE_NA)))
+	    continue;
+      
+	  if (is_same_net6(&lease->addr6, net, prefix) &&
+	      (prefix == 128 || addr6part(&lease->addr6) == addr))
+	    found = lease_first(found, lease);
+	}
+
+      return found;
+    }
+  /**********************************************/
+
   for (lease = leases; lease; lease = lease->next)
     {
       if (!(lease->flags & (LEASE_TA | LEASE_NA)))
@@ -762,7 +1267,7 @@ static struct dhcp_lease *lease_allocate(void)
     return NULL;
 
   memset(lease, 0, sizeof(struct dhcp_lease));
-  lease->flags = LEASE_NEW;
+  lease->flags = LEASE_NEW | LEASE_JOURNAL; /* Pi-hole modified */
   lease->expires = 1;
 #ifdef HAVE_BROKEN_RTC
   lease->length = 0xffffffff; /* illegal value */
@@ -770,6 +1275,9 @@ static struct dhcp_lease *lease_allocate(void)
   lease->hwaddr_len = 256; /* illegal value */
   lease->next = leases;
   leases = lease;
+  /************ Pi-hole modification ************/
+  lease->seq = ++lease_seq;
+  /**********************************************/
   
   file_dirty = 1;
   leases_left--;
@@ -784,6 +1292,9 @@ struct dhcp_lease *lease4_allocate(struct in_addr addr)
     {
       lease->addr = addr;
       daemon->metrics[METRIC_LEASES_ALLOCATED_4]++;
+      /************ Pi-hole modification ************/
+      lease_hash_add(lease, LEASE_HASH_ADDR, lease_addr_key(lease));
+      /**********************************************/
     }
   
   return lease;
@@ -801,6 +1312,9 @@ struct dhcp_lease *lease6_allocate(struct in6_addr *addrp, int lease_type)
       lease->iaid = 0;
 
       daemon->metrics[METRIC_LEASES_ALLOCATED_6]++;
+      /************ Pi-hole modification ************/
+      lease_hash_add(lease, LEASE_HASH_ADDR, lease_addr_key(lease));
+      /**********************************************/
     }
 
   return lease;
@@ -831,7 +1345,7 @@ void lease_set_expires(struct dhcp_lease *lease, unsigned int len, time_t now)
       dns_dirty = 1;
       lease->expires = exp;
 #ifndef HAVE_BROKEN_RTC
-      lease->flags |= LEASE_AUX_CHANGED | LEASE_EXP_CHANGED;
+      lease->flags |= LEASE_AUX_CHANGED | LEASE_EXP_CHANGED | LEASE_JOURNAL; /* Pi-hole modified */
       file_dirty = 1;
 #endif
     }
@@ -840,7 +1354,7 @@ void lease_set_expires(struct dhcp_lease *lease, unsigned int len, time_t now)
   if (len != lease->length)
     {
       lease->length = len;
-      lease->flags |= LEASE_AUX_CHANGED;
+      lease->flags |= LEASE_AUX_CHANGED | LEASE_JOURNAL; /* Pi-hole modified */
       file_dirty = 1; 
     }
 #endif
@@ -852,7 +1366,7 @@ void lease_set_iaid(struct dhcp_lease *lease, unsigned int iaid)
   if (lease->iaid != iaid)
     {
       lease->iaid = iaid;
-      lease->flags |= LEASE_CHANGED;
+      lease->flags |= LEASE_CHANGED | LEASE_JOURNAL; /* Pi-hole modified */
     }
 }
 #endif
@@ -873,11 +1387,17 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
       hw_type != lease->hwaddr_type || 
       (hw_len != 0 && memcmp(lease->hwaddr, hwaddr, hw_len) != 0))
     {
+      /************ Pi-hole modification ************/
+      lease_hash_del(lease, LEASE_HASH_HWADDR);
+      /**********************************************/
       if (hw_len != 0)
 	memcpy(lease->hwaddr, hwaddr, hw_len);
       lease->hwaddr_len = hw_len;
       lease->hwaddr_type = hw_type;
-      lease->flags |= LEASE_CHANGED;
+      /************ Pi-hole modification ************/
+      lease_hash_hwaddr(lease);
+      /**********************************************/
+      lease->flags |= LEASE_CHANGED | LEASE_JOURNAL; /* Pi-hole modified */
       file_dirty = 1; /* run script on change */
     }
 
@@ -886,12 +1406,16 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
      clid_len == 0 for no clid. */
   if (clid_len != 0 && clid)
     {
+      /************ Pi-hole modification ************/
+      lease_hash_del(lease, LEASE_HASH_CLID);
+      /**********************************************/
+
       if (!lease->clid)
 	lease->clid_len = 0;
 
       if (lease->clid_len != clid_len)
 	{
-	  lease->flags |= LEASE_AUX_CHANGED;
+	  lease->flags |= LEASE_AUX_CHANGED | LEASE_JOURNAL; /* Pi-hole modified */
 	  file_dirty = 1;
 	  free(lease->clid);
 	  if (!(lease->clid = whine_malloc(clid_len)))
@@ -902,7 +1426,7 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
 	}
       else if (memcmp(lease->clid, clid, clid_len) != 0)
 	{
-	  lease->flags |= LEASE_AUX_CHANGED;
+	  lease->flags |= LEASE_AUX_CHANGED | LEASE_JOURNAL; /* Pi-hole modified */
 	  file_dirty = 1;
 #ifdef HAVE_DHCP6
 	  change = 1;
@@ -911,6 +1435,9 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
       
       lease->clid_len = clid_len;
       memcpy(lease->clid, clid, clid_len);
+      /************ Pi-hole modification ************/
+      lease_hash_clid(lease);
+      /**********************************************/
     }
   
 #ifdef HAVE_DHCP6
@@ -1046,7 +1573,7 @@ void lease_set_hostname(struct dhcp_lease *lease, const char *name, int auth, ch
 	    }
 	
 	  kill_name(lease_tmp);
-	  lease_tmp->flags |= LEASE_CHANGED; /* run script on change */
+	  lease_tmp->flags |= LEASE_CHANGED | LEASE_JOURNAL; /* run script on change */ /* Pi-hole modified */
 	  break;
 	}
     }
@@ -1062,7 +1589,7 @@ void lease_set_hostname(struct dhcp_lease *lease, const char *name, int auth, ch
   
   file_dirty = 1;
   dns_dirty = 1; 
-  lease->flags |= LEASE_CHANGED; /* run script on change */
+  lease->flags |= LEASE_CHANGED | LEASE_JOURNAL; /* run script on change */ /* Pi-hole modified */
 }
 
 void lease_set_interface(struct dhcp_lease *lease, int interface, time_t now)
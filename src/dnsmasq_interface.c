@@ -46,12 +46,18 @@
 #include <stddef.h>
 // get_edestr()
 #include "api/api_helper.h"
-// logg_rate_limit_message()
-#include "database/message-table.h"
+// rate_limit_query()
+#include "ratelimit.h"
 // type struct sqlite3_stmt_vec
 #include "vector.h"
 // check_one_struct()
 #include "struct_size.h"
+// account_*()
+#include "accounting.h"
+// get_gravity_filter_info()
+#include "database/gravity-filter.h"
+// get_gravity_shared_info()
+#include "database/gravity-shared.h"
 
 // Private prototypes
 static void print_flags(const unsigned int flags);
@@ -654,24 +660,11 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	// automatically generated DNSSEC queries
 	const char *interface = internal_query ? "-" : next_iface.name;
 
-	// Check rate-limit for this client
-	if(!internal_query && config.rate_limit.count > 0 &&
-	   (++client->rate_limit > config.rate_limit.count  || client->flags.rate_limited))
+	// Check rate-limit for this client (and its network). The first
+	// rate-limited query is logged without the blocked domain for privacy
+	// reasons
+	if(!internal_query && rate_limit_query(clientIP))
 	{
-		if(!client->flags.rate_limited)
-		{
-			// Log the first rate-limited query for this client in
-			// this interval. We do not log the blocked domain for
-			// privacy reasons
-			logg_rate_limit_message(clientIP, client->rate_limit);
-			// Reset rate-limiting counter so we can count what
-			// comes within the adjacent interval
-			client->rate_limit = 0;
-		}
-
-		// Memorize this client needs rate-limiting
-		client->flags.rate_limited = true;
-
 		// Block this query
 		force_next_DNS_reply = REPLY_REFUSED;
 		blockingreason = "Rate-limiting";
@@ -695,9 +688,6 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 		     id, queryID, short_path(file), line);
 	}
 
-	// Update overTime
-	const unsigned int timeidx = getOverTimeID(querytimestamp);
-
 	// Skip rest of the analysis if this query is not of type A or AAAA
 	// but user wants to see only A and AAAA queries (pre-v4.1 behavior)
 	if(config.analyze_only_A_AAAA && querytype != TYPE_A && querytype != TYPE_AAAA)
@@ -737,7 +727,6 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	query->id = id; // Has to be set before calling query_set_status()
 
 	// This query is unknown as long as no reply has been found and analyzed
-	counters->status[QUERY_UNKNOWN]++;
 	query_set_status(query, QUERY_UNKNOWN);
 	query->domainID = domainID;
 	query->clientID = clientID;
@@ -748,7 +737,6 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	query->flags.response_calculated = false;
 	// Initialize reply type
 	query->reply = REPLY_UNKNOWN;
-	counters->reply[REPLY_UNKNOWN]++;
 	// Store DNSSEC result for this domain
 	query->dnssec = DNSSEC_UNSPECIFIED;
 	query->CNAME_domainID = -1;
@@ -770,18 +758,9 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	// Increase DNS queries counter
 	counters->queries++;
 
-	// Update overTime data
-	overTime[timeidx].total++;
-
-	// Update overTime data structure with the new client
-	change_clientcount(client, 0, 0, timeidx, 1);
-
-	// Set lastQuery timer and add one query for network table
-	client->lastQuery = querytimestamp;
-	client->numQueriesARP++;
-
-	// Update counters
-	counters->querytype[querytype-1]++;
+	// Update overTime data, client and query type counters. This is
+	// deferred to the accounting thread
+	account_new_query(querytimestamp, clientID, querytype);
 
 	// Process interface information of client (if available)
 	// Skip interface name length 1 to skip "-". No real interface should
@@ -1708,15 +1687,8 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 	const int upstreamID = findUpstreamID(upstreamIP, upstreamPort);
 	query->upstreamID = upstreamID;
 
-	upstreamsData *upstream = getUpstream(upstreamID, true);
-	if(upstream != NULL)
-	{
-		// Update overTime counts
-		const int timeidx = getOverTimeID(query->timestamp);
-		upstream->overTime[timeidx]++;
-		// Update lastQuery timestamp
-		upstream->lastQuery = time(NULL);
-	}
+	// Update overTime counts and lastQuery timestamp
+	account_upstream(query->timestamp, upstreamID, 1);
 
 	// Proceed only if
 	// - current query has not been marked as replied to so far
@@ -1785,6 +1757,8 @@ void FTL_dnsmasq_reload(void)
 {
 	// This function is called by the dnsmasq code on receive of SIGHUP
 	// *before* clearing the cache and rereading the lists
+	// Reopen log file in case it has been rotated
+	reopen_FTL_log();
 	logg("Reloading DNS cache");
 	lock_shm();
 
@@ -2333,13 +2307,8 @@ static void query_blocked(queriesData* query, domainsData* domain, clientsData*
 	// Adjust counters if we recorded a non-blocking status
 	if(query->status == QUERY_FORWARDED)
 	{
-		// Get forward pointer
-		upstreamsData* upstream = getUpstream(query->upstreamID, true);
-		if(upstream != NULL)
-		{
-			const int timeidx = getOverTimeID(query->timestamp);
-			upstream->overTime[timeidx]--;
-		}
+		// Subtract from upstream's overTime counts
+		account_upstream(query->timestamp, query->upstreamID, -1);
 	}
 	else if(is_blocked(query->status))
 	{
@@ -2353,7 +2322,7 @@ static void query_blocked(queriesData* query, domainsData* domain, clientsData*
 		if(domain != NULL)
 			domain->blockedcount++;
 		if(client != NULL)
-			change_clientcount(client, 0, 1, -1, 0);
+			account_blocked(query->clientID, 1);
 
 		query->flags.blocked = true;
 	}
@@ -2738,10 +2707,8 @@ static void _query_set_reply(const unsigned int flags, const enum reply_type rep
 			     get_query_reply_str(query->reply), get_query_reply_str(new_reply));
 	}
 
-	// Subtract from old reply counter
-	counters->reply[query->reply]--;
-	// Add to new reply counter
-	counters->reply[new_reply]++;
+	// Move from old to new reply counter
+	account_reply(query->reply, new_reply);
 	// Store reply type
 	query->reply = new_reply;
 
@@ -2766,6 +2733,10 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw)
 	// so they will not listen to real-time signals
 	handle_realtime_signals();
 
+	// Start writing to the log file asynchronously. This has to happen
+	// after forking as threads do not survive fork()
+	start_async_log();
+
 	// We will use the attributes object later to start all threads in
 	// detached mode
 	pthread_attr_t attr;
@@ -2792,6 +2763,14 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw)
 		exit(EXIT_FAILURE);
 	}
 
+	// Start thread applying statistics updates queued by the DNS resolver
+	init_accounting();
+	if(pthread_create( &threads[ACCOUNTING], &attr, accounting_thread, NULL ) != 0)
+	{
+		logg("Unable to open accounting thread. Exiting...");
+		exit(EXIT_FAILURE);
+	}
+
 	// Start thread that will stay in the background until host names needs to
 	// be resolved. If configuration does not ask for never resolving hostnames
 	// (e.g. on CI builds), the thread is never started)
@@ -2953,6 +2932,33 @@ void getCacheInformation(const int sock)
 	// <valid> are cache entries with positive remaining TTL
 	// <expired> cache entries (to be removed when space is needed)
 	// <immortal> cache records never expire (e.g. from /etc/hosts)
+
+	// Host name cache of FTL's own client name resolution
+	struct hostname_cache_info hci;
+	get_hostname_cache_info(&hci);
+	ssend(sock, "hostname-cache-entries: %u\nhostname-cache-hits: %u\nhostname-cache-negative-hits: %u\nhostname-cache-misses: %u\n",
+	            hci.entries, hci.hits, hci.negative_hits, hci.misses);
+
+	// Statistics updates waiting for the accounting thread. <overflows>
+	// counts updates applied synchronously because the queue was full
+	struct accounting_info ai;
+	get_accounting_info(&ai);
+	ssend(sock, "accounting-queue-depth: %u\naccounting-queue-peak: %u\naccounting-processed: %llu\naccounting-overflows: %llu\n",
+	            ai.depth, ai.peak, ai.processed, ai.overflows);
+
+	// Negative-lookup filter in front of the blacklist and gravity
+	// checks. <skipped> lookups did not need the database, <false-positives>
+	// passed the filter but were not found on any list of the client
+	struct gravity_filter_info gfi;
+	get_gravity_filter_info(&gfi);
+	ssend(sock, "gravity-filter-entries: %u\ngravity-filter-size: %zu\ngravity-filter-expected-fp-rate: %.6f\ngravity-filter-skipped: %llu\ngravity-filter-passed: %llu\ngravity-filter-false-positives: %llu\n",
+	            gfi.entries, gfi.size, gfi.expected_fp_rate, gfi.skipped, gfi.passed, gfi.false_positives);
+
+	// Read-only lookup tables used by TCP workers instead of the database
+	struct gravity_shared_info gsi;
+	get_gravity_shared_info(&gsi);
+	ssend(sock, "gravity-shared-domains: %u\ngravity-shared-size: %zu\n",
+	            gsi.domains, gsi.size);
 }
 
 void FTL_forwarding_retried(const struct server *serv, const int oldID, const int newID, const bool dnssec)
@@ -3231,13 +3237,16 @@ bool FTL_unlink_DHCP_lease(const char *ipaddr)
 	}
 
 	// If a lease exists for this IP address, we unlink it and immediately
-	// update the lease file to reflect the removal of this lease
+	// rewrite the lease file to reflect the removal of this lease
 	if (lease)
 	{
 		// Unlink the lease for dnsmasq's database
 		lease_prune(lease, now);
-		// Update the lease file
+		// Update the lease file. Appending the removal to the journal
+		// is not enough here as the lease would still be listed in the
+		// lease file until the journal is compacted
 		lease_update_file(now);
+		lease_compact_file(now);
 		// Argument force == 0 ensures the DNS records are only updated
 		// when unlinking the lease above actually changed something
 		// (variable lease.c:dns_dirty is used here)
@@ -3248,6 +3257,13 @@ bool FTL_unlink_DHCP_lease(const char *ipaddr)
 	return true;
 }
 
+// Number of UDP queries dnsmasq reads (and answers) at once per listening
+// socket, see DNS_UDP_BATCH
+unsigned int __attribute__((pure)) FTL_udp_batch(void)
+{
+	return config.udp_batch;
+}
+
 void FTL_query_in_progress(const int id)
 {
 	// Query (possibly from new source), but the same query may be in
@@ -3410,10 +3426,10 @@ static void _query_set_dnssec(queriesData *query, const enum dnssec_status dnsse
 int check_struct_sizes(void)
 {
 	int result = 0;
-	result += check_one_struct("ConfigStruct", sizeof(ConfigStruct), 112, 104);
+	result += check_one_struct("ConfigStruct", sizeof(ConfigStruct), 136, 128);
 	result += check_one_struct("queriesData", sizeof(queriesData), 56, 44);
 	result += check_one_struct("upstreamsData", sizeof(upstreamsData), 616, 604);
-	result += check_one_struct("clientsData", sizeof(clientsData), 672, 648);
+	result += check_one_struct("clientsData", sizeof(clientsData), 88, 64);
 	result += check_one_struct("domainsData", sizeof(domainsData), 24, 20);
 	result += check_one_struct("DNSCacheData", sizeof(DNSCacheData), 16, 16);
 	result += check_one_struct("ednsData", sizeof(ednsData), 76, 76);
@@ -3421,7 +3437,7 @@ int check_struct_sizes(void)
 	result += check_one_struct("regexData", sizeof(regexData), 64, 48);
 	result += check_one_struct("SharedMemory", sizeof(SharedMemory), 24, 12);
 	result += check_one_struct("ShmSettings", sizeof(ShmSettings), 16, 16);
-	result += check_one_struct("countersStruct", sizeof(countersStruct), 248, 248);
+	result += check_one_struct("countersStruct", sizeof(countersStruct), 252, 252);
 	result += check_one_struct("sqlite3_stmt_vec", sizeof(sqlite3_stmt_vec), 32, 16);
 
 	if(result == 0)
@@ -39,6 +39,7 @@ bool _FTL_CNAME(const char *dst, const char *src, const int id, const char* file
 
 unsigned int FTL_extract_question_flags(struct dns_header *header, const size_t qlen);
 void FTL_query_in_progress(const int id);
+unsigned int FTL_udp_batch(void) __attribute__((pure));
 void FTL_multiple_replies(const int id, int *firstID);
 
 void FTL_dnsmasq_reload(void);
@@ -173,6 +173,12 @@ enum refresh_hostnames {
 	REFRESH_NONE
 } __attribute__ ((packed));
 
+enum db_partitioning {
+	PARTITION_NONE,
+	PARTITION_DAY,
+	PARTITION_WEEK
+} __attribute__ ((packed));
+
 enum db_result {
 	NOT_FOUND,
 	FOUND,
@@ -190,6 +196,7 @@ enum thread_types {
 	DB,
 	GC,
 	DNSclient,
+	ACCOUNTING,
 	THREADS_MAX
 } __attribute__ ((packed));
 
@@ -11,6 +11,6 @@
 #define GC_H
 
 void *GC_thread(void *val);
-time_t get_rate_limit_turnaround(const unsigned int rate_limit_count);
+void runGC(const time_t now, time_t *lastGCrun);
 
 #endif //GC_H
@@ -24,9 +24,45 @@
 #include "signals.h"
 // logg_fatal_dnsmasq_message()
 #include "database/message-table.h"
+// atomic_*()
+#include <stdatomic.h>
+// eventfd()
+#include <sys/eventfd.h>
+// poll()
+#include <poll.h>
 
 static bool print_log = true, print_stdout = true;
 
+// Asynchronous logging: Log lines are put into a lock-free multi-producer
+// ring buffer which is drained by a dedicated writer thread keeping the log
+// file open. Forks of the main process and lines longer than LOG_LINE_MAX
+// are written synchronously
+#define LOG_RING_SIZE 1024 // Needs to be a power of two
+#define LOG_LINE_MAX 512
+// Maximum time the writer sleeps before checking for log rotation [ms]
+#define LOG_CHECK_INTERVAL 1000
+
+typedef struct {
+	atomic_size_t seq;
+	size_t len;
+	char line[LOG_LINE_MAX];
+} log_slot;
+
+static log_slot *log_ring = NULL;
+static atomic_size_t log_head = 0;
+static size_t log_tail = 0;
+static atomic_bool log_async = false;
+static atomic_bool log_writer_sleeping = false;
+static atomic_bool log_reopen = false;
+static atomic_uint log_dropped = 0;
+static unsigned int log_dropped_total = 0;
+static pid_t log_pid = 0;
+static int log_eventfd = -1;
+static pthread_t log_thread;
+// Protects the log file handle and the consumer side of the ring buffer
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *async_logfile = NULL;
+
 void log_ctrl(bool plog, bool pstdout)
 {
 	print_log = plog;
@@ -76,6 +112,219 @@ void get_timestr(char * const timestring, const time_t timein, const bool millis
 	}
 }
 
+// Try to add a line to the ring buffer. Returns false if the buffer is full
+static bool log_enqueue(const char *line, const size_t len)
+{
+	size_t pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+	while(true)
+	{
+		log_slot *slot = &log_ring[pos & (LOG_RING_SIZE - 1)];
+		const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		const ssize_t diff = (ssize_t)seq - (ssize_t)pos;
+		if(diff == 0)
+		{
+			// Slot is free, try to claim it
+			if(atomic_compare_exchange_weak_explicit(&log_head, &pos, pos + 1,
+			                                         memory_order_relaxed, memory_order_relaxed))
+			{
+				memcpy(slot->line, line, len);
+				slot->len = len;
+				// Publish slot to the writer
+				atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+				return true;
+			}
+		}
+		else if(diff < 0)
+		{
+			// Buffer is full
+			return false;
+		}
+		else
+		{
+			// Another producer was faster, try again
+			pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+		}
+	}
+}
+
+// Write all lines currently in the ring buffer to the log file. Needs to be
+// called with log_lock held. Returns the number of lines written
+static unsigned int log_drain(void)
+{
+	unsigned int lines = 0;
+	while(true)
+	{
+		log_slot *slot = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+		const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if((ssize_t)seq - (ssize_t)(log_tail + 1) < 0)
+			break;
+
+		if(async_logfile != NULL)
+			fwrite(slot->line, 1, slot->len, async_logfile);
+
+		// Release slot for the next round
+		atomic_store_explicit(&slot->seq, log_tail + LOG_RING_SIZE, memory_order_release);
+		log_tail++;
+		lines++;
+	}
+
+	// Report lines that did not fit into the buffer
+	const unsigned int dropped = atomic_exchange(&log_dropped, 0);
+	if(dropped > 0 && async_logfile != NULL)
+	{
+		char timestring[84] = "";
+		get_timestr(timestring, time(NULL), true);
+		log_dropped_total += dropped;
+		fprintf(async_logfile, "[%s %iM] WARNING: Log buffer full, dropped %u lines (%u in total)\n",
+		        timestring, (int)log_pid, dropped, log_dropped_total);
+	}
+
+	if((lines > 0 || dropped > 0) && async_logfile != NULL)
+		fflush(async_logfile);
+
+	return lines;
+}
+
+// (Re)open log file if requested or if it has been moved away (logrotate)
+static void log_check_reopen(void)
+{
+	static time_t last_check = 0;
+	bool reopen = atomic_exchange(&log_reopen, false) || async_logfile == NULL;
+
+	// Check for log rotation at most once per second
+	const time_t now = time(NULL);
+	if(!reopen && now == last_check)
+		return;
+	last_check = now;
+
+	struct stat st_path, st_file;
+	if(!reopen && (stat(FTLfiles.log, &st_path) != 0 ||
+	               fstat(fileno(async_logfile), &st_file) != 0 ||
+	               st_path.st_ino != st_file.st_ino || st_path.st_dev != st_file.st_dev))
+		reopen = true;
+
+	if(!reopen)
+		return;
+
+	if(async_logfile != NULL)
+		fclose(async_logfile);
+	async_logfile = fopen(FTLfiles.log, "a+");
+}
+
+static void *log_writer_thread(void *val)
+{
+	prctl(PR_SET_NAME, "logger", 0, 0, 0);
+
+	struct pollfd pfd = { .fd = log_eventfd, .events = POLLIN };
+	while(atomic_load(&log_async))
+	{
+		pthread_mutex_lock(&log_lock);
+		log_check_reopen();
+		const unsigned int lines = log_drain();
+		pthread_mutex_unlock(&log_lock);
+
+		if(lines > 0)
+			continue;
+
+		// Nothing to do, sleep until a producer wakes us up. Check the
+		// buffer again after announcing that we are going to sleep to
+		// not miss lines added in the meantime
+		atomic_store(&log_writer_sleeping, true);
+		const size_t tail = log_tail & (LOG_RING_SIZE - 1);
+		if(atomic_load(&log_ring[tail].seq) != log_tail + 1 &&
+		   poll(&pfd, 1, LOG_CHECK_INTERVAL) > 0)
+		{
+			eventfd_t value;
+			eventfd_read(log_eventfd, &value);
+		}
+		atomic_store(&log_writer_sleeping, false);
+	}
+
+	// Write remaining lines
+	pthread_mutex_lock(&log_lock);
+	log_drain();
+	if(async_logfile != NULL)
+		fclose(async_logfile);
+	async_logfile = NULL;
+	pthread_mutex_unlock(&log_lock);
+
+	return NULL;
+}
+
+// Start asynchronous logging. Has to be called after forking into the
+// background as threads do not survive fork()
+void start_async_log(void)
+{
+	if(atomic_load(&log_async) || FTLfiles.log == NULL)
+		return;
+
+	if(log_ring == NULL && (log_ring = calloc(LOG_RING_SIZE, sizeof(log_slot))) == NULL)
+		return;
+	for(size_t i = 0; i < LOG_RING_SIZE; i++)
+		atomic_init(&log_ring[i].seq, i);
+	atomic_store(&log_head, 0);
+	log_tail = 0;
+
+	if((log_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+	{
+		logg("WARNING: Unable to create eventfd for logging thread: %s", strerror(errno));
+		return;
+	}
+
+	log_pid = getpid();
+	atomic_store(&log_async, true);
+	if(pthread_create(&log_thread, NULL, log_writer_thread, NULL) != 0)
+	{
+		atomic_store(&log_async, false);
+		close(log_eventfd);
+		log_eventfd = -1;
+		logg("WARNING: Unable to start logging thread, logging synchronously");
+	}
+}
+
+// Stop asynchronous logging after writing all pending lines. All lines
+// logged afterwards are written synchronously
+void stop_async_log(void)
+{
+	if(!atomic_exchange(&log_async, false) || getpid() != log_pid)
+		return;
+
+	// The writer cannot join itself (e.g., when it crashed)
+	if(!pthread_equal(pthread_self(), log_thread))
+	{
+		eventfd_write(log_eventfd, 1);
+		pthread_join(log_thread, NULL);
+	}
+
+	close(log_eventfd);
+	log_eventfd = -1;
+}
+
+// Switch to synchronous logging from a crash handler. Unlike stop_async_log(),
+// this neither waits for the writer thread nor blocks on the log lock as the
+// crashed thread may hold it. Pending lines are written if the lock is free,
+// otherwise they are left to the writer thread
+void crash_async_log(void)
+{
+	if(!atomic_exchange(&log_async, false) || getpid() != log_pid)
+		return;
+
+	if(pthread_mutex_trylock(&log_lock) == 0)
+	{
+		log_drain();
+		pthread_mutex_unlock(&log_lock);
+	}
+
+	// Let the writer thread finish
+	eventfd_write(log_eventfd, 1);
+}
+
+// Reopen the log file (e.g., after log rotation)
+void reopen_FTL_log(void)
+{
+	atomic_store(&log_reopen, true);
+}
+
 void _FTL_log(const bool newline, const bool debug, const char *format, ...)
 {
 	char timestring[84] = "";
@@ -127,27 +376,67 @@ void _FTL_log(const bool newline, const bool debug, const char *format, ...)
 			printf("\n");
 	}
 
-	if(print_log && FTLfiles.log != NULL)
+	if(!print_log || FTLfiles.log == NULL)
+		return;
+
+	// Hand line over to the writer thread if possible
+	if(atomic_load(&log_async) && pid == log_pid)
 	{
-		// Open log file
-		FILE *logfile = fopen(FTLfiles.log, "a+");
+		char line[LOG_LINE_MAX];
+		int len = snprintf(line, sizeof(line), "[%s %s] ", timestring, idstr);
+		va_start(args, format);
+		len += vsnprintf(line + len, sizeof(line) - len, format, args);
+		va_end(args);
 
-		// Write to log file
-		if(logfile != NULL)
+		if(len < LOG_LINE_MAX - 1)
 		{
-			fprintf(logfile, "[%s %s] ", timestring, idstr);
-			va_start(args, format);
-			vfprintf(logfile, format, args);
-			va_end(args);
-			fputc('\n',logfile);
-
-			fclose(logfile);
+			line[len++] = '\n';
+			if(!log_enqueue(line, len))
+				atomic_fetch_add(&log_dropped, 1);
+			else if(atomic_load(&log_writer_sleeping))
+				eventfd_write(log_eventfd, 1);
+			return;
 		}
-		else if(!daemonmode)
+
+		// Line is too long for the ring buffer, write it directly after
+		// all pending lines
+		pthread_mutex_lock(&log_lock);
+		if(atomic_load(&log_async))
 		{
-			printf("!!! WARNING: Writing to FTL\'s log file failed!\n");
-			syslog(LOG_ERR, "Writing to FTL\'s log file failed!");
+			log_drain();
+			if(async_logfile != NULL)
+			{
+				fprintf(async_logfile, "[%s %s] ", timestring, idstr);
+				va_start(args, format);
+				vfprintf(async_logfile, format, args);
+				va_end(args);
+				fputc('\n', async_logfile);
+				fflush(async_logfile);
+			}
+			pthread_mutex_unlock(&log_lock);
+			return;
 		}
+		pthread_mutex_unlock(&log_lock);
+	}
+
+	// Open log file
+	FILE *fp = fopen(FTLfiles.log, "a+");
+
+	// Write to log file
+	if(fp != NULL)
+	{
+		fprintf(fp, "[%s %s] ", timestring, idstr);
+		va_start(args, format);
+		vfprintf(fp, format, args);
+		va_end(args);
+		fputc('\n',fp);
+
+		fclose(fp);
+	}
+	else if(!daemonmode)
+	{
+		printf("!!! WARNING: Writing to FTL\'s log file failed!\n");
+		syslog(LOG_ERR, "Writing to FTL\'s log file failed!");
 	}
 }
 
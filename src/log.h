@@ -14,6 +14,10 @@
 #include <time.h>
 
 void init_FTL_log(void);
+void start_async_log(void);
+void stop_async_log(void);
+void crash_async_log(void);
+void reopen_FTL_log(void);
 void log_counter_info(void);
 void format_memory_size(char prefix[2], unsigned long long int bytes,
                         double * const formatted);
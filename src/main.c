@@ -28,6 +28,8 @@
 #include "overTime.h"
 // flush_message_table()
 #include "database/message-table.h"
+// flush_accounting()
+#include "accounting.h"
 
 char * username;
 bool needGC = false;
@@ -95,8 +97,9 @@ int main (int argc, char* argv[])
 	// Flush messages stored in the long-term database
 	flush_message_table();
 
-	// Try to import queries from long-term database if available
-	if(config.DBimport)
+	// Try to restore the state of the last clean shutdown from the snapshot
+	// file. Import queries from long-term database if it is missing or stale
+	if(config.DBimport && !(config.snapshot && DB_read_snapshot()))
 		DB_read_queries();
 
 	log_counter_info();
@@ -120,6 +123,10 @@ int main (int argc, char* argv[])
 	// terminating immediately
 	sleepms(250);
 
+	// Apply the statistics updates still queued by dnsmasq's main thread
+	// (which is us) so they end up in the database and the snapshot
+	flush_accounting();
+
 	// Save new queries to database (if database is used)
 	if(config.DBexport)
 	{
@@ -130,6 +137,10 @@ int main (int argc, char* argv[])
 		unlock_shm();
 	}
 
+	// Store snapshot of shared memory for a fast restart
+	if(config.snapshot)
+		DB_save_snapshot();
+
 	cleanup(exit_code);
 
 	return exit_code;
@@ -0,0 +1,401 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Netlink routines (neighbor cache and interface addresses)
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "netlink.h"
+#include "log.h"
+// struct config
+#include "config.h"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#include <net/if_arp.h>
+
+// Size of the receive buffer. The kernel never sends datagrams larger than
+// one page (or 8 KB, whichever is larger) for dump requests
+#define NL_BUFFER_SIZE 32768
+
+// Local links known to the kernel, needed to translate interface indices
+// into names and hardware addresses
+typedef struct {
+	int index;
+	unsigned short type;
+	char name[IF_NAMESIZE];
+	char hwaddr[HWADDR_STRLEN];
+} link_info;
+
+typedef struct {
+	link_info *links;
+	int count;
+} link_table;
+
+// Callback invoked for every message of a dump, returns false on error
+typedef bool (*nl_callback)(const struct nlmsghdr *nh, void *data);
+
+// Iterate over the attributes following a message header of size <hdrlen>.
+// We do not use the RTA_NEXT() macro here as it casts from char* to a
+// pointer with stricter alignment requirements
+static const struct rtattr *nl_first_attr(const struct nlmsghdr *nh, const size_t hdrlen, int *len)
+{
+	*len = (int)nh->nlmsg_len - (int)NLMSG_LENGTH(hdrlen);
+	const void *attr = (const char*)NLMSG_DATA(nh) + NLMSG_ALIGN(hdrlen);
+	return attr;
+}
+
+static const struct rtattr *nl_next_attr(const struct rtattr *rta, int *len)
+{
+	*len -= (int)RTA_ALIGN(rta->rta_len);
+	const void *attr = (const char*)rta + RTA_ALIGN(rta->rta_len);
+	return attr;
+}
+
+// Format a link-layer address as colon-separated lowercase hex string
+static void format_hwaddr(char *buffer, const size_t buflen, const struct rtattr *rta)
+{
+	const unsigned char *addr = RTA_DATA(rta);
+	const size_t len = RTA_PAYLOAD(rta);
+	buffer[0] = '\0';
+	for(size_t i = 0, pos = 0; i < len && pos + 3 < buflen; i++)
+		pos += snprintf(buffer + pos, buflen - pos, i > 0 ? ":%02x" : "%02x", addr[i]);
+}
+
+// Format an IPv4 or IPv6 address stored in a netlink attribute
+static bool format_ipaddr(char *buffer, const size_t buflen, const int family, const struct rtattr *rta)
+{
+	const size_t needed = family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+	if(RTA_PAYLOAD(rta) < needed)
+		return false;
+	return inet_ntop(family, RTA_DATA(rta), buffer, buflen) != NULL;
+}
+
+// Send a dump request for <type> and pass every response message to <cb>
+static bool nl_dump(const unsigned short type, const unsigned char family, nl_callback cb, void *data)
+{
+	const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if(fd < 0)
+	{
+		logg("WARN: Cannot open netlink socket: %s", strerror(errno));
+		return false;
+	}
+
+	// All dump requests we send have a struct rtgenmsg-compatible header
+	// (the address family is always the first byte)
+	struct {
+		struct nlmsghdr nh;
+		struct rtgenmsg g;
+	} req;
+	memset(&req, 0, sizeof(req));
+	const unsigned int seq = (unsigned int)time(NULL);
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+	req.nh.nlmsg_type = type;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq = seq;
+	req.g.rtgen_family = family;
+
+	struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+	if(sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr*)&kernel, sizeof(kernel)) < 0)
+	{
+		logg("WARN: Cannot send netlink request: %s", strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	// Use a union to get a buffer suitably aligned for netlink headers
+	union {
+		struct nlmsghdr nh;
+		char buf[NL_BUFFER_SIZE];
+	} *resp = calloc(1, sizeof(*resp));
+	if(resp == NULL)
+	{
+		close(fd);
+		return false;
+	}
+
+	bool done = false, success = true;
+	while(!done && success)
+	{
+		const ssize_t len = recv(fd, resp->buf, sizeof(resp->buf), 0);
+		if(len < 0)
+		{
+			logg("WARN: Cannot receive netlink response: %s", strerror(errno));
+			success = false;
+			break;
+		}
+		else if(len == 0)
+			break;
+
+		// Walk all messages contained in this datagram
+		size_t offset = 0;
+		while(offset + sizeof(struct nlmsghdr) <= (size_t)len)
+		{
+			const void *msg = resp->buf + offset;
+			const struct nlmsghdr *nh = msg;
+			if(nh->nlmsg_len < sizeof(struct nlmsghdr) || nh->nlmsg_len > (size_t)len - offset)
+			{
+				logg("WARN: Received truncated netlink message");
+				success = false;
+				break;
+			}
+
+			// Skip messages not belonging to our request
+			if(nh->nlmsg_seq == seq)
+			{
+				if(nh->nlmsg_type == NLMSG_DONE)
+				{
+					done = true;
+					break;
+				}
+				else if(nh->nlmsg_type == NLMSG_ERROR)
+				{
+					const struct nlmsgerr *err = NLMSG_DATA(nh);
+					logg("WARN: Netlink request failed: %s", strerror(-err->error));
+					success = false;
+					break;
+				}
+				else if(!cb(nh, data))
+				{
+					success = false;
+					break;
+				}
+			}
+
+			offset += NLMSG_ALIGN(nh->nlmsg_len);
+		}
+	}
+
+	free(resp);
+	close(fd);
+	return success;
+}
+
+static bool link_callback(const struct nlmsghdr *nh, void *data)
+{
+	if(nh->nlmsg_type != RTM_NEWLINK)
+		return true;
+
+	link_table *table = data;
+	const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+
+	link_info *links = realloc(table->links, (table->count + 1)*sizeof(link_info));
+	if(links == NULL)
+		return false;
+	table->links = links;
+
+	link_info *link = &table->links[table->count++];
+	memset(link, 0, sizeof(*link));
+	link->index = ifi->ifi_index;
+	link->type = ifi->ifi_type;
+
+	int len = 0;
+	for(const struct rtattr *rta = nl_first_attr(nh, sizeof(*ifi), &len);
+	    RTA_OK(rta, len); rta = nl_next_attr(rta, &len))
+	{
+		if(rta->rta_type == IFLA_IFNAME)
+		{
+			const size_t namelen = RTA_PAYLOAD(rta) < sizeof(link->name) ? RTA_PAYLOAD(rta) : sizeof(link->name) - 1;
+			memcpy(link->name, RTA_DATA(rta), namelen);
+			link->name[sizeof(link->name) - 1] = '\0';
+		}
+		else if(rta->rta_type == IFLA_ADDRESS)
+			format_hwaddr(link->hwaddr, sizeof(link->hwaddr), rta);
+	}
+
+	return true;
+}
+
+static link_info *find_link(const link_table *table, const int index)
+{
+	for(int i = 0; i < table->count; i++)
+		if(table->links[i].index == index)
+			return &table->links[i];
+	return NULL;
+}
+
+typedef struct {
+	const link_table *table;
+	neighbor_entry *entries;
+	int count;
+} neighbor_dump;
+
+static bool neighbor_callback(const struct nlmsghdr *nh, void *data)
+{
+	if(nh->nlmsg_type != RTM_NEWNEIGH)
+		return true;
+
+	neighbor_dump *dump = data;
+	const struct ndmsg *ndm = NLMSG_DATA(nh);
+
+	// Only IP neighbors are of interest. Like "ip neigh show", we skip
+	// entries without state and those not needing resolution (e.g.,
+	// multicast addresses)
+	if((ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6) ||
+	   ndm->ndm_state == NUD_NONE || ndm->ndm_state & NUD_NOARP)
+		return true;
+
+	const link_info *link = find_link(dump->table, ndm->ndm_ifindex);
+	if(link == NULL)
+		return true;
+
+	neighbor_entry entry;
+	memset(&entry, 0, sizeof(entry));
+	memcpy(entry.iface, link->name, sizeof(entry.iface));
+
+	bool has_ip = false;
+	int len = 0;
+	for(const struct rtattr *rta = nl_first_attr(nh, sizeof(*ndm), &len);
+	    RTA_OK(rta, len); rta = nl_next_attr(rta, &len))
+	{
+		if(rta->rta_type == NDA_DST)
+			has_ip = format_ipaddr(entry.ip, sizeof(entry.ip), ndm->ndm_family, rta);
+		else if(rta->rta_type == NDA_LLADDR && RTA_PAYLOAD(rta) > 0)
+		{
+			format_hwaddr(entry.hwaddr, sizeof(entry.hwaddr), rta);
+			entry.has_hwaddr = true;
+		}
+	}
+
+	if(!has_ip)
+		return true;
+
+	// Failed and incomplete neighbors may still carry an outdated
+	// hardware address, we treat them as having none
+	if(ndm->ndm_state & (NUD_INCOMPLETE | NUD_FAILED))
+		entry.has_hwaddr = false;
+
+	neighbor_entry *entries = realloc(dump->entries, (dump->count + 1)*sizeof(neighbor_entry));
+	if(entries == NULL)
+		return false;
+	dump->entries = entries;
+	dump->entries[dump->count++] = entry;
+
+	return true;
+}
+
+typedef struct {
+	const link_table *table;
+	interface_address *entries;
+	int count;
+} address_dump;
+
+static bool address_callback(const struct nlmsghdr *nh, void *data)
+{
+	if(nh->nlmsg_type != RTM_NEWADDR)
+		return true;
+
+	address_dump *dump = data;
+	const struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+
+	if(ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+		return true;
+
+	// We only consider Ethernet and loopback interfaces, other link
+	// types (e.g., wireguard) have no usable hardware address
+	const link_info *link = find_link(dump->table, (int)ifa->ifa_index);
+	if(link == NULL || (link->type != ARPHRD_ETHER && link->type != ARPHRD_LOOPBACK) ||
+	   link->hwaddr[0] == '\0')
+		return true;
+
+	const struct rtattr *local = NULL, *address = NULL;
+	bool has_broadcast = false;
+	int len = 0;
+	for(const struct rtattr *rta = nl_first_attr(nh, sizeof(*ifa), &len);
+	    RTA_OK(rta, len); rta = nl_next_attr(rta, &len))
+	{
+		if(rta->rta_type == IFA_LOCAL)
+			local = rta;
+		else if(rta->rta_type == IFA_ADDRESS)
+			address = rta;
+		else if(rta->rta_type == IFA_BROADCAST)
+			has_broadcast = true;
+	}
+
+	// IFA_LOCAL is the interface's own address on point-to-point links,
+	// IFA_ADDRESS is the address of the remote end in this case
+	const struct rtattr *rta = local != NULL ? local : address;
+	if(rta == NULL)
+		return true;
+
+	// We only store IPv4 addresses with broadcast address, this skips
+	// host-scope addresses like 127.0.0.1
+	if(ifa->ifa_family == AF_INET && !has_broadcast)
+		return true;
+
+	interface_address entry;
+	memset(&entry, 0, sizeof(entry));
+	if(!format_ipaddr(entry.ip, sizeof(entry.ip), ifa->ifa_family, rta))
+		return true;
+	memcpy(entry.iface, link->name, sizeof(entry.iface));
+	memcpy(entry.hwaddr, link->hwaddr, sizeof(entry.hwaddr));
+
+	interface_address *entries = realloc(dump->entries, (dump->count + 1)*sizeof(interface_address));
+	if(entries == NULL)
+		return false;
+	dump->entries = entries;
+	dump->entries[dump->count++] = entry;
+
+	return true;
+}
+
+// Read the kernel's neighbor cache (equivalent to "ip neigh show"). Returns
+// the number of entries (the caller has to free the array) or -1 on error
+int get_neighbor_cache(neighbor_entry **entries)
+{
+	*entries = NULL;
+	link_table table = { NULL, 0 };
+	neighbor_dump dump = { &table, NULL, 0 };
+
+	if(!nl_dump(RTM_GETLINK, AF_UNSPEC, link_callback, &table) ||
+	   !nl_dump(RTM_GETNEIGH, AF_UNSPEC, neighbor_callback, &dump))
+	{
+		if(table.links != NULL)
+			free(table.links);
+		if(dump.entries != NULL)
+			free(dump.entries);
+		return -1;
+	}
+
+	if(table.links != NULL)
+		free(table.links);
+
+	if(config.debug & DEBUG_ARP)
+		logg("Netlink: Read %i entries from the neighbor cache", dump.count);
+
+	*entries = dump.entries;
+	return dump.count;
+}
+
+// Read addresses of local interfaces (equivalent to "ip address show").
+// Returns the number of entries (the caller has to free the array) or -1 on
+// error
+int get_interface_addresses(interface_address **entries)
+{
+	*entries = NULL;
+	link_table table = { NULL, 0 };
+	address_dump dump = { &table, NULL, 0 };
+
+	if(!nl_dump(RTM_GETLINK, AF_UNSPEC, link_callback, &table) ||
+	   !nl_dump(RTM_GETADDR, AF_UNSPEC, address_callback, &dump))
+	{
+		if(table.links != NULL)
+			free(table.links);
+		if(dump.entries != NULL)
+			free(dump.entries);
+		return -1;
+	}
+
+	if(table.links != NULL)
+		free(table.links);
+
+	if(config.debug & DEBUG_ARP)
+		logg("Netlink: Read %i local interface addresses", dump.count);
+
+	*entries = dump.entries;
+	return dump.count;
+}
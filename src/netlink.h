@@ -0,0 +1,41 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2021 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Netlink routines prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef FTL_NETLINK_H
+#define FTL_NETLINK_H
+
+// IF_NAMESIZE
+#include <net/if.h>
+// INET6_ADDRSTRLEN
+#include <netinet/in.h>
+
+// Buffer size for hardware addresses formatted as "aa:bb:cc:dd:ee:ff" (also
+// large enough for longer link-layer addresses, e.g., InfiniBand)
+#define HWADDR_STRLEN 64
+
+// One entry of the kernel's neighbor cache
+typedef struct {
+	char ip[INET6_ADDRSTRLEN];
+	char iface[IF_NAMESIZE];
+	char hwaddr[HWADDR_STRLEN];
+	// Incomplete or failed entries come without hardware address
+	bool has_hwaddr;
+} neighbor_entry;
+
+// One address configured on a local interface
+typedef struct {
+	char ip[INET6_ADDRSTRLEN];
+	char iface[IF_NAMESIZE];
+	char hwaddr[HWADDR_STRLEN];
+} interface_address;
+
+int get_neighbor_cache(neighbor_entry **entries);
+int get_interface_addresses(interface_address **entries);
+
+#endif //FTL_NETLINK_H
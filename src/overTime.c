@@ -42,17 +42,8 @@ static void initSlot(const unsigned int index, const time_t timestamp)
 	overTime[index].cached = 0;
 	overTime[index].forwarded = 0;
 
-	// Zero overTime counter for all known clients
-	for(int clientID = 0; clientID < counters->clients; clientID++)
-	{
-		// Get client pointer
-		clientsData* client = getClient(clientID, true);
-		if(client != NULL)
-		{
-			// Set overTime data to zero
-			client->overTime[index] = 0;
-		}
-	}
+	// Per-client overTime data is not stored but computed from the queries
+	// when requested, so there is nothing to zero for the clients
 
 	// Zero overTime counter for all known upstream destinations
 	for(int upstreamID = 0; upstreamID < counters->upstreams; upstreamID++)
@@ -208,18 +199,6 @@ void moveOverTimeMemory(const time_t mintime)
 			continue;
 	}
 
-	// Move client-specific overTime memory
-	for(int clientID = 0; clientID < counters->clients; clientID++)
-	{
-		clientsData *client = getClient(clientID, true);
-		if(!client)
-			continue;
-
-		memmove(&(client->overTime[0]),
-		        &(client->overTime[moveOverTime]),
-		        remainingSlots*sizeof(*client->overTime));
-	}
-
 	// Process upstream data
 	for(int upstreamID = 0; upstreamID < counters->upstreams; upstreamID++)
 	{
@@ -0,0 +1,336 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Token-bucket rate-limiting of clients and networks
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "ratelimit.h"
+// struct config
+#include "config.h"
+// logg()
+#include "log.h"
+// logg_rate_limit_message()
+#include "database/message-table.h"
+// get_rate_limit_table()
+#include "shmem.h"
+
+// Every client (and, if enabled, every network) has a bucket holding up to
+// <count> tokens which is refilled at a rate of <count> tokens per <interval>
+// seconds. Each query takes one token. A query arriving at an empty bucket is
+// refused and still takes a token, putting the bucket into debt, so clients
+// continuing to query faster than allowed stay rate-limited. Buckets are only
+// refilled when they are looked up.
+//
+// The buckets are kept in an open-addressing hash table keyed by the binary
+// address and prefix length. IPv4 addresses are stored as IPv4-mapped IPv6
+// addresses. Network buckets are only charged for queries the client's own
+// bucket allowed, so a single misbehaving client does not get its neighbors
+// rate-limited
+//
+// The table lives in shared memory so queries received by TCP forks are
+// charged to the same buckets. All functions have to be called with the
+// shared memory lock held
+
+// Initial and maximum number of slots, the table is kept at most half full
+#define RL_MIN_SLOTS 256u
+#define RL_MAX_SLOTS (1u << 20)
+
+typedef struct {
+	struct in6_addr addr;
+	unsigned char prefix;
+	bool used :1;
+	bool limited :1;
+	float tokens;
+	unsigned int refused;
+	double last;
+} rl_bucket;
+
+typedef struct {
+	unsigned int size;
+	unsigned int used;
+	rl_bucket slots[];
+} rl_table;
+
+static rl_table *rl_get_table(const unsigned int size)
+{
+	return get_rate_limit_table(sizeof(rl_table) + size*sizeof(rl_bucket));
+}
+
+static double rl_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static unsigned int __attribute__((pure)) rl_hash(const struct in6_addr *addr, const unsigned char prefix)
+{
+	// 32-bit FNV-1a
+	uint32_t hash = 2166136261u;
+	for(unsigned int i = 0; i < sizeof(addr->s6_addr); i++)
+	{
+		hash ^= addr->s6_addr[i];
+		hash *= 16777619u;
+	}
+	hash ^= prefix;
+	hash *= 16777619u;
+	return hash;
+}
+
+// Find the slot of a bucket or the free slot it would go into
+static rl_bucket * __attribute__((pure)) rl_slot(rl_bucket *slots, const unsigned int size,
+                                                 const struct in6_addr *addr, const unsigned char prefix)
+{
+	unsigned int i = rl_hash(addr, prefix) & (size - 1);
+	while(slots[i].used &&
+	      (slots[i].prefix != prefix || memcmp(&slots[i].addr, addr, sizeof(*addr)) != 0))
+		i = (i + 1) & (size - 1);
+	return &slots[i];
+}
+
+// Rebuild the table with the given number of slots, skipping buckets that
+// have been full for long enough to be indistinguishable from a new bucket if
+// purge is true. The table is rebuilt in place, so the buckets are copied
+// away first. Returns the (possibly moved) table or NULL on error
+static rl_table *rl_rebuild(const unsigned int size, const bool purge, const double now)
+{
+	rl_table *table = rl_get_table(0);
+	const unsigned int oldsize = table->size;
+	rl_bucket *old = NULL;
+	if(oldsize > 0)
+	{
+		if((old = calloc(oldsize, sizeof(rl_bucket))) == NULL)
+			return NULL;
+		memcpy(old, table->slots, oldsize*sizeof(rl_bucket));
+	}
+
+	// Enlarging the shared memory object may move it
+	table = rl_get_table(size);
+	memset(table->slots, 0, size*sizeof(rl_bucket));
+	table->size = size;
+	table->used = 0;
+
+	for(unsigned int i = 0; i < oldsize; i++)
+	{
+		const rl_bucket *b = &old[i];
+		if(!b->used)
+			continue;
+
+		if(purge)
+		{
+			const bool subnet = b->prefix < 128;
+			const unsigned int count = subnet ? config.rate_limit.subnet.count : config.rate_limit.count;
+			const unsigned int interval = subnet ? config.rate_limit.subnet.interval : config.rate_limit.interval;
+			const double tokens = b->tokens + (now - b->last)*count/(interval > 0 ? interval : 1);
+			if(tokens >= count)
+				continue;
+		}
+
+		*rl_slot(table->slots, size, &b->addr, b->prefix) = *b;
+		table->used++;
+	}
+
+	if(old != NULL)
+		free(old);
+	return table;
+}
+
+// Get the bucket of an address, creating a full one if there is none yet.
+// Returns NULL if the table cannot hold any more buckets
+static rl_bucket *rl_get(const struct in6_addr *addr, const unsigned char prefix,
+                         const unsigned int count, const double now)
+{
+	rl_table *table = rl_get_table(0);
+	if(table->size == 0 && (table = rl_rebuild(RL_MIN_SLOTS, false, now)) == NULL)
+		return NULL;
+
+	rl_bucket *b = rl_slot(table->slots, table->size, addr, prefix);
+	if(b->used)
+		return b;
+
+	// Keep the table at most half full
+	if(2*(table->used + 1) > table->size)
+	{
+		if(table->size >= RL_MAX_SLOTS || (table = rl_rebuild(2*table->size, false, now)) == NULL)
+			return NULL;
+		b = rl_slot(table->slots, table->size, addr, prefix);
+	}
+
+	memset(b, 0, sizeof(*b));
+	b->addr = *addr;
+	b->prefix = prefix;
+	b->used = true;
+	b->tokens = count;
+	b->last = now;
+	table->used++;
+	return b;
+}
+
+static void rl_refill(rl_bucket *b, const unsigned int count, const unsigned int interval, const double now)
+{
+	b->tokens += (now - b->last)*count/(interval > 0 ? interval : 1);
+	if(b->tokens > count)
+		b->tokens = count;
+	b->last = now;
+}
+
+// Take a token from the bucket, returns false if there was none left
+static bool rl_take(rl_bucket *b, const unsigned int count)
+{
+	const bool allowed = b->tokens >= 1.0f;
+
+	// Refused queries put the bucket into debt, down to one full bucket
+	if(b->tokens > -(float)count)
+		b->tokens -= 1.0f;
+
+	return allowed;
+}
+
+static void rl_format(const rl_bucket *b, char *buffer, const size_t len)
+{
+	if(IN6_IS_ADDR_V4MAPPED(&b->addr))
+	{
+		inet_ntop(AF_INET, &b->addr.s6_addr[12], buffer, len);
+		if(b->prefix < 128)
+			snprintf(buffer + strlen(buffer), len - strlen(buffer), "/%u", b->prefix - 96);
+	}
+	else
+	{
+		inet_ntop(AF_INET6, &b->addr, buffer, len);
+		if(b->prefix < 128)
+			snprintf(buffer + strlen(buffer), len - strlen(buffer), "/%u", b->prefix);
+	}
+}
+
+static void rl_refused(rl_bucket *b, const unsigned int count, const unsigned int interval)
+{
+	b->refused++;
+	if(b->limited)
+		return;
+
+	b->limited = true;
+
+	// Seconds until the next query would be allowed again, assuming the
+	// client stops querying now
+	const double rate = (double)count/(interval > 0 ? interval : 1);
+	time_t turnaround = (time_t)((1.0 - b->tokens)/rate + 0.999);
+	if(turnaround < 1)
+		turnaround = 1;
+
+	char ip[INET6_ADDRSTRLEN + 5] = { 0 };
+	rl_format(b, ip, sizeof(ip));
+	logg_rate_limit_message(ip, turnaround, count, interval);
+}
+
+static void rl_mask(struct in6_addr *addr, const unsigned int prefix)
+{
+	for(unsigned int i = 0; i < sizeof(addr->s6_addr); i++)
+	{
+		if(prefix <= 8*i)
+			addr->s6_addr[i] = 0;
+		else if(prefix < 8*(i + 1))
+			addr->s6_addr[i] &= 0xFF << (8*(i + 1) - prefix);
+	}
+}
+
+// Returns true if the query of this client should be refused
+bool rate_limit_query(const char *clientIP)
+{
+	if(config.rate_limit.count == 0 && config.rate_limit.subnet.count == 0)
+		return false;
+
+	// Get binary address, IPv4 addresses are mapped into IPv6
+	struct in6_addr addr = { 0 };
+	unsigned char prefix;
+	if(inet_pton(AF_INET, clientIP, &addr.s6_addr[12]) == 1)
+	{
+		addr.s6_addr[10] = addr.s6_addr[11] = 0xFF;
+		prefix = 96 + config.rate_limit.subnet.prefix4;
+	}
+	else if(inet_pton(AF_INET6, clientIP, &addr) == 1)
+		prefix = config.rate_limit.subnet.prefix6;
+	else
+		return false;
+
+	const double now = rl_now();
+	bool allowed = true;
+
+	rl_bucket *client = NULL;
+	if(config.rate_limit.count > 0 &&
+	   (client = rl_get(&addr, 128, config.rate_limit.count, now)) != NULL)
+	{
+		rl_refill(client, config.rate_limit.count, config.rate_limit.interval, now);
+		allowed = rl_take(client, config.rate_limit.count);
+		if(!allowed)
+			rl_refused(client, config.rate_limit.count, config.rate_limit.interval);
+	}
+
+	// The network is only charged for queries the client was allowed to
+	// make itself
+	if(allowed && config.rate_limit.subnet.count > 0 && prefix < 128)
+	{
+		rl_mask(&addr, prefix);
+		rl_bucket *net = rl_get(&addr, prefix, config.rate_limit.subnet.count, now);
+		if(net != NULL)
+		{
+			rl_refill(net, config.rate_limit.subnet.count, config.rate_limit.subnet.interval, now);
+			allowed = rl_take(net, config.rate_limit.subnet.count);
+			if(!allowed)
+				rl_refused(net, config.rate_limit.subnet.count, config.rate_limit.subnet.interval);
+		}
+	}
+
+	return !allowed;
+}
+
+// Report on rate-limited clients and networks and forget buckets which have
+// been refilled completely. Called once per rate-limiting interval
+void rate_limit_purge(void)
+{
+	rl_table *table = rl_get_table(0);
+	if(table->size == 0)
+		return;
+
+	const double now = rl_now();
+	for(unsigned int i = 0; i < table->size; i++)
+	{
+		rl_bucket *b = &table->slots[i];
+		if(!b->used || !b->limited)
+			continue;
+
+		const bool subnet = b->prefix < 128;
+		const unsigned int count = subnet ? config.rate_limit.subnet.count : config.rate_limit.count;
+		const unsigned int interval = subnet ? config.rate_limit.subnet.interval : config.rate_limit.interval;
+		rl_refill(b, count, interval, now);
+
+		char ip[INET6_ADDRSTRLEN + 5] = { 0 };
+		rl_format(b, ip, sizeof(ip));
+
+		// Check if we want to continue rate limiting
+		if(b->tokens < 1.0f)
+			logg("Still rate-limiting %s as it made additional %u queries", ip, b->refused);
+		// or if rate-limiting ends for this client now
+		else
+		{
+			logg("Ending rate-limitation of %s", ip);
+			b->limited = false;
+		}
+
+		b->refused = 0;
+	}
+
+	// Shrink the table if it is mostly empty after purging. The shared
+	// memory object is kept at its size, only fewer slots are used
+	unsigned int size = table->size;
+	if((table = rl_rebuild(size, true, now)) == NULL)
+		return;
+	while(size > RL_MIN_SLOTS && 8*table->used < size)
+		size /= 2;
+	if(size != table->size)
+		rl_rebuild(size, false, now);
+}
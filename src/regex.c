@@ -25,6 +25,13 @@
 #include "config.h"
 // cli_stuff()
 #include "args.h"
+// main_pid()
+#include "signals.h"
+// struct FTLfiles
+#include "files.h"
+#include "database/sqlite3.h"
+// atomic_fetch_add()
+#include <stdatomic.h>
 
 // Safety-measure for future extensions
 #if TYPE_MAX > 30
@@ -137,14 +144,54 @@ unsigned int __attribute__((pure)) get_num_regex(const enum regex_type regexid)
 	return num_regex[regexid];
 }
 
+// Regex filters are compiled by a pool of worker threads into a new set which
+// is swapped in while holding the shared memory lock. DNS queries are matched
+// against the previous set until then
+#define REGEX_MAX_WORKERS 8
+// Minimum number of filters per worker thread, starting threads for only a
+// few filters is not worth it
+#define REGEX_PER_WORKER 32
+
+typedef struct {
+	regexData *regex[REGEX_CLI];
+	unsigned int num[REGEX_CLI];
+	unsigned int workers;
+	double msec;
+} regex_set;
+
+typedef struct {
+	regexData *regex;
+	const char *pattern;
+	enum regex_type regexid;
+	unsigned int index;
+} regex_job;
+
+typedef struct {
+	regex_job *jobs;
+	unsigned int count;
+	atomic_uint next;
+} regex_pool;
+
+// Set compiled ahead of read_regex_from_database(), protected by staged_lock
+static regex_set staged = { 0 };
+static bool staged_ready = false;
+static pthread_mutex_t staged_lock = PTHREAD_MUTEX_INITIALIZER;
+// Serializes warnings of the worker threads as they may be written to the
+// database
+static pthread_mutex_t warning_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void regex_warning(const enum regex_type regexid, const char *warning, const int dbidx, const char *regexin)
+{
+	pthread_mutex_lock(&warning_lock);
+	logg_regex_warning(regextype[regexid], warning, dbidx, regexin);
+	pthread_mutex_unlock(&warning_lock);
+}
+
 #define FTL_REGEX_SEP ";"
 /* Compile regular expressions into data structures that can be used with
    regexec() to match against a string */
-static bool compile_regex(const char *regexin, const enum regex_type regexid, const int dbidx)
+static bool compile_regex(const char *regexin, regexData *regex, const enum regex_type regexid, const int dbidx)
 {
-	regexData *regex = get_regex_ptr(regexid);
-	int index = num_regex[regexid]++;
-
 	// Extract possible Pi-hole extensions
 	char rgxbuf[strlen(regexin) + 1u];
 	// Parse special FTL syntax if present
@@ -168,8 +215,8 @@ static bool compile_regex(const char *regexin, const enum regex_type regexid, co
 			if(sscanf(part, "querytype=%63s", extra))
 			{
 				// Warn if specified more than one querytype option
-				if(regex[index].ext.query_type != 0)
-					logg_regex_warning(regextype[regexid],
+				if(regex->ext.query_type != 0)
+					regex_warning(regexid,
 					                   "Overwriting previous querytype setting",
 					                   dbidx, regexin);
 
@@ -197,14 +244,14 @@ static bool compile_regex(const char *regexin, const enum regex_type regexid, co
 						// Check for querytype
 						if(strcasecmp(token, querytypes[type]) == 0)
 						{
-							regex[index].ext.query_type ^= 1 << type;
+							regex->ext.query_type ^= 1 << type;
 							break;
 						}
 					}
 					// Check if we found a valid query type
-					if(regex[index].ext.query_type == 0)
+					if(regex->ext.query_type == 0)
 					{
-						logg_regex_warning(regextype[regexid],
+						regex_warning(regexid,
 						                   "Unknown query type",
 						                   dbidx, regexin);
 						free(buf);
@@ -217,14 +264,14 @@ static bool compile_regex(const char *regexin, const enum regex_type regexid, co
 
 				// Invert query types if requested
 				if(inverted)
-					regex[index].ext.query_type = ~regex[index].ext.query_type;
+					regex->ext.query_type = ~regex->ext.query_type;
 
-				if(regex[index].ext.query_type != 0 && config.debug & DEBUG_REGEX)
+				if(regex->ext.query_type != 0 && config.debug & DEBUG_REGEX)
 				{
 					logg("    Hint: This regex matches only specific query types:");
 					for(int i = TYPE_A; i < TYPE_MAX; i++)
 					{
-						if(regex[index].ext.query_type & (1 << i))
+						if(regex->ext.query_type & (1 << i))
 							logg("      - %s", querytypes[i]);
 					}
 				}
@@ -232,7 +279,7 @@ static bool compile_regex(const char *regexin, const enum regex_type regexid, co
 			// option: ";invert"
 			else if(strcasecmp(part, "invert") == 0)
 			{
-				regex[index].ext.inverted = true;
+				regex->ext.inverted = true;
 
 				// Debug output
 				if(config.debug & DEBUG_REGEX)
@@ -248,58 +295,58 @@ static bool compile_regex(const char *regexin, const enum regex_type regexid, co
 				if(strcasecmp(extra, "NODATA") == 0)
 				{
 					type = "NODATA";
-					regex[index].ext.reply = REPLY_NODATA;
+					regex->ext.reply = REPLY_NODATA;
 				}
 				else if(strcasecmp(extra, "NXDOMAIN") == 0)
 				{
 					type = "NXDOMAIN";
-					regex[index].ext.reply = REPLY_NXDOMAIN;
+					regex->ext.reply = REPLY_NXDOMAIN;
 				}
 				else if(strcasecmp(extra, "REFUSED") == 0)
 				{
 					type = "REFUSED";
-					regex[index].ext.reply = REPLY_REFUSED;
+					regex->ext.reply = REPLY_REFUSED;
 				}
 				else if(strcasecmp(extra, "IP") == 0)
 				{
 					type = "IP";
-					regex[index].ext.reply = REPLY_IP;
+					regex->ext.reply = REPLY_IP;
 				}
-				else if(inet_pton(AF_INET, extra, &regex[index].ext.addr4) == 1)
+				else if(inet_pton(AF_INET, extra, &regex->ext.addr4) == 1)
 				{
 					// Custom IPv4 target
 					type = extra;
-					regex[index].ext.reply = REPLY_IP;
-					regex[index].ext.custom_ip4 = true;
+					regex->ext.reply = REPLY_IP;
+					regex->ext.custom_ip4 = true;
 				}
-				else if(inet_pton(AF_INET6, extra, &regex[index].ext.addr6) == 1)
+				else if(inet_pton(AF_INET6, extra, &regex->ext.addr6) == 1)
 				{
 					// Custom IPv6 target
 					type = extra;
-					regex[index].ext.reply = REPLY_IP;
-					regex[index].ext.custom_ip6 = true;
+					regex->ext.reply = REPLY_IP;
+					regex->ext.custom_ip6 = true;
 				}
 				else if(strcasecmp(extra, "NONE") == 0)
 				{
 					type = "NONE";
-					regex[index].ext.reply = REPLY_NONE;
+					regex->ext.reply = REPLY_NONE;
 				}
 				else
 				{
 					char msg[64] = { 0 };
 					snprintf(msg, sizeof(msg)-1, "Unknown reply type \"%s\"", extra);
-					logg_regex_warning(regextype[regexid], msg, dbidx, regexin);
+					regex_warning(regexid, msg, dbidx, regexin);
 				}
 
 				// Debug output
-				if(config.debug & DEBUG_REGEX && regex[index].ext.reply != REPLY_UNKNOWN)
+				if(config.debug & DEBUG_REGEX && regex->ext.reply != REPLY_UNKNOWN)
 					logg("   This regex will result in a custom reply: %s", type);
 			}
 			else
 			{
 				char hint[40 + strlen(part)];
 				snprintf(hint, sizeof(hint)-1, "Option \"%s\" not known, ignoring it.", part);
-				logg_regex_warning(regextype[regexid], hint,
+				regex_warning(regexid, hint,
 				                   dbidx, regexin);
 			}
 		}
@@ -313,22 +360,22 @@ static bool compile_regex(const char *regexin, const enum regex_type regexid, co
 
 	// We use the extended RegEx flavor (ERE) and specify that matching should
 	// always be case INsensitive
-	const int errcode = regcomp(&regex[index].regex, rgxbuf, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+	const int errcode = regcomp(&regex->regex, rgxbuf, REG_EXTENDED | REG_ICASE | REG_NOSUB);
 	if(errcode != 0)
 	{
 		// Get error string and log it
-		const size_t length = regerror(errcode, &regex[index].regex, NULL, 0);
+		const size_t length = regerror(errcode, &regex->regex, NULL, 0);
 		char *buffer = calloc(length, sizeof(char));
-		(void) regerror (errcode, &regex[index].regex, buffer, length);
-		logg_regex_warning(regextype[regexid], buffer, dbidx, regexin);
+		(void) regerror (errcode, &regex->regex, buffer, length);
+		regex_warning(regexid, buffer, dbidx, regexin);
 		free(buffer);
-		regex[index].available = false;
+		regex->available = false;
 		return false;
 	}
 
 	// Store compiled regex string in buffer
-	regex[index].string = strdup(regexin);
-	regex[index].available = true;
+	regex->string = strdup(regexin);
+	regex->available = true;
 
 	return true;
 }
@@ -526,6 +573,24 @@ bool in_regex(const char *domain, DNSCacheData *dns_cache, const int clientID, c
 	return false;
 }
 
+// Free all compiled filters of one regex array
+static void free_regex_entries(regexData *regex, const unsigned int count)
+{
+	// Loop over entries with this regex type
+	for(unsigned int index = 0; index < count; index++)
+	{
+		if(regex[index].available)
+			regfree(&regex[index].regex);
+
+		// Also free buffered regex strings
+		if(regex[index].string != NULL)
+		{
+			free(regex[index].string);
+			regex[index].string = NULL;
+		}
+	}
+}
+
 static void free_regex(void)
 {
 	// Return early if we don't use any regex filters
@@ -562,30 +627,11 @@ static void free_regex(void)
 
 		if(config.debug & DEBUG_DATABASE)
 		{
-			logg("Going to free %i entries in %s regex struct",
-			     oldcount, regextype[regexid]);
+			logg("Going to free %i entries in %s regex struct (%p)",
+			     oldcount, regextype[regexid], regex);
 		}
 
-		// Loop over entries with this regex type
-		for(unsigned int index = 0; index < oldcount; index++)
-		{
-			if(!regex[index].available)
-				continue;
-
-			regfree(&regex[index].regex);
-
-			// Also free buffered regex strings
-			if(regex[index].string != NULL)
-			{
-				free(regex[index].string);
-				regex[index].string = NULL;
-			}
-		}
-
-		if(config.debug & DEBUG_DATABASE)
-		{
-			logg("Loop done, freeing regex pointer (%p)", regex);
-		}
+		free_regex_entries(regex, oldcount);
 
 		// Free array with regex datastructure
 		free_regex_ptr(regexid);
@@ -617,116 +663,243 @@ void reload_per_client_regex(clientsData *client)
 		                                  "vw_regex_whitelist");
 }
 
-static void read_regex_table(const enum regex_type regexid)
+// Read all non-empty filters of one type into the set. The patterns are
+// stored in the string field until they are compiled
+static bool read_regex_table(sqlite3 *db, const enum regex_type regexid, regex_set *set)
 {
-	// Get table ID
-	const enum gravity_tables tableID = (regexid == REGEX_BLACKLIST) ? REGEX_BLACKLIST_TABLE : REGEX_WHITELIST_TABLE;
-
 	if(config.debug & DEBUG_DATABASE)
 		logg("Reading regex %s from database", regextype[regexid]);
 
-	// Get number of lines in the regex table
-	num_regex[regexid] = 0;
-	int count = gravityDB_count(tableID);
+	const char *querystr = regexid == REGEX_BLACKLIST ?
+		"SELECT domain, id FROM vw_regex_blacklist GROUP BY id;" :
+		"SELECT domain, id FROM vw_regex_whitelist GROUP BY id;";
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("read_regex_table(%s) - SQL error prepare: %s", regextype[regexid], sqlite3_errstr(rc));
+		return false;
+	}
 
-	if(count == 0)
+	unsigned int size = 0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
 	{
-		return;
+		// Skip this entry if empty: an empty regex filter would match
+		// anything anywhere and hence match all incoming domains. A user
+		// can still achieve this with a filter such as ".*", however empty
+		// filters in the regex table are probably not expected to have such
+		// an effect and would immediately lead to "blocking or whitelisting
+		// the entire Internet"
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		if(domain == NULL || strlen(domain) < 1)
+			continue;
+
+		// Grow array if needed
+		if(set->num[regexid] >= size)
+		{
+			size = size > 0 ? 2*size : 64;
+			regexData *regex = realloc(set->regex[regexid], size*sizeof(regexData));
+			if(regex == NULL)
+			{
+				logg("WARN: read_regex_table(%s): Failed to allocate memory", regextype[regexid]);
+				break;
+			}
+			set->regex[regexid] = regex;
+		}
+
+		regexData *regex = &set->regex[regexid][set->num[regexid]++];
+		memset(regex, 0, sizeof(*regex));
+		regex->database_id = sqlite3_column_int(stmt, 1);
+		regex->string = strdup(domain);
 	}
-	else if(count < 0)
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE && rc != SQLITE_ROW)
 	{
-		logg("WARN: Database query failed, assuming there are no %s regex entries", regextype[regexid]);
-		return;
+		logg("read_regex_table(%s) - SQL error step: %s", regextype[regexid], sqlite3_errstr(rc));
+		return false;
 	}
 
-	// Allocate memory for regex
-	regexData *regex = NULL;
-	if(regexid == REGEX_BLACKLIST)
+	if(config.debug & DEBUG_DATABASE)
 	{
-		black_regex = calloc(count, sizeof(regexData));
-		regex = black_regex;
+		logg("Read %i %s regex entries",
+		     set->num[regexid],
+		     regextype[regexid]);
 	}
-	else
+
+	return true;
+}
+
+static void *regex_compile_worker(void *arg)
+{
+	regex_pool *pool = arg;
+	unsigned int i;
+	while((i = atomic_fetch_add(&pool->next, 1)) < pool->count)
 	{
-		white_regex = calloc(count, sizeof(regexData));
-		regex = white_regex;
+		regex_job *job = &pool->jobs[i];
+		if(config.debug & DEBUG_REGEX)
+		{
+			logg("Compiling %s regex %u (DB ID %i): %s",
+			     regextype[job->regexid], job->index, job->regex->database_id, job->pattern);
+		}
+		compile_regex(job->pattern, job->regex, job->regexid, job->regex->database_id);
 	}
 
-	// Connect to regex table
-	if(!gravityDB_getTable(tableID))
+	return NULL;
+}
+
+// Compile all filters of the set, the calling thread takes part in the work
+static void compile_regex_set(regex_set *set)
+{
+	const unsigned int count = set->num[REGEX_BLACKLIST] + set->num[REGEX_WHITELIST];
+	regex_pool pool = { .jobs = calloc(count, sizeof(regex_job)), .count = 0 };
+	if(pool.jobs == NULL && count > 0)
 	{
-		logg("read_regex_from_database(): Error getting %s regex table from database",
-		     regextype[regexid]);
+		logg("WARN: compile_regex_set(): Failed to allocate memory");
 		return;
 	}
 
-	// Walk database table
-	const char *domain = NULL;
-	int rowid = 0;
-	while((domain = gravityDB_getDomain(&rowid)) != NULL)
+	// Take the patterns out of the string fields, compile_regex() sets
+	// them again when the filter could be compiled
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
 	{
-		// Avoid buffer overflow if database table changed
-		// since we counted its entries
-		if(num_regex[regexid] >= (unsigned int)count)
+		for(unsigned int i = 0; i < set->num[regexid]; i++)
 		{
-			logg("INFO: read_regex_table(%s) exiting early to avoid overflow (%d/%d).",
-			     regextype[regexid], num_regex[regexid], count);
-			break;
+			regex_job *job = &pool.jobs[pool.count++];
+			job->regex = &set->regex[regexid][i];
+			job->pattern = job->regex->string;
+			job->regexid = regexid;
+			job->index = i;
+			job->regex->string = NULL;
 		}
+	}
+	atomic_init(&pool.next, 0);
 
-		// Skip this entry if empty: an empty regex filter would match
-		// anything anywhere and hence match all incoming domains. A user
-		// can still achieve this with a filter such as ".*", however empty
-		// filters in the regex table are probably not expected to have such
-		// an effect and would immediately lead to "blocking or whitelisting
-		// the entire Internet"
-		if(strlen(domain) < 1)
-			continue;
+	// TCP workers compile synchronously, threads do not mix well with
+	// fork() and they only ever recompile a few changed filters
+	unsigned int workers = 1;
+	if(getpid() == main_pid())
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cpus > 0 ? (unsigned int)cpus : 1;
+		if(workers > REGEX_MAX_WORKERS)
+			workers = REGEX_MAX_WORKERS;
+		if(workers > count / REGEX_PER_WORKER)
+			workers = MAX(count / REGEX_PER_WORKER, 1u);
+	}
 
-		// Compile this regex
-		if(config.debug & DEBUG_REGEX)
+	pthread_t threads[REGEX_MAX_WORKERS];
+	unsigned int started = 0;
+	for(unsigned int i = 1; i < workers; i++)
+	{
+		const int ret = pthread_create(&threads[started], NULL, regex_compile_worker, &pool);
+		if(ret != 0)
 		{
-			logg("Compiling %s regex %i (DB ID %i): %s",
-			     regextype[regexid], num_regex[regexid], rowid, domain);
+			logg("WARN: Unable to start regex compilation thread: %s", strerror(ret));
+			break;
 		}
+		started++;
+	}
+	set->workers = started + 1;
+
+	regex_compile_worker(&pool);
+	for(unsigned int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for(unsigned int i = 0; i < pool.count; i++)
+		free((char*)pool.jobs[i].pattern);
+	if(pool.jobs != NULL)
+		free(pool.jobs);
+}
+
+// Read and compile all regex filters from the gravity database. This uses a
+// connection of its own and does not touch the filters currently in use
+static void build_regex_set(regex_set *set)
+{
+	memset(set, 0, sizeof(*set));
+	timer_start(REGEX_TIMER);
 
-		compile_regex(domain, regexid, rowid);
-		regex[num_regex[regexid]-1].database_id = rowid;
+	sqlite3 *db = NULL;
+	int rc = sqlite3_open_v2(FTLfiles.gravity_db, &db, SQLITE_OPEN_READONLY, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("WARN: Cannot open gravity database (%s), assuming there are no regex entries",
+		     sqlite3_errstr(rc));
+		sqlite3_close(db);
+		return;
+	}
 
-		// Signal other forks that the regex data has changed and should be updated
-		regex_change = ++counters->regex_change;
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
+	{
+		if(!read_regex_table(db, regexid, set))
+			logg("WARN: Database query failed, assuming there are no %s regex entries", regextype[regexid]);
 	}
+	sqlite3_close(db);
 
-	// Finalize statement and close gravity database handle
-	gravityDB_finalizeTable();
+	compile_regex_set(set);
+	set->msec = timer_elapsed_msec(REGEX_TIMER);
+}
 
-	if(config.debug & DEBUG_DATABASE)
+// Compile the regex filters ahead of read_regex_from_database(). This does
+// not need the shared memory lock so DNS queries are still answered while the
+// (possibly) many filters are compiled
+void prepare_regex_from_database(void)
+{
+	regex_set set;
+	build_regex_set(&set);
+
+	pthread_mutex_lock(&staged_lock);
+	if(staged_ready)
 	{
-		logg("Read %i %s regex entries",
-		     num_regex[regexid],
-		     regextype[regexid]);
+		for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
+		{
+			if(staged.regex[regexid] == NULL)
+				continue;
+			free_regex_entries(staged.regex[regexid], staged.num[regexid]);
+			free(staged.regex[regexid]);
+		}
 	}
+	staged = set;
+	staged_ready = true;
+	pthread_mutex_unlock(&staged_lock);
 }
 
-void read_regex_from_database(void)
+// Replace the filters in use by the given set
+static void install_regex_set(const regex_set *set)
 {
 	// Free regex filters
 	// This routine is safe to be called even when there
 	// are no regex filters at the moment
 	free_regex();
 
-	// Start timer for regex compilation analysis
-	timer_start(REGEX_TIMER);
+	black_regex = set->regex[REGEX_BLACKLIST];
+	num_regex[REGEX_BLACKLIST] = set->num[REGEX_BLACKLIST];
+	white_regex = set->regex[REGEX_WHITELIST];
+	num_regex[REGEX_WHITELIST] = set->num[REGEX_WHITELIST];
 
-	// Read and compile regex blacklist
-	read_regex_table(REGEX_BLACKLIST);
+	// Signal other forks that the regex data has changed and should be updated
+	regex_change = ++counters->regex_change;
+}
 
-	// Read and compile regex whitelist
-	read_regex_table(REGEX_WHITELIST);
+void read_regex_from_database(void)
+{
+	// Use the filters compiled by prepare_regex_from_database() if
+	// available, compile them now otherwise
+	regex_set set;
+	pthread_mutex_lock(&staged_lock);
+	const bool ready = staged_ready;
+	set = staged;
+	staged_ready = false;
+	pthread_mutex_unlock(&staged_lock);
+	if(!ready)
+		build_regex_set(&set);
+
+	install_regex_set(&set);
 
 	// Loop over all clients and ensure we have enough space and load
 	// per-client regex data, not all of the regex read and compiled above
 	// will also be used by all clients
+	timer_start(REGEX_TIMER);
 	if(config.debug & DEBUG_DATABASE)
 		logg("Loading per-client regex data");
 	for(int clientID = 0; clientID < counters->clients; clientID++)
@@ -741,8 +914,10 @@ void read_regex_from_database(void)
 	}
 
 	// Print message to FTL's log after reloading regex filters
-	logg("Compiled %i whitelist and %i blacklist regex filters for %i clients in %.1f msec",
+	logg("Compiled %i whitelist and %i blacklist regex filters in %.1f msec (%u thread%s), "
+	     "loaded them for %i clients in %.1f msec",
 	     num_regex[REGEX_WHITELIST], num_regex[REGEX_BLACKLIST],
+	     set.msec, set.workers, set.workers == 1 ? "" : "s",
 	     counters->clients, timer_elapsed_msec(REGEX_TIMER));
 }
 
@@ -766,15 +941,15 @@ int regex_test(const bool debug_mode, const bool quiet, const char *domainin, co
 	{
 		// Read and compile regex lists from database
 		logg("%s Loading regex filters from database...", cli_info());
-		timer_start(REGEX_TIMER);
 		log_ctrl(false, true); // Temporarily re-enable terminal output for error logging
-		read_regex_table(REGEX_BLACKLIST);
-		read_regex_table(REGEX_WHITELIST);
+		regex_set set;
+		build_regex_set(&set);
+		install_regex_set(&set);
 		log_ctrl(false, !quiet); // Re-apply quiet option after compilation
 		logg("    Compiled %i black- and %i whitelist regex filters in %.3f msec\n",
 		     num_regex[REGEX_BLACKLIST],
 		     num_regex[REGEX_WHITELIST],
-		     timer_elapsed_msec(REGEX_TIMER));
+		     set.msec);
 
 		// Check user-provided domain against all loaded regular blacklist expressions
 		logg("%s Checking domain against blacklist...", cli_info());
@@ -799,8 +974,9 @@ int regex_test(const bool debug_mode, const bool quiet, const char *domainin, co
 		// Compile CLI regex
 		timer_start(REGEX_TIMER);
 		log_ctrl(false, true); // Temporarily re-enable terminal output for error logging
-		if(!compile_regex(regexin, REGEX_CLI, -1))
+		if(!compile_regex(regexin, cli_regex, REGEX_CLI, -1))
 			return EXIT_FAILURE;
+		num_regex[REGEX_CLI] = 1;
 		log_ctrl(false, !quiet); // Re-apply quiet option after compilation
 		logg("    Compiled regex filter in %.3f msec\n", timer_elapsed_msec(REGEX_TIMER));
 
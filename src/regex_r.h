@@ -46,6 +46,7 @@ unsigned int get_num_regex(const enum regex_type regexid) __attribute__((pure));
 bool in_regex(const char *domain, DNSCacheData *dns_cache, const int clientID, const enum regex_type regexid);
 void allocate_regex_client_enabled(clientsData *client, const int clientID);
 void reload_per_client_regex(clientsData *client);
+void prepare_regex_from_database(void);
 void read_regex_from_database(void);
 bool regex_get_redirect(const int regexID, struct in_addr *addr4, struct in6_addr *addr6);
 
@@ -31,6 +31,11 @@
 #include "database/message-table.h"
 // Eventqueue routines
 #include "events.h"
+// poll()
+#include <poll.h>
+// hashStr()
+#include "datastructure.h"
+#include <stdatomic.h>
 
 static bool res_initialized = false;
 
@@ -317,109 +322,293 @@ char *resolveHostname(const char *addr)
 	return hostname;
 }
 
-// Resolve upstream destination host names
-static size_t resolveAndAddHostname(size_t ippos, size_t oldnamepos)
+// Maximum number of PTR queries in flight at the same time
+#define RESOLVER_MAX_INFLIGHT 64
+// Time to wait for a reply before a query is sent again [milliseconds]
+#define RESOLVER_TIMEOUT 2000
+// Number of attempts per name server before trying the next one
+#define RESOLVER_TRIES 2
+// Number of results applied to shared memory under one lock
+#define RESOLVER_APPLY_BATCH 128
+// FTL + the system's name servers
+#define RESOLVER_MAX_SERVERS (MAXNS + 1)
+// We do not use EDNS(0), replies can hence not be larger than this
+#define RESOLVER_PACKET_SIZE 512
+// Size of a query: header + question for the longest name (ip6.arpa) + type + class
+#define RESOLVER_QUERY_SIZE 96
+// Host names are cached at least/at most this long, regardless of the TTL of
+// the PTR record [seconds]
+#define HOSTNAME_CACHE_MIN_TTL 60
+#define HOSTNAME_CACHE_MAX_TTL 86400
+// Cache time of negative replies without SOA record [seconds]
+#define HOSTNAME_CACHE_NEG_TTL 300
+
+enum resolve_target { RESOLVE_CLIENT, RESOLVE_UPSTREAM };
+// Lists of jobs: new clients and upstreams are resolved first
+enum resolve_list { LIST_NEW, LIST_KNOWN, LIST_MAX };
+
+typedef struct {
+	enum resolve_target target;
+	bool newflag;
+	unsigned char server;
+	unsigned char tries;
+	// At least one server replied that there is no PTR record
+	bool negative;
+	uint32_t negative_ttl;
+	int id;
+	size_t oldnamepos;
+	char ip[INET6_ADDRSTRLEN];
+	// Result, NULL while the job is not finished
+	char *name;
+} resolve_job;
+
+typedef struct {
+	enum resolve_list list;
+	unsigned int job;
+} job_ref;
+
+typedef struct {
+	bool active;
+	uint16_t qid;
+	job_ref ref;
+	long long deadline;
+	size_t qlen;
+	unsigned char query[RESOLVER_QUERY_SIZE];
+} inflight_query;
+
+typedef struct {
+	struct {
+		resolve_job *jobs;
+		unsigned int count;
+		// Next job to be started
+		unsigned int next;
+	} lists[LIST_MAX];
+	inflight_query inflight[RESOLVER_MAX_INFLIGHT];
+	unsigned int num_inflight;
+	struct sockaddr_in servers[RESOLVER_MAX_SERVERS];
+	unsigned int num_servers;
+	// Finished jobs not yet stored in shared memory
+	job_ref *finished;
+	unsigned int num_finished;
+	unsigned int finished_new;
+	uint16_t next_qid;
+	int fd;
+	// Statistics
+	unsigned int resolved, skipped;
+} resolver_run;
+
+// Cache of PTR lookup results keyed by IP address. It is only used by the
+// resolver thread, the statistics may be read by other threads
+typedef struct {
+	char ip[INET6_ADDRSTRLEN];
+	// NULL for negative entries (no PTR record)
+	char *name;
+	time_t expires;
+} hostname_cache_entry;
+
+static struct {
+	hostname_cache_entry *entries;
+	// Always a power of two
+	unsigned int size;
+	unsigned int used;
+} hostname_cache = { NULL, 0u, 0u };
+
+static struct {
+	atomic_uint entries;
+	atomic_uint hits;
+	atomic_uint negative_hits;
+	atomic_uint misses;
+} hostname_cache_stats;
+
+static hostname_cache_entry * __attribute__((pure)) find_hostname_cache_slot(hostname_cache_entry *entries,
+                                                                              const unsigned int size, const char *ip)
 {
-	// Get IP and host name strings. They are cloned in case shared memory is
-	// resized before the next lock
-	lock_shm();
-	char *ipaddr = strdup(getstr(ippos));
-	char *oldname = strdup(getstr(oldnamepos));
-	unlock_shm();
+	// Open addressing with linear probing, the table is never full
+	unsigned int i = hashStr(ip) & (size - 1);
+	while(entries[i].ip[0] != '\0' && strcmp(entries[i].ip, ip) != 0)
+		i = (i + 1) & (size - 1);
+	return &entries[i];
+}
 
-	// Test if we want to resolve host names, otherwise all calls to resolveHostname()
-	// and getNameFromIP() can be skipped as they will all return empty names (= no records)
-	if(!resolve_this_name(ipaddr))
+// Get cached host name of <ip>. Returns false if there is no valid entry,
+// otherwise <name> points to the cached name (NULL if there is no PTR record)
+static bool lookup_hostname_cache(const char *ip, const time_t now, const char **name)
+{
+	if(hostname_cache.size == 0)
 	{
-		if(config.debug & DEBUG_RESOLVER)
-			logg(" ---> \"\" (configured to not resolve host name)");
-
-		// Free allocated memory
-		free(ipaddr);
-		free(oldname);
-
-		// Return fixed position of empty string
-		return 0;
+		atomic_fetch_add(&hostname_cache_stats.misses, 1);
+		return false;
 	}
 
-	// Important: Don't hold a lock while resolving as the main thread
-	// (dnsmasq) needs to be operable during the call to resolveHostname()
-	char *newname = resolveHostname(ipaddr);
-
-	// If no hostname was found, try to obtain hostname from the network table
-	// This may be disabled due to a user setting
-	if(strlen(newname) == 0 && config.names_from_netdb)
+	const hostname_cache_entry *entry = find_hostname_cache_slot(hostname_cache.entries, hostname_cache.size, ip);
+	if(entry->ip[0] == '\0' || entry->expires <= now)
 	{
-		free(newname);
-		newname = getNameFromIP(NULL, ipaddr);
-		if(newname != NULL && config.debug & DEBUG_RESOLVER)
-			logg(" ---> \"%s\" (provided by database)", newname);
+		atomic_fetch_add(&hostname_cache_stats.misses, 1);
+		return false;
 	}
 
-	// Only store new newname if it is valid and differs from oldname
-	// We do not need to check for oldname == NULL as names are
-	// always initialized with an empty string at position 0
-	if(newname != NULL && strcmp(oldname, newname) != 0)
+	*name = entry->name;
+	if(entry->name != NULL)
+		atomic_fetch_add(&hostname_cache_stats.hits, 1);
+	else
+		atomic_fetch_add(&hostname_cache_stats.negative_hits, 1);
+	return true;
+}
+
+// Rebuild the cache without its expired entries. The table is only grown if
+// it would still be more than half full afterwards
+static bool resize_hostname_cache(const time_t now)
+{
+	unsigned int live = 0u;
+	for(unsigned int i = 0; i < hostname_cache.size; i++)
+		if(hostname_cache.entries[i].ip[0] != '\0' && hostname_cache.entries[i].expires > now)
+			live++;
+
+	unsigned int newsize = hostname_cache.size > 0 ? hostname_cache.size : 256u;
+	while(2*(live + 1) > newsize)
+		newsize *= 2;
+
+	hostname_cache_entry *entries = calloc(newsize, sizeof(hostname_cache_entry));
+	if(entries == NULL)
+		return false;
+
+	unsigned int used = 0u;
+	for(unsigned int i = 0; i < hostname_cache.size; i++)
 	{
-		lock_shm();
-		size_t newnamepos = addstr(newname);
-		// newname has already been checked against NULL
-		// so we can safely free it
-		free(newname);
-		free(ipaddr);
-		free(oldname);
-		unlock_shm();
-		return newnamepos;
+		hostname_cache_entry *old = &hostname_cache.entries[i];
+		if(old->ip[0] == '\0')
+			continue;
+		if(old->expires <= now)
+		{
+			if(old->name != NULL)
+				free(old->name);
+			continue;
+		}
+		*find_hostname_cache_slot(entries, newsize, old->ip) = *old;
+		used++;
 	}
-	else if(config.debug & DEBUG_SHMEM)
+
+	if(hostname_cache.entries != NULL)
+		free(hostname_cache.entries);
+	hostname_cache.entries = entries;
+	hostname_cache.size = newsize;
+	hostname_cache.used = used;
+	atomic_store(&hostname_cache_stats.entries, used);
+	return true;
+}
+
+// Store the result of a PTR lookup (name == NULL: no PTR record)
+static void store_hostname_cache(const char *ip, const char *name, uint32_t ttl)
+{
+	const time_t now = time(NULL);
+
+	// Keep the load factor below 3/4
+	if(4*(hostname_cache.used + 1) > 3*hostname_cache.size && !resize_hostname_cache(now))
+		return;
+
+	if(ttl < HOSTNAME_CACHE_MIN_TTL)
+		ttl = HOSTNAME_CACHE_MIN_TTL;
+	else if(ttl > HOSTNAME_CACHE_MAX_TTL)
+		ttl = HOSTNAME_CACHE_MAX_TTL;
+
+	hostname_cache_entry *entry = find_hostname_cache_slot(hostname_cache.entries, hostname_cache.size, ip);
+	if(entry->ip[0] == '\0')
 	{
-		// Debugging output
-		logg("Not adding \"%s\" to buffer (unchanged)", oldname);
+		strncpy(entry->ip, ip, sizeof(entry->ip) - 1);
+		hostname_cache.used++;
+		atomic_store(&hostname_cache_stats.entries, hostname_cache.used);
 	}
+	else if(entry->name != NULL)
+		free(entry->name);
+
+	entry->name = name != NULL ? strdup(name) : NULL;
+	entry->expires = now + ttl;
+}
+
+// Forget all cached host names (used when refreshing is forced)
+static void flush_hostname_cache(void)
+{
+	for(unsigned int i = 0; i < hostname_cache.size; i++)
+		if(hostname_cache.entries[i].name != NULL)
+			free(hostname_cache.entries[i].name);
+	if(hostname_cache.entries != NULL)
+		free(hostname_cache.entries);
+	hostname_cache.entries = NULL;
+	hostname_cache.size = 0u;
+	hostname_cache.used = 0u;
+	atomic_store(&hostname_cache_stats.entries, 0);
+}
 
-	if(newname != NULL)
-		free(newname);
-	free(ipaddr);
-	free(oldname);
+void get_hostname_cache_info(struct hostname_cache_info *info)
+{
+	info->entries = atomic_load(&hostname_cache_stats.entries);
+	info->hits = atomic_load(&hostname_cache_stats.hits);
+	info->negative_hits = atomic_load(&hostname_cache_stats.negative_hits);
+	info->misses = atomic_load(&hostname_cache_stats.misses);
+}
+
+static long long monotonic_msec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
 
-	// Not changed, return old namepos
-	return oldnamepos;
+static resolve_job *get_job(resolver_run *run, const job_ref ref)
+{
+	return &run->lists[ref.list].jobs[ref.job];
 }
 
-// Resolve client host names
-static void resolveClients(const bool onlynew, const bool force_refreshing)
+static void add_job(resolver_run *run, const enum resolve_target target, const int id,
+                    const size_t oldnamepos, const char *ip, const bool newflag)
+{
+	const enum resolve_list list = newflag ? LIST_NEW : LIST_KNOWN;
+
+	// Skip clients and upstreams already waiting for their new names
+	if(newflag)
+		for(unsigned int i = 0; i < run->lists[list].count; i++)
+			if(run->lists[list].jobs[i].target == target && run->lists[list].jobs[i].id == id)
+				return;
+
+	resolve_job *jobs = realloc(run->lists[list].jobs, (run->lists[list].count + 1)*sizeof(resolve_job));
+	if(jobs == NULL)
+		return;
+	run->lists[list].jobs = jobs;
+
+	resolve_job *job = &jobs[run->lists[list].count++];
+	memset(job, 0, sizeof(*job));
+	job->target = target;
+	job->newflag = newflag;
+	job->id = id;
+	job->oldnamepos = oldnamepos;
+	strncpy(job->ip, ip, sizeof(job->ip) - 1);
+}
+
+// Collect clients whose host names should be resolved. This is done under
+// a single lock, the actual resolving happens without holding it
+static void resolveClients(resolver_run *run, const bool onlynew, const bool force_refreshing)
 {
 	const time_t now = time(NULL);
-	// Lock counter access here, we use a copy in the following loop
 	lock_shm();
-	int clientscount = counters->clients;
-	unlock_shm();
-
-	int skipped = 0;
+	const int clientscount = counters->clients;
 	for(int clientID = 0; clientID < clientscount; clientID++)
 	{
-		// Memory access needs to get locked
-		lock_shm();
-		// Get client pointer for the first time (reading data)
+		// Get client pointer
 		clientsData* client = getClient(clientID, true);
 		if(client == NULL)
 		{
-			logg("ERROR: Unable to get client pointer (1) with ID %i, skipping...", clientID);
-			skipped++;
-			unlock_shm();
+			logg("ERROR: Unable to get client pointer with ID %i, skipping...", clientID);
+			run->skipped++;
 			continue;
 		}
 
 		// Skip alias-clients
 		if(client->flags.aliasclient)
-		{
-			unlock_shm();
 			continue;
-		}
 
-		bool newflag = client->flags.new;
-		size_t ippos = client->ippos;
-		size_t oldnamepos = client->namepos;
+		const bool newflag = client->flags.new;
+		const size_t ippos = client->ippos;
+		const size_t oldnamepos = client->namepos;
 
 		// Only try to resolve host names of clients which were recently active if we are re-resolving
 		// Limit for a "recently active" client is two hours ago
@@ -430,12 +619,9 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 				logg("Skipping client %s (%s) because it was inactive for %i seconds",
 				     getstr(ippos), getstr(oldnamepos), (int)(now - client->lastQuery));
 			}
-			unlock_shm();
 			continue;
 		}
 
-		unlock_shm();
-
 		// If onlynew flag is set, we will only resolve new clients
 		// If not, we will try to re-resolve all known clients
 		if(!force_refreshing && onlynew && !newflag)
@@ -445,15 +631,13 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 				logg("Skipping client %s (%s) because it is not new",
 				     getstr(ippos), getstr(oldnamepos));
 			}
-			skipped++;
+			run->skipped++;
 			continue;
 		}
 
 		// Check if we want to resolve an IPv6 address
-		bool IPv6 = false;
-		const char *ipaddr = NULL;
-		if((ipaddr = getstr(ippos)) != NULL && strstr(ipaddr,":") != NULL)
-			IPv6 = true;
+		const char *ipaddr = getstr(ippos);
+		const bool IPv6 = ipaddr != NULL && strstr(ipaddr,":") != NULL;
 
 		// If we're in refreshing mode (onlynew == false), we skip clients if
 		// 1. We should not refresh any hostnames
@@ -477,79 +661,37 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 
 				logg("Skipping client %s (%s) because it should not be refreshed: %s",
 				     getstr(ippos), getstr(oldnamepos), reason);
-			}
-			skipped++;
-			if(config.debug & DEBUG_RESOLVER)
-			{
-				lock_shm();
 				logg("Client %s -> \"%s\" already known", getstr(ippos), getstr(oldnamepos));
-				unlock_shm();
 			}
+			run->skipped++;
 			continue;
 		}
 
-		// Obtain/update hostname of this client
-		size_t newnamepos = resolveAndAddHostname(ippos, oldnamepos);
-
-		lock_shm();
-		// Get client pointer for the second time (writing data)
-		// We cannot use the same pointer again as we released
-		// the lock in between so we cannot know if something
-		// happened to the shared memory object (resize event)
-		client = getClient(clientID, true);
-		if(client == NULL)
-		{
-			logg("ERROR: Unable to get client pointer (2) with ID %i, skipping...", clientID);
-			skipped++;
-			unlock_shm();
-			continue;
-		}
-
-		// Store obtained host name (may be unchanged)
-		client->namepos = newnamepos;
-		// Mark entry as not new
-		client->flags.new = false;
-
-		if(config.debug & DEBUG_RESOLVER)
-			logg("Client %s -> \"%s\" is new", getstr(ippos), getstr(newnamepos));
-
-		unlock_shm();
-	}
-
-	if(config.debug & DEBUG_RESOLVER)
-	{
-		logg("%i / %i client host names resolved",
-		     clientscount-skipped, clientscount);
+		add_job(run, RESOLVE_CLIENT, clientID, oldnamepos, ipaddr, newflag);
 	}
+	unlock_shm();
 }
 
-// Resolve upstream destination host names
-static void resolveUpstreams(const bool onlynew)
+// Collect upstream destinations whose host names should be resolved
+static void resolveUpstreams(resolver_run *run, const bool onlynew)
 {
 	const time_t now = time(NULL);
-	// Lock counter access here, we use a copy in the following loop
 	lock_shm();
-	int upstreams = counters->upstreams;
-	unlock_shm();
-
-	int skipped = 0;
+	const int upstreams = counters->upstreams;
 	for(int upstreamID = 0; upstreamID < upstreams; upstreamID++)
 	{
-		// Memory access needs to get locked
-		lock_shm();
-		// Get upstream pointer for the first time (reading data)
+		// Get upstream pointer
 		upstreamsData* upstream = getUpstream(upstreamID, true);
 		if(upstream == NULL)
 		{
 			logg("ERROR: Unable to get upstream pointer with ID %i, skipping...", upstreamID);
-			skipped++;
-			unlock_shm();
+			run->skipped++;
 			continue;
 		}
 
-		bool newflag = upstream->new;
-		size_t ippos = upstream->ippos;
-		size_t oldnamepos = upstream->namepos;
+		const bool newflag = upstream->new;
+		const size_t ippos = upstream->ippos;
+		const size_t oldnamepos = upstream->namepos;
 
 		// Only try to resolve host names of upstream servers which were recently active
 		// Limit for a "recently active" upstream server is two hours ago
@@ -560,58 +702,632 @@ static void resolveUpstreams(const bool onlynew)
 				logg("Skipping upstream %s (%s) because it was inactive for %i seconds",
 				     getstr(ippos), getstr(oldnamepos), (int)(now - upstream->lastQuery));
 			}
-			unlock_shm();
 			continue;
 		}
-		unlock_shm();
 
 		// If onlynew flag is set, we will only resolve new upstream destinations
 		// If not, we will try to re-resolve all known upstream destinations
 		if(onlynew && !newflag)
 		{
-			skipped++;
+			run->skipped++;
 			if(config.debug & DEBUG_RESOLVER)
-			{
-				lock_shm();
 				logg("Upstream %s -> \"%s\" already known", getstr(ippos), getstr(oldnamepos));
-				unlock_shm();
-			}
 			continue;
 		}
 
-		// Obtain/update hostname of this client
-		size_t newnamepos = resolveAndAddHostname(ippos, oldnamepos);
+		add_job(run, RESOLVE_UPSTREAM, upstreamID, oldnamepos, getstr(ippos), newflag);
+	}
+	unlock_shm();
+}
 
-		lock_shm();
-		// Get upstream pointer for the second time (writing data)
-		// We cannot use the same pointer again as we released
-		// the lock in between so we cannot know if something
-		// happened to the shared memory object (resize event)
-		upstream = getUpstream(upstreamID, true);
-		if(upstream == NULL)
+// Name servers asked for PTR records: FTL itself and, if FTL is not the
+// primary system resolver, the configured IPv4 system resolvers (necessary for
+// docker and friends)
+static void setup_resolver_servers(resolver_run *run)
+{
+	// Initialize resolver subroutines if trying to resolve for the first time
+	// res_init() reads resolv.conf to get the default domain name and name server
+	// address(es). If no server is given, the local host is tried. If no domain
+	// is given, that associated with the local host is used.
+	if(!res_initialized)
+	{
+		res_init();
+		res_initialized = true;
+	}
+
+	// INADDR_LOOPBACK is in host byte order, however, in_addr has to be in
+	// network byte order, convert it here if necessary
+	run->servers[0].sin_family = AF_INET;
+	run->servers[0].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	run->servers[0].sin_port = htons(config.dns_port);
+	run->num_servers = 1;
+
+	for(int i = 0; i < _res.nscount && i < MAXNS; i++)
+	{
+		const struct sockaddr_in *ns = &_res.nsaddr_list[i];
+		if(ns->sin_family != AF_INET ||
+		   (ns->sin_addr.s_addr == run->servers[0].sin_addr.s_addr &&
+		    ns->sin_port == run->servers[0].sin_port))
+			continue;
+		run->servers[run->num_servers++] = *ns;
+	}
+
+	if(config.debug & DEBUG_RESOLVER)
+		print_used_resolvers("Resolving PTR records using FTL and the following system nameservers:");
+}
+
+// Build a PTR query for the address of the given job. Returns the length of
+// the query or zero if the address is invalid
+static size_t build_ptr_query(unsigned char *buf, const uint16_t qid, const char *ip)
+{
+	char name[80] = { 0 };
+	unsigned char addr[16];
+	if(strstr(ip, ":") != NULL)
+	{
+		if(inet_pton(AF_INET6, ip, addr) != 1)
+			return 0;
+		// Nibble format: b.a.9.8.7.6.5.4.3.2.1.0.ip6.arpa
+		size_t pos = 0;
+		for(int i = 15; i >= 0; i--)
+			pos += snprintf(name + pos, sizeof(name) - pos, "%x.%x.", addr[i] & 0x0f, addr[i] >> 4);
+		snprintf(name + pos, sizeof(name) - pos, "ip6.arpa");
+	}
+	else
+	{
+		if(inet_pton(AF_INET, ip, addr) != 1)
+			return 0;
+		snprintf(name, sizeof(name), "%u.%u.%u.%u.in-addr.arpa",
+		         addr[3], addr[2], addr[1], addr[0]);
+	}
+
+	// Header: ID, recursion desired, one question
+	memset(buf, 0, 12);
+	buf[0] = qid >> 8;
+	buf[1] = qid & 0xff;
+	buf[2] = 0x01;
+	buf[5] = 1;
+	size_t len = 12;
+
+	// Question name as sequence of labels
+	for(const char *label = name; *label != '\0';)
+	{
+		const char *dot = strchr(label, '.');
+		const size_t llen = dot != NULL ? (size_t)(dot - label) : strlen(label);
+		buf[len++] = llen;
+		memcpy(buf + len, label, llen);
+		len += llen;
+		label += llen + (dot != NULL ? 1 : 0);
+	}
+	buf[len++] = 0;
+
+	// QTYPE = PTR, QCLASS = IN
+	buf[len++] = 0;
+	buf[len++] = 12;
+	buf[len++] = 0;
+	buf[len++] = 1;
+
+	return len;
+}
+
+// Skip a (possibly compressed) name, returns the offset after it or 0
+static size_t __attribute__((pure)) skip_name(const unsigned char *buf, const size_t len, size_t pos)
+{
+	while(pos < len)
+	{
+		const unsigned char l = buf[pos];
+		if((l & 0xc0) == 0xc0)
+			return pos + 2 <= len ? pos + 2 : 0;
+		else if(l == 0)
+			return pos + 1;
+		pos += l + 1u;
+	}
+	return 0;
+}
+
+// Expand a (possibly compressed) name into dotted form
+static bool expand_name(const unsigned char *buf, const size_t len, size_t pos, char *name, const size_t namelen)
+{
+	size_t out = 0;
+	// Limit the number of compression pointers followed to avoid loops
+	for(unsigned int jumps = 0; pos < len && jumps < 32;)
+	{
+		const unsigned char l = buf[pos];
+		if((l & 0xc0) == 0xc0)
 		{
-			logg("ERROR: Unable to get upstream pointer with ID %i, skipping...", upstreamID);
-			skipped++;
-			unlock_shm();
+			if(pos + 1 >= len)
+				return false;
+			pos = ((l & 0x3f) << 8) | buf[pos + 1];
+			jumps++;
 			continue;
 		}
+		else if(l == 0)
+		{
+			name[out] = '\0';
+			return out > 0;
+		}
+		else if(pos + 1 + l > len || out + l + 2 > namelen)
+			return false;
+
+		if(out > 0)
+			name[out++] = '.';
+		memcpy(name + out, buf + pos + 1, l);
+		out += l;
+		pos += l + 1u;
+	}
+	return false;
+}
+
+// Read a 32 bit integer in network byte order
+static uint32_t __attribute__((pure)) read_u32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Parse a reply to our query. Returns true if the reply is complete (even if
+// it contains no PTR record) and stores the first PTR record in <name>. <ttl>
+// is the TTL of this record or, for negative replies, the negative caching
+// time derived from the SOA record (RFC 2308)
+static bool parse_ptr_reply(const unsigned char *buf, const size_t len, const inflight_query *q,
+                            char *name, const size_t namelen, uint32_t *ttl)
+{
+	// The reply has to contain our question
+	if(len < q->qlen || !(buf[2] & 0x80) || buf[4] != 0 || buf[5] != 1)
+		return false;
+	for(size_t i = 12; i < q->qlen; i++)
+		if(tolower(buf[i]) != tolower(q->query[i]))
+			return false;
+
+	// Truncated replies are treated like no reply at all
+	if(buf[2] & 0x02)
+		return false;
+
+	name[0] = '\0';
+	*ttl = HOSTNAME_CACHE_NEG_TTL;
+	const unsigned int rcode = buf[3] & 0x0f;
+
+	// Only NOERROR and NXDOMAIN are definitive answers
+	if(rcode != 0 && rcode != 3)
+	{
+		*ttl = 0;
+		return true;
+	}
+
+	// Walk answer and authority sections
+	unsigned int ancount = (buf[6] << 8) | buf[7];
+	unsigned int nscount = (buf[8] << 8) | buf[9];
+	size_t pos = q->qlen;
+	while(ancount + nscount > 0)
+	{
+		const bool answer = ancount > 0;
+		if(answer)
+			ancount--;
+		else
+			nscount--;
+
+		if((pos = skip_name(buf, len, pos)) == 0 || pos + 10 > len)
+			break;
+		const unsigned int type = (buf[pos] << 8) | buf[pos + 1];
+		const unsigned int class = (buf[pos + 2] << 8) | buf[pos + 3];
+		const uint32_t rrttl = read_u32(buf + pos + 4);
+		const size_t rdlen = (buf[pos + 8] << 8) | buf[pos + 9];
+		pos += 10;
+		if(pos + rdlen > len)
+			break;
+
+		if(answer && type == 12 && class == 1 && expand_name(buf, len, pos, name, namelen))
+		{
+			*ttl = rrttl;
+			return true;
+		}
+		else if(!answer && type == 6)
+		{
+			// SOA: MNAME, RNAME, SERIAL, REFRESH, RETRY, EXPIRE, MINIMUM
+			size_t soa = skip_name(buf, len, pos);
+			if(soa > 0)
+				soa = skip_name(buf, len, soa);
+			if(soa > 0 && soa + 20 <= pos + rdlen)
+			{
+				const uint32_t minimum = read_u32(buf + soa + 16);
+				*ttl = rrttl < minimum ? rrttl : minimum;
+				// A TTL of zero is reserved for server failures below
+				if(*ttl < HOSTNAME_CACHE_MIN_TTL)
+					*ttl = HOSTNAME_CACHE_MIN_TTL;
+			}
+		}
+
+		pos += rdlen;
+	}
+
+	// No PTR record in this reply
+	name[0] = '\0';
+	return true;
+}
 
-		// Store obtained host name (may be unchanged)
-		upstream->namepos = newnamepos;
-		// Mark entry as not new
-		upstream->new = false;
+// Mark a job as finished. If <host> is NULL or empty, no host name was found
+static void finish_job(resolver_run *run, const job_ref ref, const char *host, const char *source)
+{
+	resolve_job *job = get_job(run, ref);
+	char hostname[NI_MAXHOST];
+	if(host != NULL && strlen(host) > 0)
+	{
+		strncpy(hostname, host, sizeof(hostname) - 1);
+		hostname[sizeof(hostname) - 1] = '\0';
+		if(valid_hostname(hostname, job->ip))
+			job->name = strdup(hostname);
+		else
+			job->name = strdup("[invalid host name]");
 
 		if(config.debug & DEBUG_RESOLVER)
-			logg("Upstream %s -> \"%s\" is new", getstr(ippos), getstr(newnamepos));
+			logg("%s ---> \"%s\" (%s)", job->ip, job->name, source);
+	}
+	else
+	{
+		// If no hostname was found, try to obtain hostname from the network table
+		// This may be disabled due to a user setting
+		if(config.names_from_netdb && resolve_this_name(job->ip))
+		{
+			job->name = getNameFromIP(NULL, job->ip);
+			if(job->name != NULL && config.debug & DEBUG_RESOLVER)
+				logg("%s ---> \"%s\" (provided by database)", job->ip, job->name);
+		}
+		if(job->name == NULL)
+		{
+			job->name = strdup("");
+			if(config.debug & DEBUG_RESOLVER)
+				logg("%s ---> \"\" (not found)", job->ip);
+		}
+	}
+
+	job_ref *finished = realloc(run->finished, (run->num_finished + 1)*sizeof(job_ref));
+	if(finished == NULL)
+		return;
+	run->finished = finished;
+	run->finished[run->num_finished++] = ref;
+	if(job->newflag)
+		run->finished_new++;
+}
+
+// Store the names of all finished jobs in shared memory
+static void apply_results(resolver_run *run)
+{
+	if(run->num_finished == 0)
+		return;
+
+	lock_shm();
+	for(unsigned int i = 0; i < run->num_finished; i++)
+	{
+		resolve_job *job = get_job(run, run->finished[i]);
+
+		// Only store new name if it differs from the old name
+		size_t newnamepos = job->oldnamepos;
+		if(job->name != NULL && strcmp(getstr(job->oldnamepos), job->name) != 0)
+			newnamepos = addstr(job->name);
+		else if(config.debug & DEBUG_SHMEM)
+			logg("Not adding \"%s\" to buffer (unchanged)", getstr(job->oldnamepos));
+
+		// Store obtained host name (may be unchanged) and mark entry as not new
+		if(job->target == RESOLVE_CLIENT)
+		{
+			clientsData *client = getClient(job->id, true);
+			if(client == NULL)
+			{
+				logg("ERROR: Unable to get client pointer with ID %i, skipping...", job->id);
+				continue;
+			}
+			client->namepos = newnamepos;
+			client->flags.new = false;
+
+			if(config.debug & DEBUG_RESOLVER)
+				logg("Client %s -> \"%s\" is new", job->ip, getstr(newnamepos));
+		}
+		else
+		{
+			upstreamsData *upstream = getUpstream(job->id, true);
+			if(upstream == NULL)
+			{
+				logg("ERROR: Unable to get upstream pointer with ID %i, skipping...", job->id);
+				continue;
+			}
+			upstream->namepos = newnamepos;
+			upstream->new = false;
+
+			if(config.debug & DEBUG_RESOLVER)
+				logg("Upstream %s -> \"%s\" is new", job->ip, getstr(newnamepos));
+		}
 
-		unlock_shm();
+		if(job->name != NULL)
+		{
+			free(job->name);
+			job->name = NULL;
+		}
+		run->resolved++;
 	}
+	unlock_shm();
+
+	run->num_finished = 0;
+	run->finished_new = 0;
+}
+
+// Send the query of an inflight slot (again) to the job's current server
+static void send_query(resolver_run *run, inflight_query *q)
+{
+	const resolve_job *job = get_job(run, q->ref);
+	const struct sockaddr_in *server = &run->servers[job->server];
+	if(sendto(run->fd, q->query, q->qlen, 0, (const struct sockaddr*)server, sizeof(*server)) < 0 &&
+	   config.debug & DEBUG_RESOLVER)
+		logg("Sending PTR query for %s failed: %s", job->ip, strerror(errno));
+	q->deadline = monotonic_msec() + RESOLVER_TIMEOUT;
+}
+
+// The current server of a job has no (usable) answer, try the next one or
+// give up
+static void next_server(resolver_run *run, inflight_query *q)
+{
+	resolve_job *job = get_job(run, q->ref);
+	if(++job->server < run->num_servers)
+	{
+		job->tries = 1;
+		send_query(run, q);
+		return;
+	}
+
+	// Remember that there is no host name for this address if at least one
+	// server told us so (not if all servers timed out)
+	if(job->negative)
+		store_hostname_cache(job->ip, NULL, job->negative_ttl);
+
+	q->active = false;
+	run->num_inflight--;
+	finish_job(run, q->ref, NULL, NULL);
+}
+
+// Start resolving the next job, returns false if there is nothing left
+static bool start_next_job(resolver_run *run)
+{
+	for(unsigned int list = 0; list < LIST_MAX; list++)
+	{
+		while(run->lists[list].next < run->lists[list].count)
+		{
+			const job_ref ref = { list, run->lists[list].next++ };
+			resolve_job *job = get_job(run, ref);
+
+			if(config.debug & DEBUG_RESOLVER)
+				logg("Trying to resolve %s", job->ip);
+
+			// Check if this is a hidden client
+			// if so, return "hidden" as hostname
+			if(strcmp(job->ip, "0.0.0.0") == 0)
+			{
+				finish_job(run, ref, "hidden", "privacy settings");
+				continue;
+			}
+			// Check if this is the internal client
+			else if(strcmp(job->ip, "::") == 0)
+			{
+				finish_job(run, ref, "pi.hole", "special");
+				continue;
+			}
+			// Check if we want to resolve host names
+			else if(!resolve_this_name(job->ip))
+			{
+				if(config.debug & DEBUG_RESOLVER)
+					logg("Configured to not resolve host name for %s", job->ip);
+				finish_job(run, ref, NULL, NULL);
+				continue;
+			}
+
+			// Use cached name if it is still valid
+			const char *cached = NULL;
+			if(lookup_hostname_cache(job->ip, time(NULL), &cached))
+			{
+				finish_job(run, ref, cached, "cached");
+				continue;
+			}
+
+			// Find a free slot
+			inflight_query *q = NULL;
+			for(unsigned int i = 0; i < RESOLVER_MAX_INFLIGHT; i++)
+				if(!run->inflight[i].active)
+				{
+					q = &run->inflight[i];
+					break;
+				}
+			if(q == NULL)
+				return true;
+
+			q->qid = run->next_qid++;
+			q->qlen = build_ptr_query(q->query, q->qid, job->ip);
+			if(q->qlen == 0)
+			{
+				logg("WARN: Invalid address when trying to resolve hostname: %s", job->ip);
+				finish_job(run, ref, NULL, NULL);
+				continue;
+			}
+			q->ref = ref;
+			q->active = true;
+			job->server = 0;
+			job->tries = 1;
+			job->negative = false;
+			run->num_inflight++;
+			send_query(run, q);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Read and process all replies waiting on the socket
+static void receive_replies(resolver_run *run)
+{
+	unsigned char buf[RESOLVER_PACKET_SIZE];
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	ssize_t len;
+	while((len = recvfrom(run->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen)) >= 12)
+	{
+		fromlen = sizeof(from);
+		const uint16_t qid = (buf[0] << 8) | buf[1];
+		for(unsigned int i = 0; i < RESOLVER_MAX_INFLIGHT; i++)
+		{
+			inflight_query *q = &run->inflight[i];
+			if(!q->active || q->qid != qid)
+				continue;
+
+			// Only accept replies from the server we asked
+			resolve_job *job = get_job(run, q->ref);
+			const struct sockaddr_in *server = &run->servers[job->server];
+			if(from.sin_addr.s_addr != server->sin_addr.s_addr || from.sin_port != server->sin_port)
+				break;
+
+			char host[NI_MAXHOST];
+			uint32_t ttl = 0;
+			if(!parse_ptr_reply(buf, (size_t)len, q, host, sizeof(host), &ttl))
+				break;
+
+			if(strlen(host) > 0)
+			{
+				store_hostname_cache(job->ip, host, ttl);
+				q->active = false;
+				run->num_inflight--;
+				finish_job(run, q->ref, host, job->server == 0 ? "found internally" : "found externally");
+			}
+			else
+			{
+				// A TTL of zero means the server failed, this is not
+				// a negative answer
+				if(ttl > 0 && (!job->negative || ttl < job->negative_ttl))
+					job->negative_ttl = ttl;
+				job->negative |= ttl > 0;
+				next_server(run, q);
+			}
+			break;
+		}
+	}
+}
+
+// Resend or give up queries which did not receive a reply in time
+static void check_timeouts(resolver_run *run)
+{
+	const long long now = monotonic_msec();
+	for(unsigned int i = 0; i < RESOLVER_MAX_INFLIGHT; i++)
+	{
+		inflight_query *q = &run->inflight[i];
+		if(!q->active || q->deadline > now)
+			continue;
+
+		resolve_job *job = get_job(run, q->ref);
+		if(job->tries++ < RESOLVER_TRIES)
+			send_query(run, q);
+		else
+			next_server(run, q);
+	}
+}
+
+// Resolve all collected jobs with many queries in flight at the same time.
+// Results are stored in shared memory in batches, new clients and upstreams
+// immediately after they have been resolved
+static void resolve_jobs(resolver_run *run, const bool reresolving)
+{
+	setup_resolver_servers(run);
+	run->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(run->fd < 0)
+	{
+		logg("WARN: Cannot create socket for resolving host names: %s", strerror(errno));
+		return;
+	}
+	run->next_qid = (uint16_t)random();
+
+	while(!killed)
+	{
+		// New clients appearing while we are re-resolving all known
+		// clients should not have to wait until we are done
+		if(reresolving && get_and_clear_event(RESOLVE_NEW_HOSTNAMES))
+		{
+			resolveClients(run, true, false);
+			resolveUpstreams(run, true);
+		}
+
+		// Fill free slots
+		bool pending = true;
+		while(run->num_inflight < RESOLVER_MAX_INFLIGHT && (pending = start_next_job(run)));
+
+		// Store results in shared memory
+		if(run->num_finished >= RESOLVER_APPLY_BATCH || run->finished_new > 0 ||
+		   (run->num_inflight == 0 && !pending))
+			apply_results(run);
+
+		if(run->num_inflight == 0)
+		{
+			if(!pending)
+				break;
+			continue;
+		}
+
+		// Wait for replies until the next query times out
+		long long timeout = RESOLVER_TIMEOUT;
+		const long long now = monotonic_msec();
+		for(unsigned int i = 0; i < RESOLVER_MAX_INFLIGHT; i++)
+			if(run->inflight[i].active && run->inflight[i].deadline - now < timeout)
+				timeout = run->inflight[i].deadline - now;
+
+		struct pollfd pfd = { .fd = run->fd, .events = POLLIN };
+		if(poll(&pfd, 1, timeout > 0 ? (int)timeout : 0) > 0)
+			receive_replies(run);
+
+		check_timeouts(run);
+	}
+
+	apply_results(run);
+	close(run->fd);
+}
+
+// Free all memory allocated for a resolver run
+static void free_resolver_run(resolver_run *run)
+{
+	for(unsigned int list = 0; list < LIST_MAX; list++)
+	{
+		for(unsigned int i = 0; i < run->lists[list].count; i++)
+			if(run->lists[list].jobs[i].name != NULL)
+				free(run->lists[list].jobs[i].name);
+		if(run->lists[list].jobs != NULL)
+			free(run->lists[list].jobs);
+	}
+	if(run->finished != NULL)
+		free(run->finished);
+}
+
+// Resolve host names of clients and upstream destinations
+static void resolveNames(const bool onlynew, const bool force_refreshing)
+{
+	resolver_run *run = calloc(1, sizeof(resolver_run));
+	if(run == NULL)
+		return;
+
+	// Forced refreshing ignores what we know
+	if(force_refreshing)
+		flush_hostname_cache();
+
+	resolveClients(run, onlynew, force_refreshing);
+	resolveUpstreams(run, onlynew);
+	const unsigned int total = run->lists[LIST_NEW].count + run->lists[LIST_KNOWN].count;
+
+	if(total > 0)
+		resolve_jobs(run, !onlynew);
 
 	if(config.debug & DEBUG_RESOLVER)
 	{
-		logg("%i / %i upstream server host names resolved",
-		     upstreams-skipped, upstreams);
+		struct hostname_cache_info info;
+		get_hostname_cache_info(&info);
+		const unsigned int lookups = info.hits + info.negative_hits + info.misses;
+		logg("%u / %u host names resolved (%u skipped)",
+		     run->resolved, run->lists[LIST_NEW].count + run->lists[LIST_KNOWN].count,
+		     run->skipped);
+		logg("Host name cache: %u entries, %u hits, %u negative hits, %u misses (hit rate %.1f%%)",
+		     info.entries, info.hits, info.negative_hits, info.misses,
+		     lookups > 0 ? 100.0*(info.hits + info.negative_hits)/lookups : 0.0);
 	}
+
+	free_resolver_run(run);
 }
 
 void *DNSclient_thread(void *val)
@@ -630,13 +1346,10 @@ void *DNSclient_thread(void *val)
 		// upstream servers
 		if(resolver_ready && get_and_clear_event(RESOLVE_NEW_HOSTNAMES))
 		{
-			// Try to resolve new client host names
-			// (onlynew=true)
+			// Try to resolve new client and upstream destination
+			// host names (onlynew=true)
 			// We're not forcing refreshing here
-			resolveClients(true, false);
-			// Try to resolve new upstream destination host names
-			// (onlynew=true)
-			resolveUpstreams(true);
+			resolveNames(true, false);
 		}
 
 		// Intermediate cancellation-point
@@ -659,17 +1372,9 @@ void *DNSclient_thread(void *val)
 		// Process resolver related event queue elements
 		if(get_and_clear_event(RERESOLVE_HOSTNAMES))
 		{
-			// Try to resolve all client host names
-			// (onlynew=false)
-			resolveClients(false, force_refreshing);
-
-			// Intermediate cancellation-point
-			if(killed)
-				break;
-
-			// Try to resolve all upstream destination host names
-			// (onlynew=false)
-			resolveUpstreams(false);
+			// Try to resolve all client and upstream destination
+			// host names (onlynew=false)
+			resolveNames(false, force_refreshing);
 		}
 
 		// Idle for 1 sec
@@ -10,8 +10,17 @@
 #ifndef RESOLVE_H
 #define RESOLVE_H
 
+// Statistics of the host name cache
+struct hostname_cache_info {
+	unsigned int entries;
+	unsigned int hits;
+	unsigned int negative_hits;
+	unsigned int misses;
+};
+
 void *DNSclient_thread(void *val);
 char *resolveHostname(const char *addr);
+void get_hostname_cache_info(struct hostname_cache_info *info);
 bool resolve_names(void) __attribute__((pure));
 bool resolve_this_name(const char *ipaddr) __attribute__((pure));
 
@@ -32,7 +32,7 @@
 #include "procps.h"
 
 /// The version of shared memory used
-#define SHARED_MEMORY_VERSION 14
+#define SHARED_MEMORY_VERSION 15
 
 /// The name of the shared memory. Use this when connecting to the shared memory.
 #define SHMEM_PATH "/dev/shm"
@@ -47,6 +47,12 @@
 #define SHARED_SETTINGS_NAME "FTL-settings"
 #define SHARED_DNS_CACHE "FTL-dns-cache"
 #define SHARED_PER_CLIENT_REGEX "FTL-per-client-regex"
+#define SHARED_RATE_LIMIT "FTL-rate-limit"
+
+/// The version and magic string of the shared memory snapshot file. Increase
+/// the version whenever the layout of the file changes
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAGIC "FTLSNAP"
 
 // Allocation step for FTL-strings bucket. This is somewhat special as we use
 // this as a general-purpose storage which should always be large enough. If,
@@ -70,6 +76,7 @@ static SharedMemory shm_overTime = { 0 };
 static SharedMemory shm_settings = { 0 };
 static SharedMemory shm_dns_cache = { 0 };
 static SharedMemory shm_per_client_regex = { 0 };
+static SharedMemory shm_rate_limit = { 0 };
 
 static SharedMemory *sharedMemories[] = { &shm_lock,
                                           &shm_strings,
@@ -81,7 +88,8 @@ static SharedMemory *sharedMemories[] = { &shm_lock,
                                           &shm_overTime,
                                           &shm_settings,
                                           &shm_dns_cache,
-                                          &shm_per_client_regex };
+                                          &shm_per_client_regex,
+                                          &shm_rate_limit };
 #define NUM_SHMEM (sizeof(sharedMemories)/sizeof(SharedMemory*))
 
 // Variable size array structs
@@ -104,6 +112,38 @@ typedef struct {
 static ShmLock *shmLock = NULL;
 static ShmSettings *shmSettings = NULL;
 
+// Header of the shared memory snapshot file. The header is followed by the
+// counters struct, the used part of the string buffer, the domains, clients,
+// queries, upstreams, overTime and DNS cache objects (in this order)
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t shm_version;
+	uint32_t checksum;
+	uint32_t overtime_slots;
+	uint32_t sizeof_counters;
+	uint32_t sizeof_domains;
+	uint32_t sizeof_clients;
+	uint32_t sizeof_queries;
+	uint32_t sizeof_upstreams;
+	uint32_t sizeof_overTime;
+	uint32_t sizeof_dns_cache;
+	int32_t domains;
+	int32_t clients;
+	int32_t queries;
+	int32_t upstreams;
+	int32_t dns_cache_size;
+	int64_t created;
+	int64_t dbstamp;
+	uint64_t strings;
+} SnapshotHeader;
+
+typedef struct {
+	const void *ptr;
+	size_t len;
+} SnapshotSection;
+#define NUM_SNAPSHOT_SECTIONS 8
+
 static int pagesize;
 static unsigned int local_shm_counter = 0;
 static pid_t shmem_pid = 0;
@@ -367,6 +407,9 @@ static void remap_shm(void)
 	realloc_shm(&shm_per_client_regex, counters->per_client_regex_MAX, sizeof(bool), false);
 	// per-client-regex bools are not exposed by a global pointer
 
+	realloc_shm(&shm_rate_limit, counters->rate_limit_MAX, sizeof(char), false);
+	// rate-limiting buckets are not exposed by a global pointer
+
 	realloc_shm(&shm_strings, counters->strings_MAX, sizeof(char), false);
 	// strings are not exposed by a global pointer
 
@@ -581,6 +624,15 @@ bool init_shmem()
 
 	counters->per_client_regex_MAX = size;
 
+	/****************************** shared rate-limiting buckets ******************************/
+	size = pagesize; // Allocate one pagesize initially. This may be expanded later on
+	// Try to create shared memory object
+	shm_rate_limit = create_shm(SHARED_RATE_LIMIT, size);
+	if(shm_rate_limit.ptr == NULL)
+		return false;
+
+	counters->rate_limit_MAX = size;
+
 	return true;
 }
 
@@ -970,6 +1022,295 @@ void shm_ensure_size(void)
 	}
 }
 
+// 32-bit FNV-1a hash used to detect truncated or corrupted snapshot files
+static uint32_t __attribute__((pure)) snapshot_hash(uint32_t hash, const void *data, const size_t len)
+{
+	const unsigned char *p = data;
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Fill the section table of a snapshot. The sections are either located in
+// shared memory (when writing) or in the mapped file (when reading)
+static size_t get_snapshot_sections(SnapshotSection sections[NUM_SNAPSHOT_SECTIONS],
+                                    const SnapshotHeader *header, const void *counters_ptr,
+                                    const void *strings_ptr, const void *domains_ptr,
+                                    const void *clients_ptr, const void *queries_ptr,
+                                    const void *upstreams_ptr, const void *overTime_ptr,
+                                    const void *dns_cache_ptr)
+{
+	sections[0] = (SnapshotSection){ counters_ptr, sizeof(countersStruct) };
+	sections[1] = (SnapshotSection){ strings_ptr, header->strings };
+	sections[2] = (SnapshotSection){ domains_ptr, header->domains*sizeof(domainsData) };
+	sections[3] = (SnapshotSection){ clients_ptr, header->clients*sizeof(clientsData) };
+	sections[4] = (SnapshotSection){ queries_ptr, header->queries*sizeof(queriesData) };
+	sections[5] = (SnapshotSection){ upstreams_ptr, header->upstreams*sizeof(upstreamsData) };
+	sections[6] = (SnapshotSection){ overTime_ptr, OVERTIME_SLOTS*sizeof(overTimeData) };
+	sections[7] = (SnapshotSection){ dns_cache_ptr, header->dns_cache_size*sizeof(DNSCacheData) };
+
+	// Return total payload size
+	size_t total = 0u;
+	for(unsigned int i = 0; i < NUM_SNAPSHOT_SECTIONS; i++)
+		total += sections[i].len;
+	return total;
+}
+
+// Store a binary snapshot of all shared memory objects in a file. The caller
+// has to hold the SHM lock. dbstamp is used to detect if the long-term database
+// has been modified in the meantime (e.g., by another FTL instance) when the
+// snapshot is restored
+bool save_shmem_snapshot(const char *file, const time_t dbstamp)
+{
+	SnapshotHeader header = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.shm_version = SHARED_MEMORY_VERSION,
+		.checksum = 2166136261u,
+		.overtime_slots = OVERTIME_SLOTS,
+		.sizeof_counters = sizeof(countersStruct),
+		.sizeof_domains = sizeof(domainsData),
+		.sizeof_clients = sizeof(clientsData),
+		.sizeof_queries = sizeof(queriesData),
+		.sizeof_upstreams = sizeof(upstreamsData),
+		.sizeof_overTime = sizeof(overTimeData),
+		.sizeof_dns_cache = sizeof(DNSCacheData),
+		.domains = counters->domains,
+		.clients = counters->clients,
+		.queries = counters->queries,
+		.upstreams = counters->upstreams,
+		.dns_cache_size = counters->dns_cache_size,
+		.created = time(NULL),
+		.dbstamp = dbstamp,
+		.strings = shmSettings->next_str_pos
+	};
+
+	SnapshotSection sections[NUM_SNAPSHOT_SECTIONS];
+	get_snapshot_sections(sections, &header, counters, shm_strings.ptr, domains,
+	                      clients, queries, upstreams, overTime, dns_cache);
+
+	for(unsigned int i = 0; i < NUM_SNAPSHOT_SECTIONS; i++)
+		header.checksum = snapshot_hash(header.checksum, sections[i].ptr, sections[i].len);
+
+	// Write into a temporary file first and move it into place only after
+	// everything has been written successfully. This ensures we never leave a
+	// partially written snapshot behind
+	char *tmpfile = NULL;
+	if(asprintf(&tmpfile, "%s.tmp", file) < 0 || tmpfile == NULL)
+	{
+		logg("WARN: Cannot write snapshot: Memory allocation failed");
+		return false;
+	}
+
+	FILE *fp = fopen(tmpfile, "w");
+	if(fp == NULL)
+	{
+		logg("WARN: Cannot open snapshot file %s for writing: %s", tmpfile, strerror(errno));
+		free(tmpfile);
+		return false;
+	}
+
+	bool okay = fwrite(&header, sizeof(header), 1, fp) == 1;
+	for(unsigned int i = 0; okay && i < NUM_SNAPSHOT_SECTIONS; i++)
+		if(sections[i].len > 0)
+			okay = fwrite(sections[i].ptr, sections[i].len, 1, fp) == 1;
+
+	// Ensure the data is on disk before renaming the file
+	okay = okay && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	okay = (fclose(fp) == 0) && okay;
+
+	if(!okay || rename(tmpfile, file) != 0)
+	{
+		logg("WARN: Writing snapshot file %s failed: %s", file, strerror(errno));
+		unlink(tmpfile);
+		free(tmpfile);
+		return false;
+	}
+	free(tmpfile);
+
+	if(config.debug & DEBUG_SHMEM)
+		logg("Stored snapshot of %i queries, %i domains, %i clients, %i upstreams and %zu bytes of strings in %s",
+		     header.queries, header.domains, header.clients, header.upstreams, (size_t)header.strings, file);
+
+	return true;
+}
+
+// Check if the snapshot header is compatible with this binary and the current
+// state of the long-term database. Returns the reason if it is not
+static const char *check_snapshot_header(const SnapshotHeader *header, const size_t filesize,
+                                         const time_t dbstamp, const time_t now)
+{
+	if(filesize < sizeof(*header) ||
+	   memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+		return "invalid file format";
+	if(header->version != SNAPSHOT_VERSION ||
+	   header->shm_version != SHARED_MEMORY_VERSION ||
+	   header->overtime_slots != OVERTIME_SLOTS ||
+	   header->sizeof_counters != sizeof(countersStruct) ||
+	   header->sizeof_domains != sizeof(domainsData) ||
+	   header->sizeof_clients != sizeof(clientsData) ||
+	   header->sizeof_queries != sizeof(queriesData) ||
+	   header->sizeof_upstreams != sizeof(upstreamsData) ||
+	   header->sizeof_overTime != sizeof(overTimeData) ||
+	   header->sizeof_dns_cache != sizeof(DNSCacheData))
+		return "incompatible version";
+	if(header->domains < 0 || header->clients < 0 || header->queries < 0 ||
+	   header->upstreams < 0 || header->dns_cache_size < 0 || header->strings < 1)
+		return "invalid object counts";
+	if(header->created > now || now - header->created >= config.maxlogage)
+		return "too old";
+	if(header->dbstamp != dbstamp)
+		return "database changed";
+	return NULL;
+}
+
+// Copy an array of objects from the snapshot into shared memory, resizing the
+// shared memory object if needed. We always leave one element of headroom as
+// required by shm_ensure_size()
+static void *restore_shm_object(SharedMemory *sharedMemory, int *max, const size_t sizeofobj,
+                                const size_t allocation_step, const SnapshotSection *section)
+{
+	const size_t num = section->len / sizeofobj;
+	if((size_t)*max <= num + 1)
+	{
+		const size_t newmax = ((num + 1)/allocation_step + 1)*allocation_step;
+		realloc_shm(sharedMemory, newmax, sizeofobj, true);
+		*max = newmax;
+	}
+	if(section->len > 0)
+		memcpy(sharedMemory->ptr, section->ptr, section->len);
+	return sharedMemory->ptr;
+}
+
+// Restore all shared memory objects from a snapshot file written by
+// save_shmem_snapshot(). The file is removed afterwards as it has been
+// consumed (or is unusable)
+bool load_shmem_snapshot(const char *file, const time_t dbstamp)
+{
+	const int fd = open(file, O_RDONLY);
+	if(fd == -1)
+	{
+		if(errno != ENOENT)
+			logg("WARN: Cannot open snapshot file %s: %s", file, strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader))
+	{
+		logg("Not using snapshot file %s: invalid file format", file);
+		close(fd);
+		unlink(file);
+		return false;
+	}
+
+	const size_t filesize = st.st_size;
+	void *map = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		logg("WARN: Cannot map snapshot file %s: %s", file, strerror(errno));
+		return false;
+	}
+
+	SnapshotHeader header;
+	memcpy(&header, map, sizeof(header));
+
+	const char *reason = check_snapshot_header(&header, filesize, dbstamp, time(NULL));
+	SnapshotSection sections[NUM_SNAPSHOT_SECTIONS];
+	if(reason == NULL)
+	{
+		// Compute section locations within the file
+		const char *p = (const char*)map + sizeof(header);
+		const void *ptrs[NUM_SNAPSHOT_SECTIONS] = { NULL };
+		size_t total = get_snapshot_sections(sections, &header, NULL, NULL, NULL,
+		                                     NULL, NULL, NULL, NULL, NULL);
+		if(sizeof(header) + total != filesize)
+			reason = "truncated file";
+		else
+		{
+			uint32_t checksum = 2166136261u;
+			for(unsigned int i = 0; i < NUM_SNAPSHOT_SECTIONS; i++)
+			{
+				ptrs[i] = p;
+				checksum = snapshot_hash(checksum, p, sections[i].len);
+				p += sections[i].len;
+			}
+			if(checksum != header.checksum)
+				reason = "checksum mismatch";
+			get_snapshot_sections(sections, &header, ptrs[0], ptrs[1], ptrs[2],
+			                      ptrs[3], ptrs[4], ptrs[5], ptrs[6], ptrs[7]);
+		}
+	}
+
+	if(reason != NULL)
+	{
+		logg("Not using snapshot file %s: %s", file, reason);
+		munmap(map, filesize);
+		unlink(file);
+		return false;
+	}
+
+	lock_shm();
+
+	// Restore counters but keep the sizes of the shared memory objects of
+	// this process as well as the gravity and regex counters which are
+	// re-computed when the lists are loaded
+	const countersStruct current = *counters;
+	memcpy(counters, sections[0].ptr, sizeof(countersStruct));
+	counters->queries_MAX = current.queries_MAX;
+	counters->upstreams_MAX = current.upstreams_MAX;
+	counters->clients_MAX = current.clients_MAX;
+	counters->domains_MAX = current.domains_MAX;
+	counters->strings_MAX = current.strings_MAX;
+	counters->dns_cache_MAX = current.dns_cache_MAX;
+	counters->per_client_regex_MAX = current.per_client_regex_MAX;
+	counters->rate_limit_MAX = current.rate_limit_MAX;
+	counters->gravity = current.gravity;
+	counters->regex_change = current.regex_change;
+
+	// Restore strings
+	restore_shm_object(&shm_strings, &counters->strings_MAX, 1, STRINGS_ALLOC_STEP, &sections[1]);
+	shmSettings->next_str_pos = header.strings;
+
+	// Restore objects
+	domains = restore_shm_object(&shm_domains, &counters->domains_MAX, sizeof(domainsData),
+	                             get_optimal_object_size(sizeof(domainsData), 1), &sections[2]);
+	clients = restore_shm_object(&shm_clients, &counters->clients_MAX, sizeof(clientsData),
+	                             get_optimal_object_size(sizeof(clientsData), 1), &sections[3]);
+	queries = restore_shm_object(&shm_queries, &counters->queries_MAX, sizeof(queriesData),
+	                             pagesize, &sections[4]);
+	upstreams = restore_shm_object(&shm_upstreams, &counters->upstreams_MAX, sizeof(upstreamsData),
+	                               get_optimal_object_size(sizeof(upstreamsData), 1), &sections[5]);
+	memcpy(overTime, sections[6].ptr, sections[6].len);
+	dns_cache = restore_shm_object(&shm_dns_cache, &counters->dns_cache_MAX, sizeof(DNSCacheData),
+	                               get_optimal_object_size(sizeof(DNSCacheData), 1), &sections[7]);
+
+	// dnsmasq's query IDs are meaningless in this process, reset them (as
+	// the database import does) so new replies are never matched to them
+	for(int queryID = 0; queryID < counters->queries; queryID++)
+		queries[queryID].id = 0;
+
+	// Group assignments may have changed in the meantime. Per-client regex
+	// data is not part of the snapshot, it is loaded for all known clients
+	// when the lists are read
+	for(int clientID = 0; clientID < counters->clients; clientID++)
+		clients[clientID].flags.found_group = false;
+
+	unlock_shm();
+
+	munmap(map, filesize);
+
+	// The snapshot has been consumed, remove it to never restore an outdated
+	// state after an unclean shutdown
+	unlink(file);
+
+	return true;
+}
+
 void reset_per_client_regex(const int clientID)
 {
 	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
@@ -1022,6 +1363,15 @@ void set_per_client_regex(const int clientID, const int regexID, const bool valu
 	((bool*) shm_per_client_regex.ptr)[id] = value;
 }
 
+void *get_rate_limit_table(const size_t size)
+{
+	if(size > shm_rate_limit.size &&
+	   realloc_shm(&shm_rate_limit, 1, get_optimal_object_size(1, size), true))
+		counters->rate_limit_MAX = shm_rate_limit.size;
+
+	return shm_rate_limit.ptr;
+}
+
 static inline bool check_range(int ID, int MAXID, const char* type, const char *func, int line, const char *file)
 {
 	// Check bounds
@@ -45,6 +45,7 @@ typedef struct {
 	int dns_cache_size;
 	int dns_cache_MAX;
 	int per_client_regex_MAX;
+	int rate_limit_MAX;
 	unsigned int regex_change;
 	int querytype[TYPE_MAX-1];
 	int status[QUERY_STATUS_MAX];
@@ -134,10 +135,18 @@ void chown_all_shmem(struct passwd *ent_pw);
 // Get details about shared memory used by FTL
 void log_shmem_details(void);
 
+// Store/restore a binary snapshot of all shared memory objects
+bool save_shmem_snapshot(const char *file, const time_t dbstamp);
+bool load_shmem_snapshot(const char *file, const time_t dbstamp);
+
 // Per-client regex buffer storing whether or not a specific regex is enabled for a particular client
 void add_per_client_regex(unsigned int clientID);
 void reset_per_client_regex(const int clientID);
 bool get_per_client_regex(const int clientID, const int regexID);
 void set_per_client_regex(const int clientID, const int regexID, const bool value);
 
+// Get the buffer holding the rate-limiting buckets, enlarged to at least
+// <size> bytes if needed. Has to be called with the shared memory lock held
+void *get_rate_limit_table(const size_t size);
+
 #endif //SHARED_MEMORY_SERVER_H
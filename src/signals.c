@@ -133,6 +133,10 @@ void generate_backtrace(void)
 
 static void __attribute__((noreturn)) signal_handler(int sig, siginfo_t *si, void *unused)
 {
+	// Write pending log lines and log synchronously from here on to
+	// ensure the crash report ends up in the log file
+	crash_async_log();
+
 	logg("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!");
 	logg("---------------------------->  FTL crashed!  <----------------------------");
 	logg("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!");
@@ -18,6 +18,8 @@ enum timers {
 	LISTS_TIMER,
 	REGEX_TIMER,
 	ARP_TIMER,
+	SNAPSHOT_TIMER,
+	MACVENDOR_TIMER,
 	LAST_TIMER
 	} __attribute__ ((packed));
 
@@ -0,0 +1,201 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  UDP DNS throughput benchmark
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "tools/dns-bench.h"
+// cli_info()
+#include "args.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#define BENCH_DEFAULT_QUERIES 100000
+// Number of queries in flight at any time
+#define BENCH_WINDOW 256
+// Outstanding queries are considered lost after this time [ms]
+#define BENCH_TIMEOUT 1000
+// Domain asked for, answered by FTL itself without going upstream
+#define BENCH_DOMAIN "pi.hole"
+
+#define RCODE_REFUSED 5
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Build an A query for BENCH_DOMAIN, returns the length of the packet
+static size_t build_query(unsigned char *buf, const size_t bufsize)
+{
+	memset(buf, 0, bufsize);
+	// Header: ID is filled in for each query, RD bit set, one question
+	buf[2] = 0x01;
+	buf[5] = 0x01;
+
+	size_t len = 12;
+	const char *label = BENCH_DOMAIN;
+	while(*label != '\0')
+	{
+		const char *dot = strchr(label, '.');
+		const size_t llen = dot != NULL ? (size_t)(dot - label) : strlen(label);
+		buf[len++] = llen;
+		memcpy(buf + len, label, llen);
+		len += llen;
+		label += llen;
+		if(*label == '.')
+			label++;
+	}
+	buf[len++] = 0;
+	// QTYPE A, QCLASS IN
+	buf[len++] = 0x00;
+	buf[len++] = 0x01;
+	buf[len++] = 0x00;
+	buf[len++] = 0x01;
+
+	return len;
+}
+
+// pihole-FTL dns-bench [<server>] [<port>] [<queries>]
+int run_dns_bench(const char *server, const char *port, const char *queries)
+{
+	const char *info = cli_info();
+	const char *tick = cli_tick();
+	const char *cross = cli_cross();
+
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(53) };
+	if(inet_pton(AF_INET, server != NULL ? server : "127.0.0.1", &addr.sin_addr) != 1)
+	{
+		printf("%s %s is not a valid IPv4 address\n", cross, server);
+		return EXIT_FAILURE;
+	}
+
+	if(port != NULL)
+	{
+		char *end = NULL;
+		const unsigned long p = strtoul(port, &end, 10);
+		if(end == port || *end != '\0' || p == 0 || p > 65535)
+		{
+			printf("%s %s is not a valid port\n", cross, port);
+			return EXIT_FAILURE;
+		}
+		addr.sin_port = htons(p);
+	}
+
+	unsigned long total = BENCH_DEFAULT_QUERIES;
+	if(queries != NULL)
+	{
+		char *end = NULL;
+		total = strtoul(queries, &end, 10);
+		if(end == queries || *end != '\0' || total == 0)
+		{
+			printf("%s %s is not a valid number of queries\n", cross, queries);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if(sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		printf("%s Unable to open socket: %s\n", cross, strerror(errno));
+		if(sock >= 0)
+			close(sock);
+		return EXIT_FAILURE;
+	}
+
+	// Make sure the socket buffers can hold a full window of queries
+	const int bufsize = 1 << 20;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+	char addrstr[INET_ADDRSTRLEN] = { 0 };
+	inet_ntop(AF_INET, &addr.sin_addr, addrstr, sizeof(addrstr));
+	printf("%s Sending %lu queries for %s to %s#%u with up to %u in flight\n",
+	       info, total, BENCH_DOMAIN, addrstr, ntohs(addr.sin_port), BENCH_WINDOW);
+
+	unsigned char query[512], reply[4096];
+	const size_t qlen = build_query(query, sizeof(query));
+	unsigned long sent = 0, answered = 0, refused = 0, lost = 0;
+	unsigned int inflight = 0;
+	const double start = bench_now();
+
+	while(answered + lost < total)
+	{
+		// Fill the window
+		while(sent < total && inflight < BENCH_WINDOW)
+		{
+			query[0] = (sent >> 8) & 0xFF;
+			query[1] = sent & 0xFF;
+			if(send(sock, query, qlen, 0) < 0)
+			{
+				// Wait for replies to free up buffer space, unless
+				// there are none to wait for
+				if((errno == EAGAIN || errno == ENOBUFS) && inflight > 0)
+					break;
+				printf("%s Unable to send query: %s\n", cross, strerror(errno));
+				close(sock);
+				return EXIT_FAILURE;
+			}
+			sent++;
+			inflight++;
+		}
+
+		struct pollfd pfd = { .fd = sock, .events = POLLIN };
+		const int rc = poll(&pfd, 1, BENCH_TIMEOUT);
+		if(rc < 0 && errno != EINTR)
+		{
+			printf("%s poll() failed: %s\n", cross, strerror(errno));
+			close(sock);
+			return EXIT_FAILURE;
+		}
+		else if(rc == 0)
+		{
+			// Nothing came back in time, give up on the queries in flight
+			lost += inflight;
+			inflight = 0;
+			continue;
+		}
+
+		// Read all replies that are available
+		ssize_t len;
+		while((len = recv(sock, reply, sizeof(reply), 0)) >= 0)
+		{
+			if(len < 12)
+				continue;
+			if((reply[3] & 0x0F) == RCODE_REFUSED)
+				refused++;
+			answered++;
+			if(inflight > 0)
+				inflight--;
+		}
+
+		if(errno == ECONNREFUSED)
+		{
+			printf("%s Connection refused, is there a DNS server listening on %s#%u?\n",
+			       cross, addrstr, ntohs(addr.sin_port));
+			close(sock);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const double elapsed = bench_now() - start;
+	close(sock);
+
+	printf("%s %lu answered, %lu lost in %.3f s: %.0f queries/s\n",
+	       tick, answered, lost, elapsed, answered/elapsed);
+	if(refused > 0)
+		printf("%s %lu queries were refused, consider disabling RATE_LIMIT for benchmarking\n",
+		       info, refused);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  UDP DNS throughput benchmark prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef DNS_BENCH_H
+#define DNS_BENCH_H
+
+int run_dns_bench(const char *server, const char *port, const char *queries);
+
+#endif // DNS_BENCH_H
@@ -0,0 +1,254 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Gravity import benchmark
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "tools/gravity-bench.h"
+#include "tools/gravity-parseList.h"
+#include "args.h"
+#include "database/sqlite3.h"
+
+// Number of lines of the synthetic list if not specified otherwise
+#define BENCH_DEFAULT_LINES 1000000
+#define BENCH_TEMPLATE "/tmp/pihole-FTL-bench-XXXXXX"
+
+// Minimal gravity database schema needed to import a list
+static const char *bench_schema =
+	"CREATE TABLE adlist (id INTEGER PRIMARY KEY, number INTEGER NOT NULL DEFAULT 0, "
+	                     "invalid_domains INTEGER NOT NULL DEFAULT 0, date_updated INTEGER);"
+	"CREATE TABLE gravity (domain TEXT NOT NULL, adlist_id INTEGER NOT NULL REFERENCES adlist (id));"
+	"CREATE TABLE info (property TEXT PRIMARY KEY, value TEXT NOT NULL);"
+	"INSERT INTO adlist (id) VALUES (1);";
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Reset the peak resident set size so it can be measured for each stage
+// individually (available since Linux 4.0)
+static void reset_peak_rss(void)
+{
+	FILE *fp = fopen("/proc/self/clear_refs", "w");
+	if(fp == NULL)
+		return;
+	fputs("5", fp);
+	fclose(fp);
+}
+
+// Peak resident set size [kB]
+static long get_peak_rss(void)
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	if(fp == NULL)
+		return -1;
+
+	long peak = -1;
+	char line[256];
+	while(fgets(line, sizeof(line), fp) != NULL)
+		if(sscanf(line, "VmHWM: %ld kB", &peak) == 1)
+			break;
+
+	fclose(fp);
+	return peak;
+}
+
+static void print_stage(const char *stage, const double start, const size_t lines, const size_t bytes)
+{
+	const double elapsed = bench_now() - start;
+	printf("  %-14s %9.3f s %12.0f lines/s %9.2f MB/s %9.1f MB peak RSS\n",
+	       stage, elapsed, lines/elapsed, bytes/elapsed/1e6, get_peak_rss()/1024.0);
+}
+
+// xorshift64
+static uint64_t bench_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// Write a synthetic list with a mix of exact domains (some of them listed
+// more than once or as FQDN), ABP-style domains and non-domain entries
+static bool generate_list(const int fd, const size_t lines, size_t *bytes)
+{
+	FILE *fp = fdopen(fd, "w");
+	if(fp == NULL)
+		return false;
+
+	static const char *tlds[] = { "com", "net", "org", "de", "io" };
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	unsigned int exact = 0;
+	for(size_t i = 0; i < lines; i++)
+	{
+		const unsigned int r = bench_random(&state) % 100;
+		if(r < 75 || (r < 80 && exact == 0))
+		{
+			fprintf(fp, "ads%u.example%u.%s\n", exact, exact % 1000, tlds[exact % 5]);
+			exact++;
+		}
+		else if(r < 80)
+		{
+			// Duplicate of an earlier domain
+			const unsigned int dup = bench_random(&state) % exact;
+			fprintf(fp, "ads%u.example%u.%s\n", dup, dup % 1000, tlds[dup % 5]);
+		}
+		else if(r < 85)
+			fprintf(fp, "||tracker%zu.example.net^\n", i);
+		else if(r < 90)
+			fprintf(fp, "0.0.0.0 host%zu.example.org\n", i);
+		else if(r < 95)
+			fprintf(fp, "# comment %zu\n", i);
+		else if(r < 98)
+			fprintf(fp, "fqdn%zu.example.com.\n", i);
+		else
+			fputs("localhost\n", fp);
+	}
+
+	*bytes = ftell(fp);
+	return fclose(fp) == 0;
+}
+
+static bool create_database(const char *dbfile)
+{
+	sqlite3 *db = NULL;
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK)
+	{
+		sqlite3_close(db);
+		return false;
+	}
+
+	const bool okay = sqlite3_exec(db, bench_schema, NULL, NULL, NULL) == SQLITE_OK;
+	sqlite3_close(db);
+	return okay;
+}
+
+// Build the index gravity.sh creates after all lists have been imported
+static bool index_database(const char *dbfile)
+{
+	sqlite3 *db = NULL;
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+	{
+		sqlite3_close(db);
+		return false;
+	}
+
+	const bool okay = sqlite3_exec(db, "CREATE INDEX idx_gravity ON gravity (domain, adlist_id);",
+	                               NULL, NULL, NULL) == SQLITE_OK;
+	sqlite3_close(db);
+	return okay;
+}
+
+// pihole-FTL gravity bench [<number of lines> | <list file>]
+int gravity_bench(const char *source)
+{
+	const char *info = cli_info();
+	const char *tick = cli_tick();
+	const char *cross = cli_cross();
+
+	int ret = EXIT_FAILURE;
+	char listfile[] = BENCH_TEMPLATE;
+	char dbfile[] = BENCH_TEMPLATE;
+	bool remove_list = false, remove_db = false;
+	struct stat st;
+	const char *infile = NULL;
+	size_t lines = BENCH_DEFAULT_LINES, bytes = 0;
+
+	if(source != NULL && stat(source, &st) == 0)
+	{
+		// Use existing list
+		infile = source;
+		printf("%s Benchmarking import of %s\n", info, infile);
+	}
+	else
+	{
+		if(source != NULL)
+		{
+			char *end = NULL;
+			lines = strtoul(source, &end, 10);
+			if(end == source || *end != '\0' || lines == 0)
+			{
+				printf("%s %s is neither a file nor a number of lines\n", cross, source);
+				return EXIT_FAILURE;
+			}
+		}
+
+		// Generate synthetic list
+		printf("%s Benchmarking import of a synthetic list with %zu lines\n", info, lines);
+		const int fd = mkstemp(listfile);
+		if(fd < 0)
+		{
+			printf("%s Unable to create temporary list file: %s\n", cross, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		remove_list = true;
+		infile = listfile;
+
+		reset_peak_rss();
+		const double start = bench_now();
+		if(!generate_list(fd, lines, &bytes))
+		{
+			printf("%s Unable to write temporary list file %s\n", cross, listfile);
+			goto end_of_bench;
+		}
+		print_stage("generate", start, lines, bytes);
+	}
+
+	// Parse list without inserting anything
+	struct gravity_parse_stats stats;
+	reset_peak_rss();
+	double start = bench_now();
+	if(gravity_parseList_stats(infile, NULL, 1, true, &stats) != EXIT_SUCCESS)
+		goto end_of_bench;
+	print_stage("parse", start, stats.lines, stats.bytes);
+
+	// Parse and insert into scratch database
+	const int dbfd = mkstemp(dbfile);
+	if(dbfd < 0)
+	{
+		printf("%s Unable to create temporary database file: %s\n", cross, strerror(errno));
+		goto end_of_bench;
+	}
+	close(dbfd);
+	remove_db = true;
+	if(!create_database(dbfile))
+	{
+		printf("%s Unable to create temporary database %s\n", cross, dbfile);
+		goto end_of_bench;
+	}
+	reset_peak_rss();
+	start = bench_now();
+	if(gravity_parseList_stats(infile, dbfile, 1, true, &stats) != EXIT_SUCCESS)
+		goto end_of_bench;
+	print_stage("parse+insert", start, stats.lines, stats.bytes);
+
+	// Build gravity index
+	reset_peak_rss();
+	start = bench_now();
+	if(!index_database(dbfile))
+	{
+		printf("%s Unable to create index in temporary database %s\n", cross, dbfile);
+		goto end_of_bench;
+	}
+	print_stage("index", start, stats.exact_domains + stats.abp_domains, stats.bytes);
+
+	printf("%s %zu lines: %u exact domains, %u ABP-style domains, %u non-domain entries, %u duplicates\n",
+	       tick, stats.lines, stats.exact_domains, stats.abp_domains, stats.invalid_domains, stats.duplicates);
+	ret = EXIT_SUCCESS;
+
+end_of_bench:
+	if(remove_list)
+		unlink(listfile);
+	if(remove_db)
+		unlink(dbfile);
+
+	return ret;
+}
@@ -10,29 +10,61 @@
 
 #include "tools/gravity-parseList.h"
 #include "args.h"
-#include <regex.h>
 #include "database/sqlite3.h"
-
-// Define valid domain patterns
-// No need to include uppercase letters, as we convert to lowercase in gravity_ParseFileIntoDomains() already
-// Adapted from https://stackoverflow.com/a/30007882
-// - Added "(?:...)" to form non-capturing groups (slightly faster)
-#define TLD_PATTERN "[a-z0-9][a-z0-9-]{0,61}[a-z0-9]"
-#define SUBDOMAIN_PATTERN "([a-z0-9_-]{0,63}\\.)"
-
+// mmap()
+#include <sys/mman.h>
+// fstat()
+#include <sys/stat.h>
+// open()
+#include <fcntl.h>
+
+// Valid domains are validated by hand instead of using regular expressions.
+// They have to match the following patterns (covering the entire line):
+//
+// TLD_PATTERN       "[a-z0-9][a-z0-9-]{0,61}[a-z0-9]"
+// SUBDOMAIN_PATTERN "([a-z0-9_-]{0,63}\\.)"
+//
 // supported exact style: subdomain.domain.tld
 // SUBDOMAIN_PATTERN is mandatory for exact style, disallowing TLD blocking
-#define VALID_DOMAIN_REXEX SUBDOMAIN_PATTERN"+"TLD_PATTERN
-
+//   SUBDOMAIN_PATTERN"+"TLD_PATTERN
+//
 // supported ABP style: ||subdomain.domain.tlp^
 // SUBDOMAIN_PATTERN is optional for ABP style, allowing TLD blocking: ||tld^
 // See https://github.com/pi-hole/pi-hole/pull/5240
-#define ABP_DOMAIN_REXEX "\\|\\|"SUBDOMAIN_PATTERN"*"TLD_PATTERN"\\^"
+//   "\\|\\|"SUBDOMAIN_PATTERN"*"TLD_PATTERN"\\^"
+//
+// Uppercase letters are not valid
+#define CHAR_ALNUM      0x01
+#define CHAR_HYPHEN     0x02
+#define CHAR_UNDERSCORE 0x04
+#define CHAR_TLD        (CHAR_ALNUM | CHAR_HYPHEN)
+#define CHAR_LABEL      (CHAR_ALNUM | CHAR_HYPHEN | CHAR_UNDERSCORE)
+static const unsigned char charclass[256] = {
+	['0' ... '9'] = CHAR_ALNUM,
+	['a' ... 'z'] = CHAR_ALNUM,
+	['-'] = CHAR_HYPHEN,
+	['_'] = CHAR_UNDERSCORE
+};
+#define MAX_LABEL_LEN 63
+#define MIN_TLD_LEN 2
 
 // A list of items of common local hostnames not to report as unusable
 // Some lists (i.e StevenBlack's) contain these as they are supposed to be used as HOST files
 // but flagging them as unusable causes more confusion than it's worth - so we suppress them from the output
-#define FALSE_POSITIVES "^(localhost|localhost.localdomain|local|broadcasthost|localhost|ip6-localhost|ip6-loopback|lo0 localhost|ip6-localnet|ip6-mcastprefix|ip6-allnodes|ip6-allrouters|ip6-allhosts)$"
+static const char *false_positives[] = {
+	"localhost",
+	"localhost.localdomain",
+	"local",
+	"broadcasthost",
+	"ip6-localhost",
+	"ip6-loopback",
+	"lo0 localhost",
+	"ip6-localnet",
+	"ip6-mcastprefix",
+	"ip6-allnodes",
+	"ip6-allrouters",
+	"ip6-allhosts"
+};
 
 // Print progress for files larger than 10 MB
 // This is to avoid printing progress for small files
@@ -42,293 +74,492 @@
 // Number of invalid domains to print before skipping the rest
 #define MAX_INVALID_DOMAINS 5
 
-int gravity_parseList(const char *infile, const char *outfile, const char *adlistIDstr)
+// The list is split into chunks which are validated by worker threads. The
+// calling thread inserts the valid domains of one chunk after the other
+#define PARSE_CHUNK_SIZE (4*1024*1024)
+#define PARSE_MAX_WORKERS 8
+// Maximum number of chunks parsed but not yet written to the database
+#define PARSE_INFLIGHT (2*PARSE_MAX_WORKERS)
+// Number of domains inserted per INSERT statement
+#define INSERT_BATCH 128
+
+// Domains are referenced by their position in the mapped list
+struct domain_entry {
+	size_t offset;
+	size_t len;
+};
+
+typedef struct {
+	struct domain_entry *domains;
+	size_t num_domains;
+	size_t size;
+	unsigned int exact_domains;
+	unsigned int abp_domains;
+	unsigned int invalid_domains;
+	struct domain_entry invalid_domains_list[MAX_INVALID_DOMAINS];
+	unsigned int invalid_domains_list_len;
+	size_t lines;
+	bool done;
+	bool failed;
+} parse_chunk;
+
+// Domains already inserted from this list. A slot stores the offset of the
+// domain within the list plus one (zero marks an empty slot) and the upper
+// eight bits of the domain's hash to skip most comparisons
+typedef struct {
+	uint64_t *slots;
+	size_t mask;
+	size_t count;
+	bool failed;
+} domain_set;
+#define DOMAIN_SET_MIN_SIZE 4096
+// Initial number of slots relative to the size of the list. Growing the set
+// is expensive as all domains have to be hashed again, lists with an average
+// line length of more than 21 bytes fit without growing it
+#define DOMAIN_SET_BYTES_PER_SLOT 16
+#define DOMAIN_SET_OFFSET ((1ULL << 56) - 1)
+
+typedef struct {
+	const char *data;
+	size_t fsize;
+	size_t nchunks;
+	size_t next;
+	size_t written;
+	bool abort;
+	parse_chunk chunks[PARSE_INFLIGHT];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} list_parser;
+
+// Validate (sub)domain labels followed by a TLD. The subdomain part is
+// mandatory for exact domains but optional for ABP-style domains
+static bool __attribute__((pure)) valid_domain(const char *domain, const size_t len, const bool need_subdomain)
 {
-	const char *info = cli_info();
-	const char *tick = cli_tick();
-	const char *cross = cli_cross();
-	const char *over = cli_over();
+	// The TLD follows the last dot
+	size_t tld = len;
+	while(tld > 0 && domain[tld-1] != '.')
+		tld--;
+	if(need_subdomain && tld == 0)
+		return false;
+
+	// TLD: alphanumeric characters and hyphens, but not at the beginning
+	// or the end
+	const size_t tldlen = len - tld;
+	if(tldlen < MIN_TLD_LEN || tldlen > MAX_LABEL_LEN)
+		return false;
+	if(!(charclass[(unsigned char)domain[tld]] & CHAR_ALNUM) ||
+	   !(charclass[(unsigned char)domain[len-1]] & CHAR_ALNUM))
+		return false;
+	for(size_t i = tld + 1; i < len - 1; i++)
+		if(!(charclass[(unsigned char)domain[i]] & CHAR_TLD))
+			return false;
+
+	// Labels in front of the TLD, each one followed by a dot. They may
+	// also contain underscores and may be empty
+	size_t label = 0;
+	for(size_t i = 0; i < tld; i++)
+	{
+		if(domain[i] == '.')
+		{
+			label = 0;
+			continue;
+		}
+		if(!(charclass[(unsigned char)domain[i]] & CHAR_LABEL) || ++label > MAX_LABEL_LEN)
+			return false;
+	}
+
+	return true;
+}
+
+static bool __attribute__((pure)) is_false_positive(const char *line, const size_t len)
+{
+	for(unsigned int i = 0; i < sizeof(false_positives)/sizeof(false_positives[0]); i++)
+		if(strlen(false_positives[i]) == len && memcmp(false_positives[i], line, len) == 0)
+			return true;
+	return false;
+}
+
+// Add an entry to a list of at most MAX_INVALID_DOMAINS distinct entries
+static bool add_invalid_domain(struct domain_entry *list, unsigned int *list_len,
+                               const char *data, const struct domain_entry *entry)
+{
+	if(*list_len >= MAX_INVALID_DOMAINS)
+		return false;
+
+	// Check if we have this domain already
+	for(unsigned int i = 0; i < *list_len; i++)
+		if(list[i].len == entry->len &&
+		   memcmp(data + list[i].offset, data + entry->offset, entry->len) == 0)
+			return false;
+
+	// If not found, add it to the list
+	list[(*list_len)++] = *entry;
+	return true;
+}
 
-	// Open input file
-	FILE *fpin = fopen(infile, "r");
-	if(fpin == NULL)
+// Validate all lines starting within the given chunk
+static void parse_chunk_lines(const list_parser *parser, const size_t chunkID, parse_chunk *chunk)
+{
+	const char *data = parser->data;
+	size_t pos = chunkID * PARSE_CHUNK_SIZE;
+	size_t end = pos + PARSE_CHUNK_SIZE;
+	if(end > parser->fsize)
+		end = parser->fsize;
+
+	// Skip the line started in the previous chunk
+	if(pos > 0 && data[pos-1] != '\n')
 	{
-		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
-		return EXIT_FAILURE;
+		const char *eol = memchr(data + pos, '\n', parser->fsize - pos);
+		pos = eol != NULL ? (size_t)(eol - data) + 1 : parser->fsize;
 	}
 
-	// Open output file
-	sqlite3 *db = NULL;
-	sqlite3_stmt *stmt = NULL;
-	if(sqlite3_open_v2(outfile, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+	while(pos < end)
 	{
-		printf("%s  %s Unable to open database file %s for writing\n", over, cross, outfile);
-		fclose(fpin);
-		return EXIT_FAILURE;
+		// Find end of line
+		const char *line = data + pos;
+		const char *eol = memchr(line, '\n', parser->fsize - pos);
+		struct domain_entry entry = { .offset = pos, .len = eol != NULL ? (size_t)(eol - line) : parser->fsize - pos };
+		pos += entry.len + 1;
+		chunk->lines++;
+
+		// Remove trailing dot (convert FQDN to domain)
+		if(entry.len > 0 && line[entry.len-1] == '.')
+			entry.len--;
+
+		// Validate line
+		bool valid = false;
+		if(entry.len > 0 && line[0] != '|' &&                    // <- Not an ABP-style match
+		   valid_domain(line, entry.len, true))                  // <- Valid domain
+		{
+			// Exact match found
+			chunk->exact_domains++;
+			valid = true;
+		}
+		else if(entry.len > 3 && line[0] == '|' && line[1] == '|' && // <- ABP-style match
+		        line[entry.len-1] == '^' &&
+		        valid_domain(line + 2, entry.len - 3, false))        // <- Valid domain
+		{
+			// ABP-style match (see comments above)
+			chunk->abp_domains++;
+			valid = true;
+		}
+		// No match - This is an invalid domain or a false positive
+		// Ignore false positives - they don't count as invalid domains
+		else if(!is_false_positive(line, entry.len))
+		{
+			add_invalid_domain(chunk->invalid_domains_list, &chunk->invalid_domains_list_len,
+			                   data, &entry);
+			chunk->invalid_domains++;
+		}
+
+		if(!valid)
+			continue;
+
+		// Grow array if needed
+		if(chunk->num_domains >= chunk->size)
+		{
+			const size_t size = chunk->size > 0 ? 2*chunk->size : 4096;
+			struct domain_entry *domains = realloc(chunk->domains, size*sizeof(*domains));
+			if(domains == NULL)
+			{
+				chunk->failed = true;
+				return;
+			}
+			chunk->domains = domains;
+			chunk->size = size;
+		}
+		chunk->domains[chunk->num_domains++] = entry;
 	}
-	// Get size of input file
-	fseek(fpin, 0L, SEEK_END);
-	const size_t fsize = ftell(fpin);
-	rewind(fpin);
-
-	// Compile regular expression to validate domains
-	regex_t exact_regex, abp_regex, false_positives_regex;
-	if(regcomp(&exact_regex, VALID_DOMAIN_REXEX, REG_EXTENDED) != 0)
+}
+
+// FNV-1a
+static uint64_t __attribute__((pure)) domain_hash(const char *domain, const size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < len; i++)
 	{
-		printf("%s  %s Unable to compile regular expression to validate exact domains\n",
-		       over, cross);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		hash ^= (unsigned char)domain[i];
+		hash *= 0x100000001b3ULL;
 	}
-	if(regcomp(&abp_regex, ABP_DOMAIN_REXEX, REG_EXTENDED) != 0)
+	// Fold upper bits into the lower ones used for the slot index
+	return hash ^ (hash >> 29);
+}
+
+// Length of the domain at the given position (see parse_chunk_lines())
+static size_t __attribute__((pure)) domain_len_at(const char *data, const size_t fsize, const size_t offset)
+{
+	const char *eol = memchr(data + offset, '\n', fsize - offset);
+	size_t len = eol != NULL ? (size_t)(eol - (data + offset)) : fsize - offset;
+	if(len > 0 && data[offset + len - 1] == '.')
+		len--;
+	return len;
+}
+
+static void domain_set_insert(domain_set *set, const uint64_t hash, const size_t offset)
+{
+	size_t i = hash & set->mask;
+	while(set->slots[i] != 0)
+		i = (i + 1) & set->mask;
+	set->slots[i] = (hash & ~DOMAIN_SET_OFFSET) | (offset + 1);
+	set->count++;
+}
+
+// Allocate the set or double its size. The hashes of the domains already in
+// the set are recomputed from the list
+static bool domain_set_grow(domain_set *set, const char *data, const size_t fsize)
+{
+	size_t size = DOMAIN_SET_MIN_SIZE;
+	if(set->slots != NULL)
+		size = 2*(set->mask + 1);
+	else while(size < fsize / DOMAIN_SET_BYTES_PER_SLOT)
+		size <<= 1;
+	uint64_t *slots = calloc(size, sizeof(*slots));
+	if(slots == NULL)
+		return false;
+
+	domain_set grown = { .slots = slots, .mask = size - 1 };
+	for(size_t i = 0; set->slots != NULL && i <= set->mask; i++)
 	{
-		printf("%s  %s Unable to compile regular expression to validate ABP-style domains\n",
-		       over, cross);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		if(set->slots[i] == 0)
+			continue;
+		const size_t offset = (set->slots[i] & DOMAIN_SET_OFFSET) - 1;
+		domain_set_insert(&grown, domain_hash(data + offset, domain_len_at(data, fsize, offset)), offset);
 	}
-	if(regcomp(&false_positives_regex, FALSE_POSITIVES, REG_EXTENDED | REG_NOSUB) != 0)
+
+	if(set->slots != NULL)
+		free(set->slots);
+	*set = grown;
+	return true;
+}
+
+// Add a domain to the set. Returns false if the set already contains it
+static bool domain_set_add(domain_set *set, const char *data, const size_t fsize, const struct domain_entry *entry)
+{
+	// Keep the load factor below 3/4. Without memory for a larger set,
+	// duplicates are no longer detected
+	if(set->failed || ((set->count + 1) * 4 > (set->mask + 1) * 3 &&
+	                   !domain_set_grow(set, data, fsize)))
 	{
-		printf("%s  %s Unable to compile regular expression to identify false positives\n",
-		       over, cross);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		set->failed = true;
+		return true;
 	}
 
-	// Begin transaction
-	if(sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
+	const char *domain = data + entry->offset;
+	const uint64_t hash = domain_hash(domain, entry->len);
+	for(size_t i = hash & set->mask; set->slots[i] != 0; i = (i + 1) & set->mask)
 	{
-		printf("%s  %s Unable to begin transaction to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		if((set->slots[i] & ~DOMAIN_SET_OFFSET) != (hash & ~DOMAIN_SET_OFFSET))
+			continue;
+		const size_t offset = (set->slots[i] & DOMAIN_SET_OFFSET) - 1;
+		if(domain_len_at(data, fsize, offset) == entry->len &&
+		   memcmp(data + offset, domain, entry->len) == 0)
+			return false;
 	}
 
-	// Prepare SQL statement
-	const char *sql = "INSERT INTO gravity (domain, adlist_id) VALUES (?, ?);";
-	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+	domain_set_insert(set, hash, entry->offset);
+	return true;
+}
+
+// Remove domains seen before from the domains of a chunk. Returns the number
+// of remaining domains
+static size_t remove_duplicates(domain_set *set, const char *data, const size_t fsize,
+                                struct domain_entry *domains, const size_t num,
+                                unsigned int *exact_duplicates, unsigned int *abp_duplicates)
+{
+	size_t unique = 0;
+	for(size_t i = 0; i < num; i++)
 	{
-		printf("%s  %s Unable to prepare SQL statement to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		if(domain_set_add(set, data, fsize, &domains[i]))
+			domains[unique++] = domains[i];
+		else if(data[domains[i].offset] == '|')
+			(*abp_duplicates)++;
+		else
+			(*exact_duplicates)++;
 	}
 
-	// Bind adlistID
-	const int adlistID = atoi(adlistIDstr);
-	if(sqlite3_bind_int(stmt, 2, adlistID) != SQLITE_OK)
+	return unique;
+}
+
+static void *parse_worker(void *arg)
+{
+	list_parser *parser = arg;
+
+	pthread_mutex_lock(&parser->lock);
+	while(!parser->abort && parser->next < parser->nchunks)
 	{
-		printf("%s  %s Unable to bind adlistID to SQL statement to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		// Wait until the writer caught up so we do not keep the entire
+		// list in memory
+		if(parser->next >= parser->written + PARSE_INFLIGHT)
+		{
+			pthread_cond_wait(&parser->cond, &parser->lock);
+			continue;
+		}
+
+		const size_t chunkID = parser->next++;
+		parse_chunk *chunk = &parser->chunks[chunkID % PARSE_INFLIGHT];
+		pthread_mutex_unlock(&parser->lock);
+
+		parse_chunk_lines(parser, chunkID, chunk);
+
+		pthread_mutex_lock(&parser->lock);
+		chunk->done = true;
+		pthread_cond_broadcast(&parser->cond);
 	}
+	pthread_mutex_unlock(&parser->lock);
 
-	// Parse list file line by line
-	char *line = NULL;
-	size_t lineno = 0;
-	size_t len = 0;
-	ssize_t read = 0;
-	size_t total_read = 0;
-	int last_progress = 0;
-	char *invalid_domains_list[MAX_INVALID_DOMAINS] = { NULL };
-	unsigned int invalid_domains_list_len = 0;
-	unsigned int exact_domains = 0, abp_domains = 0, invalid_domains = 0;
-	while((read = getline(&line, &len, fpin)) != -1)
+	return NULL;
+}
+
+// Prepare an INSERT statement for the given number of domains. The adlist ID
+// is bound to the last parameter which is shared by all rows
+static sqlite3_stmt *prepare_insert(sqlite3 *db, const unsigned int rows, const int adlistID)
+{
+	char sql[64 + rows*24];
+	size_t len = snprintf(sql, sizeof(sql), "INSERT INTO gravity (domain, adlist_id) VALUES ");
+	for(unsigned int i = 1; i <= rows; i++)
+		len += snprintf(sql + len, sizeof(sql) - len, "%s(?%u,?%u)", i > 1 ? "," : "", i, rows + 1);
+
+	sqlite3_stmt *stmt = NULL;
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return NULL;
+
+	// Bind adlistID
+	if(sqlite3_bind_int(stmt, rows + 1, adlistID) != SQLITE_OK)
 	{
-		// Update total read bytes
-		total_read += read;
-		lineno++;
+		sqlite3_finalize(stmt);
+		return NULL;
+	}
 
-		// Remove trailing newline
-		if(line[read-1] == '\n')
-			line[--read] = '\0';
+	return stmt;
+}
 
-		// Remove trailing dot (convert FQDN to domain)
-		if(line[read-1] == '.')
-			line[--read] = '\0';
+// Insert the domains of one chunk, INSERT_BATCH domains at a time
+static bool insert_domains(sqlite3_stmt *batch_stmt, sqlite3_stmt *stmt, const char *data,
+                           const struct domain_entry *domains, const size_t num)
+{
+	size_t i = 0;
+	for(; i + INSERT_BATCH <= num; i += INSERT_BATCH)
+	{
+		for(unsigned int j = 0; j < INSERT_BATCH; j++)
+			if(sqlite3_bind_text(batch_stmt, j + 1, data + domains[i+j].offset,
+			                     domains[i+j].len, SQLITE_STATIC) != SQLITE_OK)
+				return false;
+		if(sqlite3_step(batch_stmt) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(batch_stmt);
+	}
 
+	for(; i < num; i++)
+	{
+		if(sqlite3_bind_text(stmt, 1, data + domains[i].offset, domains[i].len, SQLITE_STATIC) != SQLITE_OK)
+			return false;
+		if(sqlite3_step(stmt) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(stmt);
+	}
 
-		regmatch_t match = { 0 };
-		// Validate line
-		if(line[0] != '|' &&                                 // <- Not an ABP-style match
-		   regexec(&exact_regex, line, 1, &match, 0) == 0 && // <- Regex match
-		   match.rm_so == 0 && match.rm_eo == read)          // <- Match covers entire line
-		{
-			// Exact match found
-			// Append domain to database using prepared statement
-			if(sqlite3_bind_text(stmt, 1, line, -1, SQLITE_STATIC) != SQLITE_OK)
-			{
-				printf("%s  %s Unable to bind domain to SQL statement to insert domains into database file %s\n",
-				       over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			if(sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			sqlite3_reset(stmt);
-			// Increment counter
-			exact_domains++;
-		}
-		else if(line[0] == '|' &&                               // <- ABP-style match
-		        regexec(&abp_regex, line, 1, &match, 0) == 0 && // <- Regex match
-		        match.rm_so == 0 && match.rm_eo == read)        // <- Match covers entire line
-		{
-			// ABP-style match (see comments above)
+	return true;
+}
 
-			// Append pattern to database using prepared statement
-			if(sqlite3_bind_text(stmt, 1, line, -1, SQLITE_STATIC) != SQLITE_OK)
-			{
-				printf("%s  %s Unable to bind domain to SQL statement to insert domains into database file %s\n",
-				       over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			if(sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			sqlite3_reset(stmt);
-			abp_domains++;
-		}
-		else
-		{
-			// No match - This is an invalid domain or a false positive
+// Open the database, begin a transaction and prepare the INSERT statements
+static bool open_database(const char *outfile, const int adlistID, sqlite3 **db,
+                          sqlite3_stmt **batch_stmt, sqlite3_stmt **stmt)
+{
+	const char *cross = cli_cross();
+	const char *over = cli_over();
 
-			// Ignore false positives - they don't count as invalid domains
-			if(regexec(&false_positives_regex, line, 0, NULL, 0) != 0)
-			{
-				// Add the domain to invalid_domains_list only
-				// if the list contains < MAX_INVALID_DOMAINS
-				if(invalid_domains_list_len < MAX_INVALID_DOMAINS)
-				{
-					// Check if we have this domain already
-					bool found = false;
-					for(unsigned int i = 0; i < invalid_domains_list_len; i++)
-					{
-						if(strcmp(invalid_domains_list[i], line) == 0)
-						{
-							found = true;
-							break;
-						}
-					}
-
-					// If not found, add it to the list
-					if(!found)
-						invalid_domains_list[invalid_domains_list_len++] = strdup(line);
-
-				}
-				invalid_domains++;
-			}
-		}
+	// Open output file
+	if(sqlite3_open_v2(outfile, db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to open database file %s for writing\n", over, cross, outfile);
+		return false;
+	}
 
-		// Print progress if the file is large enough every 100 lines
-		if(fsize > PRINT_PROGRESS_THRESHOLD && lineno % 100 == 1)
-		{
-			// Calculate progress
-			const int progress = (int)(100.0*total_read/fsize);
-			// Print progress if it has changed
-			if(progress > last_progress)
-			{
-				printf("%s  %s Processed %i%% of downloaded list", over, info, progress);
-				fflush(stdout);
-				last_progress = progress;
-			}
-		}
+	// Begin transaction
+	if(sqlite3_exec(*db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to begin transaction to insert domains into database file %s\n",
+		       over, cross, outfile);
+		return false;
 	}
 
-	// Finalize SQL statement
-	if(sqlite3_finalize(stmt) != SQLITE_OK)
+	// Prepare SQL statements
+	if((*batch_stmt = prepare_insert(*db, INSERT_BATCH, adlistID)) == NULL ||
+	   (*stmt = prepare_insert(*db, 1, adlistID)) == NULL)
 	{
-		printf("%s  %s Unable to finalize SQL statement to insert domains into database file %s\n",
+		printf("%s  %s Unable to prepare SQL statement to insert domains into database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
 	}
 
+	return true;
+}
+
+// Update the list's properties and end the transaction
+static bool close_database(sqlite3 *db, const char *outfile, const int adlistID,
+                           const struct gravity_parse_stats *stats)
+{
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
 	// Update database properties
 	// Are ABP patterns used?
-	if(abp_domains > 0)
+	const char *sql = NULL;
+	if(stats->abp_domains > 0)
 	{
 		sql = "INSERT OR REPLACE INTO info (property,value) VALUES ('abp_domains',1);";
 		if(sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
 		{
 			printf("%s  %s Unable to update database properties in database file %s\n",
 			       over, cross, outfile);
-			fclose(fpin);
-			sqlite3_close(db);
-			return EXIT_FAILURE;
+			return false;
 		}
 	}
 
 	// Update number of domains and update timestamp on this list
+	sqlite3_stmt *stmt = NULL;
 	sql = "UPDATE adlist SET number = ?, invalid_domains = ?, date_updated = cast(strftime('%s', 'now') as int) WHERE id = ?;";
 	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to prepare SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
 	}
 
 	// Update date
-	if(sqlite3_bind_int(stmt, 1, exact_domains) != SQLITE_OK)
+	if(sqlite3_bind_int(stmt, 1, stats->exact_domains) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind number of domains to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
-	if(sqlite3_bind_int(stmt, 2, invalid_domains) != SQLITE_OK)
+	if(sqlite3_bind_int(stmt, 2, stats->invalid_domains) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind number of invalid domains to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
 	if(sqlite3_bind_int(stmt, 3, adlistID) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind adlist ID to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
 	if(sqlite3_step(stmt) != SQLITE_DONE)
 	{
 		printf("%s  %s Unable to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
 	if(sqlite3_finalize(stmt) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to finalize SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
 	}
 
 	// End transaction
@@ -336,35 +567,212 @@ int gravity_parseList(const char *infile, const char *outfile, const char *adlis
 	{
 		printf("%s  %s Unable to end transaction to insert domains into database file %s (database file may be corrupted)\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
+	}
+
+	return true;
+}
+
+// Parse the given list. Without outfile, the domains are only validated and
+// deduplicated. Progress and summary are not printed in quiet mode
+int gravity_parseList_stats(const char *infile, const char *outfile, const int adlistID,
+                            const bool quiet, struct gravity_parse_stats *stats)
+{
+	const char *info = cli_info();
+	const char *tick = cli_tick();
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
+	int ret = EXIT_FAILURE;
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL, *batch_stmt = NULL;
+	list_parser parser = { .data = NULL };
+	pthread_mutex_init(&parser.lock, NULL);
+	pthread_cond_init(&parser.cond, NULL);
+	pthread_t workers[PARSE_MAX_WORKERS];
+	unsigned int num_workers = 0;
+	domain_set duplicates = { .slots = NULL };
+	memset(stats, 0, sizeof(*stats));
+
+	// Open and map input file
+	const int fd = open(infile, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0)
+	{
+		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
+		goto end_of_parseList;
+	}
+	parser.fsize = st.st_size;
+	if(parser.fsize > 0)
+	{
+		void *ptr = mmap(NULL, parser.fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(ptr == MAP_FAILED)
+		{
+			printf("%s  %s Unable to map %s into memory\n", over, cross, infile);
+			goto end_of_parseList;
+		}
+		madvise(ptr, parser.fsize, MADV_SEQUENTIAL);
+		parser.data = ptr;
+	}
+	parser.nchunks = (parser.fsize + PARSE_CHUNK_SIZE - 1) / PARSE_CHUNK_SIZE;
+
+	// Open output file (if any)
+	if(outfile != NULL && !open_database(outfile, adlistID, &db, &batch_stmt, &stmt))
+		goto end_of_parseList;
+
+	// Start worker threads
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_workers = cpus > 0 ? (size_t)cpus : 1;
+	if(max_workers > PARSE_MAX_WORKERS)
+		max_workers = PARSE_MAX_WORKERS;
+	if(max_workers > parser.nchunks)
+		max_workers = parser.nchunks;
+	for(; num_workers < max_workers; num_workers++)
+		if(pthread_create(&workers[num_workers], NULL, parse_worker, &parser) != 0)
+			break;
+	if(num_workers == 0 && parser.nchunks > 0)
+	{
+		printf("%s  %s Unable to start threads to parse %s\n", over, cross, infile);
+		goto end_of_parseList;
 	}
 
+	// Insert the domains of the chunks in the order they appear in the list
+	int last_progress = 0;
+	struct domain_entry invalid_domains_list[MAX_INVALID_DOMAINS] = {{ 0 }};
+	unsigned int invalid_domains_list_len = 0;
+	unsigned int exact_duplicates = 0, abp_duplicates = 0;
+	for(size_t chunkID = 0; chunkID < parser.nchunks; chunkID++)
+	{
+		parse_chunk *chunk = &parser.chunks[chunkID % PARSE_INFLIGHT];
+		pthread_mutex_lock(&parser.lock);
+		while(!chunk->done)
+			pthread_cond_wait(&parser.cond, &parser.lock);
+		pthread_mutex_unlock(&parser.lock);
+
+		if(chunk->failed)
+		{
+			printf("%s  %s Unable to allocate memory to parse %s\n", over, cross, infile);
+			goto end_of_parseList;
+		}
+
+		// Domains may be listed more than once, insert them only once
+		chunk->num_domains = remove_duplicates(&duplicates, parser.data, parser.fsize,
+		                                       chunk->domains, chunk->num_domains,
+		                                       &exact_duplicates, &abp_duplicates);
+		if(db != NULL && !insert_domains(batch_stmt, stmt, parser.data, chunk->domains, chunk->num_domains))
+		{
+			printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
+			goto end_of_parseList;
+		}
+
+		stats->lines += chunk->lines;
+		stats->exact_domains += chunk->exact_domains;
+		stats->abp_domains += chunk->abp_domains;
+		stats->invalid_domains += chunk->invalid_domains;
+		for(unsigned int i = 0; i < chunk->invalid_domains_list_len; i++)
+			add_invalid_domain(invalid_domains_list, &invalid_domains_list_len,
+			                   parser.data, &chunk->invalid_domains_list[i]);
+
+		// Hand the chunk back to the workers
+		chunk->num_domains = 0;
+		chunk->lines = 0;
+		chunk->exact_domains = chunk->abp_domains = chunk->invalid_domains = 0;
+		chunk->invalid_domains_list_len = 0;
+		pthread_mutex_lock(&parser.lock);
+		chunk->done = false;
+		parser.written++;
+		pthread_cond_broadcast(&parser.cond);
+		pthread_mutex_unlock(&parser.lock);
+
+		// Print progress if the file is large enough
+		if(!quiet && parser.fsize > PRINT_PROGRESS_THRESHOLD)
+		{
+			// Calculate progress
+			size_t total_read = (chunkID + 1) * PARSE_CHUNK_SIZE;
+			if(total_read > parser.fsize)
+				total_read = parser.fsize;
+			const int progress = (int)(100.0*total_read/parser.fsize);
+			// Print progress if it has changed
+			if(progress > last_progress)
+			{
+				printf("%s  %s Processed %i%% of downloaded list", over, info, progress);
+				fflush(stdout);
+				last_progress = progress;
+			}
+		}
+	}
+
+	// Count unique domains only
+	stats->bytes = parser.fsize;
+	stats->duplicates = exact_duplicates + abp_duplicates;
+	stats->exact_domains -= exact_duplicates;
+	stats->abp_domains -= abp_duplicates;
+
+	if(db != NULL)
+	{
+		// Finalize SQL statements
+		const int rc1 = sqlite3_finalize(batch_stmt), rc2 = sqlite3_finalize(stmt);
+		batch_stmt = stmt = NULL;
+		if(rc1 != SQLITE_OK || rc2 != SQLITE_OK)
+		{
+			printf("%s  %s Unable to finalize SQL statement to insert domains into database file %s\n",
+			       over, cross, outfile);
+			goto end_of_parseList;
+		}
+
+		if(!close_database(db, outfile, adlistID, stats))
+			goto end_of_parseList;
+	}
+
+	// Success
+	ret = EXIT_SUCCESS;
+	if(quiet)
+		goto end_of_parseList;
+
 	// Print summary
-	printf("%s  %s Parsed %u exact domains and %u ABP-style domains (ignored %u non-domain entries)\n",
-	       over, tick, exact_domains, abp_domains, invalid_domains);
+	printf("%s  %s Parsed %u exact domains and %u ABP-style domains (ignored %u non-domain entries and %u duplicates)\n",
+	       over, tick, stats->exact_domains, stats->abp_domains, stats->invalid_domains, stats->duplicates);
 	if(invalid_domains_list_len > 0)
 	{
 		puts("      Sample of non-domain entries:");
 		for(unsigned int i = 0; i < invalid_domains_list_len; i++)
-			printf("        - \"%s\"\n", invalid_domains_list[i]);
+			printf("        - \"%.*s\"\n", (int)invalid_domains_list[i].len,
+			       parser.data + invalid_domains_list[i].offset);
 		puts("");
 	}
 
+end_of_parseList:
+	// Stop and wait for the worker threads
+	pthread_mutex_lock(&parser.lock);
+	parser.abort = true;
+	pthread_cond_broadcast(&parser.cond);
+	pthread_mutex_unlock(&parser.lock);
+	for(unsigned int i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
 	// Free memory
-	free(line);
-	regfree(&exact_regex);
-	regfree(&abp_regex);
-	regfree(&false_positives_regex);
-	for(unsigned int i = 0; i < invalid_domains_list_len; i++)
-		if(invalid_domains_list[i] != NULL)
-			free(invalid_domains_list[i]);
+	for(unsigned int i = 0; i < PARSE_INFLIGHT; i++)
+		if(parser.chunks[i].domains != NULL)
+			free(parser.chunks[i].domains);
+	if(duplicates.slots != NULL)
+		free(duplicates.slots);
+	pthread_mutex_destroy(&parser.lock);
+	pthread_cond_destroy(&parser.cond);
 
 	// Close files
-	fclose(fpin);
+	sqlite3_finalize(batch_stmt);
+	sqlite3_finalize(stmt);
 	sqlite3_close(db);
+	if(parser.data != NULL)
+		munmap((void*)parser.data, parser.fsize);
+	if(fd > -1)
+		close(fd);
+
+	return ret;
+}
 
-	// Return success
-	return EXIT_SUCCESS;
+int gravity_parseList(const char *infile, const char *outfile, const char *adlistIDstr)
+{
+	struct gravity_parse_stats stats;
+	return gravity_parseList_stats(infile, outfile, atoi(adlistIDstr), false, &stats);
 }
@@ -10,4 +10,15 @@
 
 #include "FTL.h"
 
+struct gravity_parse_stats {
+	size_t lines;
+	size_t bytes;
+	unsigned int exact_domains;
+	unsigned int abp_domains;
+	unsigned int invalid_domains;
+	unsigned int duplicates;
+};
+
 int gravity_parseList(const char *infile, const char *outfile, const char *adlistID);
+int gravity_parseList_stats(const char *infile, const char *outfile, const int adlistID,
+                            const bool quiet, struct gravity_parse_stats *stats);
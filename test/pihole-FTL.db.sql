@@ -20,6 +20,11 @@ INSERT INTO "network_addresses" (network_id, ip) VALUES (0, '127.0.0.5');
 INSERT INTO "network" (id, hwaddr, interface, firstSeen, lastQuery, numQueries, aliasclient_id) VALUES (1, '00:11:22:33:44:55', 'enp0s123', 0, 0, 0, 0);
 INSERT INTO "network_addresses" (network_id, ip) VALUES (1, '127.0.0.6');
 
+-- One query old enough to be deleted on startup and one recent query outside
+-- of the 24 hours imported into memory, both end up in the rollup tables
+INSERT INTO queries (timestamp, type, status, domain, client, forward) VALUES (1500000000, 1, 2, 'old.ftl', '127.0.0.1', '127.0.0.1#5555');
+INSERT INTO queries (timestamp, type, status, domain, client, forward) VALUES (cast(strftime('%s', 'now') as int) - 172800, 1, 2, 'rollup.ftl', '127.0.0.1', '127.0.0.1#5555');
+
 CREATE TABLE aliasclient (id INTEGER PRIMARY KEY NOT NULL, name TEXT NOT NULL, comment TEXT);
 INSERT INTO aliasclient (id, name) VALUES (0, 'some-aliasclient');
 
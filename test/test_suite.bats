@@ -491,6 +491,18 @@
   [[ "${lines[@]}" == *"1 127.0.0.5 "* ]]
 }
 
+@test "Clients over time are counted per client and alias-client" {
+  run bash -c 'echo ">client-names >ClientsoverTime >quit" | nc 127.0.0.1 4711 | awk '"'"'/^[0-9 ]+$/ { for(i = 2; i <= NF; i++) sum[i-1] += $i; next } NF > 0 && $0 != "---EOM---" { ip[++n] = $NF } END { for(i = 1; i <= n; i++) { print ip[i], sum[i]; total += sum[i] } print "total", total }'"'"''
+  printf "%s\n" "${lines[@]}"
+  [[ "${lines[@]}" == *"127.0.0.1 38"* ]]
+  [[ "${lines[@]}" == *":: 6"* ]]
+  [[ "${lines[@]}" == *"127.0.0.3 4"* ]]
+  [[ "${lines[@]}" == *"127.0.0.2 3"* ]]
+  [[ "${lines[@]}" == *"aliasclient-0 1"* ]]
+  [[ "${lines[@]}" != *"127.0.0.6"* ]]
+  [[ "${lines[@]}" == *"total 54"* ]]
+}
+
 @test "Top Domains" {
   run bash -c 'echo ">top-domains (60) >quit" | nc -v 127.0.0.1 4711'
   printf "%s\n" "${lines[@]}"
@@ -671,7 +683,7 @@
   [[ "${lines[@]}" == *"CREATE TABLE IF NOT EXISTS \"network\" (id INTEGER PRIMARY KEY NOT NULL, hwaddr TEXT UNIQUE NOT NULL, interface TEXT NOT NULL, firstSeen INTEGER NOT NULL, lastQuery INTEGER NOT NULL, numQueries INTEGER NOT NULL, macVendor TEXT, aliasclient_id INTEGER);"* ]]
   [[ "${lines[@]}" == *"CREATE TABLE IF NOT EXISTS \"network_addresses\" (network_id INTEGER NOT NULL, ip TEXT UNIQUE NOT NULL, lastSeen INTEGER NOT NULL DEFAULT (cast(strftime('%s', 'now') as int)), name TEXT, nameUpdated INTEGER, FOREIGN KEY(network_id) REFERENCES network(id));"* ]]
   [[ "${lines[@]}" == *"CREATE TABLE aliasclient (id INTEGER PRIMARY KEY NOT NULL, name TEXT NOT NULL, comment TEXT);"* ]]
-  [[ "${lines[@]}" == *"INSERT INTO ftl VALUES(0,12);"* ]] # Expecting FTL database version 12
+  [[ "${lines[@]}" == *"INSERT INTO ftl VALUES(0,13);"* ]] # Expecting FTL database version 13
   # vvv This has been added in version 10 vvv
   [[ "${lines[@]}" == *"CREATE VIEW queries AS SELECT id, timestamp, type, status, CASE typeof(domain) WHEN 'integer' THEN (SELECT domain FROM domain_by_id d WHERE d.id = q.domain) ELSE domain END domain,CASE typeof(client) WHEN 'integer' THEN (SELECT ip FROM client_by_id c WHERE c.id = q.client) ELSE client END client,CASE typeof(forward) WHEN 'integer' THEN (SELECT forward FROM forward_by_id f WHERE f.id = q.forward) ELSE forward END forward,CASE typeof(additional_info) WHEN 'integer' THEN (SELECT content FROM addinfo_by_id a WHERE a.id = q.additional_info) ELSE additional_info END additional_info, reply_type, reply_time, dnssec FROM query_storage q;"* ]]
   [[ "${lines[@]}" == *"CREATE TABLE domain_by_id (id INTEGER PRIMARY KEY, domain TEXT NOT NULL);"* ]]
@@ -682,6 +694,33 @@
   # vvv This has been added in version 11 vvv
   [[ "${lines[@]}" == *"CREATE TABLE addinfo_by_id (id INTEGER PRIMARY KEY, type INTEGER NOT NULL, content NOT NULL);"* ]]
   [[ "${lines[@]}" == *"CREATE UNIQUE INDEX addinfo_by_id_idx ON addinfo_by_id(type,content);"* ]]
+  # vvv This has been added in version 13 vvv
+  [[ "${lines[@]}" == *"CREATE TABLE rollup (interval INTEGER NOT NULL, timestamp INTEGER NOT NULL, total INTEGER NOT NULL, blocked INTEGER NOT NULL, cached INTEGER NOT NULL, forwarded INTEGER NOT NULL, PRIMARY KEY (interval, timestamp)) WITHOUT ROWID;"* ]]
+  [[ "${lines[@]}" == *"CREATE TABLE rollup_types (interval INTEGER NOT NULL, timestamp INTEGER NOT NULL, type INTEGER NOT NULL, count INTEGER NOT NULL, PRIMARY KEY (interval, timestamp, type)) WITHOUT ROWID;"* ]]
+  [[ "${lines[@]}" == *"CREATE TABLE rollup_clients (interval INTEGER NOT NULL, timestamp INTEGER NOT NULL, client TEXT NOT NULL, total INTEGER NOT NULL, blocked INTEGER NOT NULL, PRIMARY KEY (interval, timestamp, client)) WITHOUT ROWID;"* ]]
+  [[ "${lines[@]}" == *"CREATE TABLE rollup_domains (timestamp INTEGER NOT NULL, domain TEXT NOT NULL, total INTEGER NOT NULL, blocked INTEGER NOT NULL, PRIMARY KEY (timestamp, domain)) WITHOUT ROWID;"* ]]
+}
+
+@test "Rollup API reports statistics of queries in the database" {
+  from="$(( $(date +%s) - 4*86400 ))"
+  until="$(( $(date +%s) - 86400 ))"
+  run bash -c "echo '>rollup daily ${from} ${until} >quit' | nc -v 127.0.0.1 4711"
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[1]} == *" 1 0 0 1" ]]
+  [[ ${lines[2]} == "" ]]
+  run bash -c "echo '>rollup-domains ${from} ${until} >quit' | nc -v 127.0.0.1 4711"
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[1]} == "rollup.ftl 1 0" ]]
+  [[ ${lines[2]} == "" ]]
+}
+
+@test "Old queries and their statistics are deleted from the database" {
+  run bash -c './pihole-FTL sqlite3 /etc/pihole/pihole-FTL.db "SELECT COUNT(*) FROM query_storage WHERE timestamp < 1600000000;"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "0" ]]
+  run bash -c 'echo ">rollup daily 0 1600000000 >quit" | nc -v 127.0.0.1 4711'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[1]} == "" ]]
 }
 
 @test "Ownership, permissions and type of pihole-FTL.db correct" {
@@ -709,6 +748,47 @@
   [[ ${lines[0]} == "The Pi-hole FTL engine - "* ]]
 }
 
+@test "Gravity import benchmark runs on a synthetic list" {
+  run bash -c '/home/pihole/pihole-FTL gravity bench 1000'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ ${lines[@]} == *"parse+insert"* ]]
+  [[ ${lines[@]} == *"1000 lines: "*" duplicates"* ]]
+}
+
+@test "Gravity list parser imports valid exact and ABP-style domains" {
+  rm -f /tmp/gravity-list.db
+  /home/pihole/pihole-FTL sqlite3 /tmp/gravity-list.db < test/gravity.db.sql
+  printf "%s\n" "example.com" "sub.example.com." "under_score.example.net" "example.com" "||ads.example.org^" "||tld^" "Invalid.Example.com" "nodots" "0.0.0.0 hosts.example.com" "localhost" "broadcasthost" > /tmp/gravity-list.txt
+  run bash -c '/home/pihole/pihole-FTL gravity parseList /tmp/gravity-list.txt /tmp/gravity-list.db 1'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ ${lines[@]} == *"Parsed 3 exact domains and 2 ABP-style domains (ignored 3 non-domain entries and 1 duplicates)"* ]]
+  run bash -c "/home/pihole/pihole-FTL sqlite3 /tmp/gravity-list.db \"SELECT domain FROM gravity WHERE domain NOT LIKE '%.ftl' AND domain NOT LIKE '%.ftl^' ORDER BY domain;\""
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "example.com" ]]
+  [[ ${lines[1]} == "sub.example.com" ]]
+  [[ ${lines[2]} == "under_score.example.net" ]]
+  [[ ${lines[3]} == "||ads.example.org^" ]]
+  [[ ${lines[4]} == "||tld^" ]]
+  [[ ${lines[5]} == "" ]]
+  run bash -c '/home/pihole/pihole-FTL sqlite3 /tmp/gravity-list.db "SELECT number,invalid_domains FROM adlist WHERE id = 1;"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "3|3" ]]
+}
+
+@test "Gravity list parser reports invalid domains but not false positives" {
+  run bash -c '/home/pihole/pihole-FTL gravity parseList /tmp/gravity-list.txt /tmp/gravity-list.db 1'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[@]} == *"Sample of non-domain entries:"* ]]
+  [[ ${lines[@]} == *"- \"Invalid.Example.com\""* ]]
+  [[ ${lines[@]} == *"- \"nodots\""* ]]
+  [[ ${lines[@]} == *"- \"0.0.0.0 hosts.example.com\""* ]]
+  [[ ${lines[@]} != *"localhost"* ]]
+  [[ ${lines[@]} != *"broadcasthost"* ]]
+  rm -f /tmp/gravity-list.txt /tmp/gravity-list.db
+}
+
 @test "No WARNING messages in FTL.log (besides known capability issues)" {
   run bash -c 'grep "WARNING" /var/log/pihole/FTL.log'
   printf "%s\n" "${lines[@]}"
@@ -1465,3 +1545,14 @@
   [[ "$firstnum" == 7 ]]
   [[ "$lastnum" == 7 ]]
 }
+
+# This test has to run last as it gets 127.0.0.1 rate-limited
+@test "Token bucket rate-limits clients sending more than RATE_LIMIT queries" {
+  run bash -c '/home/pihole/pihole-FTL dns-bench 127.0.0.1 53 2000'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ ${lines[@]} == *"queries were refused"* ]]
+  run bash -c 'grep -c "Rate-limiting 127.0.0.1 for at least" /var/log/pihole/FTL.log'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "1" ]]
+}